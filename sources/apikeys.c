@@ -0,0 +1,263 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+
+extern globals_t globals;
+
+/**
+ ** API key pool: every 'api-key' param is a key, each request takes the one with the most headroom by the last
+ ** rate-limit headers seen for it (x-ratelimit-remaining-requests / -tokens, until their reset time) less the
+ ** requests in flight on it. A 429 puts the key aside for retry-after (or the reset time, or a doubling backoff),
+ ** an auth error for APIKEY_BACKOFF_MAX_MS. The keys outlive the config snapshots, so a reload keeps their state.
+ **/
+static struct {
+    switch_mutex_t          *mutex;
+    apikey_t                *keys[MAX_API_KEYS];
+    uint32_t                count;
+    uint32_t                rr;                 // ties go round-robin
+} pool;
+
+static void apikey_label(apikey_t *key) {
+    uint32_t len = strlen(key->key);
+
+    if(len > 12) {
+        snprintf(key->label, sizeof(key->label), "%.3s...%s", key->key, key->key + len - 4);
+    } else {
+        snprintf(key->label, sizeof(key->label), "...%s", key->key + (len > 4 ? len - 4 : 0));
+    }
+}
+
+/**
+ ** "20ms", "1s", "6m0s", "1h2m3.5s" => ms
+ **/
+static uint32_t duration_ms(const char *s) {
+    double total = 0;
+
+    while(*s) {
+        char *end = NULL;
+        double v = strtod(s, &end);
+
+        if(end == s) {
+            break;
+        }
+        s = end;
+        if(!strncmp(s, "ms", 2)) { total += v; s += 2; }
+        else if(*s == 'h') { total += v * 3600000; s++; }
+        else if(*s == 'm') { total += v * 60000; s++; }
+        else if(*s == 's') { total += v * 1000; s++; }
+        else { total += v * 1000; break; } // bare number: seconds (retry-after)
+    }
+    return (uint32_t)MIN(total, (double)UINT32_MAX);
+}
+
+/**
+ ** when the key can be used again, 0 - now
+ **/
+static switch_time_t apikey_back(apikey_t *key, switch_time_t now) {
+    switch_time_t back = MAX(key->backoff_until, (key->remaining_tokens == 0 ? key->reset_tokens : 0));
+    return (back > now ? back : 0);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+void apikey_init(switch_memory_pool_t *mpool) {
+    switch_mutex_init(&pool.mutex, SWITCH_MUTEX_NESTED, mpool);
+}
+
+void apikey_shutdown() {
+    for(uint32_t i = 0; i < pool.count; i++) {
+        switch_safe_free(pool.keys[i]->key);
+        switch_safe_free(pool.keys[i]);
+    }
+    pool.count = 0;
+}
+
+/**
+ ** a new config snapshot: its keys are the ones handed out from now on
+ **/
+void apikey_sync(config_t *cfg) {
+    if(!pool.mutex) {
+        return;
+    }
+
+    switch_mutex_lock(pool.mutex);
+    for(uint32_t i = 0; i < pool.count; i++) {
+        pool.keys[i]->fl_active = false;
+    }
+    for(uint32_t n = 0; n < cfg->api_keys_count; n++) {
+        apikey_t *key = NULL;
+
+        for(uint32_t i = 0; i < pool.count; i++) {
+            if(!strcmp(pool.keys[i]->key, cfg->api_keys[n])) {
+                key = pool.keys[i];
+                break;
+            }
+        }
+        if(!key) {
+            if(pool.count >= MAX_API_KEYS) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Too many api keys (max %u), ignoring the rest\n", MAX_API_KEYS);
+                break;
+            }
+            switch_zmalloc(key, sizeof(apikey_t));
+            key->key = strdup(cfg->api_keys[n]);
+            key->remaining_requests = -1;
+            key->remaining_tokens = -1;
+            apikey_label(key);
+            pool.keys[pool.count++] = key;
+        }
+        key->fl_active = true;
+    }
+    switch_mutex_unlock(pool.mutex);
+}
+
+/**
+ ** NULL if there is no pool (the caller goes with cfg->api_key); when every key is backed off the one that
+ ** comes back first is used anyway
+ **/
+apikey_t *apikey_acquire(config_t *cfg) {
+    switch_time_t now = switch_micro_time_now();
+    apikey_t *best = NULL, *first_back = NULL;
+    switch_time_t first_time = 0;
+    int64_t best_room = 0;
+
+    if(!pool.mutex) {
+        return NULL;
+    }
+
+    switch_mutex_lock(pool.mutex);
+    for(uint32_t n = 0; n < pool.count; n++) {
+        apikey_t *key = pool.keys[(pool.rr + n) % pool.count];
+        switch_time_t back = apikey_back(key, now);
+        int64_t room = APIKEY_ROOM_UNKNOWN;
+
+        if(!key->fl_active) {
+            continue;
+        }
+        if(back) {
+            if(!first_back || back < first_time) {
+                first_back = key;
+                first_time = back;
+            }
+            continue;
+        }
+        if(key->remaining_requests >= 0 && key->reset_requests > now) {
+            room = key->remaining_requests;
+        }
+        room -= key->inflight;
+        if(!best || room > best_room) {
+            best = key;
+            best_room = room;
+        }
+    }
+    if(!best && first_back) {
+        best = first_back;
+        __atomic_add_fetch(&globals.apikey_exhausted, 1, __ATOMIC_RELAXED);
+    }
+    if(best) {
+        best->inflight++;
+        pool.rr++;
+    }
+    switch_mutex_unlock(pool.mutex);
+
+    return best;
+}
+
+void apikey_release(apikey_t *key, apikey_limits_t *lim, config_t *cfg) {
+    switch_time_t now = switch_micro_time_now();
+    uint32_t backoff_ms = 0;
+
+    if(!key) {
+        return;
+    }
+
+    switch_mutex_lock(pool.mutex);
+    key->inflight--;
+    key->requests++;
+
+    if(lim->remaining_requests >= 0) {
+        key->remaining_requests = lim->remaining_requests;
+        key->reset_requests = now + (switch_time_t)(lim->reset_requests_ms ? lim->reset_requests_ms : APIKEY_BACKOFF_MS) * 1000;
+    }
+    if(lim->remaining_tokens >= 0) {
+        key->remaining_tokens = lim->remaining_tokens;
+        key->reset_tokens = now + (switch_time_t)(lim->reset_tokens_ms ? lim->reset_tokens_ms : APIKEY_BACKOFF_MS) * 1000;
+    }
+
+    if(lim->http_code == 429) {
+        key->errors++;
+        key->rate_limited++;
+        key->backoff_ms = (key->backoff_ms ? MIN(key->backoff_ms * 2, APIKEY_BACKOFF_MAX_MS) : APIKEY_BACKOFF_MS);
+        backoff_ms = (lim->retry_after_ms ? lim->retry_after_ms : lim->reset_requests_ms ? lim->reset_requests_ms : key->backoff_ms);
+        key->backoff_until = now + (switch_time_t)backoff_ms * 1000;
+    } else if(lim->http_code == 401 || lim->http_code == 403) {
+        key->errors++;
+        backoff_ms = APIKEY_BACKOFF_MAX_MS;
+        key->backoff_until = now + (switch_time_t)backoff_ms * 1000;
+    } else if(lim->http_code != 200 && lim->http_code != 101) {
+        key->errors++;
+    } else {
+        key->backoff_ms = 0;
+    }
+    switch_mutex_unlock(pool.mutex);
+
+    if(backoff_ms) {
+        slog_printf(cfg, SWITCH_LOG_WARNING, "stage=apikey key=%s http=%ld backoff_ms=%u", key->label, lim->http_code, backoff_ms);
+    }
+}
+
+void apikey_limits_init(apikey_limits_t *lim) {
+    memset(lim, 0, sizeof(*lim));
+    lim->remaining_requests = -1;
+    lim->remaining_tokens = -1;
+}
+
+/**
+ ** one response header line (curl header callback)
+ **/
+void apikey_header(apikey_limits_t *lim, const char *line, size_t len) {
+    char buf[128];
+    char *val = NULL;
+
+    if(len >= sizeof(buf) || (val = memchr(line, ':', len)) == NULL) {
+        return;
+    }
+    memcpy(buf, line, len);
+    buf[len] = '\0';
+    val = buf + (val - line);
+    *val++ = '\0';
+    while(*val == ' ') { val++; }
+
+    if(!strcasecmp(buf, "x-ratelimit-remaining-requests")) {
+        lim->remaining_requests = atoll(val);
+    } else if(!strcasecmp(buf, "x-ratelimit-remaining-tokens")) {
+        lim->remaining_tokens = atoll(val);
+    } else if(!strcasecmp(buf, "x-ratelimit-reset-requests")) {
+        lim->reset_requests_ms = duration_ms(val);
+    } else if(!strcasecmp(buf, "x-ratelimit-reset-tokens")) {
+        lim->reset_tokens_ms = duration_ms(val);
+    } else if(!strcasecmp(buf, "retry-after-ms")) {
+        lim->retry_after_ms = atoi(val);
+    } else if(!strcasecmp(buf, "retry-after") && !lim->retry_after_ms) {
+        lim->retry_after_ms = duration_ms(val);
+    }
+}
+
+void apikey_stats(switch_stream_handle_t *stream) {
+    switch_time_t now = switch_micro_time_now();
+
+    if(!pool.mutex) {
+        return;
+    }
+
+    switch_mutex_lock(pool.mutex);
+    for(uint32_t i = 0; i < pool.count; i++) {
+        apikey_t *key = pool.keys[i];
+        stream->write_function(stream, "apikey %s: active=%s inflight=%u requests=%"PRIu64" errors=%"PRIu64" rate_limited=%"PRIu64" remaining_requests=%"PRId64" remaining_tokens=%"PRId64" backoff_ms=%"PRId64"\n",
+                               key->label, BOOL2STR(key->fl_active), key->inflight, key->requests, key->errors, key->rate_limited,
+                               (key->reset_requests > now ? key->remaining_requests : -1), (key->reset_tokens > now ? key->remaining_tokens : -1),
+                               (key->backoff_until > now ? (int64_t)((key->backoff_until - now) / 1000) : 0));
+    }
+    switch_mutex_unlock(pool.mutex);
+}
@@ -0,0 +1,35 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ *
+ * nlohmann::json side of the verbose_json benchmark: the DOM openai-cpp builds of a response,
+ * read for the same fields vjson_parse() picks up.
+ **/
+#include <switch.h>
+#include <string>
+#include <nlohmann/json.hpp>
+
+extern "C" uint32_t bench_nlohmann_parse(const char *buf, size_t len, double *sum) {
+    auto doc = nlohmann::json::parse(buf, buf + len);
+    uint32_t items = 0;
+
+    if(doc.contains("text")) {
+        *sum += doc["text"].get<std::string>().size();
+    }
+    if(doc.contains("segments")) {
+        for(auto &seg : doc["segments"]) {
+            *sum += seg["start"].get<double>() + seg["end"].get<double>() + seg["avg_logprob"].get<double>() + seg["no_speech_prob"].get<double>();
+            *sum += seg["text"].get<std::string>().size();
+            items++;
+        }
+    }
+    if(doc.contains("words")) {
+        for(auto &word : doc["words"]) {
+            *sum += word["start"].get<double>() + word["end"].get<double>() + word["word"].get<std::string>().size();
+            items++;
+        }
+    }
+
+    return items;
+}
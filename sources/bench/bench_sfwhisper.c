@@ -0,0 +1,523 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ *
+ * Microbenchmarks for the per-frame paths of mod_sfwhisper, built against the stubs in ./stubs.
+ * The module is compiled into this unit to reach its static asr_* functions.
+ *
+ * bench_sfwhisper [--seconds N] [--out file.json|file.csv] [--baseline file.csv] [--tolerance pct]
+ **/
+#include "../mod_sfwhisper.c"
+#include <time.h>
+#include <math.h>
+
+#define BENCH_SECONDS       60
+#define BENCH_TOLERANCE     10
+#define BENCH_ROWS_MAX      128
+
+uint32_t bench_nlohmann_parse(const char *buf, size_t len, double *sum);
+
+typedef struct {
+    const char  *name;
+    const char  *codec;
+    uint32_t    rate;
+    uint32_t    ptime;
+    uint64_t    frames;
+    uint64_t    ns;
+    uint64_t    allocs;
+    uint64_t    alloc_bytes;
+    uint64_t    copied_bytes;
+} bench_row_t;
+
+typedef enum { SIGNAL_SPEECH, SIGNAL_SILENCE, SIGNAL_MIXED } bench_signal_t;
+
+static bench_row_t rows[BENCH_ROWS_MAX];
+static uint32_t rows_count = 0;
+static uint32_t bench_seconds = BENCH_SECONDS;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void counters_snap(stub_counters_t *c) {
+    __atomic_load(&stub_counters.allocs, &c->allocs, __ATOMIC_SEQ_CST);
+    __atomic_load(&stub_counters.alloc_bytes, &c->alloc_bytes, __ATOMIC_SEQ_CST);
+    __atomic_load(&stub_counters.copied_bytes, &c->copied_bytes, __ATOMIC_SEQ_CST);
+}
+
+static bench_row_t *row_new(const char *name, const char *codec, uint32_t rate, uint32_t ptime) {
+    bench_row_t *row = &rows[rows_count++];
+
+    assert(rows_count <= BENCH_ROWS_MAX);
+    memset(row, 0, sizeof(*row));
+    row->name = name;
+    row->codec = codec;
+    row->rate = rate;
+    row->ptime = ptime;
+    return row;
+}
+
+static void row_account(bench_row_t *row, uint64_t t0, uint64_t t1, stub_counters_t *c0, stub_counters_t *c1, uint64_t frames) {
+    row->ns += (t1 - t0);
+    row->frames += frames;
+    row->allocs += (c1->allocs - c0->allocs);
+    row->alloc_bytes += (c1->alloc_bytes - c0->alloc_bytes);
+    row->copied_bytes += (c1->copied_bytes - c0->copied_bytes);
+}
+
+/**
+ ** one second of frames: a 440Hz tone well above the vad threshold, or digital silence
+ **/
+static switch_byte_t *signal_gen(uint8_t codec, uint32_t rate, uint32_t seconds, bench_signal_t signal) {
+    uint32_t samples = rate * seconds;
+    uint32_t sample_bytes = (codec == CODEC_L16 ? sizeof(int16_t) : sizeof(uint8_t));
+    switch_byte_t *buf = malloc(samples * sample_bytes);
+
+    for(uint32_t i = 0; i < samples; i++) {
+        uint8_t voiced = (signal == SIGNAL_SPEECH || (signal == SIGNAL_MIXED && ((i / rate) % 2) == 0));
+        int16_t s = (voiced ? (int16_t)(6000.0 * sin(2.0 * M_PI * 440.0 * i / rate)) : 0);
+
+        if(codec == CODEC_L16) {
+            ((int16_t *)buf)[i] = s;
+        } else {
+            buf[i] = (codec == CODEC_PCMU ? (voiced ? (s < 0 ? 0x20 : 0xa0) : 0xff) : (voiced ? (s < 0 ? 0x3a : 0xba) : 0xd5));
+        }
+    }
+    return buf;
+}
+
+static const char *codec2name(uint8_t codec) {
+    return (codec == CODEC_PCMU ? "PCMU" : codec == CODEC_PCMA ? "PCMA" : "L16");
+}
+
+static gasr_ctx_t *session_open(switch_asr_handle_t *ah, uint8_t codec, uint32_t rate, uint8_t fl_vad) {
+    switch_asr_flag_t flags = 0;
+
+    memset(ah, 0, sizeof(*ah));
+    switch_core_new_memory_pool(&ah->memory_pool);
+
+    if(asr_open(ah, codec2name(codec), rate, NULL, &flags) != SWITCH_STATUS_SUCCESS) {
+        fprintf(stderr, "asr_open() failed\n");
+        exit(1);
+    }
+    ((gasr_ctx_t *)ah->private_info)->fl_vad_enabled = fl_vad;
+    return (gasr_ctx_t *)ah->private_info;
+}
+
+static void session_close(switch_asr_handle_t *ah) {
+    switch_asr_flag_t flags = 0;
+
+    asr_close(ah, &flags);
+    switch_core_destroy_memory_pool(&ah->memory_pool);
+}
+
+static void queue_drain(gasr_ctx_t *asr_ctx, switch_queue_t *queue) {
+    xdata_buffer_t *buf = NULL;
+
+    while(switch_queue_trypop(queue, (void **)&buf) == SWITCH_STATUS_SUCCESS) {
+        if(asr_ctx) {
+            __atomic_sub_fetch(&asr_ctx->q_audio_bytes, buf->len, __ATOMIC_RELEASE);
+        }
+        xdata_buffer_free(&buf);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// cases
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+/**
+ ** asr_feed() as called from the media thread, the consumer side is drained between one-second batches
+ **/
+static void bench_feed(const char *name, uint8_t codec, uint32_t rate, uint32_t ptime, uint8_t fl_vad, bench_signal_t signal) {
+    bench_row_t *row = row_new(name, codec2name(codec), rate, ptime);
+    uint32_t sample_bytes = (codec == CODEC_L16 ? sizeof(int16_t) : sizeof(uint8_t));
+    uint32_t frame_len = (rate / 1000) * ptime * sample_bytes;
+    uint32_t frames_sec = 1000 / ptime;
+    switch_byte_t *audio = signal_gen(codec, rate, 2, signal);
+    switch_asr_handle_t ah;
+    switch_asr_flag_t flags = 0;
+    stub_counters_t c0, c1;
+    gasr_ctx_t *asr_ctx = session_open(&ah, codec, rate, fl_vad);
+
+    for(uint32_t sec = 0; sec < bench_seconds; sec++) {
+        switch_byte_t *src = audio + ((sec % 2) * frames_sec * frame_len);
+        uint64_t t0, t1;
+
+        counters_snap(&c0);
+        t0 = now_ns();
+        for(uint32_t i = 0; i < frames_sec; i++) {
+            asr_feed(&ah, src + (i * frame_len), frame_len, &flags);
+        }
+        t1 = now_ns();
+        counters_snap(&c1);
+
+        row_account(row, t0, t1, &c0, &c1, frames_sec);
+        queue_drain(asr_ctx, asr_ctx->q_audio);
+    }
+
+    session_close(&ah);
+    free(audio);
+}
+
+static void bench_xdata_push(uint8_t codec, uint32_t rate, uint32_t ptime) {
+    bench_row_t *row = row_new("xdata_buffer_push", codec2name(codec), rate, ptime);
+    uint32_t sample_bytes = (codec == CODEC_L16 ? sizeof(int16_t) : sizeof(uint8_t));
+    uint32_t frame_len = (rate / 1000) * ptime * sample_bytes;
+    uint32_t frames_sec = 1000 / ptime;
+    switch_byte_t *audio = signal_gen(codec, rate, 1, SIGNAL_SPEECH);
+    switch_memory_pool_t *pool = NULL;
+    switch_queue_t *queue = NULL;
+    stub_counters_t c0, c1;
+
+    switch_core_new_memory_pool(&pool);
+    switch_queue_create(&queue, frames_sec, pool);
+
+    for(uint32_t sec = 0; sec < bench_seconds; sec++) {
+        uint64_t t0, t1;
+
+        counters_snap(&c0);
+        t0 = now_ns();
+        for(uint32_t i = 0; i < frames_sec; i++) {
+            xdata_buffer_push(queue, audio + (i * frame_len), frame_len);
+        }
+        t1 = now_ns();
+        counters_snap(&c1);
+
+        row_account(row, t0, t1, &c0, &c1, frames_sec);
+        queue_drain(NULL, queue);
+    }
+
+    switch_core_destroy_memory_pool(&pool);
+    free(audio);
+}
+
+/**
+ ** chunk preparation: chunk_classify(), audio_file_write() and whisper_transcribe() per chunk, reported per frame of the chunk
+ **/
+static void bench_chunk(uint8_t codec, uint32_t rate, uint32_t ptime) {
+    bench_row_t *crow = row_new("chunk_classify", codec2name(codec), rate, ptime);
+    bench_row_t *wrow = row_new("audio_file_write", codec2name(codec), rate, ptime);
+    bench_row_t *trow = row_new("whisper_transcribe", codec2name(codec), rate, ptime);
+    uint32_t chunk_sec = globals.config->chunk_size_sec;
+    uint32_t chunks = MAX(3, bench_seconds / chunk_sec);
+    uint32_t sample_bytes = (codec == CODEC_L16 ? sizeof(int16_t) : sizeof(uint8_t));
+    uint64_t chunk_frames = (chunk_sec * 1000) / ptime;
+    switch_byte_t *audio = signal_gen(codec, rate, chunk_sec, SIGNAL_SPEECH);
+    uint32_t audio_len = rate * chunk_sec * sample_bytes;
+    switch_asr_handle_t ah;
+    stub_counters_t c0, c1;
+    gasr_ctx_t *asr_ctx = session_open(&ah, codec, rate, false);
+
+    for(uint32_t i = 0; i < chunks; i++) {
+        char *fname = NULL, *text = NULL;
+        uint64_t t0, t1;
+
+        chunk_class_t cls;
+
+        counters_snap(&c0);
+        t0 = now_ns();
+        chunk_classify(asr_ctx, audio, audio_len, &cls);
+        t1 = now_ns();
+        counters_snap(&c1);
+        row_account(crow, t0, t1, &c0, &c1, chunk_frames);
+
+        counters_snap(&c0);
+        t0 = now_ns();
+        fname = audio_file_write(audio, audio_len, codec, 1, rate);
+        t1 = now_ns();
+        counters_snap(&c1);
+        row_account(wrow, t0, t1, &c0, &c1, chunk_frames);
+
+        if(!fname) {
+            fprintf(stderr, "audio_file_write() failed\n");
+            exit(1);
+        }
+
+        counters_snap(&c0);
+        t0 = now_ns();
+        whisper_transcribe(asr_ctx, fname, &text);
+        t1 = now_ns();
+        counters_snap(&c1);
+        row_account(trow, t0, t1, &c0, &c1, chunk_frames);
+
+        unlink(fname);
+        switch_safe_free(fname);
+        switch_safe_free(text);
+    }
+
+    session_close(&ah);
+    free(audio);
+}
+
+/**
+ ** a verbose_json response with segment and word timestamps for `seconds` of speech, shaped like the API's
+ ** (tokens, temperature, ... in the segments; a few escapes in the words)
+ **/
+static char *vjson_gen(uint32_t seconds, size_t *len) {
+    static const char *vocab[] = { "the", "account", "number", "is", "don't", "\\\"seven\\\"", "caf\\u00e9", "please", "call", "me", "back", "tomorrow" };
+    uint32_t words = seconds * 5 / 2, segs = MAX(1, seconds / 5), vsz = sizeof(vocab) / sizeof(vocab[0]);
+    size_t cap = 4096 + (words * 160) + (segs * 512), offs = 0;
+    char *buf = malloc(cap);
+
+    offs += sprintf(buf + offs, "{\"task\":\"transcribe\",\"language\":\"english\",\"duration\":%u.0,\"text\":\"", seconds);
+    for(uint32_t i = 0; i < words; i++) {
+        offs += sprintf(buf + offs, "%s%s", (i ? " " : ""), vocab[i % vsz]);
+    }
+    offs += sprintf(buf + offs, "\",\"segments\":[");
+    for(uint32_t i = 0; i < segs; i++) {
+        offs += sprintf(buf + offs, "%s{\"id\":%u,\"seek\":%u,\"start\":%.2f,\"end\":%.2f,\"text\":\"", (i ? "," : ""), i, i * 500, i * 5.0, (i + 1) * 5.0);
+        for(uint32_t j = i * words / segs; j < (i + 1) * words / segs; j++) {
+            offs += sprintf(buf + offs, " %s", vocab[j % vsz]);
+        }
+        offs += sprintf(buf + offs, "\",\"tokens\":[50364,440,2696,1230,307,1411,1804,51264],\"temperature\":0.0,\"avg_logprob\":-0.%03u,"
+                        "\"compression_ratio\":1.35,\"no_speech_prob\":0.0%02u}", 150 + i % 300, i % 50);
+    }
+    offs += sprintf(buf + offs, "],\"words\":[");
+    for(uint32_t i = 0; i < words; i++) {
+        offs += sprintf(buf + offs, "%s{\"word\":\"%s\",\"start\":%.2f,\"end\":%.2f}", (i ? "," : ""), vocab[i % vsz], i * 0.4, (i * 0.4) + 0.32);
+    }
+    offs += sprintf(buf + offs, "]}");
+
+    assert(offs < cap);
+    *len = offs;
+    return buf;
+}
+
+/**
+ ** verbose_json parsing, per response: vjson_parse() against nlohmann::json::parse() (bench_json.cpp),
+ ** a chunk-size-sec chunk and a coalesced-size one; rate is the response size in KB
+ **/
+static void bench_vjson(uint32_t seconds) {
+    size_t len = 0;
+    char *json = vjson_gen(seconds, &len);
+    bench_row_t *vrow = row_new("vjson_parse", "json", len / 1024, seconds);
+    bench_row_t *nrow = row_new("nlohmann_parse", "json", len / 1024, seconds);
+    uint32_t rounds = MAX(200, (bench_seconds * 4000) / seconds);
+    stub_counters_t c0, c1;
+    double sum = 0;
+
+    for(uint32_t i = 0; i < rounds; i++) {
+        vjson_t vj = { 0 };
+        uint32_t items = 0;
+        uint64_t t0, t1;
+
+        counters_snap(&c0);
+        t0 = now_ns();
+        if(vjson_parse(json, len, &vj) != SWITCH_STATUS_SUCCESS) {
+            fprintf(stderr, "vjson_parse() failed\n");
+            exit(1);
+        }
+        items = vj.segments_count + vj.words_count;
+        vjson_free(&vj);
+        t1 = now_ns();
+        counters_snap(&c1);
+        row_account(vrow, t0, t1, &c0, &c1, 1);
+
+        counters_snap(&c0);
+        t0 = now_ns();
+        if(bench_nlohmann_parse(json, len, &sum) != items) {
+            fprintf(stderr, "vjson_parse() and nlohmann disagree\n");
+            exit(1);
+        }
+        t1 = now_ns();
+        counters_snap(&c1);
+        row_account(nrow, t0, t1, &c0, &c1, 1);
+    }
+
+    free(json);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// output
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+#define ROW_NS(r)       ((double)(r)->ns / (r)->frames)
+#define ROW_ALLOCS(r)   ((double)(r)->allocs / (r)->frames)
+#define ROW_ABYTES(r)   ((double)(r)->alloc_bytes / (r)->frames)
+#define ROW_CBYTES(r)   ((double)(r)->copied_bytes / (r)->frames)
+
+static void report_table() {
+    printf("%-20s %-5s %6s %6s %10s %12s %12s %14s\n", "case", "codec", "rate", "ptime", "frames", "ns/frame", "allocs/frame", "copied/frame");
+    for(uint32_t i = 0; i < rows_count; i++) {
+        bench_row_t *r = &rows[i];
+        printf("%-20s %-5s %6u %6u %10"PRIu64" %12.1f %12.2f %14.1f\n", r->name, r->codec, r->rate, r->ptime, r->frames, ROW_NS(r), ROW_ALLOCS(r), ROW_CBYTES(r));
+    }
+}
+
+static int report_write(const char *path) {
+    uint8_t fl_json = (strlen(path) > 5 && !strcmp(path + strlen(path) - 5, ".json"));
+    FILE *fp = fopen(path, "w");
+
+    if(!fp) {
+        fprintf(stderr, "Couldn't open: %s\n", path);
+        return -1;
+    }
+
+    if(fl_json) {
+        fprintf(fp, "{\"version\":\"%s\",\"seconds\":%u,\"results\":[\n", VERSION, bench_seconds);
+    } else {
+        fprintf(fp, "case,codec,rate,ptime,frames,ns_per_frame,allocs_per_frame,alloc_bytes_per_frame,copied_bytes_per_frame\n");
+    }
+
+    for(uint32_t i = 0; i < rows_count; i++) {
+        bench_row_t *r = &rows[i];
+        if(fl_json) {
+            fprintf(fp, "  {\"case\":\"%s\",\"codec\":\"%s\",\"rate\":%u,\"ptime\":%u,\"frames\":%"PRIu64",\"ns_per_frame\":%.1f,\"allocs_per_frame\":%.3f,\"alloc_bytes_per_frame\":%.1f,\"copied_bytes_per_frame\":%.1f}%s\n",
+                    r->name, r->codec, r->rate, r->ptime, r->frames, ROW_NS(r), ROW_ALLOCS(r), ROW_ABYTES(r), ROW_CBYTES(r), (i + 1 < rows_count ? "," : ""));
+        } else {
+            fprintf(fp, "%s,%s,%u,%u,%"PRIu64",%.1f,%.3f,%.1f,%.1f\n", r->name, r->codec, r->rate, r->ptime, r->frames, ROW_NS(r), ROW_ALLOCS(r), ROW_ABYTES(r), ROW_CBYTES(r));
+        }
+    }
+
+    if(fl_json) {
+        fprintf(fp, "]}\n");
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+/**
+ ** compare with a previous csv report: ns/frame beyond the tolerance or any growth of allocs/copies is a regression
+ **/
+static int report_compare(const char *path, uint32_t tolerance) {
+    char line[512], name[64], codec[16];
+    uint32_t rate = 0, ptime = 0, regressions = 0;
+    double ns = 0, allocs = 0, abytes = 0, cbytes = 0;
+    uint64_t frames = 0;
+    FILE *fp = fopen(path, "r");
+
+    if(!fp) {
+        fprintf(stderr, "Couldn't open: %s\n", path);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), fp)) {
+        if(sscanf(line, "%63[^,],%15[^,],%u,%u,%"SCNu64",%lf,%lf,%lf,%lf", name, codec, &rate, &ptime, &frames, &ns, &allocs, &abytes, &cbytes) != 9) {
+            continue;
+        }
+        for(uint32_t i = 0; i < rows_count; i++) {
+            bench_row_t *r = &rows[i];
+            if(strcmp(r->name, name) || strcmp(r->codec, codec) || r->rate != rate || r->ptime != ptime) {
+                continue;
+            }
+            if(ROW_NS(r) > ns * (100 + tolerance) / 100 || ROW_ALLOCS(r) > allocs + 0.001 || ROW_CBYTES(r) > cbytes + 0.5) {
+                printf("REGRESSION %s %s %u/%u: ns/frame %.1f -> %.1f, allocs/frame %.2f -> %.2f, copied/frame %.1f -> %.1f\n",
+                       name, codec, rate, ptime, ns, ROW_NS(r), allocs, ROW_ALLOCS(r), cbytes, ROW_CBYTES(r));
+                regressions++;
+            }
+        }
+    }
+    fclose(fp);
+
+    return (regressions ? 1 : 0);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+static void bench_init(switch_memory_pool_t *pool) {
+    config_t *cfg = NULL;
+    switch_memory_pool_t *cpool = NULL;
+
+    memset(&globals, 0, sizeof(globals));
+    switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_core_hash_init(&globals.sessions);
+    g711_init();
+    slog_init(pool);
+    apikey_init(pool);
+
+    // no xml outside of FreeSWITCH, the snapshot is what config_load() would produce for the stock sfwhisper.conf.xml
+    switch_core_new_memory_pool(&cpool);
+    cfg = switch_core_alloc(cpool, sizeof(config_t));
+    cfg->pool = cpool;
+    cfg->api_url = "http://127.0.0.1:8080/v1/audio/transcriptions";
+    cfg->api_url_ep = strdup(cfg->api_url);
+    cfg->api_key = cfg->api_keys[0] = "bench";
+    cfg->api_keys_count = 1;
+    cfg->default_lang = "en";
+    cfg->realtime_model = DEF_REALTIME_MODEL;
+    cfg->chunk_size_sec = DEF_CHUNK_SZ_SEC;
+    cfg->audio_buffer_ms = DEF_AUDIO_BUFFER_MS;
+    cfg->overflow_policy = OVERFLOW_DROP_OLDEST;
+    cfg->vad_silence_ms = 700;
+    cfg->vad_voice_ms = 200;
+    cfg->vad_threshold = 200;
+    cfg->fl_vad_enabled = true;
+    cfg->max_parallel_uploads = DEF_PARALLEL_UPLOADS;
+    cfg->fl_classifier_enabled = true;
+    cfg->classifier_min_voiced_ms = CLS_MIN_VOICED_MS;
+    cfg->classifier_max_flatness = CLS_MAX_FLATNESS;
+    cfg->classifier_tone_ratio = CLS_TONE_RATIO;
+    cfg->classifier_tone_frames = CLS_TONE_FRAMES;
+    cfg->coalesce_max_sec = DEF_COALESCE_MAX_SEC;
+    cfg->coalesce_max_age_ms = DEF_COALESCE_MAX_AGE_MS;
+    cfg->coalesce_gap_ms = DEF_COALESCE_GAP_MS;
+    cfg->capture_max_mb = DEF_CAPTURE_MAX_MB;
+    cfg->log_level = SWITCH_LOG_WARNING;
+    cfg->log_sample_rate = 1;
+    cfg->no_input_timeout = 5000;
+    cfg->gen = ++globals.config_gen;
+    switch_atomic_set(&cfg->refs, 1);
+    globals.config = cfg;
+    apikey_sync(cfg);
+}
+
+int main(int argc, char **argv) {
+    static const uint32_t rates[] = { 8000, 16000, 48000 };
+    static const uint32_t ptimes[] = { 10, 20, 30 };
+    const char *out_path = NULL, *baseline_path = NULL;
+    uint32_t tolerance = BENCH_TOLERANCE;
+    switch_memory_pool_t *pool = NULL;
+    int rc = 0;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            bench_seconds = atoi(argv[++i]);
+            if(bench_seconds < 1) { bench_seconds = 1; }
+        } else if(!strcmp(argv[i], "--out") && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if(!strcmp(argv[i], "--baseline") && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if(!strcmp(argv[i], "--tolerance") && i + 1 < argc) {
+            tolerance = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--seconds N] [--out file.json|file.csv] [--baseline file.csv] [--tolerance pct]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    switch_core_new_memory_pool(&pool);
+    bench_init(pool);
+
+    // the consumer side is driven by the benchmark itself
+    stub_threads_enable(SWITCH_FALSE);
+
+    for(uint32_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        for(uint32_t p = 0; p < sizeof(ptimes) / sizeof(ptimes[0]); p++) {
+            bench_feed("asr_feed", CODEC_L16, rates[r], ptimes[p], false, SIGNAL_SPEECH);
+            bench_feed("asr_feed+vad", CODEC_L16, rates[r], ptimes[p], true, SIGNAL_SPEECH);
+            bench_feed("asr_feed+vad-preroll", CODEC_L16, rates[r], ptimes[p], true, SIGNAL_MIXED);
+            bench_xdata_push(CODEC_L16, rates[r], ptimes[p]);
+            bench_chunk(CODEC_L16, rates[r], ptimes[p]);
+        }
+    }
+    for(uint32_t p = 0; p < sizeof(ptimes) / sizeof(ptimes[0]); p++) {
+        bench_feed("asr_feed+vad", CODEC_PCMU, 8000, ptimes[p], true, SIGNAL_SPEECH);
+        bench_feed("asr_feed+vad-preroll", CODEC_PCMU, 8000, ptimes[p], true, SIGNAL_MIXED);
+        bench_chunk(CODEC_PCMU, 8000, ptimes[p]);
+    }
+    bench_vjson(globals.config->chunk_size_sec);
+    bench_vjson(300);
+
+    report_table();
+
+    if(out_path && report_write(out_path) != 0) {
+        rc = 2;
+    }
+    if(baseline_path && (rc = report_compare(baseline_path, tolerance)) == 0) {
+        printf("no regressions against %s (tolerance %u%%)\n", baseline_path, tolerance);
+    }
+
+    return rc;
+}
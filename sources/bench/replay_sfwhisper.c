@@ -0,0 +1,362 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ *
+ * Replays a session capture (.sfwcap, see capture.c) through the module, built against the stubs in ./stubs.
+ * The frames go to asr_feed at their recorded times (scaled by --speed, --fast: no waiting), pause/resume/params and
+ * the result reads are repeated where the session did them, the API responses come from the capture (matched by the
+ * chunk audio) after the recorded upload time. The transcripts have to come out the same, the timings are reported.
+ *
+ * replay_sfwhisper [--fast] [--speed N] [--verbose] file.sfwcap
+ **/
+#include "../mod_sfwhisper.c"
+#include <time.h>
+
+#define REPLAY_RESULT_WAIT_MS   30000
+
+typedef struct {
+    uint64_t                hash;
+    uint32_t                upload_ms;
+    uint8_t                 fl_error;
+    uint8_t                 fl_used;
+    char                    *response;
+} replay_resp_t;
+
+static struct {
+    switch_mutex_t          *mutex;             // resps
+    capture_hdr_t           hdr;
+    uint8_t                 *buf;
+    size_t                  len;
+    replay_resp_t           *resps;
+    uint32_t                resps_count;
+    uint32_t                requests;
+    uint32_t                requests_unmatched;
+    double                  speed;
+    uint8_t                 fl_fast;
+    uint8_t                 fl_verbose;
+} replay = { .speed = 1.0 };
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t t) {
+    uint64_t now = now_ns();
+
+    if(t > now) {
+        struct timespec ts = { (t - now) / 1000000000ULL, (t - now) % 1000000000ULL };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static const char *codec2name(uint8_t codec) {
+    return (codec == CODEC_PCMU ? "PCMU" : codec == CODEC_PCMA ? "PCMA" : "L16");
+}
+
+static uint8_t *file_load(const char *path, size_t *len) {
+    FILE *fp = fopen(path, "rb");
+    uint8_t *buf = NULL;
+    long sz = 0;
+
+    if(!fp) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    sz = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if(sz > 0 && (buf = malloc(sz)) != NULL && fread(buf, sz, 1, fp) != 1) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+
+    *len = (buf ? sz : 0);
+    return buf;
+}
+
+/**
+ ** the mock backend (stub_transcribe_hook): the chunk in the wav file is looked up by its hash
+ **/
+static char *replay_transcribe(const char *file, int verbose) {
+    replay_resp_t *resp = NULL;
+    uint8_t *wav = NULL, *data = NULL;
+    size_t len = 0, data_len = 0;
+    uint64_t hash = 0;
+    char *text = NULL;
+
+    if((wav = file_load(file, &len)) == NULL) {
+        return NULL;
+    }
+    data = wav;
+    data_len = len;
+    if(len >= 12 && !memcmp(wav, "RIFF", 4)) {
+        for(size_t offs = 12; offs + 8 <= len; ) {
+            uint32_t clen = wav[offs + 4] | (wav[offs + 5] << 8) | (wav[offs + 6] << 16) | ((uint32_t)wav[offs + 7] << 24);
+            if(!memcmp(wav + offs, "data", 4)) {
+                data = wav + offs + 8;
+                data_len = MIN(clen, len - offs - 8);
+                break;
+            }
+            offs += 8 + clen + (clen & 1);
+        }
+    }
+    hash = capture_hash(data, data_len);
+    free(wav);
+
+    switch_mutex_lock(replay.mutex);
+    replay.requests++;
+    for(uint32_t i = 0; i < replay.resps_count; i++) {
+        if(replay.resps[i].hash == hash && (!resp || (resp->fl_used && !replay.resps[i].fl_used))) {
+            resp = &replay.resps[i];
+        }
+    }
+    if(resp) {
+        resp->fl_used = true;
+    } else {
+        replay.requests_unmatched++;
+    }
+    switch_mutex_unlock(replay.mutex);
+
+    if(!resp) {
+        fprintf(stderr, "replay: no recorded response for a chunk of %zu bytes (diverged)\n", data_len);
+        return NULL;
+    }
+    if(!replay.fl_fast && resp->upload_ms) {
+        sleep_until_ns(now_ns() + (uint64_t)(resp->upload_ms * 1000000.0 / replay.speed));
+    }
+    if(!resp->fl_error && resp->response) {
+        text = strdup(resp->response);
+    }
+    return text;
+}
+
+static void replay_init(switch_memory_pool_t *pool) {
+    capture_hdr_t *hdr = &replay.hdr;
+    config_t *cfg = NULL;
+    switch_memory_pool_t *cpool = NULL;
+
+    memset(&globals, 0, sizeof(globals));
+    switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_mutex_init(&replay.mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_core_hash_init(&globals.sessions);
+    g711_init();
+    slog_init(pool);
+
+    // the settings the session ran with, the rest is the stock sfwhisper.conf.xml
+    switch_core_new_memory_pool(&cpool);
+    cfg = switch_core_alloc(cpool, sizeof(config_t));
+    cfg->pool = cpool;
+    cfg->api_url = "http://127.0.0.1:8080/v1/audio/transcriptions";
+    cfg->api_url_ep = strdup(cfg->api_url);
+    cfg->api_key = "replay";
+    cfg->default_lang = (hdr->lang[0] ? hdr->lang : "en");
+    cfg->realtime_model = DEF_REALTIME_MODEL;
+    cfg->chunk_size_sec = hdr->chunk_size_sec;
+    cfg->audio_buffer_ms = DEF_AUDIO_BUFFER_MS;
+    cfg->overflow_policy = OVERFLOW_DROP_OLDEST;
+    cfg->vad_silence_ms = hdr->vad_silence_ms;
+    cfg->vad_voice_ms = hdr->vad_voice_ms;
+    cfg->vad_threshold = hdr->vad_threshold;
+    cfg->fl_vad_enabled = (hdr->flags & CAP_HDR_FL_VAD) ? true : false;
+    cfg->max_parallel_uploads = hdr->max_parallel_uploads;
+    cfg->fl_classifier_enabled = (hdr->flags & CAP_HDR_FL_CLASSIFIER) ? true : false;
+    cfg->classifier_min_voiced_ms = hdr->classifier_min_voiced_ms;
+    cfg->classifier_max_flatness = CLS_MAX_FLATNESS;
+    cfg->classifier_tone_ratio = CLS_TONE_RATIO;
+    cfg->classifier_tone_frames = CLS_TONE_FRAMES;
+    cfg->fl_coalesce = (hdr->flags & CAP_HDR_FL_COALESCE) ? true : false;
+    cfg->coalesce_max_sec = hdr->coalesce_max_sec;
+    cfg->coalesce_max_age_ms = hdr->coalesce_max_age_ms;
+    cfg->coalesce_gap_ms = hdr->coalesce_gap_ms;
+    cfg->capture_max_mb = DEF_CAPTURE_MAX_MB;
+    cfg->log_level = SWITCH_LOG_WARNING;
+    cfg->log_sample_rate = 1;
+    cfg->no_input_timeout = 5000;
+    cfg->gen = ++globals.config_gen;
+    switch_atomic_set(&cfg->refs, 1);
+    globals.config = cfg;
+}
+
+/**
+ ** recorded responses, so the mock can answer whatever order the uploads come in
+ **/
+static void responses_load() {
+    size_t offs = sizeof(capture_hdr_t);
+
+    while(offs + sizeof(capture_rec_t) <= replay.len) {
+        capture_rec_t *rec = (capture_rec_t *)(replay.buf + offs);
+
+        if(offs + sizeof(capture_rec_t) + rec->len > replay.len) {
+            break;
+        }
+        if(rec->type == CAP_RESULT && rec->len >= sizeof(capture_result_t)) {
+            capture_result_t *res = (capture_result_t *)(rec + 1);
+            replay_resp_t *resp = NULL;
+            uint32_t text_len = rec->len - sizeof(capture_result_t);
+
+            replay.resps = realloc(replay.resps, sizeof(replay_resp_t) * (replay.resps_count + 1));
+            resp = &replay.resps[replay.resps_count++];
+            memset(resp, 0, sizeof(*resp));
+            resp->hash = res->hash;
+            resp->upload_ms = res->upload_ms;
+            resp->fl_error = res->fl_error;
+            if(!res->fl_error) {
+                resp->response = malloc(text_len + 1);
+                memcpy(resp->response, (char *)(res + 1), text_len);
+                resp->response[text_len] = '\0';
+            }
+        }
+        offs += sizeof(capture_rec_t) + rec->len;
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    switch_memory_pool_t *pool = NULL;
+    switch_asr_handle_t ah = { 0 };
+    switch_asr_flag_t flags = 0;
+    gasr_ctx_t *asr_ctx = NULL;
+    size_t offs = sizeof(capture_hdr_t);
+    uint64_t t0 = 0, t_feed = 0, feed_ns = 0, feed_ns_max = 0, late_ms = 0, late_ms_max = 0;
+    uint32_t frames = 0, vad_mismatches = 0, texts = 0, texts_matched = 0, texts_missing = 0, results = 0;
+    int64_t duration_us = 0;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--fast")) {
+            replay.fl_fast = true;
+        } else if(!strcmp(argv[i], "--speed") && i + 1 < argc) {
+            replay.speed = atof(argv[++i]);
+            if(replay.speed <= 0) { replay.speed = 1.0; }
+        } else if(!strcmp(argv[i], "--verbose")) {
+            replay.fl_verbose = true;
+        } else if(argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if(!path) {
+        fprintf(stderr, "usage: %s [--fast] [--speed N] [--verbose] file.sfwcap\n", argv[0]);
+        return 2;
+    }
+
+    if((replay.buf = file_load(path, &replay.len)) == NULL || replay.len < sizeof(capture_hdr_t)) {
+        fprintf(stderr, "replay: can't read %s\n", path);
+        return 2;
+    }
+    memcpy(&replay.hdr, replay.buf, sizeof(capture_hdr_t));
+    if(replay.hdr.magic != CAPTURE_MAGIC || replay.hdr.version != CAPTURE_VERSION) {
+        fprintf(stderr, "replay: %s isn't a capture (or another version)\n", path);
+        return 2;
+    }
+
+    switch_core_new_memory_pool(&pool);
+    replay_init(pool);
+    responses_load();
+    stub_transcribe_hook = replay_transcribe;
+
+    switch_core_new_memory_pool(&ah.memory_pool);
+    if(asr_open(&ah, codec2name(replay.hdr.codec), replay.hdr.samplerate, NULL, &flags) != SWITCH_STATUS_SUCCESS) {
+        fprintf(stderr, "asr_open() failed\n");
+        return 1;
+    }
+    asr_ctx = (gasr_ctx_t *)ah.private_info;
+    if(replay.hdr.lang[0]) {
+        asr_text_param(&ah, "lang", replay.hdr.lang);
+    }
+
+    t0 = now_ns();
+    while(offs + sizeof(capture_rec_t) <= replay.len) {
+        capture_rec_t *rec = (capture_rec_t *)(replay.buf + offs);
+        uint8_t *payload = (uint8_t *)(rec + 1);
+        uint64_t t_rec = t0 + (uint64_t)(rec->ts_us * 1000.0 / replay.speed);
+
+        if(offs + sizeof(capture_rec_t) + rec->len > replay.len) {
+            fprintf(stderr, "replay: truncated capture\n");
+            break;
+        }
+        offs += sizeof(capture_rec_t) + rec->len;
+        duration_us = MAX(duration_us, rec->ts_us);
+
+        if(!replay.fl_fast && rec->type != CAP_RESULT) {
+            sleep_until_ns(t_rec);
+        }
+
+        if(rec->type == CAP_FEED) {
+            t_feed = now_ns();
+            asr_feed(&ah, (rec->len ? payload : NULL), rec->len, &flags);
+            t_feed = now_ns() - t_feed;
+            feed_ns += t_feed;
+            feed_ns_max = MAX(feed_ns_max, t_feed);
+            frames++;
+            if(asr_ctx->vad_state != rec->vad) {
+                vad_mismatches++;
+            }
+        } else if(rec->type == CAP_PAUSE) {
+            asr_pause(&ah);
+        } else if(rec->type == CAP_RESUME) {
+            asr_resume(&ah);
+        } else if(rec->type == CAP_TIMERS) {
+            asr_start_input_timers(&ah);
+        } else if(rec->type == CAP_PARAM && rec->len > 0) {
+            char *name = strndup((char *)payload, rec->len);
+            uint32_t name_len = strlen(name);
+            char *val = (name_len < rec->len ? strndup((char *)payload + name_len + 1, rec->len - name_len - 1) : NULL);
+
+            if(strcasecmp(name, "capture")) {
+                asr_text_param(&ah, name, val);
+            }
+            free(name);
+            free(val);
+        } else if(rec->type == CAP_RESULT) {
+            results++;
+        } else if(rec->type == CAP_TEXT) {
+            char *expected = strndup((char *)payload, rec->len), *text = NULL;
+            uint64_t t_wait = now_ns() + (REPLAY_RESULT_WAIT_MS * 1000000ULL);
+
+            // the session read this result here: wait for it like the application would
+            while(asr_check_results(&ah, &flags) != SWITCH_STATUS_SUCCESS && now_ns() < t_wait) {
+                switch_yield(1000);
+            }
+            if(!replay.fl_fast && now_ns() > t_rec) {
+                uint64_t late = (now_ns() - t_rec) / 1000000;
+                late_ms += late;
+                late_ms_max = MAX(late_ms_max, late);
+            }
+
+            texts++;
+            if(asr_get_results(&ah, &text, &flags) != SWITCH_STATUS_SUCCESS) {
+                texts_missing++;
+                printf("MISSING  #%u expected=\"%s\"\n", texts, expected);
+            } else if(strcmp(text, expected) != 0) {
+                printf("MISMATCH #%u expected=\"%s\" got=\"%s\"\n", texts, expected, text);
+            } else {
+                texts_matched++;
+                if(replay.fl_verbose) {
+                    printf("ok       #%u \"%s\"\n", texts, text);
+                }
+            }
+            switch_safe_free(text);
+            free(expected);
+        } else if(rec->type == CAP_END) {
+            break;
+        }
+    }
+
+    asr_close(&ah, &flags);
+    switch_core_destroy_memory_pool(&ah.memory_pool);
+
+    printf("capture:  uuid=%s codec=%s rate=%u duration_ms=%"PRId64" frames=%u results=%u texts=%u\n",
+           replay.hdr.uuid, codec2name(replay.hdr.codec), replay.hdr.samplerate, duration_us / 1000, frames, results, texts);
+    printf("replay:   mode=%s wall_ms=%"PRIu64" feed_ns_avg=%.1f feed_ns_max=%"PRIu64" requests=%u unmatched=%u\n",
+           (replay.fl_fast ? "fast" : "timed"), (now_ns() - t0) / 1000000, (frames ? (double)feed_ns / frames : 0.0), feed_ns_max,
+           replay.requests, replay.requests_unmatched);
+    printf("compare:  texts_matched=%u texts_mismatched=%u texts_missing=%u vad_mismatches=%u late_ms_avg=%.1f late_ms_max=%"PRIu64"\n",
+           texts_matched, texts - texts_matched - texts_missing, texts_missing, vad_mismatches, (texts ? (double)late_ms / texts : 0.0), late_ms_max);
+
+    return (texts_matched == texts ? 0 : 1);
+}
@@ -0,0 +1,21 @@
+/**
+ * Counts C++ heap allocations into stub_counters (whisper_api.cpp request building)
+ **/
+#include <switch.h>
+#include <new>
+
+void *operator new(std::size_t len) {
+    void *p = stub_malloc(len ? len : 1);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, std::size_t len) noexcept {
+    free(p);
+}
@@ -0,0 +1,273 @@
+/**
+ * Thin stand-ins for the FreeSWITCH core API, just enough to build the module
+ * outside of the FreeSWITCH tree for the benchmark and replay tools.
+ * Only what the module uses is declared, behaviour is simplified (see switch_stubs.c).
+ **/
+#ifndef STUB_SWITCH_H
+#define STUB_SWITCH_H
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <assert.h>
+#include <stdarg.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+typedef enum { SWITCH_FALSE = 0, SWITCH_TRUE = 1 } switch_bool_t;
+typedef enum { SWITCH_STATUS_SUCCESS, SWITCH_STATUS_FALSE, SWITCH_STATUS_TIMEOUT, SWITCH_STATUS_RESTART, SWITCH_STATUS_INTR, SWITCH_STATUS_NOTIMPL, SWITCH_STATUS_MEMERR, SWITCH_STATUS_NOOP, SWITCH_STATUS_RESAMPLE, SWITCH_STATUS_GENERR, SWITCH_STATUS_INUSE, SWITCH_STATUS_BREAK, SWITCH_STATUS_TERM, SWITCH_STATUS_NOTFOUND } switch_status_t;
+typedef uint8_t switch_byte_t;
+typedef size_t switch_size_t;
+typedef int64_t switch_time_t;
+typedef int64_t switch_interval_time_t;
+typedef struct switch_memory_pool switch_memory_pool_t;
+typedef struct switch_mutex switch_mutex_t;
+typedef struct switch_thread_cond switch_thread_cond_t;
+typedef struct switch_queue switch_queue_t;
+typedef struct switch_buffer switch_buffer_t;
+typedef struct switch_thread switch_thread_t;
+typedef struct switch_threadattr switch_threadattr_t;
+typedef struct switch_vad_s switch_vad_t;
+typedef struct switch_core_session switch_core_session_t;
+typedef struct switch_channel switch_channel_t;
+typedef struct switch_file switch_file_t;
+typedef struct switch_hash switch_hash_t;
+typedef struct switch_hashtable_iterator switch_hash_index_t;
+typedef void *(*switch_thread_start_t)(switch_thread_t *, void *);
+#define SWITCH_THREAD_FUNC
+#define SWITCH_THREAD_STACKSIZE (240*1024)
+#define SWITCH_MUTEX_NESTED 1
+#define SWITCH_MUTEX_DEFAULT 0
+#define SWITCH_UUID_FORMATTED_LENGTH 36
+#define SWITCH_PATH_SEPARATOR "/"
+#define SWITCH_DECLARE(t) t
+typedef int32_t switch_atomic_t;
+typedef enum { SWITCH_VAD_STATE_NONE, SWITCH_VAD_STATE_START_TALKING, SWITCH_VAD_STATE_TALKING, SWITCH_VAD_STATE_STOP_TALKING, SWITCH_VAD_STATE_ERROR } switch_vad_state_t;
+typedef enum { SWITCH_LOG_DEBUG10=110, SWITCH_LOG_DEBUG=7, SWITCH_LOG_INFO=6, SWITCH_LOG_NOTICE=5, SWITCH_LOG_WARNING=4, SWITCH_LOG_ERROR=3, SWITCH_LOG_CRIT=2, SWITCH_LOG_ALERT=1, SWITCH_LOG_CONSOLE=0 } switch_log_level_t;
+#define SWITCH_CHANNEL_LOG 0, __FILE__, __func__, __LINE__, NULL
+#define SWITCH_CHANNEL_SESSION_LOG(s) 1, __FILE__, __func__, __LINE__, (const char*)(s)
+void switch_log_printf(int channel, const char *file, const char *func, int line, const char *userdata, switch_log_level_t level, const char *fmt, ...);
+switch_log_level_t switch_log_str2level(const char *str);
+const char *switch_log_level2str(switch_log_level_t level);
+typedef uint32_t switch_asr_flag_t;
+#define SWITCH_ASR_FLAG_CLOSED (1<<2)
+typedef struct switch_asr_handle { void *private_info; switch_memory_pool_t *memory_pool; uint32_t flags; char *grammar; char *param; uint32_t rate; } switch_asr_handle_t;
+typedef struct switch_loadable_module_interface switch_loadable_module_interface_t;
+typedef struct switch_stream_handle switch_stream_handle_t;
+typedef switch_status_t (*switch_stream_handle_write_function_t)(switch_stream_handle_t *handle, const char *fmt, ...);
+struct switch_stream_handle { switch_stream_handle_write_function_t write_function; void *data; };
+typedef struct switch_asr_interface {
+ const char *interface_name;
+ switch_status_t (*asr_open)(switch_asr_handle_t *ah, const char *codec, int rate, const char *dest, switch_asr_flag_t *flags);
+ switch_status_t (*asr_load_grammar)(switch_asr_handle_t *ah, const char *grammar, const char *name);
+ switch_status_t (*asr_unload_grammar)(switch_asr_handle_t *ah, const char *name);
+ switch_status_t (*asr_close)(switch_asr_handle_t *ah, switch_asr_flag_t *flags);
+ switch_status_t (*asr_feed)(switch_asr_handle_t *ah, void *data, unsigned int len, switch_asr_flag_t *flags);
+ switch_status_t (*asr_resume)(switch_asr_handle_t *ah);
+ switch_status_t (*asr_pause)(switch_asr_handle_t *ah);
+ switch_status_t (*asr_check_results)(switch_asr_handle_t *ah, switch_asr_flag_t *flags);
+ switch_status_t (*asr_get_results)(switch_asr_handle_t *ah, char **xmlstr, switch_asr_flag_t *flags);
+ switch_status_t (*asr_start_input_timers)(switch_asr_handle_t *ah);
+ void (*asr_text_param)(switch_asr_handle_t *ah, char *param, const char *val);
+ void (*asr_numeric_param)(switch_asr_handle_t *ah, char *param, int val);
+ void (*asr_float_param)(switch_asr_handle_t *ah, char *param, double val);
+} switch_asr_interface_t;
+typedef enum { SWITCH_ASR_INTERFACE, SWITCH_API_INTERFACE } switch_module_interface_name_t;
+typedef struct switch_api_interface switch_api_interface_t;
+typedef switch_status_t (*switch_api_function_t)(const char *cmd, switch_core_session_t *session, switch_stream_handle_t *stream);
+#define SWITCH_STANDARD_API(name) static switch_status_t name(const char *cmd, switch_core_session_t *session, switch_stream_handle_t *stream)
+#define SWITCH_ADD_API(api_int, int_name, descript, funcptr, syntax_string) do { api_int = (switch_api_interface_t*)switch_loadable_module_create_interface(*module_interface, SWITCH_API_INTERFACE); (void)api_int; (void)(funcptr); } while(0)
+void switch_console_set_complete(const char *s);
+#define SWITCH_MODULE_LOAD_FUNCTION(name) switch_status_t name(switch_loadable_module_interface_t **module_interface, switch_memory_pool_t *pool)
+#define SWITCH_MODULE_SHUTDOWN_FUNCTION(name) switch_status_t name(void)
+#define SWITCH_MODULE_RUNTIME_FUNCTION(name) switch_status_t name(void)
+#define SWITCH_MODULE_DEFINITION(name, load, shutdown, runtime) static const char modname[] = #name
+switch_loadable_module_interface_t *switch_loadable_module_create_module_interface(switch_memory_pool_t *pool, const char *name);
+void *switch_loadable_module_create_interface(switch_loadable_module_interface_t *mod, switch_module_interface_name_t iname);
+/* memory */
+#define switch_zmalloc(ptr, len) (void)(ptr = stub_calloc(1, (len)))
+#define switch_malloc(ptr, len) (void)(ptr = stub_malloc(len))
+#define switch_safe_free(it) if (it) {free(it);it=NULL;}
+#define switch_assert(expr) assert(expr)
+#define switch_goto_status(_status, _label) do { status = _status; goto _label; } while(0)
+#define zstr(x) (!(x) || !*(x))
+#define switch_set_flag(obj, flag) (obj)->flags |= (flag)
+#define switch_test_flag(obj, flag) ((obj)->flags & flag)
+switch_status_t switch_core_new_memory_pool(switch_memory_pool_t **pool);
+switch_status_t switch_core_destroy_memory_pool(switch_memory_pool_t **pool);
+void *switch_core_alloc(switch_memory_pool_t *pool, switch_size_t memory);
+char *switch_core_strdup(switch_memory_pool_t *pool, const char *todup);
+char *switch_core_sprintf(switch_memory_pool_t *pool, const char *fmt, ...);
+void *switch_core_memory_pool_get_data(switch_memory_pool_t *pool, const char *key);
+char *switch_mprintf(const char *zFormat, ...);
+char *switch_string_replace(const char *string, const char *search, const char *replace);
+switch_bool_t switch_true(const char *expr);
+switch_bool_t switch_is_number(const char *str);
+int switch_separate_string(char *buf, char delim, char **array, unsigned int arraylen);
+#define switch_split(_data, _delim, _array) switch_separate_string(_data, _delim, _array, (sizeof(_array)/sizeof(_array[0])))
+char *switch_copy_string(char *dst, const char *src, switch_size_t dst_size);
+char *switch_strip_whitespace(const char *str);
+switch_size_t switch_b64_encode(unsigned char *in, switch_size_t ilen, unsigned char *out, switch_size_t olen);
+switch_size_t switch_b64_decode(const char *in, char *out, switch_size_t olen);
+/* threads */
+switch_status_t switch_mutex_init(switch_mutex_t **lock, unsigned int flags, switch_memory_pool_t *pool);
+switch_status_t switch_mutex_lock(switch_mutex_t *lock);
+switch_status_t switch_mutex_unlock(switch_mutex_t *lock);
+switch_status_t switch_mutex_trylock(switch_mutex_t *lock);
+switch_status_t switch_mutex_destroy(switch_mutex_t *lock);
+switch_status_t switch_thread_cond_create(switch_thread_cond_t **cond, switch_memory_pool_t *pool);
+switch_status_t switch_thread_cond_wait(switch_thread_cond_t *cond, switch_mutex_t *mutex);
+switch_status_t switch_thread_cond_timedwait(switch_thread_cond_t *cond, switch_mutex_t *mutex, switch_interval_time_t timeout);
+switch_status_t switch_thread_cond_signal(switch_thread_cond_t *cond);
+switch_status_t switch_thread_cond_broadcast(switch_thread_cond_t *cond);
+switch_status_t switch_threadattr_create(switch_threadattr_t **new_attr, switch_memory_pool_t *pool);
+switch_status_t switch_threadattr_detach_set(switch_threadattr_t *attr, int32_t on);
+switch_status_t switch_threadattr_stacksize_set(switch_threadattr_t *attr, switch_size_t stacksize);
+switch_status_t switch_thread_create(switch_thread_t **new_thread, switch_threadattr_t *attr, switch_thread_start_t func, void *data, switch_memory_pool_t *cont);
+void switch_yield(int us);
+switch_time_t switch_micro_time_now(void);
+switch_time_t switch_time_now(void);
+switch_time_t switch_epoch_time_now(switch_time_t *t);
+void switch_atomic_set(volatile switch_atomic_t *mem, uint32_t val);
+uint32_t switch_atomic_read(volatile switch_atomic_t *mem);
+void switch_atomic_add(volatile switch_atomic_t *mem, uint32_t val);
+void switch_atomic_inc(volatile switch_atomic_t *mem);
+int switch_atomic_dec(volatile switch_atomic_t *mem);
+/* queue */
+switch_status_t switch_queue_create(switch_queue_t **queue, unsigned int queue_capacity, switch_memory_pool_t *pool);
+switch_status_t switch_queue_push(switch_queue_t *queue, void *data);
+switch_status_t switch_queue_trypush(switch_queue_t *queue, void *data);
+switch_status_t switch_queue_pop(switch_queue_t *queue, void **data);
+switch_status_t switch_queue_trypop(switch_queue_t *queue, void **data);
+switch_status_t switch_queue_pop_timeout(switch_queue_t *queue, void **data, switch_interval_time_t timeout);
+unsigned int switch_queue_size(switch_queue_t *queue);
+switch_status_t switch_queue_term(switch_queue_t *queue);
+/* buffer */
+switch_status_t switch_buffer_create(switch_memory_pool_t *pool, switch_buffer_t **buffer, switch_size_t max_len);
+switch_status_t switch_buffer_create_dynamic(switch_buffer_t **buffer, switch_size_t blocksize, switch_size_t start_len, switch_size_t max_len);
+switch_size_t switch_buffer_write(switch_buffer_t *buffer, const void *data, switch_size_t datalen);
+switch_size_t switch_buffer_read(switch_buffer_t *buffer, void *data, switch_size_t datalen);
+switch_size_t switch_buffer_peek_zerocopy(switch_buffer_t *buffer, const void **ptr);
+switch_size_t switch_buffer_inuse(switch_buffer_t *buffer);
+switch_size_t switch_buffer_freespace(switch_buffer_t *buffer);
+switch_size_t switch_buffer_toss(switch_buffer_t *buffer, switch_size_t datalen);
+void switch_buffer_zero(switch_buffer_t *buffer);
+void switch_buffer_destroy(switch_buffer_t **buffer);
+/* vad */
+switch_vad_t *switch_vad_init(int sample_rate, int channels);
+int switch_vad_set_mode(switch_vad_t *vad, int mode);
+void switch_vad_set_param(switch_vad_t *vad, const char *key, int val);
+switch_vad_state_t switch_vad_process(switch_vad_t *vad, int16_t *data, unsigned int samples);
+switch_vad_state_t switch_vad_get_state(switch_vad_t *vad);
+void switch_vad_reset(switch_vad_t *vad);
+void switch_vad_destroy(switch_vad_t **vad);
+const char *switch_vad_state2str(switch_vad_state_t state);
+/* session / channel */
+typedef enum { CF_BREAK = 1 } switch_channel_flag_t;
+switch_channel_t *switch_core_session_get_channel(switch_core_session_t *session);
+char *switch_core_session_get_uuid(switch_core_session_t *session);
+void switch_channel_set_flag(switch_channel_t *channel, switch_channel_flag_t flag);
+switch_status_t switch_channel_set_variable(switch_channel_t *channel, const char *varname, const char *value);
+const char *switch_channel_get_variable(switch_channel_t *channel, const char *varname);
+#define switch_channel_set_variable_printf(c, v, ...) ((void)(c), SWITCH_STATUS_SUCCESS)
+switch_core_session_t *switch_core_session_locate(const char *uuid);
+void switch_core_session_rwunlock(switch_core_session_t *session);
+switch_status_t switch_core_session_wake_session_thread(switch_core_session_t *session);
+switch_status_t switch_core_session_queue_event(switch_core_session_t *session, void **event);
+/* file */
+#define SWITCH_FILE_FLAG_WRITE (1<<1)
+#define SWITCH_FILE_FLAG_READ (1<<0)
+#define SWITCH_FILE_DATA_SHORT (1<<4)
+typedef struct switch_file_handle { uint32_t samplerate; uint8_t channels; unsigned int flags; void *private_info; } switch_file_handle_t;
+switch_status_t switch_core_file_open(switch_file_handle_t *fh, const char *file_path, uint32_t channels, uint32_t rate, unsigned int flags, switch_memory_pool_t *pool);
+switch_status_t switch_core_file_write(switch_file_handle_t *fh, void *data, switch_size_t *len);
+switch_status_t switch_core_file_close(switch_file_handle_t *fh);
+#define SWITCH_FOPEN_READ 1
+#define SWITCH_FOPEN_WRITE 2
+#define SWITCH_FOPEN_CREATE 4
+#define SWITCH_FOPEN_APPEND 8
+#define SWITCH_FOPEN_TRUNCATE 16
+#define SWITCH_FOPEN_BINARY 32
+#define SWITCH_FPROT_OS_DEFAULT 0x0FFF
+switch_status_t switch_file_open(switch_file_t **newf, const char *fname, int32_t flag, int32_t perm, switch_memory_pool_t *pool);
+switch_status_t switch_file_write(switch_file_t *thefile, const void *buf, switch_size_t *nbytes);
+switch_status_t switch_file_read(switch_file_t *thefile, void *buf, switch_size_t *nbytes);
+switch_status_t switch_file_close(switch_file_t *thefile);
+switch_status_t switch_dir_make_recursive(const char *path, int32_t perm, switch_memory_pool_t *pool);
+#define SWITCH_DEFAULT_DIR_PERMS 0x0755
+switch_bool_t switch_directory_exists(const char *dirname, switch_memory_pool_t *pool);
+typedef struct switch_dir switch_dir_t;
+switch_status_t switch_dir_open(switch_dir_t **new_dir, const char *dirname, switch_memory_pool_t *pool);
+switch_status_t switch_dir_close(switch_dir_t *thedir);
+const char *switch_dir_next_file(switch_dir_t *thedir, char *buf, switch_size_t len);
+struct switch_directories { char *base_dir; char *temp_dir; char *log_dir; char *storage_dir; char *recordings_dir; };
+extern struct switch_directories SWITCH_GLOBAL_dirs;
+void switch_uuid_str(char *buf, switch_size_t len);
+/* xml */
+typedef struct switch_xml *switch_xml_t;
+struct switch_xml { char *name; switch_xml_t next; };
+switch_xml_t switch_xml_open_cfg(const char *file_path, switch_xml_t *node, void *params);
+switch_xml_t switch_xml_child(switch_xml_t xml, const char *name);
+const char *switch_xml_attr_soft(switch_xml_t xml, const char *attr);
+const char *switch_xml_attr(switch_xml_t xml, const char *attr);
+const char *switch_xml_txt(switch_xml_t xml);
+switch_xml_t switch_xml_parse_str_dynamic(char *s, switch_bool_t dup);
+void switch_xml_free(switch_xml_t xml);
+/* events */
+typedef enum { SWITCH_EVENT_CUSTOM, SWITCH_EVENT_RELOADXML, SWITCH_EVENT_ALL } switch_event_types_t;
+typedef enum { SWITCH_STACK_BOTTOM, SWITCH_STACK_TOP } switch_stack_t;
+typedef struct switch_event { switch_event_types_t event_id; } switch_event_t;
+typedef struct switch_event_node switch_event_node_t;
+typedef void (*switch_event_callback_t)(switch_event_t *);
+#define SWITCH_EVENT_SUBCLASS_ANY NULL
+switch_status_t switch_event_create_subclass(switch_event_t **event, switch_event_types_t event_id, const char *subclass_name);
+#define switch_event_create(e, id) switch_event_create_subclass(e, id, NULL)
+switch_status_t switch_event_add_header(switch_event_t *event, switch_stack_t stack, const char *header_name, const char *fmt, ...);
+switch_status_t switch_event_add_header_string(switch_event_t *event, switch_stack_t stack, const char *header_name, const char *data);
+switch_status_t switch_event_add_body(switch_event_t *event, const char *fmt, ...);
+switch_status_t switch_event_fire(switch_event_t **event);
+void switch_event_destroy(switch_event_t **event);
+switch_status_t switch_event_reserve_subclass(const char *owner, const char *subclass_name);
+#define switch_event_reserve_subclass(n) switch_event_reserve_subclass(__FILE__, n)
+switch_status_t switch_event_free_subclass(const char *owner, const char *subclass_name);
+#define switch_event_free_subclass(n) switch_event_free_subclass(__FILE__, n)
+switch_status_t switch_event_bind_removable(const char *id, switch_event_types_t event, const char *subclass_name, switch_event_callback_t callback, void *user_data, switch_event_node_t **node);
+switch_status_t switch_event_unbind(switch_event_node_t **node);
+switch_status_t switch_event_unbind_callback(switch_event_callback_t callback);
+switch_status_t switch_event_bind(const char *id, switch_event_types_t event, const char *subclass_name, switch_event_callback_t callback, void *user_data);
+/* hash */
+switch_status_t switch_core_hash_init(switch_hash_t **hash);
+switch_status_t switch_core_hash_destroy(switch_hash_t **hash);
+switch_status_t switch_core_hash_insert(switch_hash_t *hash, const char *key, const void *data);
+void *switch_core_hash_delete(switch_hash_t *hash, const char *key);
+void *switch_core_hash_find(switch_hash_t *hash, const char *key);
+switch_hash_index_t *switch_core_hash_first(switch_hash_t *hash);
+switch_hash_index_t *switch_core_hash_next(switch_hash_index_t **hi);
+void switch_core_hash_this(switch_hash_index_t *hi, const void **key, switch_size_t *klen, void **val);
+/* counters reported by the benchmark */
+typedef struct {
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+    uint64_t copies;
+    uint64_t copied_bytes;
+} stub_counters_t;
+extern stub_counters_t stub_counters;
+void *stub_malloc(size_t len);
+void *stub_calloc(size_t n, size_t len);
+char *stub_strdup(const char *s);
+void *stub_memcpy(void *dst, const void *src, size_t len);
+void *stub_memmove(void *dst, const void *src, size_t len);
+void stub_threads_enable(switch_bool_t on);
+extern char *(*stub_transcribe_hook)(const char *file, int verbose); // switch_curl.h
+#if !defined(__cplusplus) || defined(STUB_CXX_COPIES) // C++ only where no std headers follow (feed.cpp)
+#define memcpy(d, s, n) stub_memcpy(d, s, n)
+#define memmove(d, s, n) stub_memmove(d, s, n)
+#define strdup(s) stub_strdup(s)
+#endif
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,29 @@
+/**
+ * Bench stand-in for switch_curl.h, maps straight to libcurl.
+ * The buffered upload (a request with a file part, curl_transcribe()) doesn't go out: it is answered in
+ * stub_curl_easy_perform() by stub_transcribe_hook (replay) or a canned response, so it can be measured
+ * without the network. STUB_HTTP=1 sends it for real (tools/mock_whisper.py).
+ **/
+#ifndef STUB_SWITCH_CURL_H
+#define STUB_SWITCH_CURL_H
+#include <curl/curl.h>
+
+typedef struct curl_slist switch_curl_slist_t;
+typedef CURLcode switch_CURLcode;
+
+CURLcode stub_curl_easy_setopt(CURL *handle, CURLoption option, ...);
+CURLcode stub_curl_easy_perform(CURL *handle);
+CURLcode stub_curl_easy_getinfo(CURL *handle, CURLINFO info, ...);
+CURLcode stub_curl_mime_filedata(curl_mimepart *part, const char *filename);
+CURLcode stub_curl_mime_data(curl_mimepart *part, const char *data, size_t datasize);
+
+#define switch_curl_easy_init curl_easy_init
+#define switch_curl_easy_setopt stub_curl_easy_setopt
+#define switch_curl_easy_perform stub_curl_easy_perform
+#define switch_curl_easy_getinfo stub_curl_easy_getinfo
+#define switch_curl_easy_cleanup curl_easy_cleanup
+#define switch_curl_slist_append curl_slist_append
+#define switch_curl_slist_free_all curl_slist_free_all
+#define curl_mime_filedata stub_curl_mime_filedata
+#define curl_mime_data stub_curl_mime_data
+#endif
@@ -0,0 +1,42 @@
+/**
+ * Bench stand-in for switch_json.h (cJSON subset)
+ **/
+#ifndef STUB_SWITCH_JSON_H
+#define STUB_SWITCH_JSON_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define cJSON_False  0
+#define cJSON_True   1
+#define cJSON_NULL   2
+#define cJSON_Number 3
+#define cJSON_String 4
+#define cJSON_Array  5
+#define cJSON_Object 6
+
+typedef struct cJSON {
+    struct cJSON *next, *prev, *child;
+    int type;
+    char *valuestring;
+    int valueint;
+    double valuedouble;
+    char *string;
+} cJSON;
+
+cJSON *cJSON_Parse(const char *value);
+void cJSON_Delete(cJSON *c);
+cJSON *cJSON_GetObjectItem(const cJSON *object, const char *string);
+int cJSON_GetArraySize(const cJSON *array);
+cJSON *cJSON_GetArrayItem(const cJSON *array, int item);
+cJSON *cJSON_CreateObject(void);
+cJSON *cJSON_CreateString(const char *string);
+cJSON *cJSON_CreateNumber(double num);
+cJSON *cJSON_CreateNull(void);
+void cJSON_AddItemToObject(cJSON *object, const char *string, cJSON *item);
+char *cJSON_PrintUnformatted(cJSON *item);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
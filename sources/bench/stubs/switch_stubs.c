@@ -0,0 +1,1387 @@
+/**
+ * Bench stand-ins for the FreeSWITCH core API.
+ * Simplified on purpose: pools are lists of malloc'ed blocks, queues are mutex+cond rings,
+ * the VAD is a plain energy detector, events/xml/api registration do nothing.
+ **/
+#define _GNU_SOURCE
+#include <switch.h>
+#include <switch_json.h>
+#include <switch_curl.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <math.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#undef memcpy
+#undef memmove
+#undef strdup
+
+stub_counters_t stub_counters;
+char *(*stub_transcribe_hook)(const char *file, int verbose) = NULL;
+struct switch_directories SWITCH_GLOBAL_dirs = { "/tmp", "/tmp", "/tmp", "/tmp", "/tmp" };
+
+static switch_bool_t threads_enabled = SWITCH_TRUE;
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// counters
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+void *stub_malloc(size_t len) {
+    __atomic_add_fetch(&stub_counters.allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stub_counters.alloc_bytes, len, __ATOMIC_RELAXED);
+    return malloc(len);
+}
+
+void *stub_calloc(size_t n, size_t len) {
+    __atomic_add_fetch(&stub_counters.allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stub_counters.alloc_bytes, n * len, __ATOMIC_RELAXED);
+    return calloc(n, len);
+}
+
+char *stub_strdup(const char *s) {
+    size_t len = strlen(s) + 1;
+    char *p = stub_malloc(len);
+    memcpy(p, s, len);
+    return p;
+}
+
+void *stub_memcpy(void *dst, const void *src, size_t len) {
+    __atomic_add_fetch(&stub_counters.copies, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stub_counters.copied_bytes, len, __ATOMIC_RELAXED);
+    return memcpy(dst, src, len);
+}
+
+void *stub_memmove(void *dst, const void *src, size_t len) {
+    __atomic_add_fetch(&stub_counters.copies, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stub_counters.copied_bytes, len, __ATOMIC_RELAXED);
+    return memmove(dst, src, len);
+}
+
+void stub_threads_enable(switch_bool_t on) {
+    threads_enabled = on;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// log
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+static switch_log_level_t stub_log_level = SWITCH_LOG_WARNING;
+
+void switch_log_printf(int channel, const char *file, const char *func, int line, const char *userdata, switch_log_level_t level, const char *fmt, ...) {
+    va_list ap;
+
+    if(level > stub_log_level || getenv("STUB_LOG_QUIET")) {
+        return;
+    }
+    va_start(ap, fmt);
+    fprintf(stderr, "[%s] ", switch_log_level2str(level));
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+switch_log_level_t switch_log_str2level(const char *str) {
+    if(!strcasecmp(str, "debug")) return SWITCH_LOG_DEBUG;
+    if(!strcasecmp(str, "info")) return SWITCH_LOG_INFO;
+    if(!strcasecmp(str, "notice")) return SWITCH_LOG_NOTICE;
+    if(!strcasecmp(str, "warning")) return SWITCH_LOG_WARNING;
+    if(!strcasecmp(str, "err") || !strcasecmp(str, "error")) return SWITCH_LOG_ERROR;
+    if(!strcasecmp(str, "crit")) return SWITCH_LOG_CRIT;
+    if(!strcasecmp(str, "alert")) return SWITCH_LOG_ALERT;
+    return SWITCH_LOG_DEBUG;
+}
+
+const char *switch_log_level2str(switch_log_level_t level) {
+    switch(level) {
+        case SWITCH_LOG_DEBUG: return "DEBUG";
+        case SWITCH_LOG_INFO: return "INFO";
+        case SWITCH_LOG_NOTICE: return "NOTICE";
+        case SWITCH_LOG_WARNING: return "WARNING";
+        case SWITCH_LOG_ERROR: return "ERR";
+        case SWITCH_LOG_CRIT: return "CRIT";
+        case SWITCH_LOG_ALERT: return "ALERT";
+        default: return "CONSOLE";
+    }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// memory
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+typedef struct pool_block_s {
+    struct pool_block_s *next;
+} pool_block_t;
+
+struct switch_memory_pool {
+    pthread_mutex_t     mutex;
+    pool_block_t        *blocks;
+};
+
+switch_status_t switch_core_new_memory_pool(switch_memory_pool_t **pool) {
+    switch_memory_pool_t *p = stub_calloc(1, sizeof(*p));
+
+    pthread_mutex_init(&p->mutex, NULL);
+    *pool = p;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_core_destroy_memory_pool(switch_memory_pool_t **pool) {
+    pool_block_t *b = NULL, *n = NULL;
+
+    if(!pool || !*pool) {
+        return SWITCH_STATUS_FALSE;
+    }
+    for(b = (*pool)->blocks; b; b = n) {
+        n = b->next;
+        free(b);
+    }
+    pthread_mutex_destroy(&(*pool)->mutex);
+    free(*pool);
+    *pool = NULL;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void *switch_core_alloc(switch_memory_pool_t *pool, switch_size_t memory) {
+    pool_block_t *b = stub_calloc(1, sizeof(pool_block_t) + memory + 16);
+
+    pthread_mutex_lock(&pool->mutex);
+    b->next = pool->blocks;
+    pool->blocks = b;
+    pthread_mutex_unlock(&pool->mutex);
+
+    return (void *)(((uintptr_t)(b + 1) + 15) & ~(uintptr_t)15);
+}
+
+char *switch_core_strdup(switch_memory_pool_t *pool, const char *todup) {
+    size_t len = 0;
+    char *p = NULL;
+
+    if(!todup) {
+        return NULL;
+    }
+    len = strlen(todup) + 1;
+    p = switch_core_alloc(pool, len);
+    memcpy(p, todup, len);
+    return p;
+}
+
+char *switch_core_sprintf(switch_memory_pool_t *pool, const char *fmt, ...) {
+    va_list ap;
+    char *tmp = NULL, *res = NULL;
+
+    va_start(ap, fmt);
+    if(vasprintf(&tmp, fmt, ap) < 0) {
+        tmp = NULL;
+    }
+    va_end(ap);
+
+    if(tmp) {
+        res = switch_core_strdup(pool, tmp);
+        free(tmp);
+    }
+    return res;
+}
+
+void *switch_core_memory_pool_get_data(switch_memory_pool_t *pool, const char *key) {
+    return NULL;
+}
+
+char *switch_mprintf(const char *fmt, ...) {
+    va_list ap;
+    char *res = NULL;
+
+    va_start(ap, fmt);
+    if(vasprintf(&res, fmt, ap) < 0) {
+        res = NULL;
+    }
+    va_end(ap);
+
+    __atomic_add_fetch(&stub_counters.allocs, 1, __ATOMIC_RELAXED);
+    return res;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// strings
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+char *switch_string_replace(const char *string, const char *search, const char *replace) {
+    size_t slen = strlen(search), rlen = strlen(replace), n = 0;
+    const char *p = string, *q = NULL;
+    char *res = NULL, *w = NULL;
+
+    for(q = strstr(p, search); slen && q; q = strstr(q + slen, search)) { n++; }
+    res = malloc(strlen(string) + (n * rlen) + 1);
+    w = res;
+    while(slen && (q = strstr(p, search))) {
+        memcpy(w, p, q - p); w += q - p;
+        memcpy(w, replace, rlen); w += rlen;
+        p = q + slen;
+    }
+    strcpy(w, p);
+    return res;
+}
+
+switch_bool_t switch_true(const char *expr) {
+    if(!expr) {
+        return SWITCH_FALSE;
+    }
+    if(!strcasecmp(expr, "yes") || !strcasecmp(expr, "on") || !strcasecmp(expr, "true") || !strcasecmp(expr, "t") ||
+       !strcasecmp(expr, "enabled") || !strcasecmp(expr, "active") || !strcasecmp(expr, "allow")) {
+        return SWITCH_TRUE;
+    }
+    return (switch_is_number(expr) && atoi(expr) ? SWITCH_TRUE : SWITCH_FALSE);
+}
+
+switch_bool_t switch_is_number(const char *str) {
+    const char *p = str;
+
+    if(zstr(p)) {
+        return SWITCH_FALSE;
+    }
+    if(*p == '-' || *p == '+') { p++; }
+    for(; *p; p++) {
+        if(!isdigit((unsigned char)*p) && *p != '.') {
+            return SWITCH_FALSE;
+        }
+    }
+    return SWITCH_TRUE;
+}
+
+int switch_separate_string(char *buf, char delim, char **array, unsigned int arraylen) {
+    unsigned int argc = 0;
+    char *p = buf;
+
+    if(!buf || !array || !arraylen) {
+        return 0;
+    }
+    while(*p && argc < arraylen) {
+        while(*p == delim) { p++; }
+        if(!*p) {
+            break;
+        }
+        array[argc++] = p;
+        if(argc == arraylen) {
+            break;
+        }
+        while(*p && *p != delim) { p++; }
+        if(*p) { *p++ = '\0'; }
+    }
+    return argc;
+}
+
+char *switch_copy_string(char *dst, const char *src, switch_size_t dst_size) {
+    if(!dst_size) {
+        return dst;
+    }
+    snprintf(dst, dst_size, "%s", src ? src : "");
+    return dst;
+}
+
+char *switch_strip_whitespace(const char *str) {
+    const char *s = str;
+    char *res = NULL;
+    size_t len = 0;
+
+    while(*s && isspace((unsigned char)*s)) { s++; }
+    res = strdup(s);
+    len = strlen(res);
+    while(len && isspace((unsigned char)res[len - 1])) { res[--len] = '\0'; }
+    return res;
+}
+
+switch_size_t switch_b64_encode(unsigned char *in, switch_size_t ilen, unsigned char *out, switch_size_t olen) {
+    static const char c64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    switch_size_t i = 0, o = 0;
+
+    for(i = 0; i + 2 < ilen && o + 4 < olen; i += 3) {
+        uint32_t v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+        out[o++] = c64[(v >> 18) & 63]; out[o++] = c64[(v >> 12) & 63];
+        out[o++] = c64[(v >> 6) & 63]; out[o++] = c64[v & 63];
+    }
+    if(i < ilen && o + 4 < olen) {
+        uint32_t v = in[i] << 16;
+        if(i + 1 < ilen) { v |= in[i + 1] << 8; }
+        out[o++] = c64[(v >> 18) & 63]; out[o++] = c64[(v >> 12) & 63];
+        out[o++] = (i + 1 < ilen ? c64[(v >> 6) & 63] : '=');
+        out[o++] = '=';
+    }
+    if(o < olen) { out[o] = '\0'; }
+    return o;
+}
+
+switch_size_t switch_b64_decode(const char *in, char *out, switch_size_t olen) {
+    uint32_t acc = 0, bits = 0;
+    switch_size_t o = 0;
+
+    for(; *in && *in != '='; in++) {
+        const char c = *in;
+        int v = (c >= 'A' && c <= 'Z') ? c - 'A' : (c >= 'a' && c <= 'z') ? c - 'a' + 26 : (c >= '0' && c <= '9') ? c - '0' + 52 : (c == '+') ? 62 : (c == '/') ? 63 : -1;
+        if(v < 0) { continue; }
+        acc = (acc << 6) | v; bits += 6;
+        if(bits >= 8) {
+            bits -= 8;
+            if(o < olen) { out[o++] = (char)((acc >> bits) & 0xff); }
+        }
+    }
+    return o;
+}
+
+void switch_uuid_str(char *buf, switch_size_t len) {
+    static uint64_t counter = 0;
+    uint64_t seed = (uint64_t)switch_micro_time_now() ^ (__atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED) * 0x9e3779b97f4a7c15ULL);
+    uint8_t b[16];
+
+    for(int i = 0; i < 16; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        b[i] = (uint8_t)(seed >> 56);
+    }
+    snprintf(buf, len, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+             b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// threads / time / atomics
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+struct switch_mutex { pthread_mutex_t m; };
+struct switch_thread_cond { pthread_cond_t c; };
+struct switch_threadattr { int detach; };
+struct switch_thread { pthread_t t; switch_thread_start_t func; void *data; };
+
+switch_status_t switch_mutex_init(switch_mutex_t **lock, unsigned int flags, switch_memory_pool_t *pool) {
+    pthread_mutexattr_t attr;
+    switch_mutex_t *m = switch_core_alloc(pool, sizeof(*m));
+
+    pthread_mutexattr_init(&attr);
+    if(flags & SWITCH_MUTEX_NESTED) {
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    }
+    pthread_mutex_init(&m->m, &attr);
+    pthread_mutexattr_destroy(&attr);
+    *lock = m;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_mutex_lock(switch_mutex_t *lock) { pthread_mutex_lock(&lock->m); return SWITCH_STATUS_SUCCESS; }
+switch_status_t switch_mutex_unlock(switch_mutex_t *lock) { pthread_mutex_unlock(&lock->m); return SWITCH_STATUS_SUCCESS; }
+switch_status_t switch_mutex_trylock(switch_mutex_t *lock) { return (pthread_mutex_trylock(&lock->m) == 0 ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_FALSE); }
+switch_status_t switch_mutex_destroy(switch_mutex_t *lock) { pthread_mutex_destroy(&lock->m); return SWITCH_STATUS_SUCCESS; }
+
+switch_status_t switch_thread_cond_create(switch_thread_cond_t **cond, switch_memory_pool_t *pool) {
+    switch_thread_cond_t *c = switch_core_alloc(pool, sizeof(*c));
+    pthread_cond_init(&c->c, NULL);
+    *cond = c;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_cond_wait(switch_thread_cond_t *cond, switch_mutex_t *mutex) {
+    pthread_cond_wait(&cond->c, &mutex->m);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_thread_cond_timedwait(switch_thread_cond_t *cond, switch_mutex_t *mutex, switch_interval_time_t timeout) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout / 1000000;
+    ts.tv_nsec += (timeout % 1000000) * 1000;
+    if(ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+
+    return (pthread_cond_timedwait(&cond->c, &mutex->m, &ts) == ETIMEDOUT ? SWITCH_STATUS_TIMEOUT : SWITCH_STATUS_SUCCESS);
+}
+
+switch_status_t switch_thread_cond_signal(switch_thread_cond_t *cond) { pthread_cond_signal(&cond->c); return SWITCH_STATUS_SUCCESS; }
+switch_status_t switch_thread_cond_broadcast(switch_thread_cond_t *cond) { pthread_cond_broadcast(&cond->c); return SWITCH_STATUS_SUCCESS; }
+
+switch_status_t switch_threadattr_create(switch_threadattr_t **new_attr, switch_memory_pool_t *pool) {
+    *new_attr = switch_core_alloc(pool, sizeof(switch_threadattr_t));
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_threadattr_detach_set(switch_threadattr_t *attr, int32_t on) { attr->detach = on; return SWITCH_STATUS_SUCCESS; }
+switch_status_t switch_threadattr_stacksize_set(switch_threadattr_t *attr, switch_size_t stacksize) { return SWITCH_STATUS_SUCCESS; }
+
+static void *stub_thread_main(void *arg) {
+    switch_thread_t *th = (switch_thread_t *)arg;
+    switch_thread_start_t func = th->func;
+    void *data = th->data;
+
+    free(th);
+    return func(NULL, data);
+}
+
+switch_status_t switch_thread_create(switch_thread_t **new_thread, switch_threadattr_t *attr, switch_thread_start_t func, void *data, switch_memory_pool_t *cont) {
+    switch_thread_t *th = NULL;
+    pthread_t tid;
+
+    if(!threads_enabled) {
+        // the benchmark drives the worker side itself, the caller's bookkeeping is undone by thread_finished()
+        *new_thread = NULL;
+        return SWITCH_STATUS_FALSE;
+    }
+
+    th = calloc(1, sizeof(*th));
+    th->func = func;
+    th->data = data;
+    // th belongs to the new thread from here on
+    if(pthread_create(&tid, NULL, stub_thread_main, th) != 0) {
+        free(th);
+        return SWITCH_STATUS_FALSE;
+    }
+    pthread_detach(tid);
+    *new_thread = NULL;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void switch_yield(int us) {
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+switch_time_t switch_micro_time_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((switch_time_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+switch_time_t switch_time_now(void) {
+    return switch_micro_time_now();
+}
+
+switch_time_t switch_epoch_time_now(switch_time_t *t) {
+    switch_time_t now = (switch_time_t)time(NULL);
+    if(t) { *t = now; }
+    return now;
+}
+
+void switch_atomic_set(volatile switch_atomic_t *mem, uint32_t val) { __atomic_store_n(mem, val, __ATOMIC_SEQ_CST); }
+uint32_t switch_atomic_read(volatile switch_atomic_t *mem) { return __atomic_load_n(mem, __ATOMIC_SEQ_CST); }
+void switch_atomic_add(volatile switch_atomic_t *mem, uint32_t val) { __atomic_add_fetch(mem, val, __ATOMIC_SEQ_CST); }
+void switch_atomic_inc(volatile switch_atomic_t *mem) { __atomic_add_fetch(mem, 1, __ATOMIC_SEQ_CST); }
+int switch_atomic_dec(volatile switch_atomic_t *mem) { return __atomic_sub_fetch(mem, 1, __ATOMIC_SEQ_CST); }
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// queue
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+struct switch_queue {
+    pthread_mutex_t     mutex;
+    pthread_cond_t      not_empty;
+    void                **data;
+    unsigned int        size;
+    unsigned int        head;
+    unsigned int        count;
+    int                 term;
+};
+
+switch_status_t switch_queue_create(switch_queue_t **queue, unsigned int queue_capacity, switch_memory_pool_t *pool) {
+    switch_queue_t *q = switch_core_alloc(pool, sizeof(*q));
+
+    q->data = switch_core_alloc(pool, sizeof(void *) * queue_capacity);
+    q->size = queue_capacity;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    *queue = q;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_queue_trypush(switch_queue_t *queue, void *data) {
+    switch_status_t status = SWITCH_STATUS_FALSE;
+
+    pthread_mutex_lock(&queue->mutex);
+    if(!queue->term && queue->count < queue->size) {
+        queue->data[(queue->head + queue->count) % queue->size] = data;
+        queue->count++;
+        pthread_cond_signal(&queue->not_empty);
+        status = SWITCH_STATUS_SUCCESS;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return status;
+}
+
+switch_status_t switch_queue_push(switch_queue_t *queue, void *data) {
+    while(switch_queue_trypush(queue, data) != SWITCH_STATUS_SUCCESS) {
+        if(queue->term) {
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_yield(1000);
+    }
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_status_t queue_pop(switch_queue_t *queue, void **data, int64_t timeout) {
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+
+    pthread_mutex_lock(&queue->mutex);
+    if(queue->count == 0 && timeout != 0 && !queue->term) {
+        if(timeout < 0) {
+            pthread_cond_wait(&queue->not_empty, &queue->mutex);
+        } else {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += timeout / 1000000;
+            ts.tv_nsec += (timeout % 1000000) * 1000;
+            if(ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+            pthread_cond_timedwait(&queue->not_empty, &queue->mutex, &ts);
+        }
+    }
+    if(queue->count > 0) {
+        *data = queue->data[queue->head];
+        queue->head = (queue->head + 1) % queue->size;
+        queue->count--;
+    } else {
+        status = (timeout == 0 ? SWITCH_STATUS_FALSE : SWITCH_STATUS_TIMEOUT);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return status;
+}
+
+switch_status_t switch_queue_pop(switch_queue_t *queue, void **data) { return queue_pop(queue, data, -1); }
+switch_status_t switch_queue_trypop(switch_queue_t *queue, void **data) { return queue_pop(queue, data, 0); }
+switch_status_t switch_queue_pop_timeout(switch_queue_t *queue, void **data, switch_interval_time_t timeout) { return queue_pop(queue, data, timeout > 0 ? timeout : 1); }
+
+unsigned int switch_queue_size(switch_queue_t *queue) {
+    return __atomic_load_n(&queue->count, __ATOMIC_RELAXED);
+}
+
+switch_status_t switch_queue_term(switch_queue_t *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    queue->term = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// buffer
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+struct switch_buffer {
+    uint8_t             *data;
+    switch_size_t       head;
+    switch_size_t       used;
+    switch_size_t       size;
+    switch_size_t       max_len;
+    switch_size_t       blocksize;
+    int                 dynamic;
+};
+
+switch_status_t switch_buffer_create(switch_memory_pool_t *pool, switch_buffer_t **buffer, switch_size_t max_len) {
+    switch_buffer_t *b = switch_core_alloc(pool, sizeof(*b));
+
+    b->data = switch_core_alloc(pool, max_len);
+    b->size = max_len;
+    b->max_len = max_len;
+    *buffer = b;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_buffer_create_dynamic(switch_buffer_t **buffer, switch_size_t blocksize, switch_size_t start_len, switch_size_t max_len) {
+    switch_buffer_t *b = stub_calloc(1, sizeof(*b));
+
+    b->data = stub_malloc(start_len);
+    b->size = start_len;
+    b->blocksize = blocksize;
+    b->max_len = max_len;
+    b->dynamic = 1;
+    *buffer = b;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_size_t switch_buffer_write(switch_buffer_t *buffer, const void *data, switch_size_t datalen) {
+    if(buffer->head + buffer->used + datalen > buffer->size) {
+        if(buffer->head) {
+            memmove(buffer->data, buffer->data + buffer->head, buffer->used);
+            buffer->head = 0;
+        }
+        if(buffer->used + datalen > buffer->size) {
+            switch_size_t nsize = buffer->size;
+            if(!buffer->dynamic || (buffer->max_len && buffer->used + datalen > buffer->max_len)) {
+                return 0;
+            }
+            while(nsize < buffer->used + datalen) { nsize += (buffer->blocksize ? buffer->blocksize : 1024); }
+            buffer->data = realloc(buffer->data, nsize);
+            buffer->size = nsize;
+        }
+    }
+    stub_memcpy(buffer->data + buffer->head + buffer->used, data, datalen);
+    buffer->used += datalen;
+    return buffer->used;
+}
+
+switch_size_t switch_buffer_read(switch_buffer_t *buffer, void *data, switch_size_t datalen) {
+    switch_size_t n = (datalen < buffer->used ? datalen : buffer->used);
+
+    memcpy(data, buffer->data + buffer->head, n);
+    buffer->head += n;
+    buffer->used -= n;
+    if(!buffer->used) { buffer->head = 0; }
+    return n;
+}
+
+switch_size_t switch_buffer_peek_zerocopy(switch_buffer_t *buffer, const void **ptr) {
+    *ptr = buffer->data + buffer->head;
+    return buffer->used;
+}
+
+switch_size_t switch_buffer_inuse(switch_buffer_t *buffer) { return buffer->used; }
+switch_size_t switch_buffer_freespace(switch_buffer_t *buffer) { return buffer->size - buffer->used; }
+
+switch_size_t switch_buffer_toss(switch_buffer_t *buffer, switch_size_t datalen) {
+    switch_size_t n = (datalen < buffer->used ? datalen : buffer->used);
+
+    buffer->head += n;
+    buffer->used -= n;
+    if(!buffer->used) { buffer->head = 0; }
+    return buffer->used;
+}
+
+void switch_buffer_zero(switch_buffer_t *buffer) {
+    buffer->head = 0;
+    buffer->used = 0;
+}
+
+void switch_buffer_destroy(switch_buffer_t **buffer) {
+    if(buffer && *buffer) {
+        if((*buffer)->dynamic) {
+            free((*buffer)->data);
+            free(*buffer);
+        }
+        *buffer = NULL;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// vad: energy detector with the same state machine as switch_vad
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+struct switch_vad_s {
+    int                 rate;
+    int                 thresh;
+    int                 voice_ms;
+    int                 silence_ms;
+    int                 voice_acc;
+    int                 silence_acc;
+    switch_vad_state_t  state;
+};
+
+switch_vad_t *switch_vad_init(int sample_rate, int channels) {
+    switch_vad_t *vad = stub_calloc(1, sizeof(*vad));
+
+    vad->rate = sample_rate;
+    vad->thresh = 100;
+    vad->voice_ms = 200;
+    vad->silence_ms = 500;
+    return vad;
+}
+
+int switch_vad_set_mode(switch_vad_t *vad, int mode) { return 0; }
+
+void switch_vad_set_param(switch_vad_t *vad, const char *key, int val) {
+    if(!strcmp(key, "thresh")) { vad->thresh = val; }
+    else if(!strcmp(key, "voice_ms")) { vad->voice_ms = val; }
+    else if(!strcmp(key, "silence_ms")) { vad->silence_ms = val; }
+}
+
+switch_vad_state_t switch_vad_process(switch_vad_t *vad, int16_t *data, unsigned int samples) {
+    uint64_t energy = 0;
+    int frame_ms = (samples * 1000) / (vad->rate ? vad->rate : 8000);
+    int voiced = 0;
+
+    for(unsigned int i = 0; i < samples; i++) {
+        energy += abs(data[i]);
+    }
+    voiced = (samples && (energy / samples) >= (uint64_t)vad->thresh);
+
+    if(vad->state == SWITCH_VAD_STATE_START_TALKING) { vad->state = SWITCH_VAD_STATE_TALKING; }
+    if(vad->state == SWITCH_VAD_STATE_STOP_TALKING) { vad->state = SWITCH_VAD_STATE_NONE; }
+
+    if(voiced) {
+        vad->silence_acc = 0;
+        vad->voice_acc += frame_ms;
+        if(vad->state == SWITCH_VAD_STATE_NONE && vad->voice_acc >= vad->voice_ms) {
+            vad->state = SWITCH_VAD_STATE_START_TALKING;
+        }
+    } else {
+        vad->voice_acc = 0;
+        vad->silence_acc += frame_ms;
+        if(vad->state == SWITCH_VAD_STATE_TALKING && vad->silence_acc >= vad->silence_ms) {
+            vad->state = SWITCH_VAD_STATE_STOP_TALKING;
+        }
+    }
+    return vad->state;
+}
+
+switch_vad_state_t switch_vad_get_state(switch_vad_t *vad) { return vad->state; }
+
+void switch_vad_reset(switch_vad_t *vad) {
+    vad->state = SWITCH_VAD_STATE_NONE;
+    vad->voice_acc = 0;
+    vad->silence_acc = 0;
+}
+
+void switch_vad_destroy(switch_vad_t **vad) {
+    if(vad && *vad) {
+        free(*vad);
+        *vad = NULL;
+    }
+}
+
+const char *switch_vad_state2str(switch_vad_state_t state) {
+    switch(state) {
+        case SWITCH_VAD_STATE_START_TALKING: return "START_TALKING";
+        case SWITCH_VAD_STATE_TALKING: return "TALKING";
+        case SWITCH_VAD_STATE_STOP_TALKING: return "STOP_TALKING";
+        case SWITCH_VAD_STATE_ERROR: return "ERROR";
+        default: return "NONE";
+    }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// session / channel: there are no sessions outside of FreeSWITCH
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+switch_channel_t *switch_core_session_get_channel(switch_core_session_t *session) { return NULL; }
+char *switch_core_session_get_uuid(switch_core_session_t *session) { return ""; }
+void switch_channel_set_flag(switch_channel_t *channel, switch_channel_flag_t flag) { }
+switch_status_t switch_channel_set_variable(switch_channel_t *channel, const char *varname, const char *value) { return SWITCH_STATUS_SUCCESS; }
+const char *switch_channel_get_variable(switch_channel_t *channel, const char *varname) { return NULL; }
+switch_core_session_t *switch_core_session_locate(const char *uuid) { return NULL; }
+void switch_core_session_rwunlock(switch_core_session_t *session) { }
+switch_status_t switch_core_session_wake_session_thread(switch_core_session_t *session) { return SWITCH_STATUS_SUCCESS; }
+switch_status_t switch_core_session_queue_event(switch_core_session_t *session, void **event) { return SWITCH_STATUS_FALSE; }
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// files: switch_core_file_* writes raw samples, no container
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+/**
+ ** written as a wav file (L16), the header is filled in on close
+ **/
+switch_status_t switch_core_file_open(switch_file_handle_t *fh, const char *file_path, uint32_t channels, uint32_t rate, unsigned int flags, switch_memory_pool_t *pool) {
+    static const uint8_t hdr[44] = { 0 };
+    FILE *fp = fopen(file_path, (flags & SWITCH_FILE_FLAG_WRITE) ? "wb" : "rb");
+
+    if(!fp) {
+        return SWITCH_STATUS_FALSE;
+    }
+    if(flags & SWITCH_FILE_FLAG_WRITE) {
+        fwrite(hdr, sizeof(hdr), 1, fp);
+    }
+    fh->private_info = fp;
+    fh->samplerate = rate;
+    fh->channels = channels;
+    fh->flags = flags;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_core_file_write(switch_file_handle_t *fh, void *data, switch_size_t *len) {
+    *len = fwrite(data, sizeof(int16_t), *len, (FILE *)fh->private_info);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_core_file_close(switch_file_handle_t *fh) {
+    FILE *fp = (FILE *)fh->private_info;
+
+    if(fp && (fh->flags & SWITCH_FILE_FLAG_WRITE)) {
+        long pos = ftell(fp);
+        uint32_t data_len = (uint32_t)(pos > 44 ? pos - 44 : 0), riff_len = data_len + 36, fmt_len = 16;
+        uint32_t rate = fh->samplerate, byte_rate = fh->samplerate * fh->channels * 2;
+        uint16_t fmt = 1, channels = fh->channels, align = fh->channels * 2, bits = 16;
+
+        fseek(fp, 0, SEEK_SET);
+        fwrite("RIFF", 4, 1, fp); fwrite(&riff_len, 4, 1, fp); fwrite("WAVEfmt ", 8, 1, fp); fwrite(&fmt_len, 4, 1, fp);
+        fwrite(&fmt, 2, 1, fp); fwrite(&channels, 2, 1, fp); fwrite(&rate, 4, 1, fp); fwrite(&byte_rate, 4, 1, fp);
+        fwrite(&align, 2, 1, fp); fwrite(&bits, 2, 1, fp); fwrite("data", 4, 1, fp); fwrite(&data_len, 4, 1, fp);
+    }
+    if(fp) {
+        fclose(fp);
+        fh->private_info = NULL;
+    }
+    return SWITCH_STATUS_SUCCESS;
+}
+
+struct switch_file { FILE *fp; };
+
+switch_status_t switch_file_open(switch_file_t **newf, const char *fname, int32_t flag, int32_t perm, switch_memory_pool_t *pool) {
+    const char *mode = (flag & SWITCH_FOPEN_APPEND) ? "ab" : (flag & SWITCH_FOPEN_WRITE) ? ((flag & SWITCH_FOPEN_READ) ? "w+b" : "wb") : "rb";
+    FILE *fp = fopen(fname, mode);
+    switch_file_t *f = NULL;
+
+    if(!fp) {
+        return SWITCH_STATUS_FALSE;
+    }
+    f = switch_core_alloc(pool, sizeof(*f));
+    f->fp = fp;
+    *newf = f;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_file_write(switch_file_t *thefile, const void *buf, switch_size_t *nbytes) {
+    *nbytes = fwrite(buf, 1, *nbytes, thefile->fp);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_file_read(switch_file_t *thefile, void *buf, switch_size_t *nbytes) {
+    *nbytes = fread(buf, 1, *nbytes, thefile->fp);
+    return (*nbytes ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_FALSE);
+}
+
+switch_status_t switch_file_close(switch_file_t *thefile) {
+    fclose(thefile->fp);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_dir_make_recursive(const char *path, int32_t perm, switch_memory_pool_t *pool) {
+    char tmp[1024];
+
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for(char *p = tmp + 1; *p; p++) {
+        if(*p == '/') { *p = '\0'; mkdir(tmp, 0755); *p = '/'; }
+    }
+    return ((mkdir(tmp, 0755) == 0 || errno == EEXIST) ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_FALSE);
+}
+
+switch_bool_t switch_directory_exists(const char *dirname, switch_memory_pool_t *pool) {
+    struct stat st;
+    return (stat(dirname, &st) == 0 && S_ISDIR(st.st_mode)) ? SWITCH_TRUE : SWITCH_FALSE;
+}
+
+struct switch_dir { DIR *d; };
+
+switch_status_t switch_dir_open(switch_dir_t **new_dir, const char *dirname, switch_memory_pool_t *pool) {
+    DIR *d = opendir(dirname);
+
+    if(!d) {
+        return SWITCH_STATUS_FALSE;
+    }
+    *new_dir = switch_core_alloc(pool, sizeof(switch_dir_t));
+    (*new_dir)->d = d;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_dir_close(switch_dir_t *thedir) {
+    closedir(thedir->d);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+const char *switch_dir_next_file(switch_dir_t *thedir, char *buf, switch_size_t len) {
+    struct dirent *de = NULL;
+
+    while((de = readdir(thedir->d)) != NULL) {
+        if(de->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(buf, len, "%s", de->d_name);
+        return buf;
+    }
+    return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// xml / events / modules / hash: registration only
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+switch_xml_t switch_xml_open_cfg(const char *file_path, switch_xml_t *node, void *params) { return NULL; }
+switch_xml_t switch_xml_child(switch_xml_t xml, const char *name) { return NULL; }
+const char *switch_xml_attr_soft(switch_xml_t xml, const char *attr) { return ""; }
+const char *switch_xml_attr(switch_xml_t xml, const char *attr) { return NULL; }
+const char *switch_xml_txt(switch_xml_t xml) { return ""; }
+switch_xml_t switch_xml_parse_str_dynamic(char *s, switch_bool_t dup) { return NULL; }
+void switch_xml_free(switch_xml_t xml) { }
+
+uint64_t stub_events_fired = 0;
+
+switch_status_t switch_event_create_subclass(switch_event_t **event, switch_event_types_t event_id, const char *subclass_name) {
+    *event = stub_calloc(1, sizeof(switch_event_t));
+    (*event)->event_id = event_id;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_event_add_header(switch_event_t *event, switch_stack_t stack, const char *header_name, const char *fmt, ...) { return SWITCH_STATUS_SUCCESS; }
+switch_status_t switch_event_add_header_string(switch_event_t *event, switch_stack_t stack, const char *header_name, const char *data) { return SWITCH_STATUS_SUCCESS; }
+switch_status_t switch_event_add_body(switch_event_t *event, const char *fmt, ...) { return SWITCH_STATUS_SUCCESS; }
+
+switch_status_t switch_event_fire(switch_event_t **event) {
+    __atomic_add_fetch(&stub_events_fired, 1, __ATOMIC_RELAXED);
+    switch_event_destroy(event);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void switch_event_destroy(switch_event_t **event) {
+    if(event && *event) {
+        free(*event);
+        *event = NULL;
+    }
+}
+
+#undef switch_event_reserve_subclass
+#undef switch_event_free_subclass
+switch_status_t switch_event_reserve_subclass(const char *owner, const char *subclass_name) { return SWITCH_STATUS_SUCCESS; }
+switch_status_t switch_event_free_subclass(const char *owner, const char *subclass_name) { return SWITCH_STATUS_SUCCESS; }
+switch_status_t switch_event_bind_removable(const char *id, switch_event_types_t event, const char *subclass_name, switch_event_callback_t callback, void *user_data, switch_event_node_t **node) { return SWITCH_STATUS_SUCCESS; }
+switch_status_t switch_event_unbind(switch_event_node_t **node) { return SWITCH_STATUS_SUCCESS; }
+switch_status_t switch_event_unbind_callback(switch_event_callback_t callback) { return SWITCH_STATUS_SUCCESS; }
+switch_status_t switch_event_bind(const char *id, switch_event_types_t event, const char *subclass_name, switch_event_callback_t callback, void *user_data) { return SWITCH_STATUS_SUCCESS; }
+
+struct switch_loadable_module_interface { int dummy; };
+static struct switch_loadable_module_interface stub_module;
+static char stub_interface[4096];
+
+switch_loadable_module_interface_t *switch_loadable_module_create_module_interface(switch_memory_pool_t *pool, const char *name) { return &stub_module; }
+void *switch_loadable_module_create_interface(switch_loadable_module_interface_t *mod, switch_module_interface_name_t iname) { return stub_interface; }
+void switch_console_set_complete(const char *s) { }
+
+typedef struct hash_entry_s {
+    struct hash_entry_s *next;
+    char *key;
+    void *val;
+} hash_entry_t;
+struct switch_hash { hash_entry_t *head; };
+struct switch_hashtable_iterator { hash_entry_t *cur; };
+
+switch_status_t switch_core_hash_init(switch_hash_t **hash) { *hash = stub_calloc(1, sizeof(switch_hash_t)); return SWITCH_STATUS_SUCCESS; }
+
+switch_status_t switch_core_hash_destroy(switch_hash_t **hash) {
+    hash_entry_t *e = NULL, *n = NULL;
+
+    for(e = (*hash)->head; e; e = n) { n = e->next; free(e->key); free(e); }
+    free(*hash);
+    *hash = NULL;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_core_hash_insert(switch_hash_t *hash, const char *key, const void *data) {
+    hash_entry_t *e = NULL;
+
+    for(e = hash->head; e; e = e->next) {
+        if(!strcmp(e->key, key)) { e->val = (void *)data; return SWITCH_STATUS_SUCCESS; }
+    }
+    e = stub_calloc(1, sizeof(*e));
+    e->key = strdup(key);
+    e->val = (void *)data;
+    e->next = hash->head;
+    hash->head = e;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void *switch_core_hash_delete(switch_hash_t *hash, const char *key) {
+    hash_entry_t *e = NULL, *prev = NULL;
+
+    for(e = hash->head; e; prev = e, e = e->next) {
+        if(!strcmp(e->key, key)) {
+            void *val = e->val;
+            if(prev) { prev->next = e->next; } else { hash->head = e->next; }
+            free(e->key); free(e);
+            return val;
+        }
+    }
+    return NULL;
+}
+
+void *switch_core_hash_find(switch_hash_t *hash, const char *key) {
+    for(hash_entry_t *e = hash->head; e; e = e->next) {
+        if(!strcmp(e->key, key)) { return e->val; }
+    }
+    return NULL;
+}
+
+switch_hash_index_t *switch_core_hash_first(switch_hash_t *hash) {
+    switch_hash_index_t *hi = NULL;
+
+    if(!hash->head) {
+        return NULL;
+    }
+    hi = stub_calloc(1, sizeof(*hi));
+    hi->cur = hash->head;
+    return hi;
+}
+
+switch_hash_index_t *switch_core_hash_next(switch_hash_index_t **hi) {
+    if(!(*hi)->cur->next) {
+        free(*hi);
+        *hi = NULL;
+        return NULL;
+    }
+    (*hi)->cur = (*hi)->cur->next;
+    return *hi;
+}
+
+void switch_core_hash_this(switch_hash_index_t *hi, const void **key, switch_size_t *klen, void **val) {
+    if(key) { *key = hi->cur->key; }
+    if(klen) { *klen = strlen(hi->cur->key); }
+    if(val) { *val = hi->cur->val; }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// cJSON subset: enough to read the API responses and build the realtime session
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+static const char *json_ws(const char *p) {
+    while(*p && isspace((unsigned char)*p)) { p++; }
+    return p;
+}
+
+static const char *json_value(cJSON *item, const char *p);
+
+static const char *json_string(char **out, const char *p) {
+    size_t cap = 16, len = 0;
+    char *s = NULL;
+
+    if(*p != '"') {
+        return NULL;
+    }
+    s = malloc(cap);
+    for(p++; *p && *p != '"'; p++) {
+        unsigned int c = (unsigned char)*p;
+        if(c == '\\') {
+            p++;
+            switch(*p) {
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'u': {
+                    unsigned int cp = 0;
+                    if(sscanf(p + 1, "%4x", &cp) != 1) { free(s); return NULL; }
+                    p += 4;
+                    if(len + 4 >= cap) { cap = (cap * 2) + 4; s = realloc(s, cap); }
+                    if(cp < 0x80) { s[len++] = (char)cp; }
+                    else if(cp < 0x800) { s[len++] = (char)(0xc0 | (cp >> 6)); s[len++] = (char)(0x80 | (cp & 0x3f)); }
+                    else { s[len++] = (char)(0xe0 | (cp >> 12)); s[len++] = (char)(0x80 | ((cp >> 6) & 0x3f)); s[len++] = (char)(0x80 | (cp & 0x3f)); }
+                    continue;
+                }
+                default: c = (unsigned char)*p;
+            }
+        }
+        if(len + 1 >= cap) { cap *= 2; s = realloc(s, cap); }
+        s[len++] = (char)c;
+    }
+    if(*p != '"') {
+        free(s);
+        return NULL;
+    }
+    s[len] = '\0';
+    *out = s;
+    return p + 1;
+}
+
+static const char *json_container(cJSON *item, const char *p, char close) {
+    cJSON *prev = NULL;
+
+    item->type = (close == '}' ? cJSON_Object : cJSON_Array);
+    p = json_ws(p + 1);
+    if(*p == close) {
+        return p + 1;
+    }
+    while(p && *p) {
+        cJSON *child = calloc(1, sizeof(cJSON));
+        if(prev) { prev->next = child; child->prev = prev; } else { item->child = child; }
+        prev = child;
+        if(close == '}') {
+            if(!(p = json_string(&child->string, json_ws(p)))) { return NULL; }
+            p = json_ws(p);
+            if(*p != ':') { return NULL; }
+            p++;
+        }
+        if(!(p = json_value(child, json_ws(p)))) {
+            return NULL;
+        }
+        p = json_ws(p);
+        if(*p == ',') { p++; continue; }
+        if(*p == close) { return p + 1; }
+        return NULL;
+    }
+    return NULL;
+}
+
+static const char *json_value(cJSON *item, const char *p) {
+    if(*p == '"') { item->type = cJSON_String; return json_string(&item->valuestring, p); }
+    if(*p == '{') { return json_container(item, p, '}'); }
+    if(*p == '[') { return json_container(item, p, ']'); }
+    if(!strncmp(p, "true", 4)) { item->type = cJSON_True; item->valueint = 1; return p + 4; }
+    if(!strncmp(p, "false", 5)) { item->type = cJSON_False; return p + 5; }
+    if(!strncmp(p, "null", 4)) { item->type = cJSON_NULL; return p + 4; }
+    if(*p == '-' || isdigit((unsigned char)*p)) {
+        char *end = NULL;
+        item->type = cJSON_Number;
+        item->valuedouble = strtod(p, &end);
+        item->valueint = (int)item->valuedouble;
+        return end;
+    }
+    return NULL;
+}
+
+cJSON *cJSON_Parse(const char *value) {
+    cJSON *item = NULL;
+
+    if(!value) {
+        return NULL;
+    }
+    item = calloc(1, sizeof(cJSON));
+    if(!json_value(item, json_ws(value))) {
+        cJSON_Delete(item);
+        return NULL;
+    }
+    return item;
+}
+
+void cJSON_Delete(cJSON *c) {
+    cJSON *n = NULL;
+
+    for(; c; c = n) {
+        n = c->next;
+        cJSON_Delete(c->child);
+        free(c->valuestring);
+        free(c->string);
+        free(c);
+    }
+}
+
+cJSON *cJSON_GetObjectItem(const cJSON *object, const char *string) {
+    for(cJSON *c = (object ? object->child : NULL); c; c = c->next) {
+        if(c->string && !strcasecmp(c->string, string)) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+int cJSON_GetArraySize(const cJSON *array) {
+    int n = 0;
+    for(cJSON *c = (array ? array->child : NULL); c; c = c->next) { n++; }
+    return n;
+}
+
+cJSON *cJSON_GetArrayItem(const cJSON *array, int item) {
+    cJSON *c = (array ? array->child : NULL);
+    while(c && item-- > 0) { c = c->next; }
+    return c;
+}
+
+static cJSON *json_new(int type) {
+    cJSON *item = calloc(1, sizeof(cJSON));
+    item->type = type;
+    return item;
+}
+
+cJSON *cJSON_CreateObject(void) {
+    return json_new(cJSON_Object);
+}
+
+cJSON *cJSON_CreateString(const char *string) {
+    cJSON *item = json_new(cJSON_String);
+    item->valuestring = strdup(string);
+    return item;
+}
+
+cJSON *cJSON_CreateNumber(double num) {
+    cJSON *item = json_new(cJSON_Number);
+    item->valuedouble = num;
+    item->valueint = (int)num;
+    return item;
+}
+
+cJSON *cJSON_CreateNull(void) {
+    return json_new(cJSON_NULL);
+}
+
+void cJSON_AddItemToObject(cJSON *object, const char *string, cJSON *item) {
+    cJSON *c = object->child;
+
+    item->string = strdup(string);
+    if(!c) {
+        object->child = item;
+        return;
+    }
+    while(c->next) { c = c->next; }
+    c->next = item;
+    item->prev = c;
+}
+
+static void json_print_string(switch_buffer_t *out, const char *s) {
+    switch_buffer_write(out, "\"", 1);
+    for(; *s; s++) {
+        unsigned char c = *s;
+        char esc[8];
+        switch(c) {
+            case '"':  switch_buffer_write(out, "\\\"", 2); break;
+            case '\\': switch_buffer_write(out, "\\\\", 2); break;
+            case '\n': switch_buffer_write(out, "\\n", 2); break;
+            case '\r': switch_buffer_write(out, "\\r", 2); break;
+            case '\t': switch_buffer_write(out, "\\t", 2); break;
+            default:
+                if(c < 0x20) { snprintf(esc, sizeof(esc), "\\u%04x", c); switch_buffer_write(out, esc, 6); }
+                else { switch_buffer_write(out, s, 1); }
+        }
+    }
+    switch_buffer_write(out, "\"", 1);
+}
+
+static void json_print(switch_buffer_t *out, const cJSON *item) {
+    char num[64];
+
+    switch(item->type) {
+        case cJSON_False:  switch_buffer_write(out, "false", 5); break;
+        case cJSON_True:   switch_buffer_write(out, "true", 4); break;
+        case cJSON_NULL:   switch_buffer_write(out, "null", 4); break;
+        case cJSON_Number: switch_buffer_write(out, num, snprintf(num, sizeof(num), "%.17g", item->valuedouble)); break;
+        case cJSON_String: json_print_string(out, item->valuestring); break;
+        default:
+            switch_buffer_write(out, (item->type == cJSON_Object ? "{" : "["), 1);
+            for(cJSON *c = item->child; c; c = c->next) {
+                if(c != item->child) { switch_buffer_write(out, ",", 1); }
+                if(item->type == cJSON_Object) { json_print_string(out, c->string); switch_buffer_write(out, ":", 1); }
+                json_print(out, c);
+            }
+            switch_buffer_write(out, (item->type == cJSON_Object ? "}" : "]"), 1);
+    }
+}
+
+char *cJSON_PrintUnformatted(cJSON *item) {
+    switch_buffer_t *out = NULL;
+    char *str = NULL;
+    switch_size_t len = 0;
+
+    switch_buffer_create_dynamic(&out, 256, 256, 0);
+    json_print(out, item);
+    len = switch_buffer_inuse(out);
+    str = malloc(len + 1);
+    switch_buffer_read(out, str, len);
+    str[len] = '\0';
+    switch_buffer_destroy(&out);
+    return str;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// curl: the buffered upload is answered here (switch_curl.h)
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+#undef curl_mime_filedata
+#undef curl_mime_data
+
+static __thread struct {
+    CURL                *handle;
+    curl_write_callback write_fn;
+    void                *write_data;
+    char                file[512];
+    int                 verbose;
+    int                 words;
+    int                 segments;
+    CURL                *answered;
+    long                http_code;
+} stub_req;
+
+static char *stub_json_text(const char *prefix, const char *text, const char *suffix) {
+    size_t len = strlen(prefix) + strlen(suffix) + (strlen(text) * 6) + 1;
+    char *buf = malloc(len), *p = buf;
+
+    p += sprintf(p, "%s", prefix);
+    for(const unsigned char *s = (const unsigned char *)text; *s; s++) {
+        if(*s == '"' || *s == '\\') { *p++ = '\\'; *p++ = *s; }
+        else if(*s < 0x20) { p += sprintf(p, "\\u%04x", *s); }
+        else { *p++ = *s; }
+    }
+    sprintf(p, "%s", suffix);
+    return buf;
+}
+
+static char *stub_response(const char *file, int verbose, int words, int segments) {
+    char *text = NULL, *resp = NULL;
+
+    if(stub_transcribe_hook) {
+        if((text = stub_transcribe_hook(file, verbose)) == NULL) {
+            return NULL;
+        }
+        resp = (verbose ? strdup(text) : stub_json_text("{\"text\":\"", text, "\"}"));
+        free(text);
+        return resp;
+    }
+
+    text = malloc(strlen(file) + 32);
+    sprintf(text, "stub transcript for %s", file);
+    if(words) {
+        resp = strdup(segments ? "{\"text\":\"stub transcript\",\"segments\":[{\"start\":0.0,\"end\":1.0,\"text\":\"stub transcript\",\"avg_logprob\":-0.2,\"no_speech_prob\":0.01}],"
+                                 "\"words\":[{\"word\":\"stub\",\"start\":0.0,\"end\":0.5},{\"word\":\"transcript\",\"start\":0.5,\"end\":1.0}]}"
+                               : "{\"text\":\"stub transcript\",\"words\":[{\"word\":\"stub\",\"start\":0.0,\"end\":0.5},{\"word\":\"transcript\",\"start\":0.5,\"end\":1.0}]}");
+    } else if(verbose) {
+        char *seg = stub_json_text("\",\"segments\":[{\"start\":0.0,\"end\":1.0,\"text\":\"", text, "\"}]}");
+        char *head = stub_json_text("{\"text\":\"", text, seg);
+        free(seg);
+        resp = head;
+    } else {
+        resp = stub_json_text("{\"text\":\"", text, "\"}");
+    }
+    free(text);
+    return resp;
+}
+
+CURLcode stub_curl_easy_setopt(CURL *handle, CURLoption option, ...) {
+    CURLcode ret;
+    va_list ap;
+
+    va_start(ap, option);
+    if(option < CURLOPTTYPE_OBJECTPOINT) {
+        ret = curl_easy_setopt(handle, option, va_arg(ap, long));
+    } else if(option < CURLOPTTYPE_FUNCTIONPOINT || option >= CURLOPTTYPE_BLOB) {
+        void *ptr = va_arg(ap, void *);
+        if(option == CURLOPT_WRITEDATA) { stub_req.handle = handle; stub_req.write_data = ptr; }
+        ret = curl_easy_setopt(handle, option, ptr);
+    } else if(option < CURLOPTTYPE_OFF_T) {
+        void (*fn)(void) = va_arg(ap, void (*)(void));
+        if(option == CURLOPT_WRITEFUNCTION) { stub_req.handle = handle; stub_req.write_fn = (curl_write_callback)fn; }
+        ret = curl_easy_setopt(handle, option, fn);
+    } else {
+        ret = curl_easy_setopt(handle, option, va_arg(ap, curl_off_t));
+    }
+    va_end(ap);
+    return ret;
+}
+
+CURLcode stub_curl_mime_filedata(curl_mimepart *part, const char *filename) {
+    snprintf(stub_req.file, sizeof(stub_req.file), "%s", filename);
+    return curl_mime_filedata(part, filename);
+}
+
+CURLcode stub_curl_mime_data(curl_mimepart *part, const char *data, size_t datasize) {
+    if(datasize == CURL_ZERO_TERMINATED && !strcmp(data, "verbose_json")) {
+        stub_req.verbose = 1;
+    }
+    if(datasize == CURL_ZERO_TERMINATED && !strcmp(data, "word")) {
+        stub_req.words = 1;
+    }
+    if(datasize == CURL_ZERO_TERMINATED && !strcmp(data, "segment")) {
+        stub_req.segments = 1;
+    }
+    return curl_mime_data(part, data, datasize);
+}
+
+CURLcode stub_curl_easy_perform(CURL *handle) {
+    CURLcode ret = CURLE_OK;
+    char *resp = NULL;
+
+    stub_req.answered = NULL;
+    if(!stub_req.file[0] || stub_req.handle != handle || !stub_req.write_fn || getenv("STUB_HTTP")) {
+        ret = curl_easy_perform(handle);
+    } else {
+        stub_req.answered = handle;
+        if((resp = stub_response(stub_req.file, stub_req.verbose, stub_req.words, stub_req.segments)) != NULL) {
+            stub_req.write_fn(resp, 1, strlen(resp), stub_req.write_data);
+            stub_req.http_code = 200;
+            free(resp);
+        } else {
+            stub_req.http_code = 500;
+        }
+    }
+    stub_req.file[0] = '\0';
+    stub_req.verbose = 0;
+    stub_req.words = 0;
+    stub_req.segments = 0;
+    stub_req.handle = NULL;
+    return ret;
+}
+
+CURLcode stub_curl_easy_getinfo(CURL *handle, CURLINFO info, ...) {
+    void *ptr = NULL;
+    va_list ap;
+
+    va_start(ap, info);
+    ptr = va_arg(ap, void *);
+    va_end(ap);
+
+    if(handle == stub_req.answered && info == CURLINFO_RESPONSE_CODE) {
+        *(long *)ptr = stub_req.http_code;
+        return CURLE_OK;
+    }
+    return curl_easy_getinfo(handle, info, ptr);
+}
@@ -0,0 +1,240 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+
+extern globals_t globals;
+
+/**
+ ** Session capture ({capture=true} or 'sfwhisper capture <uuid> on'): the frames as asr_feed got them, the control
+ ** calls, the VAD state and the API responses go to <capture-dir>/<uuid>-<time>.sfwcap, so a session can be replayed
+ ** offline (bench/replay_sfwhisper). The callers only queue the records, the session's transcript thread writes them.
+ **/
+typedef struct capture_s {
+    switch_memory_pool_t    *pool;
+    switch_mutex_t          *mutex;             // fp
+    switch_queue_t          *q_recs;
+    FILE                    *fp;
+    char                    *path;
+    switch_time_t           t_start;
+    uint64_t                bytes;
+    uint64_t                max_bytes;
+    uint32_t                drops;
+    uint8_t                 fl_active;
+} capture_t;
+
+#define CAPTURE_FILE_BUFFER (256 * 1024)
+
+static void capture_close(capture_t *cap, const char *reason) {
+    capture_rec_t rec = { 0 };
+
+    if(!cap->fp) {
+        return;
+    }
+
+    rec.type = CAP_END;
+    rec.ts_us = switch_micro_time_now() - cap->t_start;
+    fwrite(&rec, sizeof(rec), 1, cap->fp);
+    fclose(cap->fp);
+    cap->fp = NULL;
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "sfwhisper: stage=capture closed (%s) file=%s bytes=%"PRIu64" drops=%u\n",
+                      reason, cap->path, cap->bytes, cap->drops);
+    switch_safe_free(cap->path);
+}
+
+static void capture_drain(capture_t *cap) {
+    void *pop = NULL;
+
+    while(switch_queue_trypop(cap->q_recs, &pop) == SWITCH_STATUS_SUCCESS) {
+        capture_rec_t *rec = (capture_rec_t *)pop;
+        uint32_t len = sizeof(capture_rec_t) + rec->len;
+
+        if(cap->fp) {
+            if(fwrite(rec, len, 1, cap->fp) != 1) {
+                capture_close(cap, "write error");
+            } else if((cap->bytes += len) >= cap->max_bytes) {
+                cap->fl_active = false;
+                capture_close(cap, "capture-max-mb");
+            }
+        }
+        free(rec);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+switch_status_t capture_start(gasr_ctx_t *asr_ctx) {
+    config_t *cfg = asr_ctx->cfg;
+    capture_t *cap = NULL;
+    capture_hdr_t hdr = { 0 };
+    switch_status_t status = SWITCH_STATUS_FALSE;
+
+    switch_mutex_lock(asr_ctx->mutex);
+    if(!asr_ctx->capture) {
+        switch_zmalloc(cap, sizeof(capture_t));
+        if(switch_core_new_memory_pool(&cap->pool) != SWITCH_STATUS_SUCCESS) {
+            switch_mutex_unlock(asr_ctx->mutex);
+            free(cap);
+            return SWITCH_STATUS_GENERR;
+        }
+        switch_mutex_init(&cap->mutex, SWITCH_MUTEX_NESTED, cap->pool);
+        switch_queue_create(&cap->q_recs, CAPTURE_QUEUE_SIZE, cap->pool);
+        asr_ctx->capture = cap;
+    }
+    cap = asr_ctx->capture;
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    switch_mutex_lock(cap->mutex);
+    if(cap->fp) {
+        switch_goto_status(SWITCH_STATUS_SUCCESS, out);
+    }
+
+    cap->t_start = switch_micro_time_now();
+    cap->path = switch_mprintf("%s%s%s-%"PRId64".sfwcap", (cfg->capture_dir ? cfg->capture_dir : SWITCH_GLOBAL_dirs.temp_dir), SWITCH_PATH_SEPARATOR,
+                               asr_ctx->uuid, (int64_t)(cap->t_start / 1000000));
+    if((cap->fp = fopen(cap->path, "wb")) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "sfwhisper: stage=capture open fail: %s\n", cap->path);
+        switch_safe_free(cap->path);
+        goto out;
+    }
+    setvbuf(cap->fp, NULL, _IOFBF, CAPTURE_FILE_BUFFER);
+
+    hdr.magic = CAPTURE_MAGIC;
+    hdr.version = CAPTURE_VERSION;
+    hdr.codec = asr_ctx->codec;
+    hdr.channels = asr_ctx->channels;
+    hdr.samplerate = asr_ctx->samplerate;
+    hdr.flags = (asr_ctx->fl_vad_enabled ? CAP_HDR_FL_VAD : 0) | (asr_ctx->fl_classifier_enabled ? CAP_HDR_FL_CLASSIFIER : 0) | (asr_ctx->fl_coalesce ? CAP_HDR_FL_COALESCE : 0);
+    hdr.chunk_size_sec = cfg->chunk_size_sec;
+    hdr.vad_silence_ms = cfg->vad_silence_ms;
+    hdr.vad_voice_ms = cfg->vad_voice_ms;
+    hdr.vad_threshold = cfg->vad_threshold;
+    hdr.classifier_min_voiced_ms = cfg->classifier_min_voiced_ms;
+    hdr.coalesce_max_sec = cfg->coalesce_max_sec;
+    hdr.coalesce_max_age_ms = cfg->coalesce_max_age_ms;
+    hdr.coalesce_gap_ms = cfg->coalesce_gap_ms;
+    hdr.max_parallel_uploads = asr_ctx->max_parallel_uploads;
+    hdr.timestamp = cap->t_start;
+    snprintf(hdr.uuid, sizeof(hdr.uuid), "%s", asr_ctx->uuid);
+    snprintf(hdr.lang, sizeof(hdr.lang), "%s", (asr_ctx->lang ? asr_ctx->lang : ""));
+
+    fwrite(&hdr, sizeof(hdr), 1, cap->fp);
+    cap->bytes = sizeof(hdr);
+    cap->max_bytes = (uint64_t)cfg->capture_max_mb * 1024 * 1024;
+    cap->drops = 0;
+    cap->fl_active = true;
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "sfwhisper: stage=capture started uuid=%s file=%s\n", asr_ctx->uuid, cap->path);
+    status = SWITCH_STATUS_SUCCESS;
+out:
+    switch_mutex_unlock(cap->mutex);
+    return status;
+}
+
+void capture_stop(gasr_ctx_t *asr_ctx) {
+    capture_t *cap = asr_ctx->capture;
+
+    if(!cap) {
+        return;
+    }
+
+    switch_mutex_lock(cap->mutex);
+    cap->fl_active = false;
+    capture_drain(cap);
+    capture_close(cap, "stopped");
+    switch_mutex_unlock(cap->mutex);
+}
+
+/**
+ ** asr_close, no more writers
+ **/
+void capture_destroy(gasr_ctx_t *asr_ctx) {
+    capture_t *cap = asr_ctx->capture;
+
+    if(!cap) {
+        return;
+    }
+
+    capture_stop(asr_ctx);
+    asr_ctx->capture = NULL;
+
+    switch_queue_term(cap->q_recs);
+    switch_core_destroy_memory_pool(&cap->pool);
+    free(cap);
+}
+
+/**
+ ** any thread; dropped (and counted) when the writer is behind
+ **/
+void capture_put(gasr_ctx_t *asr_ctx, uint8_t type, uint8_t status, const void *data, uint32_t len, const void *data2, uint32_t len2) {
+    capture_t *cap = asr_ctx->capture;
+    capture_rec_t *rec = NULL;
+
+    if(!cap || !cap->fl_active) {
+        return;
+    }
+
+    switch_malloc(rec, sizeof(capture_rec_t) + len + len2);
+    rec->type = type;
+    rec->vad = asr_ctx->vad_state;
+    rec->status = status;
+    rec->fl_pause = asr_ctx->fl_pause;
+    rec->len = len + len2;
+    rec->ts_us = switch_micro_time_now() - cap->t_start;
+    if(len) memcpy((uint8_t *)(rec + 1), data, len);
+    if(len2) memcpy((uint8_t *)(rec + 1) + len, data2, len2);
+
+    if(switch_queue_trypush(cap->q_recs, rec) != SWITCH_STATUS_SUCCESS) {
+        __atomic_add_fetch(&cap->drops, 1, __ATOMIC_RELAXED);
+        free(rec);
+    }
+}
+
+void capture_result(gasr_ctx_t *asr_ctx, upload_job_t *job, const char *mode, switch_status_t status, const char *response, switch_time_t t_upload, switch_time_t t_done) {
+    capture_result_t res = { 0 };
+
+    if(!asr_ctx->capture || !asr_ctx->capture->fl_active) {
+        return;
+    }
+
+    res.hash = capture_hash(job->data, job->data_len);
+    res.chunk_id = job->chunk_id;
+    res.seq = job->seq;
+    res.data_len = job->data_len;
+    res.upload_ms = (t_upload ? (uint32_t)((t_done - t_upload) / 1000) : 0);
+    res.fl_error = (status != SWITCH_STATUS_SUCCESS);
+    res.fl_segments = job->fl_segments;
+    snprintf(res.mode, sizeof(res.mode), "%s", mode);
+
+    capture_put(asr_ctx, CAP_RESULT, status, &res, sizeof(res), response, (response && !res.fl_error ? strlen(response) : 0));
+}
+
+/**
+ ** transcript thread
+ **/
+void capture_flush(gasr_ctx_t *asr_ctx) {
+    capture_t *cap = asr_ctx->capture;
+
+    if(!cap) {
+        return;
+    }
+
+    switch_mutex_lock(cap->mutex);
+    capture_drain(cap);
+    switch_mutex_unlock(cap->mutex);
+}
+
+/**
+ ** FNV-1a
+ **/
+uint64_t capture_hash(const switch_byte_t *data, uint32_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for(uint32_t i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
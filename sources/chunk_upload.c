@@ -0,0 +1,364 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+#include "whisper_api.h"
+
+extern globals_t globals;
+
+/**
+ ** Chunks of a session are uploaded by their own threads, up to max-parallel-uploads at a time.
+ ** Every dispatched chunk takes the next seq, results are handed to q_text strictly in seq order:
+ ** an early result waits in upload_slots for the slower ones before it, a failed chunk leaves an empty slot.
+ **/
+static uint32_t upload_slots_flush(gasr_ctx_t *asr_ctx) {
+    upload_slot_t *slot = NULL;
+    uint32_t delivered = 0;
+
+    for(slot = &asr_ctx->upload_slots[asr_ctx->deliver_seq % MAX_PARALLEL_UPLOADS]; slot->fl_done; slot = &asr_ctx->upload_slots[asr_ctx->deliver_seq % MAX_PARALLEL_UPLOADS]) {
+        if(slot->overlap || asr_ctx->overlap_pending) {
+            overlap_stitch(asr_ctx, slot);
+        }
+        for(uint32_t i = 0; i < slot->count; i++) {
+            if(slot->texts[i] && !asr_ctx->fl_destroyed) {
+                xdata_buffer_t *tbuff = NULL;
+                if(xdata_buffer_alloc(&tbuff, (switch_byte_t *)slot->texts[i], strlen(slot->texts[i])) == SWITCH_STATUS_SUCCESS) {
+                    if(switch_queue_trypush(asr_ctx->q_text, tbuff) == SWITCH_STATUS_SUCCESS) {
+                        asr_ctx->transcript_results++;
+                        result_event(asr_ctx, slot->texts[i], i, &slot->timing);
+                        delivered++;
+                    } else {
+                        xdata_buffer_free(&tbuff);
+                    }
+                }
+            }
+            switch_safe_free(slot->texts[i]);
+        }
+        switch_safe_free(slot->texts);
+        slot->count = 0;
+        slot->fl_done = false;
+        asr_ctx->deliver_seq++;
+    }
+
+    return delivered;
+}
+
+static void upload_deliver(gasr_ctx_t *asr_ctx, uint32_t seq, char **texts, uint32_t count, overlap_chunk_t *overlap, const result_timing_t *timing) {
+    upload_slot_t *slot = NULL;
+    uint32_t delivered = 0;
+
+    switch_mutex_lock(asr_ctx->mutex);
+
+    // the slot was given up by upload_kill()
+    if((int32_t)(seq - asr_ctx->deliver_seq) < 0) {
+        switch_mutex_unlock(asr_ctx->mutex);
+        for(uint32_t i = 0; texts && i < count; i++) {
+            switch_safe_free(texts[i]);
+        }
+        switch_safe_free(texts);
+        overlap_free(&overlap);
+        return;
+    }
+
+    slot = &asr_ctx->upload_slots[seq % MAX_PARALLEL_UPLOADS];
+    slot->texts = texts;
+    slot->count = count;
+    slot->overlap = overlap;
+    slot->timing = *timing;
+    slot->fl_done = true;
+    delivered = upload_slots_flush(asr_ctx);
+
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    if(delivered) {
+        session_wake(asr_ctx);
+    }
+}
+
+static void *SWITCH_THREAD_FUNC upload_thread(switch_thread_t *thread, void *obj) {
+    upload_job_t *job = (upload_job_t *) obj;
+    gasr_ctx_t *asr_ctx = job->asr_ctx;
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    uint32_t audio_ms = job->data_len / ((asr_ctx->samplerate / 1000) * asr_ctx->sample_bytes);
+    uint8_t fl_log = slog_sample(asr_ctx->cfg);
+    const char *mode = "buffered";
+    char *result = NULL, **texts = NULL;
+    overlap_chunk_t *overlap = NULL;
+    uint32_t count = 1, text_len = 0;
+    uint8_t fl_fallback = true;
+    switch_time_t t_write = switch_micro_time_now(), t_upload = 0, t_done = 0;
+
+    if(job->kill_gen == asr_ctx->kill_gen) {
+        __atomic_store_n(&asr_ctx->upload_since[job->seq % MAX_PARALLEL_UPLOADS], t_write, __ATOMIC_RELAXED);
+    }
+
+    // coalescing was switched while the chunk was streamed, the response wouldn't match
+    if(job->stream && (job->stream->fl_segments != job->fl_segments || job->stream->fl_words != job->fl_words || job->stream->fl_nlsml != job->fl_nlsml)) {
+        upload_stream_release(&job->stream);
+    }
+    if(spill_deferring(asr_ctx)) {
+        upload_stream_release(&job->stream);
+        __atomic_add_fetch(&globals.spill_deferred, 1, __ATOMIC_RELAXED);
+        mode = "deferred";
+        fl_fallback = false;
+    } else if(job->stream) {
+        mode = "stream";
+        t_upload = t_write;
+        status = upload_stream_finish(job->stream, &result);
+        upload_stream_release(&job->stream);
+        if(status != SWITCH_STATUS_SUCCESS && !asr_ctx->fl_destroyed && job->kill_gen == asr_ctx->kill_gen) {
+            slog_chunk(asr_ctx, job->chunk_id, SWITCH_LOG_WARNING, "fallback", "bytes=%u stream_ms=%u", job->data_len, (uint32_t)((switch_micro_time_now() - t_upload) / 1000));
+            mode = "fallback";
+            t_write = switch_micro_time_now();
+        }
+    } else if(asr_ctx->cfg->sidecar_socket) {
+        mode = "sidecar";
+        t_upload = t_write;
+        status = sidecar_transcribe(asr_ctx, job->data, job->data_len, job->fl_segments, job->fl_words, job->fl_nlsml, &result);
+        if(status != SWITCH_STATUS_SUCCESS && !asr_ctx->fl_destroyed && job->kill_gen == asr_ctx->kill_gen && (fl_fallback = asr_ctx->cfg->fl_sidecar_fallback)) {
+            slog_chunk(asr_ctx, job->chunk_id, SWITCH_LOG_WARNING, "fallback", "bytes=%u sidecar_ms=%u", job->data_len, (uint32_t)((switch_micro_time_now() - t_upload) / 1000));
+            mode = "fallback";
+            t_write = switch_micro_time_now();
+        }
+    }
+    if(status != SWITCH_STATUS_SUCCESS && fl_fallback && !asr_ctx->fl_destroyed && !globals.fl_shutdown && job->kill_gen == asr_ctx->kill_gen) {
+        char *fname = audio_file_write(job->data, job->data_len, asr_ctx->codec, asr_ctx->channels, asr_ctx->samplerate);
+        if(fname != NULL) {
+            t_upload = switch_micro_time_now();
+            if(job->fl_segments) {
+                status = whisper_transcribe_segments(asr_ctx, fname, &result);
+            } else if(job->fl_words) {
+                status = whisper_transcribe_words(asr_ctx, fname, &result);
+            } else if(job->fl_nlsml) {
+                status = whisper_transcribe_timestamps(asr_ctx, fname, &result);
+            } else {
+                status = whisper_transcribe(asr_ctx, fname, &result);
+            }
+            audio_file_delete(fname);
+            switch_safe_free(fname);
+        } else {
+            slog_chunk(asr_ctx, job->chunk_id, SWITCH_LOG_ERROR, "error", "bytes=%u reason=audio_file_write", job->data_len);
+        }
+    }
+    t_done = switch_micro_time_now();
+    capture_result(asr_ctx, job, mode, status, result, t_upload, t_done);
+
+    // the audio isn't lost with the request: the result comes later as sfwhisper::spill-result
+    if(status != SWITCH_STATUS_SUCCESS && spill_put(asr_ctx, job) == SWITCH_STATUS_SUCCESS) {
+        mode = "spill";
+    }
+
+    if(status == SWITCH_STATUS_SUCCESS && result && job->fl_segments) {
+        count = job->marks_count;
+        switch_zmalloc(texts, sizeof(char *) * count);
+        status = coalesce_split(result, job->marks_ms, count, texts);
+        switch_safe_free(result);
+    } else if(status == SWITCH_STATUS_SUCCESS && result && job->fl_words) {
+        switch_zmalloc(texts, sizeof(char *));
+        status = overlap_parse(result, job->overlap_head_ms, job->overlap_tail_ms, audio_ms, &overlap, &texts[0]);
+        switch_safe_free(result);
+    } else if(status == SWITCH_STATUS_SUCCESS && result && job->fl_nlsml) {
+        switch_zmalloc(texts, sizeof(char *));
+        status = nlsml_result(asr_ctx, job->grammar, job->data, job->data_len, result, &texts[0]);
+        switch_safe_free(result);
+    } else if(status == SWITCH_STATUS_SUCCESS && result) {
+        switch_zmalloc(texts, sizeof(char *));
+        texts[0] = result;
+        result = NULL;
+    }
+    if(status == SWITCH_STATUS_SUCCESS && job->grammar && !job->fl_nlsml && texts && texts[0]) {
+        grammar_result(asr_ctx, job->grammar, job->data, job->data_len, &texts[0]);
+    }
+
+    if(status == SWITCH_STATUS_SUCCESS && texts) {
+        for(uint32_t i = 0; i < count; i++) {
+            text_len += (texts[i] ? strlen(texts[i]) : 0);
+        }
+        if(fl_log) {
+            slog_chunk(asr_ctx, job->chunk_id, SWITCH_LOG_NOTICE, "done", "mode=%s lang=%s seq=%u bytes=%u audio_ms=%u write_ms=%u upload_ms=%u utterances=%u text_len=%u",
+                       mode, asr_ctx->lang, job->seq, job->data_len, audio_ms, (uint32_t)((t_upload - t_write) / 1000), (uint32_t)((t_done - t_upload) / 1000), count, text_len);
+            if(asr_ctx->cfg->fl_log_transcripts) {
+                for(uint32_t i = 0; i < count; i++) {
+                    if(texts[i]) slog_chunk(asr_ctx, job->chunk_id, SWITCH_LOG_NOTICE, "text", "utterance=%u text=\"%s\"", i, texts[i]);
+                }
+            }
+        }
+    } else {
+        if(t_upload) {
+            slog_chunk(asr_ctx, job->chunk_id, SWITCH_LOG_ERROR, "error", "mode=%s lang=%s seq=%u bytes=%u audio_ms=%u upload_ms=%u",
+                       mode, asr_ctx->lang, job->seq, job->data_len, audio_ms, (uint32_t)((t_done - t_upload) / 1000));
+        }
+        for(uint32_t i = 0; texts && i < count; i++) {
+            switch_safe_free(texts[i]);
+        }
+        switch_safe_free(texts);
+        switch_safe_free(result);
+        overlap_free(&overlap);
+        count = 0;
+    }
+
+    journal_write(asr_ctx, job, mode, (status != SWITCH_STATUS_SUCCESS ? JOURNAL_FL_ERROR : 0) | (job->fl_segments ? JOURNAL_FL_SEGMENTS : 0), texts, count, t_upload, t_done);
+    job->timing.t_response = t_done;
+    upload_deliver(asr_ctx, job->seq, texts, count, overlap, &job->timing);
+
+    // the slot may belong to a later seq already (upload_kill)
+    __atomic_compare_exchange_n(&asr_ctx->upload_since[job->seq % MAX_PARALLEL_UPLOADS], &t_write, 0, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    if(t_upload) {
+        __atomic_add_fetch(&asr_ctx->bytes_uploaded, job->data_len, __ATOMIC_RELAXED);
+    }
+
+    switch_safe_free(job->data);
+    free(job);
+
+    switch_mutex_lock(asr_ctx->mutex);
+    if(asr_ctx->uploads_active > 0) asr_ctx->uploads_active--;
+    if(asr_ctx->deps > 0) asr_ctx->deps--;
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    slog_thread_done();
+    thread_finished();
+
+    return NULL;
+}
+
+/**
+ ** SWITCH_STATUS_FALSE: the reorder window is full, the caller keeps the chunk and tries again later
+ ** marks_ms: a coalesced chunk, utterance starts (ms)
+ ** overlap_head_ms/overlap_tail_ms: audio shared with the previous/next chunk (chunk-overlap-ms)
+ **/
+switch_status_t upload_dispatch(gasr_ctx_t *asr_ctx, switch_memory_pool_t *pool, const switch_byte_t *data, uint32_t data_len, upload_stream_t **stream, const uint32_t *marks_ms, uint32_t marks_count, uint32_t overlap_head_ms, uint32_t overlap_tail_ms) {
+    upload_job_t *job = NULL;
+
+    switch_mutex_lock(asr_ctx->mutex);
+    if(asr_ctx->upload_seq - asr_ctx->deliver_seq >= asr_ctx->max_parallel_uploads) {
+        switch_mutex_unlock(asr_ctx->mutex);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_zmalloc(job, sizeof(upload_job_t));
+    switch_malloc(job->data, data_len);
+    memcpy(job->data, data, data_len);
+    job->data_len = data_len;
+    job->asr_ctx = asr_ctx;
+    job->stream = *stream;
+    job->kill_gen = asr_ctx->kill_gen;
+    upload_timing_start(asr_ctx, &job->timing);
+    if(marks_ms && marks_count) {
+        job->fl_segments = true;
+        job->marks_count = MIN(marks_count, COALESCE_MAX_UTTERANCES);
+        memcpy(job->marks_ms, marks_ms, sizeof(uint32_t) * job->marks_count);
+    } else {
+        job->grammar = __atomic_load_n(&asr_ctx->grammar, __ATOMIC_ACQUIRE);
+        job->fl_words = (asr_ctx->cfg->chunk_overlap_ms > 0);
+        job->fl_nlsml = (asr_ctx->fl_nlsml && !job->fl_words);
+        job->overlap_head_ms = overlap_head_ms;
+        job->overlap_tail_ms = overlap_tail_ms;
+    }
+    job->chunk_id = asr_ctx->chunk_seq++;
+    job->seq = asr_ctx->upload_seq++;
+    asr_ctx->uploads_active++;
+    asr_ctx->deps++;
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    *stream = NULL;
+    __atomic_add_fetch(&globals.chunks_uploaded, 1, __ATOMIC_RELAXED);
+
+    thread_launch(pool, upload_thread, job);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ ** a result found without a request (grammar match): takes the next seq and goes out in order like an upload;
+ ** text NULL: an empty slot, the words held from an overlapping chunk go out with it
+ ** SWITCH_STATUS_FALSE: the reorder window is full
+ **/
+switch_status_t upload_local(gasr_ctx_t *asr_ctx, char *text) {
+    result_timing_t timing = { 0 };
+    char **texts = NULL;
+    uint32_t seq = 0;
+
+    switch_mutex_lock(asr_ctx->mutex);
+    if(asr_ctx->upload_seq - asr_ctx->deliver_seq >= asr_ctx->max_parallel_uploads) {
+        switch_mutex_unlock(asr_ctx->mutex);
+        return SWITCH_STATUS_FALSE;
+    }
+    asr_ctx->chunk_seq++;
+    seq = asr_ctx->upload_seq++;
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    upload_timing_start(asr_ctx, &timing);
+    timing.t_response = timing.t_dispatch;
+
+    if(text) {
+        switch_zmalloc(texts, sizeof(char *));
+        texts[0] = strdup(text);
+    }
+    upload_deliver(asr_ctx, seq, texts, (texts ? 1 : 0), NULL, &timing);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ ** the utterance the chunk belongs to, at dispatch (the session is paused until the result, so it's still this one)
+ **/
+void upload_timing_start(gasr_ctx_t *asr_ctx, result_timing_t *timing) {
+    timing->t_speech_start = __atomic_load_n(&asr_ctx->t_speech_start, __ATOMIC_RELAXED);
+    timing->t_speech_end = __atomic_load_n(&asr_ctx->t_speech_end, __ATOMIC_RELAXED);
+    if(timing->t_speech_end < timing->t_speech_start) {
+        timing->t_speech_end = 0;
+    }
+    timing->t_dispatch = switch_micro_time_now();
+    timing->t_response = 0;
+}
+
+/**
+ ** results that never made it to q_text (session closed while uploading)
+ **/
+void upload_slots_clean(gasr_ctx_t *asr_ctx) {
+    for(uint32_t i = 0; i < MAX_PARALLEL_UPLOADS; i++) {
+        upload_slot_t *slot = &asr_ctx->upload_slots[i];
+        for(uint32_t j = 0; slot->texts && j < slot->count; j++) {
+            switch_safe_free(slot->texts[j]);
+        }
+        switch_safe_free(slot->texts);
+        overlap_free(&slot->overlap);
+        slot->count = 0;
+        slot->fl_done = false;
+    }
+    overlap_free(&asr_ctx->overlap_pending);
+}
+
+/**
+ ** sfwhisper kill: the requests in flight are given up, their slots are delivered empty so the results after them
+ ** go out; the threads finish on their own (a buffered upload can't be interrupted) and their results are dropped
+ **/
+uint32_t upload_kill(gasr_ctx_t *asr_ctx) {
+    uint32_t killed = 0, delivered = 0;
+
+    switch_mutex_lock(asr_ctx->mutex);
+    __atomic_add_fetch(&asr_ctx->kill_gen, 1, __ATOMIC_RELAXED);
+
+    for(uint32_t seq = asr_ctx->deliver_seq; seq != asr_ctx->upload_seq; seq++) {
+        upload_slot_t *slot = &asr_ctx->upload_slots[seq % MAX_PARALLEL_UPLOADS];
+        if(!slot->fl_done) {
+            slot->texts = NULL;
+            slot->count = 0;
+            slot->fl_done = true;
+            killed++;
+        }
+        __atomic_store_n(&asr_ctx->upload_since[seq % MAX_PARALLEL_UPLOADS], 0, __ATOMIC_RELAXED);
+    }
+    delivered = upload_slots_flush(asr_ctx);
+
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    if(delivered) {
+        session_wake(asr_ctx);
+    }
+    __atomic_add_fetch(&globals.uploads_killed, killed, __ATOMIC_RELAXED);
+    slog_printf(asr_ctx->cfg, SWITCH_LOG_WARNING, "uuid=%s stage=kill requests=%u", asr_ctx->uuid, killed);
+
+    return killed;
+}
@@ -0,0 +1,164 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+#include <math.h>
+
+/**
+ ** Pre-upload check of a finished chunk, the core VAD also fires on clicks, DTMF bleed, hold music and breathing.
+ ** Wideband audio is averaged down to ~8kHz first (only 100..4000 Hz is looked at), then cut in CLS_FRAME_MS
+ ** frames (power of 2 samples), the ones above the energy threshold are voiced;
+ ** for those the 100..4000 Hz power spectrum gives the flatness (noise ~0.5+, speech well below) and whether
+ ** 1-2 peaks hold most of the energy at the same place as in the previous frame (tones).
+ **/
+void fft_radix2(float *re, float *im, uint32_t n) {
+    for(uint32_t i = 1, j = 0; i < n; i++) {
+        uint32_t bit = n >> 1;
+        for(; j & bit; bit >>= 1) { j ^= bit; }
+        j ^= bit;
+        if(i < j) {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for(uint32_t len = 2; len <= n; len <<= 1) {
+        double ang = -2.0 * M_PI / len;
+        float wr = cos(ang), wi = sin(ang);
+        for(uint32_t i = 0; i < n; i += len) {
+            float cr = 1.0f, ci = 0.0f;
+            for(uint32_t k = 0; k < len / 2; k++) {
+                uint32_t a = i + k, b = i + k + len / 2;
+                float tr = (re[b] * cr) - (im[b] * ci);
+                float ti = (re[b] * ci) + (im[b] * cr);
+                float nr = (cr * wr) - (ci * wi);
+                re[b] = re[a] - tr; im[b] = im[a] - ti;
+                re[a] += tr; im[a] += ti;
+                ci = (cr * wi) + (ci * wr);
+                cr = nr;
+            }
+        }
+    }
+}
+
+static uint32_t peak_take(float *pw, uint32_t lo, uint32_t hi, double *energy) {
+    uint32_t peak = lo;
+
+    for(uint32_t k = lo; k <= hi; k++) {
+        if(pw[k] > pw[peak]) { peak = k; }
+    }
+    // hann main lobe is +-2 bins
+    *energy = 0;
+    for(uint32_t k = (peak > lo + 2 ? peak - 2 : lo); k <= MIN(peak + 2, hi); k++) {
+        *energy += pw[k];
+        pw[k] = 0;
+    }
+    return peak;
+}
+
+uint8_t chunk_classify(gasr_ctx_t *asr_ctx, const switch_byte_t *data, uint32_t data_len, chunk_class_t *cls) {
+    config_t *cfg = asr_ctx->cfg;
+    uint32_t threshold = (cfg->vad_threshold ? cfg->vad_threshold : SILENCE_ENERGY_THRESHOLD);
+    uint32_t samples = data_len / asr_ctx->sample_bytes;
+    uint32_t step = MAX(1, asr_ctx->samplerate / 8000), rate = asr_ctx->samplerate / step;
+    uint32_t n = 64, lo = 0, hi = 0, voiced = 0, tonal = 0, prev_peak = 0;
+    double flatness = 0;
+    int16_t *pcm = NULL;
+    const int16_t *frame = NULL;
+    float *win = NULL, *re = NULL, *im = NULL;
+
+    while(n < (rate * CLS_FRAME_MS) / 1000) { n <<= 1; }
+    lo = MAX(1, (CLS_BAND_LO_HZ * n) / rate);
+    hi = MIN((n / 2) - 1, (CLS_BAND_HI_HZ * n) / rate);
+
+    memset(cls, 0, sizeof(*cls));
+
+    switch_malloc(pcm, n * step * sizeof(int16_t));
+    switch_malloc(win, n * sizeof(float) * 3);
+    re = win + n;
+    im = re + n;
+
+    for(uint32_t i = 0; i < n; i++) {
+        win[i] = 0.5f - 0.5f * cos((2.0 * M_PI * i) / (n - 1));
+    }
+
+    for(uint32_t offs = 0; offs + (n * step) <= samples; offs += (n * step)) {
+        uint64_t level = 0;
+        double sum = 0, logsum = 0, e1 = 0, e2 = 0;
+        uint32_t p1 = 0;
+
+        if(asr_ctx->codec == CODEC_L16) {
+            frame = (const int16_t *)(data + (offs * sizeof(int16_t)));
+        } else {
+            g711_decode(asr_ctx->codec, data + offs, n * step, pcm);
+            frame = pcm;
+        }
+        if(step > 1) {
+            for(uint32_t i = 0; i < n; i++) {
+                int32_t acc = 0;
+                for(uint32_t j = 0; j < step; j++) { acc += frame[(i * step) + j]; }
+                pcm[i] = acc / (int32_t)step;
+            }
+            frame = pcm;
+        }
+
+        for(uint32_t i = 0; i < n; i++) { level += abs(frame[i]); }
+        if((level / n) < threshold) {
+            prev_peak = 0;
+            continue;
+        }
+        voiced++;
+
+        for(uint32_t i = 0; i < n; i++) {
+            re[i] = frame[i] * win[i];
+            im[i] = 0;
+        }
+        fft_radix2(re, im, n);
+
+        for(uint32_t k = lo; k <= hi; k++) {
+            re[k] = (re[k] * re[k]) + (im[k] * im[k]);
+            sum += re[k];
+            logsum += log(re[k] + 1e-3);
+        }
+        if(sum <= 0) {
+            continue;
+        }
+        flatness += exp(logsum / (hi - lo + 1)) / (sum / (hi - lo + 1));
+
+        // DTMF is a pair, ringback/busy/hold beeps one or two; speech pitch moves between frames
+        p1 = peak_take(re, lo, hi, &e1);
+        peak_take(re, lo, hi, &e2);
+        if((e1 + e2) / sum >= cfg->classifier_tone_ratio && prev_peak && abs((int)p1 - (int)prev_peak) <= 1) {
+            tonal++;
+        }
+        prev_peak = p1;
+    }
+
+    switch_safe_free(pcm);
+    switch_safe_free(win);
+
+    cls->voiced_ms = (voiced * n * 1000) / rate;
+    cls->flatness = (voiced ? flatness / voiced : 0);
+    cls->tonal = (voiced > 1 ? (double)tonal / (voiced - 1) : 0);
+
+    if(cls->voiced_ms < cfg->classifier_min_voiced_ms) {
+        return CHUNK_REJECT_SHORT;
+    }
+    if(cls->tonal >= cfg->classifier_tone_frames) {
+        return CHUNK_REJECT_TONE;
+    }
+    if(cls->flatness >= cfg->classifier_max_flatness) {
+        return CHUNK_REJECT_NOISE;
+    }
+    return CHUNK_ACCEPT;
+}
+
+const char *chunk_reject2str(uint8_t reason) {
+    switch(reason) {
+        case CHUNK_REJECT_SHORT: return "short";
+        case CHUNK_REJECT_NOISE: return "noise";
+        case CHUNK_REJECT_TONE: return "tone";
+    }
+    return "none";
+}
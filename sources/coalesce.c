@@ -0,0 +1,130 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+
+extern globals_t globals;
+
+/**
+ ** Coalescing mode ({coalesce=true}): short utterances are collected in one chunk, separated by coalesce-gap-ms of silence,
+ ** until it holds coalesce-max-sec of audio or the first one is coalesce-max-age-ms old. The chunk is uploaded with
+ ** response_format=verbose_json and the segments are given back to the utterances by their timestamps.
+ ** marks[] are the chunk offsets (bytes) where the utterances start.
+ **/
+void coalesce_reset(coalesce_t *co) {
+    co->count = 0;
+    co->offs = 0;
+    co->expiry = 0;
+}
+
+/**
+ ** at the end of an utterance; true if the chunk should go now, otherwise the gap is appended and the next utterance is marked
+ **/
+uint8_t coalesce_utterance_end(gasr_ctx_t *asr_ctx, coalesce_t *co, switch_buffer_t *chunk_buffer, upload_stream_t *stream) {
+    config_t *cfg = asr_ctx->cfg;
+    uint32_t bytes_ms = (asr_ctx->samplerate / 1000) * asr_ctx->sample_bytes;
+    uint32_t used = switch_buffer_inuse(chunk_buffer);
+    uint32_t gap_len = cfg->coalesce_gap_ms * bytes_ms;
+    xdata_buffer_t *gap = NULL;
+
+    if(co->count == 0) {
+        co->marks[co->count++] = 0;
+        co->expiry = switch_micro_time_now() + (cfg->coalesce_max_age_ms * 1000LL);
+    }
+
+    if(used >= cfg->coalesce_max_sec * 1000 * bytes_ms || co->count >= COALESCE_MAX_UTTERANCES || gap_len >= switch_buffer_freespace(chunk_buffer)) {
+        return true;
+    }
+    if(switch_micro_time_now() >= co->expiry) {
+        return true;
+    }
+
+    if(gap_len && xdata_buffer_alloc(&gap, NULL, 0) == SWITCH_STATUS_SUCCESS) {
+        switch_malloc(gap->data, gap_len);
+        gap->len = gap_len;
+        memset(gap->data, (asr_ctx->codec == CODEC_PCMU ? 0xff : asr_ctx->codec == CODEC_PCMA ? 0xd5 : 0x00), gap_len);
+
+        switch_buffer_write(chunk_buffer, gap->data, gap->len);
+        if(stream) {
+            upload_stream_push(stream, gap);
+            gap = NULL;
+        }
+        xdata_buffer_free(&gap);
+    }
+
+    co->offs = switch_buffer_inuse(chunk_buffer);
+    co->marks[co->count++] = co->offs;
+
+    return false;
+}
+
+/**
+ ** utterance starts in ms for the upload, the trailing mark without audio after it is dropped;
+ ** a chunk that filled up before the first utterance ended is one utterance
+ **/
+uint32_t coalesce_marks_ms(gasr_ctx_t *asr_ctx, coalesce_t *co, uint32_t chunk_len, uint32_t *marks_ms) {
+    uint32_t bytes_ms = (asr_ctx->samplerate / 1000) * asr_ctx->sample_bytes;
+    uint32_t count = co->count;
+
+    if(count > 0 && co->marks[count - 1] >= chunk_len) {
+        count--;
+    }
+    if(count == 0) {
+        marks_ms[0] = 0;
+        return 1;
+    }
+    for(uint32_t i = 0; i < count; i++) {
+        marks_ms[i] = co->marks[i] / bytes_ms;
+    }
+    return count;
+}
+
+static void text_append(char **dst, const char *src) {
+    size_t dlen = (*dst ? strlen(*dst) : 0), slen = 0;
+
+    while(*src == ' ') { src++; }
+    if(!(slen = strlen(src))) {
+        return;
+    }
+    *dst = realloc(*dst, dlen + slen + 2);
+    if(dlen) {
+        (*dst)[dlen++] = ' ';
+    }
+    memcpy(*dst + dlen, src, slen + 1);
+}
+
+/**
+ ** verbose_json response -> one text per utterance (NULL if nothing was said in it);
+ ** a segment belongs to the utterance its middle falls in, no segments: all the text goes to the first one
+ **/
+switch_status_t coalesce_split(const char *json_str, const uint32_t *marks_ms, uint32_t count, char **texts) {
+    vjson_t vj = { 0 };
+
+    memset(texts, 0, sizeof(char *) * count);
+
+    if(!json_str || vjson_parse(json_str, strlen(json_str), &vj) != SWITCH_STATUS_SUCCESS) {
+        __atomic_add_fetch(&globals.vjson_errors, 1, __ATOMIC_RELAXED);
+        vjson_free(&vj);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    if(vj.segments_count == 0 || count == 1) {
+        if(vj.text) {
+            text_append(&texts[0], vj.text);
+        }
+    } else {
+        for(uint32_t i = 0; i < vj.segments_count; i++) {
+            vjson_segment_t *seg = &vj.segments[i];
+            double mid_ms = (seg->start + seg->end) * 500.0;
+            uint32_t u = 0;
+
+            while(u + 1 < count && marks_ms[u + 1] <= mid_ms) { u++; }
+            text_append(&texts[u], seg->text);
+        }
+    }
+
+    vjson_free(&vj);
+    return SWITCH_STATUS_SUCCESS;
+}
@@ -0,0 +1,298 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+
+extern globals_t globals;
+
+#define CONFIG_NAME "sfwhisper.conf"
+
+/**
+ ** Settings are kept in immutable snapshots: a session takes a reference in asr_open
+ ** and reads it without locking until asr_close, a reload only swaps the current pointer.
+ **/
+static void config_destroy(config_t *cfg) {
+    switch_memory_pool_t *pool = cfg->pool;
+
+    switch_safe_free(cfg->api_url_ep);
+    switch_core_destroy_memory_pool(&pool);
+}
+
+switch_status_t config_load(config_t **out) {
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    switch_memory_pool_t *pool = NULL;
+    switch_xml_t xcfg, xml, settings, param;
+    config_t *cfg = NULL;
+
+    if(switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_core_new_memory_pool() fail\n");
+        return SWITCH_STATUS_GENERR;
+    }
+
+    cfg = switch_core_alloc(pool, sizeof(config_t));
+    cfg->pool = pool;
+    cfg->start_input_timers = SWITCH_FALSE;
+    cfg->no_input_timeout = 5000;
+    cfg->log_level = SWITCH_LOG_NOTICE;
+    cfg->log_sample_rate = 1;
+    cfg->coalesce_gap_ms = DEF_COALESCE_GAP_MS;
+    cfg->fl_grammar_learn = true;
+    cfg->fl_sidecar_fallback = true;
+    cfg->fl_journal_audio = true;
+
+    if((xml = switch_xml_open_cfg(CONFIG_NAME, &xcfg, NULL)) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't open configuration file: %s\n", CONFIG_NAME);
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    }
+
+    if((settings = switch_xml_child(xcfg, "settings"))) {
+        for (param = switch_xml_child(settings, "param"); param; param = param->next) {
+            char *var = (char *) switch_xml_attr_soft(param, "name");
+            char *val = (char *) switch_xml_attr_soft(param, "value");
+
+            if(!strcasecmp(var, "vad-silence-ms")) {
+                if(val) cfg->vad_silence_ms = atoi (val);
+            } else if(!strcasecmp(var, "vad-voice-ms")) {
+                if(val) cfg->vad_voice_ms = atoi (val);
+            } else if(!strcasecmp(var, "vad-threshold")) {
+                if(val) cfg->vad_threshold = atoi (val);
+            } else if(!strcasecmp(var, "vad-enable")) {
+                if(val) cfg->fl_vad_enabled = switch_true(val);
+            } else if(!strcasecmp(var, "vad-debug")) {
+                if(val) cfg->fl_vad_debug = switch_true(val);
+            } else if(!strcasecmp(var, "api-key")) {
+                if(!zstr(val) && cfg->api_keys_count < MAX_API_KEYS) {
+                    cfg->api_keys[cfg->api_keys_count++] = switch_core_strdup(cfg->pool, val);
+                    cfg->api_key = cfg->api_keys[0];
+                }
+            } else if(!strcasecmp(var, "api-url")) {
+                if(val) cfg->api_url = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "user-agent")) {
+                if(val) cfg->user_agent = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "proxy")) {
+                if(val) cfg->proxy = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "proxy-credentials")) {
+                if(val) cfg->proxy_credentials = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "sidecar-socket")) {
+                if(!zstr(val)) cfg->sidecar_socket = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "sidecar-fallback")) {
+                if(val) cfg->fl_sidecar_fallback = switch_true(val);
+            } else if(!strcasecmp(var, "journal-dir")) {
+                if(!zstr(val)) cfg->journal_dir = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "journal-audio")) {
+                if(val) cfg->fl_journal_audio = switch_true(val);
+            } else if(!strcasecmp(var, "journal-segment-mb")) {
+                if(val && switch_is_number(val)) cfg->journal_segment_mb = atoi(val);
+            } else if(!strcasecmp(var, "journal-max-segments")) {
+                if(val && switch_is_number(val)) cfg->journal_max_segments = atoi(val);
+            } else if(!strcasecmp(var, "capture-dir")) {
+                if(!zstr(val)) cfg->capture_dir = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "capture-max-mb")) {
+                if(val && switch_is_number(val)) cfg->capture_max_mb = atoi(val);
+            } else if(!strcasecmp(var, "spill")) {
+                if(val) cfg->fl_spill = switch_true(val);
+            } else if(!strcasecmp(var, "spill-dir")) {
+                if(!zstr(val)) cfg->spill_dir = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "spill-max-mb")) {
+                if(val && switch_is_number(val)) cfg->spill_max_mb = atoi(val);
+            } else if(!strcasecmp(var, "spill-drain-per-min")) {
+                if(val && switch_is_number(val)) cfg->spill_drain_per_min = atoi(val);
+            } else if(!strcasecmp(var, "chunk-overlap-ms")) {
+                if(val && switch_is_number(val)) cfg->chunk_overlap_ms = atoi(val);
+            } else if(!strcasecmp(var, "grammar-templates-dir")) {
+                if(!zstr(val)) cfg->grammar_templates_dir = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "grammar-learn")) {
+                if(val) cfg->fl_grammar_learn = switch_true(val);
+            } else if(!strcasecmp(var, "grammar-max-ms")) {
+                if(val && switch_is_number(val)) cfg->grammar_max_ms = atoi(val);
+            } else if(!strcasecmp(var, "grammar-confidence")) {
+                if(val && switch_is_number(val)) cfg->grammar_confidence = atof(val);
+            } else if(!strcasecmp(var, "grammar-max-distance")) {
+                if(val && switch_is_number(val)) cfg->grammar_max_distance = atof(val);
+            } else if(!strcasecmp(var, "realtime")) {
+                if(val) cfg->fl_realtime = switch_true(val);
+            } else if(!strcasecmp(var, "realtime-url")) {
+                if(!zstr(val)) cfg->realtime_url = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "realtime-model")) {
+                if(!zstr(val)) cfg->realtime_model = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "default-language")) {
+                if(val) cfg->default_lang = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "encoding")) {
+                if(val) cfg->opt_encoding = switch_core_strdup(cfg->pool, gcp_get_encoding(val));
+            } else if(!strcasecmp(var, "chunk-size-sec")) {
+                if(val) cfg->chunk_size_sec = atoi(val);
+            } else if(!strcasecmp(var, "request-timeout")) {
+                if(val) cfg->request_timeout = atoi(val);
+            } else if(!strcasecmp(var, "connect-timeout")) {
+                if(val) cfg->connect_timeout = atoi(val);
+            } else if(!strcasecmp(var, "speech-model")) {
+                if(val) cfg->opt_speech_model = switch_core_strdup(cfg->pool, val);
+            } else if(!strcasecmp(var, "use-enhanced-model")) {
+                if(val) cfg->opt_use_enhanced_model = switch_true(val);
+            } else if(!strcasecmp(var, "max-alternatives")) {
+                if(val) cfg->opt_max_alternatives = atoi(val);
+            } else if(!strcasecmp(var, "enable-word-time-offsets")) {
+                if(val) cfg->opt_enable_word_time_offsets = switch_true(val);
+            } else if(!strcasecmp(var, "enable-word-confidence")) {
+                if(val) cfg->opt_enable_word_confidence = switch_true(val);
+            } else if(!strcasecmp(var, "enable-profanity-filter")) {
+                if(val) cfg->opt_enable_profanity_filter = switch_true(val);
+            } else if(!strcasecmp(var, "enable-automatic-punctuation")) {
+                if(val) cfg->opt_enable_automatic_punctuation = switch_true(val);
+            } else if(!strcasecmp(var, "enable-spoken-punctuation")) {
+                if(val) cfg->opt_enable_spoken_punctuation = switch_true(val);
+            } else if(!strcasecmp(var, "enable-spoken-emojis")) {
+                if(val) cfg->opt_enable_spoken_emojis = switch_true(val);
+            } else if(!strcasecmp(var, "microphone-distance")) {
+                if(val) cfg->opt_meta_microphone_distance = switch_core_strdup(cfg->pool, gcp_get_microphone_distance(val));
+            } else if(!strcasecmp(var, "recording-device-type")) {
+                if(val) cfg->opt_meta_recording_device_type = switch_core_strdup(cfg->pool, gcp_get_recording_device(val));
+            } else if(!strcasecmp(var, "interaction-type")) {
+                if(val) cfg->opt_meta_interaction_type = switch_core_strdup(cfg->pool, gcp_get_interaction(val));
+            } else if(!strcasecmp(var, "start-input-timers")) {
+                if(val) cfg->start_input_timers = switch_true(val);
+            } else if(!strcasecmp(var, "no-input-timeout")) {
+                if(val && switch_is_number(val)) cfg->no_input_timeout = atoi(val);
+            } else if(!strcasecmp(var, "progressive-upload")) {
+                if(val) cfg->fl_progressive_upload = switch_true(val);
+            } else if(!strcasecmp(var, "max-parallel-uploads")) {
+                if(val && switch_is_number(val)) cfg->max_parallel_uploads = atoi(val);
+            } else if(!strcasecmp(var, "audio-buffer-ms")) {
+                if(val && switch_is_number(val)) cfg->audio_buffer_ms = atoi(val);
+            } else if(!strcasecmp(var, "audio-overflow-policy")) {
+                if(val) {
+                    if(!strcasecmp(val, "drop-newest")) { cfg->overflow_policy = OVERFLOW_DROP_NEWEST; }
+                    else if(!strcasecmp(val, "compact-silence")) { cfg->overflow_policy = OVERFLOW_COMPACT_SILENCE; }
+                    else { cfg->overflow_policy = OVERFLOW_DROP_OLDEST; }
+                }
+            } else if(!strcasecmp(var, "classifier-enable")) {
+                if(val) cfg->fl_classifier_enabled = switch_true(val);
+            } else if(!strcasecmp(var, "classifier-min-voiced-ms")) {
+                if(val && switch_is_number(val)) cfg->classifier_min_voiced_ms = atoi(val);
+            } else if(!strcasecmp(var, "classifier-max-flatness")) {
+                if(val && switch_is_number(val)) cfg->classifier_max_flatness = atof(val);
+            } else if(!strcasecmp(var, "classifier-tone-ratio")) {
+                if(val && switch_is_number(val)) cfg->classifier_tone_ratio = atof(val);
+            } else if(!strcasecmp(var, "classifier-tone-frames")) {
+                if(val && switch_is_number(val)) cfg->classifier_tone_frames = atof(val);
+            } else if(!strcasecmp(var, "nlsml")) {
+                if(val) cfg->fl_nlsml = switch_true(val);
+            } else if(!strcasecmp(var, "coalesce")) {
+                if(val) cfg->fl_coalesce = switch_true(val);
+            } else if(!strcasecmp(var, "coalesce-max-sec")) {
+                if(val && switch_is_number(val)) cfg->coalesce_max_sec = atoi(val);
+            } else if(!strcasecmp(var, "coalesce-max-age-ms")) {
+                if(val && switch_is_number(val)) cfg->coalesce_max_age_ms = atoi(val);
+            } else if(!strcasecmp(var, "coalesce-gap-ms")) {
+                if(val && switch_is_number(val)) cfg->coalesce_gap_ms = atoi(val);
+            } else if(!strcasecmp(var, "log-level")) {
+                if(val) cfg->log_level = switch_log_str2level(val);
+            } else if(!strcasecmp(var, "log-sample-rate")) {
+                if(val && switch_is_number(val)) cfg->log_sample_rate = atoi(val);
+            } else if(!strcasecmp(var, "log-transcripts")) {
+                if(val) cfg->fl_log_transcripts = switch_true(val);
+            }
+        }
+    }
+
+    if(!cfg->api_url) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid parameter: api-url\n");
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    }
+    if(!cfg->api_key) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid parameter: api-key\n");
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    }
+
+    cfg->api_url_ep = switch_string_replace(cfg->api_url, "${api-key}", cfg->api_key);
+    if(!cfg->api_url_ep) {
+        cfg->api_url_ep = strdup(cfg->api_url);
+    }
+
+    cfg->chunk_size_sec = cfg->chunk_size_sec > 0 ? MAX(cfg->chunk_size_sec, (cfg->chunk_overlap_ms ? OVERLAP_MIN_CHUNK_SEC : DEF_CHUNK_SZ_SEC)) : DEF_CHUNK_SZ_SEC;
+    cfg->chunk_overlap_ms = MIN(cfg->chunk_overlap_ms, (cfg->chunk_size_sec * 1000) / 2);
+    cfg->audio_buffer_ms = cfg->audio_buffer_ms > 0 ? cfg->audio_buffer_ms : DEF_AUDIO_BUFFER_MS;
+    cfg->max_parallel_uploads = cfg->max_parallel_uploads > 0 ? MIN(cfg->max_parallel_uploads, MAX_PARALLEL_UPLOADS) : DEF_PARALLEL_UPLOADS;
+    cfg->classifier_min_voiced_ms = cfg->classifier_min_voiced_ms > 0 ? cfg->classifier_min_voiced_ms : CLS_MIN_VOICED_MS;
+    cfg->classifier_max_flatness = cfg->classifier_max_flatness > 0 ? cfg->classifier_max_flatness : CLS_MAX_FLATNESS;
+    cfg->classifier_tone_ratio = cfg->classifier_tone_ratio > 0 ? cfg->classifier_tone_ratio : CLS_TONE_RATIO;
+    cfg->classifier_tone_frames = cfg->classifier_tone_frames > 0 ? cfg->classifier_tone_frames : CLS_TONE_FRAMES;
+    cfg->coalesce_max_sec = MIN((cfg->coalesce_max_sec > 0 ? cfg->coalesce_max_sec : DEF_COALESCE_MAX_SEC), cfg->chunk_size_sec);
+    cfg->coalesce_max_age_ms = cfg->coalesce_max_age_ms > 0 ? cfg->coalesce_max_age_ms : DEF_COALESCE_MAX_AGE_MS;
+    cfg->journal_segment_mb = cfg->journal_segment_mb > 0 ? MIN(cfg->journal_segment_mb, 2048) : DEF_JOURNAL_SEGMENT_MB;
+    cfg->capture_max_mb = cfg->capture_max_mb > 0 ? cfg->capture_max_mb : DEF_CAPTURE_MAX_MB;
+    cfg->spill_max_mb = cfg->spill_max_mb > 0 ? cfg->spill_max_mb : DEF_SPILL_MAX_MB;
+    cfg->spill_drain_per_min = cfg->spill_drain_per_min > 0 ? cfg->spill_drain_per_min : DEF_SPILL_DRAIN_PER_MIN;
+    cfg->grammar_max_ms = cfg->grammar_max_ms > 0 ? cfg->grammar_max_ms : DEF_GRAMMAR_MAX_MS;
+    cfg->grammar_confidence = cfg->grammar_confidence > 0 ? cfg->grammar_confidence : DEF_GRAMMAR_CONFIDENCE;
+    cfg->grammar_max_distance = cfg->grammar_max_distance > 0 ? cfg->grammar_max_distance : DEF_GRAMMAR_MAX_DISTANCE;
+    cfg->realtime_url = cfg->realtime_url ? cfg->realtime_url : DEF_REALTIME_URL;
+    cfg->realtime_model = cfg->realtime_model ? cfg->realtime_model : DEF_REALTIME_MODEL;
+    cfg->opt_encoding = cfg->opt_encoding ?  cfg->opt_encoding : gcp_get_encoding("l16");
+    cfg->opt_speech_model = cfg->opt_speech_model ?  cfg->opt_speech_model : "phone_call";
+    cfg->opt_max_alternatives = cfg->opt_max_alternatives > 0 ? cfg->opt_max_alternatives : 1;
+    cfg->opt_meta_microphone_distance = cfg->opt_meta_microphone_distance ? cfg->opt_meta_microphone_distance : gcp_get_microphone_distance("unspecified");
+    cfg->opt_meta_recording_device_type = cfg->opt_meta_recording_device_type ? cfg->opt_meta_recording_device_type : gcp_get_recording_device("unspecified");
+    cfg->opt_meta_interaction_type = cfg->opt_meta_interaction_type ? cfg->opt_meta_interaction_type : gcp_get_interaction("unspecified");
+
+
+    switch_mutex_lock(globals.mutex);
+    cfg->gen = ++globals.config_gen;
+    switch_mutex_unlock(globals.mutex);
+
+    apikey_sync(cfg);
+
+    switch_atomic_set(&cfg->refs, 1);
+out:
+    if(xml) {
+        switch_xml_free(xml);
+    }
+    if(status != SWITCH_STATUS_SUCCESS) {
+        config_destroy(cfg);
+        cfg = NULL;
+    }
+    *out = cfg;
+    return status;
+}
+
+switch_status_t config_reload() {
+    config_t *cfg = NULL, *old = NULL;
+
+    if(config_load(&cfg) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Reload failed, keeping the current configuration\n");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_mutex_lock(globals.mutex);
+    old = globals.config;
+    globals.config = cfg;
+    switch_mutex_unlock(globals.mutex);
+
+    config_release(&old);
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "Configuration reloaded (gen=%u)\n", cfg->gen);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+config_t *config_acquire() {
+    config_t *cfg = NULL;
+
+    switch_mutex_lock(globals.mutex);
+    if((cfg = globals.config) != NULL) {
+        switch_atomic_inc(&cfg->refs);
+    }
+    switch_mutex_unlock(globals.mutex);
+
+    return cfg;
+}
+
+void config_release(config_t **cfg) {
+    if(cfg && *cfg) {
+        if(!switch_atomic_dec(&(*cfg)->refs)) {
+            config_destroy(*cfg);
+        }
+        *cfg = NULL;
+    }
+}
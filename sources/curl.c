@@ -32,6 +32,31 @@ static size_t curl_io_read_callback(char *buffer, size_t size, size_t nitems, vo
     return ncur;
 }
 
+static void curl_setup_common(CURL *curl_handle, config_t *cfg) {
+    if(cfg->connect_timeout > 0) {
+        switch_curl_easy_setopt(curl_handle, CURLOPT_CONNECTTIMEOUT, cfg->connect_timeout);
+    }
+    if(cfg->user_agent) {
+        switch_curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, cfg->user_agent);
+    }
+    if(strncasecmp(cfg->api_url_ep, "https", 5) == 0) {
+        switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYPEER, 0);
+        switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYHOST, 0);
+    }
+    if(cfg->proxy) {
+        if(cfg->proxy_credentials != NULL) {
+            switch_curl_easy_setopt(curl_handle, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
+            switch_curl_easy_setopt(curl_handle, CURLOPT_PROXYUSERPWD, cfg->proxy_credentials);
+        }
+        if(strncasecmp(cfg->proxy, "https", 5) == 0) {
+            switch_curl_easy_setopt(curl_handle, CURLOPT_PROXY_SSL_VERIFYPEER, 0);
+        }
+        switch_curl_easy_setopt(curl_handle, CURLOPT_PROXY, cfg->proxy);
+    }
+
+    switch_curl_easy_setopt(curl_handle, CURLOPT_URL, cfg->api_url_ep);
+}
+
 switch_status_t curl_perform(gasr_ctx_t *asr_ctx) {
     switch_status_t status = SWITCH_STATUS_SUCCESS;
     CURL *curl_handle = NULL;
@@ -50,31 +75,11 @@ switch_status_t curl_perform(gasr_ctx_t *asr_ctx) {
     switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, curl_io_write_callback);
     switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *) asr_ctx);
 
-    if(globals.connect_timeout > 0) {
-        switch_curl_easy_setopt(curl_handle, CURLOPT_CONNECTTIMEOUT, globals.connect_timeout);
-    }
-    if(globals.request_timeout > 0) {
-        switch_curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, globals.request_timeout);
-    }
-    if(globals.user_agent) {
-        switch_curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, globals.user_agent);
-    }
-    if(strncasecmp(globals.api_url_ep, "https", 5) == 0) {
-        switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYPEER, 0);
-        switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYHOST, 0);
-    }
-    if(globals.proxy) {
-        if(globals.proxy_credentials != NULL) {
-            switch_curl_easy_setopt(curl_handle, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
-            switch_curl_easy_setopt(curl_handle, CURLOPT_PROXYUSERPWD, globals.proxy_credentials);
-        }
-        if(strncasecmp(globals.proxy, "https", 5) == 0) {
-            switch_curl_easy_setopt(curl_handle, CURLOPT_PROXY_SSL_VERIFYPEER, 0);
-        }
-        switch_curl_easy_setopt(curl_handle, CURLOPT_PROXY, globals.proxy);
+    if(asr_ctx->cfg->request_timeout > 0) {
+        switch_curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, asr_ctx->cfg->request_timeout);
     }
 
-    switch_curl_easy_setopt(curl_handle, CURLOPT_URL, globals.api_url_ep);
+    curl_setup_common(curl_handle, asr_ctx->cfg);
 
     curl_ret = switch_curl_easy_perform(curl_handle);
     if(!curl_ret) {
@@ -85,7 +90,7 @@ switch_status_t curl_perform(gasr_ctx_t *asr_ctx) {
     }
 
     if(http_resp != 200) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "http-error=[%ld] (%s)\n", http_resp, globals.api_url);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "http-error=[%ld] (%s)\n", http_resp, asr_ctx->cfg->api_url);
         status = SWITCH_STATUS_FALSE;
     }
 
@@ -105,3 +110,272 @@ switch_status_t curl_perform(gasr_ctx_t *asr_ctx) {
 
     return status;
 }
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// progressive upload
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+static size_t curl_stream_write_callback(char *buffer, size_t size, size_t nitems, void *user_data) {
+    upload_stream_t *stream = (upload_stream_t *)user_data;
+    size_t len = (size * nitems);
+
+    if(len > 0) {
+        switch_buffer_write(stream->recv_buffer, buffer, len);
+    }
+
+    return len;
+}
+
+static uint8_t curl_stream_aborted(upload_stream_t *stream) {
+    return (stream->fl_cancel || stream->asr_ctx->fl_destroyed || globals.fl_shutdown || stream->kill_gen != stream->asr_ctx->kill_gen);
+}
+
+/**
+ ** head -> audio frames as they arrive -> tail
+ ** blocks (in the upload thread) while the queue is empty and the end of audio isn't reached yet
+ **/
+static size_t curl_stream_read_callback(char *buffer, size_t size, size_t nitems, void *user_data) {
+    upload_stream_t *stream = (upload_stream_t *)user_data;
+    size_t nmax = (size * nitems), ncur = 0;
+    void *pop = NULL;
+
+    if(curl_stream_aborted(stream)) {
+        return CURL_READFUNC_ABORT;
+    }
+
+    if(stream->head_len > stream->offs) {
+        ncur = MIN(nmax, stream->head_len - stream->offs);
+        memcpy(buffer, stream->head + stream->offs, ncur);
+        stream->offs += ncur;
+        if(stream->offs == stream->head_len) { stream->offs = 0; stream->head_len = 0; }
+        return ncur;
+    }
+
+    while(!stream->fl_eof) {
+        if(stream->cur) {
+            ncur = MIN(nmax, stream->cur->len - stream->offs);
+            memcpy(buffer, stream->cur->data + stream->offs, ncur);
+            stream->offs += ncur;
+            stream->bytes_sent += ncur;
+            if(stream->offs == stream->cur->len) {
+                xdata_buffer_free(&stream->cur);
+                stream->cur = NULL;
+                stream->offs = 0;
+            }
+            return ncur;
+        }
+        if(switch_queue_pop_timeout(stream->q_data, &pop, 20000) == SWITCH_STATUS_SUCCESS) {
+            xdata_buffer_t *buf = (xdata_buffer_t *)pop;
+            if(!buf || !buf->len) {
+                xdata_buffer_free(&buf);
+                stream->fl_eof = true;
+                break;
+            }
+            stream->cur = buf;
+            stream->offs = 0;
+            continue;
+        }
+        if(curl_stream_aborted(stream)) {
+            return CURL_READFUNC_ABORT;
+        }
+    }
+
+    if(stream->tail_len > stream->offs) {
+        ncur = MIN(nmax, stream->tail_len - stream->offs);
+        memcpy(buffer, stream->tail + stream->offs, ncur);
+        stream->offs += ncur;
+    }
+
+    return ncur;
+}
+
+static size_t curl_stream_header_callback(char *buffer, size_t size, size_t nitems, void *user_data) {
+    apikey_header((apikey_limits_t *)user_data, buffer, size * nitems);
+    return size * nitems;
+}
+
+static int curl_stream_progress_callback(void *user_data, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    return (curl_stream_aborted((upload_stream_t *)user_data) ? 1 : 0);
+}
+
+switch_status_t curl_upload_stream(upload_stream_t *stream) {
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    config_t *cfg = stream->asr_ctx->cfg;
+    CURL *curl_handle = NULL;
+    switch_curl_slist_t *headers = NULL;
+    switch_CURLcode curl_ret = 0;
+    char *hdr_auth = NULL, *hdr_ctype = NULL;
+    long http_resp = 0;
+    apikey_t *key = apikey_acquire(cfg);
+    apikey_limits_t lim;
+
+    apikey_limits_init(&lim);
+    hdr_auth = switch_mprintf("Authorization: Bearer %s", (key ? key->key : cfg->api_key));
+    hdr_ctype = switch_mprintf("Content-Type: multipart/form-data; boundary=%s", stream->boundary);
+
+    curl_handle = switch_curl_easy_init();
+    headers = switch_curl_slist_append(headers, hdr_ctype);
+    headers = switch_curl_slist_append(headers, hdr_auth);
+    headers = switch_curl_slist_append(headers, "Transfer-Encoding: chunked");
+    headers = switch_curl_slist_append(headers, "Expect:");
+
+    switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, headers);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_POST, 1);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_READFUNCTION, curl_stream_read_callback);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_READDATA, (void *) stream);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, curl_stream_write_callback);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *) stream);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_NOPROGRESS, 0);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_XFERINFOFUNCTION, curl_stream_progress_callback);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_XFERINFODATA, (void *) stream);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, curl_stream_header_callback);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, (void *) &lim);
+
+    // the request stays open while the caller speaks
+    switch_curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, (long)(cfg->chunk_size_sec + MAX(cfg->request_timeout, 1)));
+
+    curl_setup_common(curl_handle, cfg);
+
+    curl_ret = switch_curl_easy_perform(curl_handle);
+    if(!curl_ret) {
+        switch_curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &http_resp);
+    }
+    stream->http_code = http_resp;
+    lim.http_code = http_resp;
+    apikey_release(key, &lim, cfg);
+
+    if(http_resp != 200) {
+        // 411 Length Required, 501 Not Implemented, 505 HTTP Version Not Supported: no chunked bodies on the way
+        stream->fl_unsupported = (http_resp == 411 || http_resp == 501 || http_resp == 505);
+        if(!curl_stream_aborted(stream)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "stream http-error=[%ld] curl=[%d] (%s)\n", http_resp, curl_ret, cfg->api_url);
+        }
+        status = SWITCH_STATUS_FALSE;
+    }
+
+    if(switch_buffer_inuse(stream->recv_buffer) > 0) {
+        switch_buffer_write(stream->recv_buffer, "\0", 1);
+    }
+
+    switch_curl_easy_cleanup(curl_handle);
+    switch_curl_slist_free_all(headers);
+    switch_safe_free(hdr_auth);
+    switch_safe_free(hdr_ctype);
+
+    return status;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// buffered upload
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+static size_t curl_buffered_write_callback(char *buffer, size_t size, size_t nitems, void *user_data) {
+    switch_buffer_t *recv_buffer = (switch_buffer_t *)user_data;
+    size_t len = (size * nitems);
+
+    if(len > 0) {
+        switch_buffer_write(recv_buffer, buffer, len);
+    }
+
+    return len;
+}
+
+static int curl_buffered_progress_callback(void *user_data, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    gasr_ctx_t *asr_ctx = (gasr_ctx_t *)user_data;
+    return (asr_ctx->fl_destroyed || globals.fl_shutdown ? 1 : 0);
+}
+
+static void curl_form_field(curl_mime *mime, const char *name, const char *value) {
+    curl_mimepart *part = curl_mime_addpart(mime);
+
+    curl_mime_name(part, name);
+    curl_mime_data(part, value, CURL_ZERO_TERMINATED);
+}
+
+/**
+ ** the chunk written out as a wav file, in one multipart request; the response body goes to recv_buffer (NUL terminated)
+ ** the rate limit headers go to the key pool as with the progressive upload
+ ** fl_words: verbose_json with word timestamps, fl_segments: the segments kept along (they go away with words alone)
+ **/
+switch_status_t curl_transcribe(gasr_ctx_t *asr_ctx, const char *fname, uint8_t fl_verbose, uint8_t fl_words, uint8_t fl_segments, switch_buffer_t *recv_buffer) {
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    config_t *cfg = asr_ctx->cfg;
+    const char *prompt = grammar_prompt(asr_ctx);
+    CURL *curl_handle = NULL;
+    curl_mime *mime = NULL;
+    curl_mimepart *part = NULL;
+    switch_curl_slist_t *headers = NULL;
+    switch_CURLcode curl_ret = 0;
+    char *hdr_auth = NULL;
+    long http_resp = 0;
+    apikey_t *key = apikey_acquire(cfg);
+    apikey_limits_t lim;
+
+    apikey_limits_init(&lim);
+    hdr_auth = switch_mprintf("Authorization: Bearer %s", (key ? key->key : cfg->api_key));
+
+    curl_handle = switch_curl_easy_init();
+    headers = switch_curl_slist_append(headers, hdr_auth);
+    headers = switch_curl_slist_append(headers, "Expect:");
+
+    mime = curl_mime_init(curl_handle);
+    part = curl_mime_addpart(mime);
+    curl_mime_name(part, "file");
+    curl_mime_filedata(part, fname);
+    curl_mime_type(part, "audio/wav");
+    curl_form_field(mime, "model", WHISPER_MODEL);
+    curl_form_field(mime, "language", asr_ctx->lang);
+    if(prompt) {
+        curl_form_field(mime, "prompt", prompt);
+    }
+    if(fl_verbose || fl_words) {
+        curl_form_field(mime, "response_format", "verbose_json");
+    }
+    if(fl_words) {
+        curl_form_field(mime, "timestamp_granularities[]", "word");
+    }
+    if(fl_words && fl_segments) {
+        curl_form_field(mime, "timestamp_granularities[]", "segment");
+    }
+
+    switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, headers);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_MIMEPOST, mime);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, curl_buffered_write_callback);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *) recv_buffer);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_NOPROGRESS, 0);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_XFERINFOFUNCTION, curl_buffered_progress_callback);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_XFERINFODATA, (void *) asr_ctx);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, curl_stream_header_callback);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, (void *) &lim);
+
+    if(cfg->request_timeout > 0) {
+        switch_curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, cfg->request_timeout);
+    }
+
+    curl_setup_common(curl_handle, cfg);
+
+    curl_ret = switch_curl_easy_perform(curl_handle);
+    if(!curl_ret) {
+        switch_curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &http_resp);
+    }
+    lim.http_code = http_resp;
+    apikey_release(key, &lim, cfg);
+
+    if(http_resp != 200) {
+        if(!asr_ctx->fl_destroyed && !globals.fl_shutdown) {
+            slog_printf(cfg, SWITCH_LOG_ERROR, "uuid=%s stage=api http=%ld curl=%d", asr_ctx->uuid, http_resp, curl_ret);
+        }
+        status = SWITCH_STATUS_FALSE;
+    }
+
+    if(switch_buffer_inuse(recv_buffer) > 0) {
+        switch_buffer_write(recv_buffer, "\0", 1);
+    }
+
+    switch_curl_easy_cleanup(curl_handle);
+    curl_mime_free(mime);
+    switch_curl_slist_free_all(headers);
+    switch_safe_free(hdr_auth);
+
+    return status;
+}
@@ -0,0 +1,162 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+
+/**
+ ** Per-frame part of asr_feed (pre-roll store, G.711 decode and VAD, queueing the audio), built per codec and
+ ** frame size: with FRAME_LEN set the copies, the decode loop and the pre-roll ring arithmetic work on constants.
+ ** FRAME_LEN 0 is the generic kernel, it takes the sizes from the session and handles any frame.
+ ** The kernel is picked in asr_open for FEED_PTIME frames and again on the first frame if it has another size;
+ ** a frame of another size than the kernel's (the last one of a file, ...) is passed to the generic one.
+ **/
+
+static inline switch_byte_t *bytes_alloc(uint32_t len) {
+    void *ptr = NULL;
+    switch_malloc(ptr, len); // assigns a void *, C++ wants the cast
+    return (switch_byte_t *)ptr;
+}
+
+static constexpr uint32_t frame_bytes(uint8_t codec, uint32_t samplerate, uint32_t ptime) {
+    return (samplerate / 1000) * ptime * (codec == CODEC_L16 ? sizeof(int16_t) : 1);
+}
+
+template<uint8_t CODEC, uint32_t FRAME_LEN>
+static switch_status_t feed_kernel(gasr_ctx_t *asr_ctx, switch_byte_t *data, uint32_t data_len) {
+    const uint32_t frame_len = (FRAME_LEN ? FRAME_LEN : asr_ctx->frame_len);
+    const uint32_t vad_buffer_size = (FRAME_LEN ? FRAME_LEN * VAD_STORE_FRAMES : asr_ctx->vad_buffer_size);
+    switch_vad_state_t vad_state = SWITCH_VAD_STATE_NONE;
+    uint8_t fl_has_audio = false;
+    uint32_t recover_len = 0;
+    uint32_t samples = 0;
+    int16_t *pcm = NULL;
+
+    if(FRAME_LEN && data_len != FRAME_LEN) {
+        return feed_kernel<CODEC, 0>(asr_ctx, data, data_len);
+    }
+
+    if(asr_ctx->fl_vad_enabled && asr_ctx->vad_buffer_size) {
+        if(asr_ctx->vad_state == SWITCH_VAD_STATE_NONE || asr_ctx->vad_state == SWITCH_VAD_STATE_STOP_TALKING) {
+            if((uint32_t)asr_ctx->vad_buffer_offs >= vad_buffer_size) {
+                recover_len = vad_buffer_size / 2;
+                memcpy((void *)(asr_ctx->vad_buffer), (void *)(asr_ctx->vad_buffer + recover_len), recover_len);
+                memset((void *)(asr_ctx->vad_buffer + recover_len), 0, recover_len);
+                asr_ctx->vad_buffer_offs = recover_len;
+                asr_ctx->vad_stored_frames = VAD_STORE_FRAMES / 2;
+            }
+            memcpy((void *)(asr_ctx->vad_buffer + asr_ctx->vad_buffer_offs), data, (FRAME_LEN ? FRAME_LEN : MIN(frame_len, data_len)));
+            asr_ctx->vad_buffer_offs += frame_len;
+            asr_ctx->vad_stored_frames++;
+        }
+
+        if(CODEC == CODEC_L16) {
+            pcm = (int16_t *)data;
+            samples = (FRAME_LEN ? FRAME_LEN : data_len) / sizeof(int16_t);
+        } else {
+            const int16_t *tbl = g711_table(CODEC);
+
+            pcm = asr_ctx->pcm_buffer;
+            samples = (FRAME_LEN ? FRAME_LEN : MIN(frame_len, data_len));
+            for(uint32_t i = 0; i < samples; i++) {
+                pcm[i] = tbl[data[i]];
+            }
+        }
+
+        vad_state = switch_vad_process(asr_ctx->vad, pcm, samples);
+
+        if(asr_ctx->start_input_timers) {
+            if(vad_state == SWITCH_VAD_STATE_NONE && asr_ctx->silence_time > 0) {
+                switch_time_t elapsed_ms = (switch_micro_time_now() - asr_ctx->silence_time) / 1000;
+                if(asr_ctx->no_input_timeout > 0 && elapsed_ms >= asr_ctx->no_input_timeout) {
+                    return SWITCH_STATUS_BREAK;
+                }
+            }
+        }
+        if(vad_state == SWITCH_VAD_STATE_START_TALKING) {
+            if(asr_ctx->session) {
+                switch_channel_t *channel = switch_core_session_get_channel(asr_ctx->session);
+                switch_channel_set_flag(channel, CF_BREAK);
+            }
+            asr_ctx->vad_state = vad_state;
+            asr_ctx->fl_drop_reported = false;
+            __atomic_store_n(&asr_ctx->t_speech_start, switch_micro_time_now(), __ATOMIC_RELAXED);
+            fl_has_audio = true;
+        } else if(vad_state == SWITCH_VAD_STATE_STOP_TALKING) {
+            asr_ctx->vad_state = vad_state;
+            __atomic_store_n(&asr_ctx->t_speech_end, switch_micro_time_now(), __ATOMIC_RELAXED);
+            fl_has_audio = false;
+            switch_vad_reset(asr_ctx->vad);
+        } else if(vad_state == SWITCH_VAD_STATE_TALKING) {
+            asr_ctx->vad_state = vad_state;
+            fl_has_audio = true;
+        }
+    } else {
+        fl_has_audio = true;
+    }
+
+    if(fl_has_audio) {
+        xdata_buffer_t *au_buf = NULL;
+
+        if(vad_state == SWITCH_VAD_STATE_START_TALKING && asr_ctx->vad_buffer_offs > 0) {
+            if(asr_ctx->vad_stored_frames >= VAD_RECOVERY_FRAMES) { asr_ctx->vad_stored_frames = VAD_RECOVERY_FRAMES; }
+
+            recover_len = (asr_ctx->vad_stored_frames * frame_len);
+            asr_ctx->vad_buffer_offs -= recover_len;
+            if(asr_ctx->vad_buffer_offs < 0 ) { asr_ctx->vad_buffer_offs = 0; }
+
+            xdata_buffer_alloc(&au_buf, NULL, 0);
+            au_buf->data = bytes_alloc(recover_len + data_len);
+            au_buf->len = recover_len + data_len;
+
+            memcpy(au_buf->data, asr_ctx->vad_buffer + asr_ctx->vad_buffer_offs, recover_len);
+            memcpy(au_buf->data + recover_len, data, (FRAME_LEN ? FRAME_LEN : data_len));
+
+            audio_queue_push(asr_ctx, au_buf);
+
+            asr_ctx->vad_stored_frames = 0;
+            asr_ctx->vad_buffer_offs = 0;
+        } else {
+            xdata_buffer_alloc(&au_buf, NULL, 0);
+            au_buf->data = bytes_alloc(FRAME_LEN ? FRAME_LEN : data_len);
+            au_buf->len = (FRAME_LEN ? FRAME_LEN : data_len);
+            memcpy(au_buf->data, data, (FRAME_LEN ? FRAME_LEN : data_len));
+
+            audio_queue_push(asr_ctx, au_buf);
+        }
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+#define FEED_KERNEL(codec, samplerate, ptime) { codec, samplerate, frame_bytes(codec, samplerate, ptime), feed_kernel<codec, frame_bytes(codec, samplerate, ptime)> }
+
+static const struct {
+    uint8_t         codec;
+    uint32_t        samplerate;
+    uint32_t        frame_len;
+    feed_kernel_t   kernel;
+} kernels[] = {
+    FEED_KERNEL(CODEC_L16,  8000,  20),
+    FEED_KERNEL(CODEC_L16,  16000, 20),
+    FEED_KERNEL(CODEC_PCMU, 8000,  20),
+    FEED_KERNEL(CODEC_PCMA, 8000,  20),
+};
+
+/**
+ ** the kernel for frames of frame_len bytes, the generic one for the codec if there is none
+ **/
+extern "C" feed_kernel_t feed_select(uint8_t codec, uint32_t samplerate, uint32_t frame_len) {
+    for(uint32_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if(kernels[i].codec == codec && kernels[i].samplerate == samplerate && kernels[i].frame_len == frame_len) {
+            return kernels[i].kernel;
+        }
+    }
+
+    switch(codec) {
+        case CODEC_PCMU: return feed_kernel<CODEC_PCMU, 0>;
+        case CODEC_PCMA: return feed_kernel<CODEC_PCMA, 0>;
+    }
+    return feed_kernel<CODEC_L16, 0>;
+}
@@ -0,0 +1,766 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+#include "whisper_api.h"
+#include <math.h>
+#include <ctype.h>
+#include <dirent.h>
+
+extern globals_t globals;
+
+/**
+ ** Grammars for closed-vocabulary turns ("say one, two or three"): builtin:digits, SRGS (the leaf <item>s, their
+ ** <tag> is the result) or a word list ("yes|no|operator", "one,two,three", a file with a phrase per line).
+ ** A short utterance is compared (MFCC + DTW) with the templates of the items: <grammar-templates-dir>/<phrase>[-*].wav
+ ** (spaces in the phrase as '_') and, with grammar-learn, the cloud results that matched an item. A clear winner
+ ** is the result without a request; otherwise the chunk goes to the cloud with the vocabulary as the prompt and
+ ** the text is mapped back to an item. Templates are shared by all sessions and outlive the grammars.
+ **/
+typedef struct {
+    uint32_t                refs;
+    uint32_t                frames;
+    float                   *feat;              // frames x GRAMMAR_CEPS
+} gtemplate_t;
+
+typedef struct {
+    uint32_t                count;
+    uint32_t                next;               // the oldest one when full
+    gtemplate_t             *tpl[GRAMMAR_MAX_TEMPLATES];
+} gtemplate_set_t;
+
+static struct {
+    switch_mutex_t          *mutex;
+    switch_hash_t           *sets;              // phrase => gtemplate_set_t
+    uint32_t                templates;
+    float                   win[GRAMMAR_FRAME];
+    float                   fbank[GRAMMAR_BANDS][GRAMMAR_FFT / 2 + 1];
+    float                   dct[GRAMMAR_CEPS][GRAMMAR_BANDS];
+} cache;
+
+static const char *digits[] = { "zero", "one", "two", "three", "four", "five", "six", "seven", "eight", "nine" };
+
+static double hz2mel(double hz) { return 2595.0 * log10(1.0 + hz / 700.0); }
+static double mel2hz(double mel) { return 700.0 * (pow(10.0, mel / 2595.0) - 1.0); }
+
+static void features_init() {
+    double lo = hz2mel(100), hi = hz2mel(3800);
+    double edges[GRAMMAR_BANDS + 2];
+
+    for(uint32_t i = 0; i < GRAMMAR_FRAME; i++) {
+        cache.win[i] = 0.54f - 0.46f * cos((2.0 * M_PI * i) / (GRAMMAR_FRAME - 1));
+    }
+    for(uint32_t i = 0; i < GRAMMAR_BANDS + 2; i++) {
+        edges[i] = (mel2hz(lo + ((hi - lo) * i) / (GRAMMAR_BANDS + 1)) * GRAMMAR_FFT) / GRAMMAR_RATE;
+    }
+    for(uint32_t b = 0; b < GRAMMAR_BANDS; b++) {
+        for(uint32_t k = 0; k <= GRAMMAR_FFT / 2; k++) {
+            if(k > edges[b] && k < edges[b + 1]) { cache.fbank[b][k] = (k - edges[b]) / (edges[b + 1] - edges[b]); }
+            else if(k >= edges[b + 1] && k < edges[b + 2]) { cache.fbank[b][k] = (edges[b + 2] - k) / (edges[b + 2] - edges[b + 1]); }
+        }
+    }
+    for(uint32_t c = 0; c < GRAMMAR_CEPS; c++) {
+        for(uint32_t b = 0; b < GRAMMAR_BANDS; b++) {
+            cache.dct[c][b] = cos((M_PI * (c + 1) * (b + 0.5)) / GRAMMAR_BANDS);
+        }
+    }
+}
+
+/**
+ ** any codec/rate => 8kHz pcm, wideband is averaged down like in classify.c
+ **/
+static int16_t *pcm_8k(uint8_t codec, uint32_t samplerate, const switch_byte_t *data, uint32_t data_len, uint32_t *samples) {
+    uint32_t step = MAX(1, samplerate / GRAMMAR_RATE);
+    uint32_t n = (codec == CODEC_L16 ? data_len / sizeof(int16_t) : data_len);
+    int16_t *pcm = NULL;
+
+    if(n < step) {
+        return NULL;
+    }
+    switch_malloc(pcm, n * sizeof(int16_t));
+    if(codec == CODEC_L16) {
+        memcpy(pcm, data, n * sizeof(int16_t));
+    } else {
+        g711_decode(codec, data, n, pcm);
+    }
+    if(step > 1) {
+        for(uint32_t i = 0; i < n / step; i++) {
+            int32_t acc = 0;
+            for(uint32_t j = 0; j < step; j++) { acc += pcm[(i * step) + j]; }
+            pcm[i] = acc / (int32_t)step;
+        }
+        n /= step;
+    }
+
+    *samples = n;
+    return pcm;
+}
+
+static void template_release(gtemplate_t *tpl) {
+    if(tpl && __atomic_sub_fetch(&tpl->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        switch_safe_free(tpl->feat);
+        free(tpl);
+    }
+}
+
+/**
+ ** MFCC of the voiced part (first to last frame above the threshold), mean removed; NULL if it's too short
+ **/
+static gtemplate_t *features(const int16_t *pcm, uint32_t samples, uint32_t threshold, uint32_t max_frames) {
+    uint32_t frames = (samples >= GRAMMAR_FRAME ? ((samples - GRAMMAR_FRAME) / GRAMMAR_HOP) + 1 : 0);
+    uint32_t first = frames, last = 0;
+    gtemplate_t *tpl = NULL;
+    float re[GRAMMAR_FFT], im[GRAMMAR_FFT], mean[GRAMMAR_CEPS] = { 0 };
+
+    for(uint32_t f = 0; f < frames; f++) {
+        uint64_t level = 0;
+        for(uint32_t i = 0; i < GRAMMAR_FRAME; i++) { level += abs(pcm[(f * GRAMMAR_HOP) + i]); }
+        if((level / GRAMMAR_FRAME) >= threshold) {
+            if(first == frames) { first = f; }
+            last = f;
+        }
+    }
+    if(first == frames || (last - first + 1) < GRAMMAR_MIN_FRAMES || (last - first + 1) > max_frames) {
+        return NULL;
+    }
+
+    switch_zmalloc(tpl, sizeof(gtemplate_t));
+    switch_malloc(tpl->feat, (last - first + 1) * GRAMMAR_CEPS * sizeof(float));
+    tpl->frames = last - first + 1;
+    tpl->refs = 1;
+
+    for(uint32_t f = first; f <= last; f++) {
+        const int16_t *x = pcm + (f * GRAMMAR_HOP);
+        float *c = tpl->feat + ((f - first) * GRAMMAR_CEPS);
+        float mel[GRAMMAR_BANDS];
+
+        for(uint32_t i = 0; i < GRAMMAR_FFT; i++) {
+            re[i] = (i < GRAMMAR_FRAME ? (x[i] - (i ? 0.97f * x[i - 1] : 0.0f)) * cache.win[i] : 0.0f);
+            im[i] = 0;
+        }
+        fft_radix2(re, im, GRAMMAR_FFT);
+        for(uint32_t k = 0; k <= GRAMMAR_FFT / 2; k++) {
+            re[k] = (re[k] * re[k]) + (im[k] * im[k]);
+        }
+        for(uint32_t b = 0; b < GRAMMAR_BANDS; b++) {
+            double e = 0;
+            for(uint32_t k = 0; k <= GRAMMAR_FFT / 2; k++) { e += cache.fbank[b][k] * re[k]; }
+            mel[b] = log(e + 1.0);
+        }
+        for(uint32_t i = 0; i < GRAMMAR_CEPS; i++) {
+            c[i] = 0;
+            for(uint32_t b = 0; b < GRAMMAR_BANDS; b++) { c[i] += cache.dct[i][b] * mel[b]; }
+            mean[i] += c[i];
+        }
+    }
+    for(uint32_t f = 0; f < tpl->frames; f++) {
+        for(uint32_t i = 0; i < GRAMMAR_CEPS; i++) {
+            tpl->feat[(f * GRAMMAR_CEPS) + i] -= mean[i] / tpl->frames;
+        }
+    }
+
+    return tpl;
+}
+
+/**
+ ** symmetric DTW (diagonal step counts twice), normalized by the path length; rows: 2 x (b->frames + 1)
+ **/
+static float dtw(const gtemplate_t *a, const gtemplate_t *b, float *rows) {
+    float *prev = rows, *cur = rows + b->frames + 1, *tmp = NULL;
+
+    if(a->frames > 2 * b->frames || b->frames > 2 * a->frames) {
+        return INFINITY;
+    }
+
+    prev[0] = 0;
+    for(uint32_t j = 1; j <= b->frames; j++) { prev[j] = INFINITY; }
+
+    for(uint32_t i = 1; i <= a->frames; i++) {
+        const float *x = a->feat + ((i - 1) * GRAMMAR_CEPS);
+        cur[0] = INFINITY;
+        for(uint32_t j = 1; j <= b->frames; j++) {
+            const float *y = b->feat + ((j - 1) * GRAMMAR_CEPS);
+            float d = 0, best = 0;
+            for(uint32_t k = 0; k < GRAMMAR_CEPS; k++) { d += (x[k] - y[k]) * (x[k] - y[k]); }
+            d = sqrtf(d);
+            best = MIN(prev[j] + d, cur[j - 1] + d);
+            cur[j] = MIN(best, prev[j - 1] + (2 * d));
+        }
+        tmp = prev; prev = cur; cur = tmp;
+    }
+
+    return prev[b->frames] / (a->frames + b->frames);
+}
+
+static uint32_t le16(const switch_byte_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t le32(const switch_byte_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+/**
+ ** mono 16 bit pcm or G.711 wav, the rate a multiple of 8kHz
+ **/
+static gtemplate_t *template_read(const char *path, uint32_t threshold) {
+    switch_byte_t *buf = NULL, *data = NULL;
+    uint32_t format = 0, channels = 0, rate = 0, bits = 0, data_len = 0, samples = 0;
+    gtemplate_t *tpl = NULL;
+    int16_t *pcm = NULL;
+    uint8_t codec = CODEC_L16;
+    FILE *fp = NULL;
+    long size = 0;
+
+    if((fp = fopen(path, "rb")) == NULL) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if(size < 12 || size > GRAMMAR_MAX_WAV) {
+        goto out;
+    }
+    switch_malloc(buf, size);
+    if(fread(buf, 1, size, fp) != size || memcmp(buf, "RIFF", 4) || memcmp(buf + 8, "WAVE", 4)) {
+        goto out;
+    }
+    for(long offs = 12; offs + 8 <= size; offs += 8 + le32(buf + offs + 4) + (le32(buf + offs + 4) & 1)) {
+        uint32_t clen = le32(buf + offs + 4);
+        if(!memcmp(buf + offs, "fmt ", 4) && clen >= 16 && offs + 24 <= size) {
+            format = le16(buf + offs + 8);
+            channels = le16(buf + offs + 10);
+            rate = le32(buf + offs + 12);
+            bits = le16(buf + offs + 22);
+        } else if(!memcmp(buf + offs, "data", 4)) {
+            data = buf + offs + 8;
+            data_len = MIN(clen, (uint32_t)(size - offs - 8));
+            break;
+        }
+    }
+    if(format == 6) { codec = CODEC_PCMA; }
+    else if(format == 7) { codec = CODEC_PCMU; }
+    else if(format != 1 || bits != 16) { data = NULL; }
+
+    if(!data || channels != 1 || !rate || (rate % GRAMMAR_RATE)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unsupported template: %s (format=%u channels=%u rate=%u bits=%u)\n", path, format, channels, rate, bits);
+        goto out;
+    }
+    if((pcm = pcm_8k(codec, rate, data, data_len, &samples)) != NULL) {
+        tpl = features(pcm, samples, threshold, (GRAMMAR_MAX_WAV / (GRAMMAR_RATE / 1000)) / 10);
+    }
+out:
+    switch_safe_free(pcm);
+    switch_safe_free(buf);
+    fclose(fp);
+    return tpl;
+}
+
+/**
+ ** "one two" => "one_two"
+ **/
+static void phrase_fname(const char *phrase, char *buf, uint32_t len) {
+    uint32_t i = 0;
+
+    for(; phrase[i] && i < len - 1; i++) {
+        buf[i] = (phrase[i] == ' ' ? '_' : phrase[i]);
+    }
+    buf[i] = '\0';
+}
+
+/**
+ ** the set of the phrase, read from grammar-templates-dir the first time
+ **/
+static void templates_load(config_t *cfg, const char *phrase) {
+    uint32_t threshold = (cfg->vad_threshold ? cfg->vad_threshold : SILENCE_ENERGY_THRESHOLD);
+    gtemplate_set_t *set = NULL;
+    struct dirent *de = NULL;
+    DIR *dir = NULL;
+    char base[256], path[1024];
+    size_t blen = 0;
+
+    switch_mutex_lock(cache.mutex);
+    if(switch_core_hash_find(cache.sets, phrase)) {
+        goto out;
+    }
+    switch_zmalloc(set, sizeof(gtemplate_set_t));
+    switch_core_hash_insert(cache.sets, phrase, set);
+
+    if(!cfg->grammar_templates_dir || (dir = opendir(cfg->grammar_templates_dir)) == NULL) {
+        goto out;
+    }
+    phrase_fname(phrase, base, sizeof(base));
+    blen = strlen(base);
+    while((de = readdir(dir)) != NULL && set->count < GRAMMAR_MAX_TEMPLATES) {
+        size_t nlen = strlen(de->d_name);
+        gtemplate_t *tpl = NULL;
+
+        if(nlen < blen + 4 || strncmp(de->d_name, base, blen) || strcasecmp(de->d_name + nlen - 4, ".wav")) {
+            continue;
+        }
+        if(de->d_name[blen] != '.' && de->d_name[blen] != '-') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", cfg->grammar_templates_dir, de->d_name);
+        if((tpl = template_read(path, threshold)) != NULL) {
+            set->tpl[set->count++] = tpl;
+            cache.templates++;
+        }
+    }
+    closedir(dir);
+out:
+    switch_mutex_unlock(cache.mutex);
+}
+
+/**
+ ** a cloud result matched the item: the audio becomes a template of its phrase (on disk too, until it has enough)
+ **/
+static void template_learn(gasr_ctx_t *asr_ctx, const char *phrase, const switch_byte_t *data, uint32_t data_len) {
+    config_t *cfg = asr_ctx->cfg;
+    uint32_t threshold = (cfg->vad_threshold ? cfg->vad_threshold : SILENCE_ENERGY_THRESHOLD);
+    uint32_t samples = 0;
+    gtemplate_set_t *set = NULL;
+    gtemplate_t *tpl = NULL;
+    int16_t *pcm = NULL;
+    uint8_t fl_write = false;
+
+    if((pcm = pcm_8k(asr_ctx->codec, asr_ctx->samplerate, data, data_len, &samples)) == NULL) {
+        return;
+    }
+    if((tpl = features(pcm, samples, threshold, cfg->grammar_max_ms / 10)) == NULL) {
+        goto out;
+    }
+
+    switch_mutex_lock(cache.mutex);
+    if((set = switch_core_hash_find(cache.sets, phrase)) != NULL) {
+        if(set->count < GRAMMAR_MAX_TEMPLATES) {
+            set->tpl[set->count++] = tpl;
+            cache.templates++;
+            fl_write = true;
+        } else {
+            template_release(set->tpl[set->next]);
+            set->tpl[set->next] = tpl;
+            set->next = (set->next + 1) % GRAMMAR_MAX_TEMPLATES;
+        }
+        tpl = NULL;
+    }
+    switch_mutex_unlock(cache.mutex);
+
+    if(!set) {
+        goto out;
+    }
+    __atomic_add_fetch(&globals.grammar_learned, 1, __ATOMIC_RELAXED);
+
+    if(fl_write && cfg->grammar_templates_dir) {
+        switch_byte_t hdr[WAV_HDR_MAX_SZ];
+        uint32_t hdr_len = wav_header_build(hdr, CODEC_L16, 1, GRAMMAR_RATE, samples * sizeof(int16_t));
+        char base[256], path[1024];
+        FILE *fp = NULL;
+
+        phrase_fname(phrase, base, sizeof(base));
+        snprintf(path, sizeof(path), "%s/%s-%"PRId64".wav", cfg->grammar_templates_dir, base, (int64_t)switch_micro_time_now());
+        if((fp = fopen(path, "wb")) != NULL) {
+            fwrite(hdr, 1, hdr_len, fp);
+            fwrite(pcm, sizeof(int16_t), samples, fp);
+            fclose(fp);
+        } else {
+            slog_printf(cfg, SWITCH_LOG_WARNING, "uuid=%s stage=grammar error=\"can't write %s\"", asr_ctx->uuid, path);
+        }
+    }
+out:
+    template_release(tpl);
+    switch_safe_free(pcm);
+}
+
+/**
+ ** lowercase words of letters, digits and apostrophes, one space between them (in place)
+ **/
+static char *phrase_normalize(char *s) {
+    uint8_t fl_space = false;
+    char *w = s;
+
+    for(char *r = s; *r; r++) {
+        unsigned char c = *r;
+        if(c >= 0x80 || isalnum(c) || c == '\'') {
+            if(fl_space && w > s) { *w++ = ' '; }
+            *w++ = tolower(c);
+            fl_space = false;
+        } else {
+            fl_space = true;
+        }
+    }
+    *w = '\0';
+    return s;
+}
+
+static void xml_unescape(char *s) {
+    static const char *ent[][2] = { { "&amp;", "&" }, { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" }, { "&apos;", "'" } };
+    char *w = s;
+
+    while(*s) {
+        uint8_t fl_ent = false;
+        if(*s == '&') {
+            for(uint32_t i = 0; i < sizeof(ent) / sizeof(ent[0]); i++) {
+                size_t len = strlen(ent[i][0]);
+                if(!strncmp(s, ent[i][0], len)) {
+                    *w++ = ent[i][1][0];
+                    s += len;
+                    fl_ent = true;
+                    break;
+                }
+            }
+        }
+        if(!fl_ent) { *w++ = *s++; }
+    }
+    *w = '\0';
+}
+
+/**
+ ** SISR tag: out="x"; / out='x' / out=x; / x
+ **/
+static char *tag_value(char *tag) {
+    char *p = NULL, *e = NULL, q = 0;
+
+    if((p = strpbrk(tag, "\"'")) != NULL && (e = strchr(p + 1, (q = *p))) != NULL) {
+        *e = '\0';
+        return p + 1;
+    }
+    p = tag;
+    while(isspace((unsigned char)*p)) { p++; }
+    if(!strncmp(p, "out", 3) && (e = strchr(p, '=')) != NULL) {
+        p = e + 1;
+    }
+    while(isspace((unsigned char)*p)) { p++; }
+    for(e = p + strlen(p); e > p && (isspace((unsigned char)e[-1]) || e[-1] == ';'); e--) { e[-1] = '\0'; }
+    return p;
+}
+
+static void grammar_add(switch_memory_pool_t *pool, grammar_t *gram, const char *phrase, const char *value) {
+    char *norm = NULL;
+
+    if(gram->count >= GRAMMAR_MAX_ITEMS) {
+        return;
+    }
+    norm = phrase_normalize(switch_core_strdup(pool, phrase));
+    if(zstr(norm)) {
+        return;
+    }
+    for(uint32_t i = 0; i < gram->count; i++) {
+        if(!strcmp(gram->items[i].phrase, norm)) {
+            return;
+        }
+    }
+    gram->items[gram->count].phrase = norm;
+    gram->items[gram->count].value = (zstr(value) ? norm : switch_core_strdup(pool, value));
+    gram->count++;
+}
+
+/**
+ ** the leaf <item>s: their text is the phrase, <tag> the value
+ **/
+static void srgs_parse(switch_memory_pool_t *pool, grammar_t *gram, const char *xml) {
+    const char *p = xml;
+
+    while((p = strstr(p, "<item")) != NULL) {
+        const char *body = strchr(p, '>'), *end = NULL, *next = NULL;
+        char *text = NULL, *tag = NULL;
+        uint32_t tlen = 0;
+
+        if(!body) {
+            break;
+        }
+        if(body[-1] == '/') {
+            p = body;
+            continue;
+        }
+        body++;
+        if((end = strstr(body, "</item>")) == NULL) {
+            break;
+        }
+        if((next = strstr(body, "<item")) != NULL && next < end) {
+            p = next;
+            continue;
+        }
+
+        switch_zmalloc(text, (end - body) + 1);
+        for(const char *q = body; q < end; ) {
+            if(*q == '<') {
+                const char *gt = strchr(q, '>'), *te = NULL;
+                if(!strncmp(q, "<tag", 4) && gt && (te = strstr(gt, "</tag>")) != NULL && te < end) {
+                    switch_safe_free(tag);
+                    switch_zmalloc(tag, (te - gt));
+                    memcpy(tag, gt + 1, (te - gt) - 1);
+                    q = te + 6;
+                } else {
+                    q = (gt ? gt + 1 : end);
+                }
+                continue;
+            }
+            text[tlen++] = *q++;
+        }
+        xml_unescape(text);
+        if(tag) {
+            xml_unescape(tag);
+        }
+        grammar_add(pool, gram, text, (tag ? tag_value(tag) : NULL));
+
+        switch_safe_free(text);
+        switch_safe_free(tag);
+        p = end + 7;
+    }
+}
+
+static char *file_read(const char *path) {
+    char *buf = NULL;
+    FILE *fp = NULL;
+    long size = 0;
+
+    if((fp = fopen(path, "rb")) == NULL) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if(size > 0 && size <= GRAMMAR_MAX_WAV) {
+        switch_zmalloc(buf, size + 1);
+        if(fread(buf, 1, size, fp) != size) {
+            switch_safe_free(buf);
+        }
+    }
+    fclose(fp);
+    return buf;
+}
+
+static uint8_t words_contain(const char *text, const char *words) {
+    size_t len = strlen(words);
+
+    for(const char *p = strstr(text, words); len && p; p = strstr(p + 1, words)) {
+        if((p == text || p[-1] == ' ') && (p[len] == '\0' || p[len] == ' ')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ ** the item the cloud text means: the whole text is its phrase or value, or the only one found in the text
+ **/
+static int32_t grammar_map(grammar_t *grammar, const char *text) {
+    char *norm = phrase_normalize(strdup(text));
+    int32_t found = -1;
+
+    for(uint32_t i = 0; i < grammar->count; i++) {
+        if(!strcmp(norm, grammar->items[i].phrase) || !strcasecmp(norm, grammar->items[i].value)) {
+            found = i;
+            goto out;
+        }
+    }
+    for(uint32_t i = 0; i < grammar->count; i++) {
+        if(words_contain(norm, grammar->items[i].phrase) || words_contain(norm, grammar->items[i].value)) {
+            if(found >= 0 && strcmp(grammar->items[found].value, grammar->items[i].value)) {
+                found = -1;
+                goto out;
+            }
+            found = i;
+        }
+    }
+out:
+    switch_safe_free(norm);
+    return found;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+void grammar_init(switch_memory_pool_t *pool) {
+    switch_mutex_init(&cache.mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_core_hash_init(&cache.sets);
+    features_init();
+}
+
+void grammar_shutdown() {
+    switch_hash_index_t *hi = NULL;
+    void *val = NULL;
+
+    if(!cache.sets) {
+        return;
+    }
+    for(hi = switch_core_hash_first(cache.sets); hi; hi = switch_core_hash_next(&hi)) {
+        gtemplate_set_t *set = NULL;
+        switch_core_hash_this(hi, NULL, NULL, &val);
+        set = (gtemplate_set_t *)val;
+        for(uint32_t i = 0; i < set->count; i++) {
+            template_release(set->tpl[i]);
+        }
+        switch_safe_free(set);
+    }
+    switch_core_hash_destroy(&cache.sets);
+}
+
+/**
+ ** builtin:digits, SRGS or a word list, inline or an absolute path; NULL - nothing usable (no grammar)
+ **/
+grammar_t *grammar_parse(switch_memory_pool_t *pool, config_t *cfg, const char *grammar, const char *name) {
+    const char *src = grammar;
+    grammar_t *gram = NULL;
+    char *text = NULL, *prompt = NULL;
+    uint32_t plen = 0;
+
+    if(zstr(grammar)) {
+        return NULL;
+    }
+    if(!strncasecmp(src, "inline:", 7)) {
+        src += 7;
+    }
+    gram = switch_core_alloc(pool, sizeof(grammar_t));
+    gram->name = switch_core_strdup(pool, (name ? name : "default"));
+
+    if(!strcasecmp(src, "builtin:digits") || !strcasecmp(src, "builtin:grammar/digits")) {
+        for(uint32_t i = 0; i < 10; i++) {
+            char val[2] = { '0' + i, '\0' };
+            grammar_add(pool, gram, digits[i], val);
+        }
+        grammar_add(pool, gram, "oh", "0");
+    } else {
+        if(*src == '/' && (text = file_read(src)) != NULL) {
+            src = text;
+        }
+        if(strstr(src, "<grammar") || strstr(src, "<item")) {
+            srgs_parse(pool, gram, src);
+        } else if(strpbrk(src, ",|\n")) {
+            char *list = strdup(src), *p = list, *e = NULL;
+            while(p) {
+                if((e = strpbrk(p, ",|\n")) != NULL) { *e++ = '\0'; }
+                grammar_add(pool, gram, p, NULL);
+                p = e;
+            }
+            switch_safe_free(list);
+        }
+    }
+    switch_safe_free(text);
+
+    if(!gram->count) {
+        return NULL;
+    }
+
+    for(uint32_t i = 0; i < gram->count; i++) {
+        plen += strlen(gram->items[i].phrase) + 2;
+    }
+    prompt = switch_core_alloc(pool, plen + 1);
+    for(uint32_t i = 0; i < gram->count; i++) {
+        strcat(prompt, gram->items[i].phrase);
+        strcat(prompt, (i + 1 < gram->count ? ", " : "."));
+        templates_load(cfg, gram->items[i].phrase);
+    }
+    gram->prompt = prompt;
+
+    return gram;
+}
+
+/**
+ ** the value of the matched item (free it), NULL - not sure enough, the cloud decides
+ **/
+char *grammar_recognize(gasr_ctx_t *asr_ctx, grammar_t *grammar, const switch_byte_t *data, uint32_t data_len) {
+    config_t *cfg = asr_ctx->cfg;
+    uint32_t threshold = (cfg->vad_threshold ? cfg->vad_threshold : SILENCE_ENERGY_THRESHOLD);
+    uint32_t audio_ms = data_len / ((asr_ctx->samplerate / 1000) * asr_ctx->sample_bytes);
+    uint32_t samples = 0, count = 0, max_frames = 0;
+    gtemplate_t *tpls[GRAMMAR_MAX_ITEMS * GRAMMAR_MAX_TEMPLATES], *utt = NULL;
+    uint8_t owner[GRAMMAR_MAX_ITEMS * GRAMMAR_MAX_TEMPLATES];
+    float best[GRAMMAR_MAX_ITEMS], d1 = INFINITY, d2 = INFINITY, confidence = 0, *rows = NULL;
+    switch_time_t t_start = switch_micro_time_now();
+    int32_t match = -1;
+    int16_t *pcm = NULL;
+    char *result = NULL;
+
+    if(audio_ms > cfg->grammar_max_ms) {
+        return NULL;
+    }
+    if((pcm = pcm_8k(asr_ctx->codec, asr_ctx->samplerate, data, data_len, &samples)) == NULL) {
+        return NULL;
+    }
+    if((utt = features(pcm, samples, threshold, cfg->grammar_max_ms / 10)) == NULL) {
+        goto out;
+    }
+
+    switch_mutex_lock(cache.mutex);
+    for(uint32_t i = 0; i < grammar->count; i++) {
+        gtemplate_set_t *set = switch_core_hash_find(cache.sets, grammar->items[i].phrase);
+        for(uint32_t j = 0; set && j < set->count; j++) {
+            __atomic_add_fetch(&set->tpl[j]->refs, 1, __ATOMIC_RELAXED);
+            max_frames = MAX(max_frames, set->tpl[j]->frames);
+            owner[count] = i;
+            tpls[count++] = set->tpl[j];
+        }
+        best[i] = INFINITY;
+    }
+    switch_mutex_unlock(cache.mutex);
+
+    if(count) {
+        switch_malloc(rows, 2 * (max_frames + 1) * sizeof(float));
+        for(uint32_t k = 0; k < count; k++) {
+            best[owner[k]] = MIN(best[owner[k]], dtw(utt, tpls[k], rows));
+            template_release(tpls[k]);
+        }
+        switch_safe_free(rows);
+    }
+
+    // the runner-up is the best item with another value ("zero" and "oh" don't compete)
+    for(uint32_t i = 0; i < grammar->count; i++) {
+        if(best[i] < d1) { d1 = best[i]; match = i; }
+    }
+    for(uint32_t i = 0; match >= 0 && i < grammar->count; i++) {
+        if(best[i] < d2 && strcmp(grammar->items[i].value, grammar->items[match].value)) { d2 = best[i]; }
+    }
+    confidence = (match >= 0 && isfinite(d2) && d2 > 0 ? (d2 - d1) / d2 : 0);
+
+    if(match >= 0 && d1 <= cfg->grammar_max_distance && confidence >= cfg->grammar_confidence) {
+        result = strdup(grammar->items[match].value);
+        __atomic_add_fetch(&globals.grammar_local, 1, __ATOMIC_RELAXED);
+    }
+    if(slog_sample(cfg)) {
+        slog_printf(cfg, (result ? SWITCH_LOG_NOTICE : SWITCH_LOG_INFO), "uuid=%s stage=grammar match=%s item=\"%s\" distance=%.2f confidence=%.2f templates=%u audio_ms=%u match_ms=%u",
+                    asr_ctx->uuid, (result ? "local" : "cloud"), (match >= 0 ? grammar->items[match].phrase : ""), (isfinite(d1) ? d1 : -1.0), confidence,
+                    count, audio_ms, (uint32_t)((switch_micro_time_now() - t_start) / 1000));
+    }
+out:
+    template_release(utt);
+    switch_safe_free(pcm);
+    return result;
+}
+
+/**
+ ** a cloud result of a grammar turn: replaced by the value of the item it means (and learned), kept if none
+ **/
+void grammar_result(gasr_ctx_t *asr_ctx, grammar_t *grammar, const switch_byte_t *data, uint32_t data_len, char **text) {
+    int32_t item = grammar_map(grammar, *text);
+
+    __atomic_add_fetch(&globals.grammar_cloud, 1, __ATOMIC_RELAXED);
+    if(item < 0) {
+        __atomic_add_fetch(&globals.grammar_nomatch, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_add_fetch(&globals.grammar_mapped, 1, __ATOMIC_RELAXED);
+
+    if(asr_ctx->cfg->fl_grammar_learn) {
+        template_learn(asr_ctx, grammar->items[item].phrase, data, data_len);
+    }
+    switch_safe_free(*text);
+    *text = strdup(grammar->items[item].value);
+}
+
+/**
+ ** the vocabulary of the loaded grammar, else the language prompt
+ **/
+const char *grammar_prompt(gasr_ctx_t *asr_ctx) {
+    grammar_t *grammar = __atomic_load_n(&asr_ctx->grammar, __ATOMIC_ACQUIRE);
+    return (grammar ? grammar->prompt : whisper_prompt(asr_ctx->lang));
+}
+
+uint32_t grammar_templates() {
+    uint32_t count = 0;
+
+    if(!cache.mutex) {
+        return 0;
+    }
+    switch_mutex_lock(cache.mutex);
+    count = cache.templates;
+    switch_mutex_unlock(cache.mutex);
+
+    return count;
+}
@@ -0,0 +1,412 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+extern globals_t globals;
+
+/**
+ ** Journal (journal-dir): every uploaded chunk with its audio, transcript, timings and session data goes to
+ ** append-only segments (sfwhisper-NNNNNNNN.jnl), memory mapped and pre-sized to journal-segment-mb, rotated when full.
+ ** Upload threads only queue the record (the audio buffer changes hands, no copy); one writer thread copies the
+ ** records into the mapping in batches and appends their index entries to the segment's .idx, so a lookup by
+ ** uuid reads the small .idx files and only the matching records. A new run starts a new segment.
+ **/
+typedef struct {
+    journal_rec_t           hdr;
+    char                    *text;
+    switch_byte_t           *audio;
+} journal_item_t;
+
+static struct {
+    switch_queue_t          *q_items;
+    char                    *dir;               // of the open segment
+    switch_byte_t           *map;
+    uint32_t                map_size;
+    uint32_t                offs;
+    uint32_t                no;                 // segment number
+    uint32_t                dirty;              // offs of the first byte not synced
+    int                     fd;
+    int                     idx_fd;
+    uint8_t                 fl_started;
+} journal = { .fd = -1, .idx_fd = -1 };
+
+#define JOURNAL_ALIGN(n)    (((n) + 7) & ~7)
+
+static void journal_item_free(journal_item_t **item) {
+    if(item && *item) {
+        switch_safe_free((*item)->text);
+        switch_safe_free((*item)->audio);
+        switch_safe_free(*item);
+    }
+}
+
+static uint8_t segment_no_parse(const char *name, const char *ext, uint32_t *no) {
+    char tail[8] = { 0 };
+
+    if(sscanf(name, "sfwhisper-%8u.%7s", no, tail) != 2) {
+        return false;
+    }
+    return (strcmp(tail, ext) == 0);
+}
+
+/**
+ ** highest segment number in the dir, older ones beyond journal-max-segments are removed
+ **/
+static uint32_t segments_scan(const char *dir, uint32_t keep, uint32_t next) {
+    DIR *d = NULL;
+    struct dirent *de = NULL;
+    uint32_t no = 0, last = 0;
+
+    if((d = opendir(dir)) == NULL) {
+        return 0;
+    }
+    while((de = readdir(d)) != NULL) {
+        if(segment_no_parse(de->d_name, "jnl", &no) && no > last) {
+            last = no;
+        }
+    }
+    if(keep > 0) {
+        uint32_t top = MAX(last, next);
+        rewinddir(d);
+        while((de = readdir(d)) != NULL) {
+            if((segment_no_parse(de->d_name, "jnl", &no) || segment_no_parse(de->d_name, "idx", &no)) && no + keep <= top) {
+                char *path = switch_mprintf("%s/%s", dir, de->d_name);
+                unlink(path);
+                switch_safe_free(path);
+            }
+        }
+    }
+    closedir(d);
+
+    return last;
+}
+
+static void segment_close() {
+    if(journal.map) {
+        msync(journal.map, journal.offs, MS_SYNC);
+        munmap(journal.map, journal.map_size);
+        journal.map = NULL;
+    }
+    if(journal.fd >= 0) {
+        // not needed past the last record
+        if(ftruncate(journal.fd, journal.offs) != 0) { }
+        close(journal.fd);
+        journal.fd = -1;
+    }
+    if(journal.idx_fd >= 0) {
+        close(journal.idx_fd);
+        journal.idx_fd = -1;
+    }
+    journal.offs = journal.dirty = journal.map_size = 0;
+}
+
+static switch_status_t segment_open(uint32_t min_size) {
+    config_t *cfg = config_acquire();
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    char *path = NULL;
+
+    if(!cfg || !cfg->journal_dir) {
+        goto out;
+    }
+    if(!journal.dir || strcmp(journal.dir, cfg->journal_dir) != 0) {
+        switch_safe_free(journal.dir);
+        journal.dir = strdup(cfg->journal_dir);
+        mkdir(journal.dir, 0755);
+        journal.no = segments_scan(journal.dir, 0, 0);
+    }
+    journal.no++;
+    segments_scan(journal.dir, cfg->journal_max_segments, journal.no);
+
+    journal.map_size = MAX(cfg->journal_segment_mb * 1024 * 1024, min_size);
+
+    path = switch_mprintf("%s/sfwhisper-%08u.jnl", journal.dir, journal.no);
+    if((journal.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0 || ftruncate(journal.fd, journal.map_size) != 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "sfwhisper: stage=journal open fail: %s\n", path);
+        goto out;
+    }
+    if((journal.map = mmap(NULL, journal.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, journal.fd, 0)) == MAP_FAILED) {
+        journal.map = NULL;
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "sfwhisper: stage=journal mmap fail: %s\n", path);
+        goto out;
+    }
+    switch_safe_free(path);
+
+    path = switch_mprintf("%s/sfwhisper-%08u.idx", journal.dir, journal.no);
+    if((journal.idx_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "sfwhisper: stage=journal open fail: %s\n", path);
+        goto out;
+    }
+
+    journal.offs = journal.dirty = 0;
+    status = SWITCH_STATUS_SUCCESS;
+out:
+    if(status != SWITCH_STATUS_SUCCESS) {
+        segment_close();
+    }
+    switch_safe_free(path);
+    config_release(&cfg);
+    return status;
+}
+
+static uint8_t journal_append(journal_item_t *item, journal_idx_t *idx) {
+    journal_rec_t *hdr = &item->hdr;
+
+    if(journal.map && journal.offs + hdr->len > journal.map_size) {
+        segment_close();
+    }
+    if(!journal.map && segment_open(hdr->len) != SWITCH_STATUS_SUCCESS) {
+        return false;
+    }
+
+    memcpy(journal.map + journal.offs + sizeof(journal_rec_t), item->text, hdr->text_len);
+    memcpy(journal.map + journal.offs + sizeof(journal_rec_t) + hdr->text_len, item->audio, hdr->audio_len);
+    // the header goes last, a reader never sees a magic in front of a half copied record
+    memcpy(journal.map + journal.offs, hdr, sizeof(journal_rec_t));
+
+    memcpy(idx->uuid, hdr->uuid, sizeof(idx->uuid));
+    idx->offs = journal.offs;
+    idx->len = hdr->len;
+
+    journal.offs += hdr->len;
+    return true;
+}
+
+static void *SWITCH_THREAD_FUNC journal_thread(switch_thread_t *thread, void *obj) {
+    journal_idx_t idx[JOURNAL_BATCH];
+    void *pop = NULL;
+
+    while(true) {
+        uint32_t n = 0;
+
+        while(n < JOURNAL_BATCH && switch_queue_trypop(journal.q_items, &pop) == SWITCH_STATUS_SUCCESS) {
+            journal_item_t *item = (journal_item_t *)pop;
+
+            // a rotation in the middle of the batch: the entries so far belong to the previous .idx
+            if(journal.map && journal.offs + item->hdr.len > journal.map_size && n > 0) {
+                if(write(journal.idx_fd, idx, n * sizeof(journal_idx_t)) < 0) { }
+                n = 0;
+            }
+            if(journal_append(item, &idx[n])) {
+                __atomic_add_fetch(&globals.journal_records, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&globals.journal_bytes, item->hdr.len, __ATOMIC_RELAXED);
+                n++;
+            } else {
+                __atomic_add_fetch(&globals.journal_drops, 1, __ATOMIC_RELAXED);
+            }
+            journal_item_free(&item);
+        }
+
+        if(n > 0 && journal.idx_fd >= 0) {
+            uint32_t from = journal.dirty & ~(getpagesize() - 1);
+
+            msync(journal.map + from, journal.offs - from, MS_ASYNC);
+            journal.dirty = journal.offs;
+            if(write(journal.idx_fd, idx, n * sizeof(journal_idx_t)) < 0) { }
+        }
+
+        if(n == JOURNAL_BATCH) {
+            continue;
+        }
+        if(globals.fl_shutdown) {
+            break;
+        }
+        switch_yield(JOURNAL_FLUSH_MS * 1000);
+    }
+
+    thread_finished();
+    return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+void journal_init(switch_memory_pool_t *pool) {
+    switch_queue_create(&journal.q_items, JOURNAL_QUEUE_SIZE, pool);
+}
+
+/**
+ ** the thread runs from the first config with journal-dir on (load or reload), under globals.mutex
+ **/
+void journal_start(config_t *cfg) {
+    if(cfg->journal_dir && !journal.fl_started) {
+        journal.fl_started = true;
+        thread_launch(globals.pool, journal_thread, NULL);
+    }
+}
+
+/**
+ ** called after all module threads are gone
+ **/
+void journal_shutdown() {
+    void *pop = NULL;
+
+    if(journal.q_items) {
+        while(switch_queue_trypop(journal.q_items, &pop) == SWITCH_STATUS_SUCCESS) {
+            journal_item_t *item = (journal_item_t *)pop;
+            journal_item_free(&item);
+        }
+    }
+    segment_close();
+    switch_safe_free(journal.dir);
+}
+
+/**
+ ** takes job->data (with journal-audio)
+ **/
+void journal_write(gasr_ctx_t *asr_ctx, upload_job_t *job, const char *mode, uint16_t flags, char **texts, uint32_t count, switch_time_t t_upload, switch_time_t t_done) {
+    config_t *cfg = asr_ctx->cfg;
+    journal_item_t *item = NULL;
+    journal_rec_t *hdr = NULL;
+    uint32_t text_len = 0;
+
+    if(!cfg->journal_dir || !journal.q_items) {
+        return;
+    }
+
+    for(uint32_t i = 0; texts && i < count; i++) {
+        text_len += (texts[i] ? strlen(texts[i]) : 0) + (i > 0 ? 1 : 0);
+    }
+
+    switch_zmalloc(item, sizeof(journal_item_t));
+    hdr = &item->hdr;
+    hdr->magic = JOURNAL_MAGIC;
+    hdr->timestamp = t_upload;
+    snprintf(hdr->uuid, sizeof(hdr->uuid), "%s", asr_ctx->uuid);
+    snprintf(hdr->lang, sizeof(hdr->lang), "%s", asr_ctx->lang);
+    snprintf(hdr->mode, sizeof(hdr->mode), "%s", mode);
+    hdr->chunk_id = job->chunk_id;
+    hdr->seq = job->seq;
+    hdr->samplerate = asr_ctx->samplerate;
+    hdr->codec = asr_ctx->codec;
+    hdr->channels = asr_ctx->channels;
+    hdr->flags = flags;
+    hdr->audio_ms = job->data_len / ((asr_ctx->samplerate / 1000) * asr_ctx->sample_bytes);
+    hdr->upload_ms = (t_upload ? (t_done - t_upload) / 1000 : 0);
+
+    if(text_len) {
+        char *p = NULL;
+        switch_malloc(item->text, text_len + 1);
+        p = item->text;
+        for(uint32_t i = 0; i < count; i++) {
+            uint32_t len = (texts[i] ? strlen(texts[i]) : 0);
+            if(i > 0) { *p++ = '\n'; }
+            memcpy(p, texts[i], len);
+            p += len;
+        }
+        hdr->text_len = text_len;
+    }
+    if(cfg->fl_journal_audio) {
+        item->audio = job->data;
+        hdr->audio_len = job->data_len;
+        job->data = NULL;
+    }
+    hdr->len = JOURNAL_ALIGN(sizeof(journal_rec_t) + hdr->text_len + hdr->audio_len);
+
+    if(switch_queue_trypush(journal.q_items, item) != SWITCH_STATUS_SUCCESS) {
+        __atomic_add_fetch(&globals.journal_drops, 1, __ATOMIC_RELAXED);
+        if(item->audio) {
+            job->data = item->audio;
+            item->audio = NULL;
+        }
+        journal_item_free(&item);
+    }
+}
+
+static int segment_cmp(const void *a, const void *b) {
+    return (*(uint32_t *)a > *(uint32_t *)b) - (*(uint32_t *)a < *(uint32_t *)b);
+}
+
+/**
+ ** sfwhisper journal <uuid> [export]: the chunks of the call, oldest first; export writes their audio to wav files
+ **/
+void journal_lookup(const char *uuid, uint8_t fl_export, switch_stream_handle_t *stream) {
+    config_t *cfg = config_acquire();
+    uint32_t *nos = NULL, nos_count = 0, nos_size = 0, found = 0;
+    struct dirent *de = NULL;
+    DIR *d = NULL;
+
+    if(!cfg || !cfg->journal_dir) {
+        stream->write_function(stream, "-ERR: journal is disabled\n");
+        goto out;
+    }
+    if((d = opendir(cfg->journal_dir)) == NULL) {
+        stream->write_function(stream, "-ERR: %s\n", cfg->journal_dir);
+        goto out;
+    }
+    while((de = readdir(d)) != NULL) {
+        uint32_t no = 0;
+        if(segment_no_parse(de->d_name, "idx", &no)) {
+            if(nos_count == nos_size) {
+                nos_size = (nos_size ? nos_size * 2 : 64);
+                nos = realloc(nos, nos_size * sizeof(uint32_t));
+            }
+            nos[nos_count++] = no;
+        }
+    }
+    closedir(d);
+    qsort(nos, nos_count, sizeof(uint32_t), segment_cmp);
+
+    for(uint32_t i = 0; i < nos_count; i++) {
+        char *idx_path = switch_mprintf("%s/sfwhisper-%08u.idx", cfg->journal_dir, nos[i]);
+        char *jnl_path = switch_mprintf("%s/sfwhisper-%08u.jnl", cfg->journal_dir, nos[i]);
+        journal_idx_t idx = { 0 };
+        int ifd = open(idx_path, O_RDONLY), jfd = -1;
+        FILE *fp = (ifd >= 0 ? fdopen(ifd, "rb") : NULL);
+
+        while(fp && fread(&idx, sizeof(idx), 1, fp) == 1) {
+            journal_rec_t hdr = { 0 };
+            char *text = NULL;
+
+            if(strncmp(idx.uuid, uuid, sizeof(idx.uuid)) != 0) {
+                continue;
+            }
+            if(jfd < 0 && (jfd = open(jnl_path, O_RDONLY)) < 0) {
+                break;
+            }
+            if(pread(jfd, &hdr, sizeof(hdr), idx.offs) != sizeof(hdr) || hdr.magic != JOURNAL_MAGIC) {
+                continue;
+            }
+
+            switch_zmalloc(text, hdr.text_len + 1);
+            if(hdr.text_len && pread(jfd, text, hdr.text_len, idx.offs + sizeof(hdr)) != hdr.text_len) {
+                text[0] = '\0';
+            }
+            stream->write_function(stream, "%"PRIu64" segment=%u chunk=%u seq=%u mode=%s lang=%s codec=%u rate=%u audio_ms=%u upload_ms=%u audio_bytes=%u%s%s\n%s\n",
+                                   (uint64_t)hdr.timestamp, nos[i], hdr.chunk_id, hdr.seq, hdr.mode, hdr.lang, hdr.codec, hdr.samplerate, hdr.audio_ms, hdr.upload_ms,
+                                   hdr.audio_len, ((hdr.flags & JOURNAL_FL_ERROR) ? " error" : ""), ((hdr.flags & JOURNAL_FL_SEGMENTS) ? " coalesced" : ""), text);
+            switch_safe_free(text);
+
+            if(fl_export && hdr.audio_len) {
+                switch_byte_t *audio = NULL;
+                char *fname = NULL;
+
+                switch_malloc(audio, hdr.audio_len);
+                if(pread(jfd, audio, hdr.audio_len, idx.offs + sizeof(hdr) + hdr.text_len) == hdr.audio_len) {
+                    fname = audio_file_write(audio, hdr.audio_len, hdr.codec, MAX(hdr.channels, 1), hdr.samplerate);
+                }
+                stream->write_function(stream, "audio: %s\n", (fname ? fname : "write failed"));
+                switch_safe_free(fname);
+                switch_safe_free(audio);
+            }
+            found++;
+        }
+
+        if(fp) fclose(fp);
+        if(jfd >= 0) close(jfd);
+        switch_safe_free(idx_path);
+        switch_safe_free(jnl_path);
+    }
+
+    if(!found) {
+        stream->write_function(stream, "-ERR: no records\n");
+    }
+out:
+    switch_safe_free(nos);
+    config_release(&cfg);
+}
@@ -0,0 +1,214 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+
+extern globals_t globals;
+
+/**
+ ** Per-thread single producer / single consumer rings, drained by one background thread.
+ ** A producer never blocks and never takes a lock after its ring is registered, when the
+ ** ring is full the record is counted as dropped.
+ ** Only the module's own threads (thread_launch) get a ring; the core's threads calling in
+ ** (media, api) would never release theirs, they go to switch_log_printf() directly.
+ **/
+typedef struct {
+    switch_log_level_t      level;
+    char                    text[LOG_RECORD_SZ];
+} log_record_t;
+
+typedef struct log_ring_s {
+    struct log_ring_s       *next;
+    uint32_t                head;       // owner thread
+    uint32_t                tail;       // flusher
+    uint32_t                dropped;
+    uint8_t                 fl_detached;
+    log_record_t            records[LOG_RING_SLOTS];
+} log_ring_t;
+
+static switch_mutex_t *rings_mutex = NULL;
+static log_ring_t *rings = NULL;
+static __thread log_ring_t *thread_ring = NULL;
+static __thread uint8_t thread_attached = false;
+static __thread uint32_t thread_seed = 0;
+
+static log_ring_t *ring_get() {
+    log_ring_t *ring = thread_ring;
+
+    if(ring == NULL && thread_attached && rings_mutex) {
+        switch_zmalloc(ring, sizeof(log_ring_t));
+
+        switch_mutex_lock(rings_mutex);
+        ring->next = rings;
+        rings = ring;
+        switch_mutex_unlock(rings_mutex);
+
+        thread_ring = ring;
+    }
+
+    return ring;
+}
+
+static void ring_put(switch_log_level_t level, const char *prefix, const char *fmt, va_list ap) {
+    log_ring_t *ring = ring_get();
+    log_record_t *rec = NULL;
+    uint32_t head = 0, tail = 0;
+    int len = 0;
+
+    if(!ring) {
+        char text[LOG_RECORD_SZ];
+
+        len = snprintf(text, sizeof(text), "%s", prefix);
+        if(len < 0 || len >= sizeof(text)) {
+            len = 0;
+        }
+        vsnprintf(text + len, sizeof(text) - len, fmt, ap);
+        switch_log_printf(SWITCH_CHANNEL_LOG, level, "%s\n", text);
+        return;
+    }
+
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if(head - tail >= LOG_RING_SLOTS) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    rec = &ring->records[head % LOG_RING_SLOTS];
+    rec->level = level;
+    len = snprintf(rec->text, sizeof(rec->text), "%s", prefix);
+    if(len < 0 || len >= sizeof(rec->text)) {
+        len = 0;
+    }
+    vsnprintf(rec->text + len, sizeof(rec->text) - len, fmt, ap);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static uint32_t ring_drain(log_ring_t *ring) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = ring->tail, dropped = 0, n = 0;
+
+    while(tail != head) {
+        log_record_t *rec = &ring->records[tail % LOG_RING_SLOTS];
+        switch_log_printf(SWITCH_CHANNEL_LOG, rec->level, "%s\n", rec->text);
+        tail++; n++;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    if((dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED)) > 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "sfwhisper: stage=log dropped=%u\n", dropped);
+    }
+
+    return n;
+}
+
+static void rings_flush(uint8_t fl_release_all) {
+    log_ring_t *ring = NULL, *prev = NULL, *next = NULL;
+
+    switch_mutex_lock(rings_mutex);
+    for(ring = rings; ring; ring = next) {
+        next = ring->next;
+        ring_drain(ring);
+
+        if(fl_release_all || __atomic_load_n(&ring->fl_detached, __ATOMIC_ACQUIRE)) {
+            ring_drain(ring);
+            if(prev) { prev->next = next; } else { rings = next; }
+            free(ring);
+            continue;
+        }
+        prev = ring;
+    }
+    switch_mutex_unlock(rings_mutex);
+}
+
+static void *SWITCH_THREAD_FUNC slog_thread(switch_thread_t *thread, void *obj) {
+    while(!globals.fl_shutdown) {
+        rings_flush(false);
+        switch_yield(LOG_FLUSH_INTERVAL_MS * 1000);
+    }
+
+    rings_flush(false);
+    thread_finished();
+
+    return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+void slog_init(switch_memory_pool_t *pool) {
+    switch_mutex_init(&rings_mutex, SWITCH_MUTEX_NESTED, pool);
+    thread_launch(pool, slog_thread, NULL);
+}
+
+/**
+ ** called after all module threads are gone
+ **/
+void slog_shutdown() {
+    if(rings_mutex) {
+        rings_flush(true);
+    }
+}
+
+/**
+ ** thread_launch() calls it in the new thread, the ring is allocated on the first record
+ **/
+void slog_thread_attach() {
+    thread_attached = true;
+}
+
+/**
+ ** worker threads call it before exit, the ring is released by the flusher once drained
+ **/
+void slog_thread_done() {
+    if(thread_ring) {
+        __atomic_store_n(&thread_ring->fl_detached, 1, __ATOMIC_RELEASE);
+        thread_ring = NULL;
+    }
+    thread_attached = false;
+}
+
+/**
+ ** per-chunk sampling decision, errors are never sampled out
+ **/
+uint8_t slog_sample(config_t *cfg) {
+    if(cfg->log_sample_rate <= 1) {
+        return true;
+    }
+    if(thread_seed == 0) {
+        thread_seed = (uint32_t)(switch_micro_time_now() ^ (uintptr_t)&thread_seed) | 1;
+    }
+    thread_seed ^= thread_seed << 13;
+    thread_seed ^= thread_seed >> 17;
+    thread_seed ^= thread_seed << 5;
+
+    return ((thread_seed % cfg->log_sample_rate) == 0);
+}
+
+void slog_printf(config_t *cfg, switch_log_level_t level, const char *fmt, ...) {
+    va_list ap;
+
+    if(cfg && level > cfg->log_level) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    ring_put(level, "sfwhisper: ", fmt, ap);
+    va_end(ap);
+}
+
+void slog_chunk(gasr_ctx_t *asr_ctx, uint32_t chunk_id, switch_log_level_t level, const char *stage, const char *fmt, ...) {
+    char prefix[128] = { 0 };
+    va_list ap;
+
+    if(level > asr_ctx->cfg->log_level) {
+        return;
+    }
+
+    snprintf(prefix, sizeof(prefix), "sfwhisper: uuid=%s chunk=%u stage=%s ", asr_ctx->uuid, chunk_id, stage);
+
+    va_start(ap, fmt);
+    ring_put(level, prefix, fmt, ap);
+    va_end(ap);
+}
@@ -19,14 +19,158 @@ SWITCH_MODULE_DEFINITION(mod_sfwhisper, mod_sfwhisper_load, mod_sfwhisper_shutdo
  **/
 
 // ---------------------------------------------------------------------------------------------------------------------------------------------
+static void audio_queue_drop(gasr_ctx_t *asr_ctx, xdata_buffer_t **buf) {
+    switch_event_t *event = NULL;
+    uint32_t len = (*buf)->len;
+
+    xdata_buffer_free(buf);
+
+    asr_ctx->drops_frames++;
+    asr_ctx->drops_bytes += len;
+    __atomic_add_fetch(&globals.drops_frames, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&globals.drops_bytes, len, __ATOMIC_RELAXED);
+
+    if(asr_ctx->fl_drop_reported) {
+        return;
+    }
+    asr_ctx->fl_drop_reported = true;
+    __atomic_add_fetch(&globals.drops_utterances, 1, __ATOMIC_RELAXED);
+
+    slog_printf(asr_ctx->cfg, SWITCH_LOG_WARNING, "uuid=%s stage=overflow policy=%s buffer_ms=%u dropped_frames=%u dropped_bytes=%u",
+                asr_ctx->uuid, overflow_policy2str(asr_ctx->cfg->overflow_policy), asr_ctx->cfg->audio_buffer_ms, asr_ctx->drops_frames, asr_ctx->drops_bytes);
+
+    if(switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, EVENT_OVERFLOW) == SWITCH_STATUS_SUCCESS) {
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", asr_ctx->uuid);
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Overflow-Policy", overflow_policy2str(asr_ctx->cfg->overflow_policy));
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Buffer-MS", "%u", asr_ctx->cfg->audio_buffer_ms);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Dropped-Frames", "%u", asr_ctx->drops_frames);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Dropped-Bytes", "%u", asr_ctx->drops_bytes);
+        switch_event_fire(&event);
+    }
+}
+
+/**
+ ** a result went to q_text: sfwhisper::result right away instead of waiting for the next asr_check_results poll
+ **/
+void result_event(gasr_ctx_t *asr_ctx, const char *text, uint32_t utterance, const result_timing_t *timing) {
+    switch_event_t *event = NULL;
+
+    if(switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, EVENT_RESULT) == SWITCH_STATUS_SUCCESS) {
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", asr_ctx->uuid);
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Transcript", text);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Utterance", "%u", utterance);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Speech-Start", "%"PRId64, (int64_t)timing->t_speech_start);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Speech-End", "%"PRId64, (int64_t)timing->t_speech_end);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Dispatch-Time", "%"PRId64, (int64_t)timing->t_dispatch);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Response-Time", "%"PRId64, (int64_t)timing->t_response);
+        if(timing->t_speech_end) {
+            switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Turn-Latency-MS", "%"PRId64, (int64_t)((timing->t_response - timing->t_speech_end) / 1000));
+        }
+        switch_event_fire(&event);
+    }
+}
+
+/**
+ ** the session thread may sit in a read until the next frame, don't let the result wait for it
+ **/
+void session_wake(gasr_ctx_t *asr_ctx) {
+    switch_core_session_t *session = NULL;
+
+    if(asr_ctx->fl_destroyed || !asr_ctx->session) {
+        return;
+    }
+    if((session = switch_core_session_locate(asr_ctx->uuid)) != NULL) {
+        switch_core_session_wake_session_thread(session);
+        switch_core_session_rwunlock(session);
+    }
+}
+
+/**
+ ** q_audio is bounded by bytes (audio-buffer-ms), not by items
+ **/
+switch_status_t audio_queue_push(gasr_ctx_t *asr_ctx, xdata_buffer_t *buf) {
+    void *pop = NULL;
+
+    while(__atomic_load_n(&asr_ctx->q_audio_bytes, __ATOMIC_ACQUIRE) + buf->len > asr_ctx->q_audio_budget) {
+        if(asr_ctx->cfg->overflow_policy == OVERFLOW_DROP_NEWEST) {
+            goto drop;
+        }
+        if(asr_ctx->cfg->overflow_policy == OVERFLOW_COMPACT_SILENCE) {
+            int16_t *pcm = (int16_t *)buf->data;
+            uint32_t samples = buf->len / sizeof(int16_t);
+
+            if(asr_ctx->codec != CODEC_L16) {
+                pcm = asr_ctx->pcm_buffer;
+                samples = MIN(buf->len, asr_ctx->frame_len);
+                g711_decode(asr_ctx->codec, buf->data, samples, pcm);
+            }
+            if(pcm && pcm_is_silence(pcm, samples, (asr_ctx->cfg->vad_threshold ? asr_ctx->cfg->vad_threshold : SILENCE_ENERGY_THRESHOLD))) {
+                goto drop;
+            }
+        }
+        if(switch_queue_trypop(asr_ctx->q_audio, &pop) != SWITCH_STATUS_SUCCESS) {
+            break; // consumer got them meanwhile
+        }
+        xdata_buffer_t *oldest = (xdata_buffer_t *)pop;
+        __atomic_sub_fetch(&asr_ctx->q_audio_bytes, oldest->len, __ATOMIC_RELEASE);
+        audio_queue_drop(asr_ctx, &oldest);
+    }
+
+    __atomic_add_fetch(&asr_ctx->q_audio_bytes, buf->len, __ATOMIC_RELEASE);
+    if(switch_queue_trypush(asr_ctx->q_audio, buf) == SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+    __atomic_sub_fetch(&asr_ctx->q_audio_bytes, buf->len, __ATOMIC_RELEASE);
+drop:
+    audio_queue_drop(asr_ctx, &buf);
+    return SWITCH_STATUS_FALSE;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+/**
+ ** chunk-overlap-ms: the end of the dispatched chunk stays in the buffer as the start of the next one
+ ** (and opens its progressive request), returns the bytes kept
+ **/
+static uint32_t chunk_overlap_carry(gasr_ctx_t *asr_ctx, switch_buffer_t *chunk_buffer, uint32_t tail_ms, upload_stream_t **stream) {
+    uint32_t bytes_ms = (asr_ctx->samplerate / 1000) * asr_ctx->sample_bytes;
+    const void *ptr = NULL;
+    uint32_t len = switch_buffer_peek_zerocopy(chunk_buffer, &ptr);
+    uint32_t carry = MIN(tail_ms * bytes_ms, len / 2);
+    xdata_buffer_t *buf = NULL;
+
+    carry -= (carry % asr_ctx->sample_bytes);
+    if(!carry || xdata_buffer_alloc(&buf, NULL, 0) != SWITCH_STATUS_SUCCESS) {
+        switch_buffer_zero(chunk_buffer);
+        return 0;
+    }
+    switch_malloc(buf->data, carry);
+    buf->len = carry;
+    memcpy(buf->data, (const switch_byte_t *)ptr + (len - carry), carry);
+
+    switch_buffer_zero(chunk_buffer);
+    switch_buffer_write(chunk_buffer, buf->data, buf->len);
+
+    if(asr_ctx->cfg->fl_progressive_upload && !asr_ctx->cfg->sidecar_socket && (*stream = upload_stream_start(asr_ctx, asr_ctx->chunk_seq)) != NULL) {
+        upload_stream_push(*stream, buf);
+        buf = NULL;
+    }
+    xdata_buffer_free(&buf);
+
+    return carry;
+}
+
 static void *SWITCH_THREAD_FUNC transcript_thread(switch_thread_t *thread, void *obj) {
     volatile gasr_ctx_t *_ref = (gasr_ctx_t *) obj;
     gasr_ctx_t *asr_ctx = (gasr_ctx_t *) _ref;
-    switch_status_t status;
     switch_buffer_t *chunk_buffer = NULL;
     switch_memory_pool_t *pool = NULL;
+    upload_stream_t *stream = NULL;
+    coalesce_t coalesce = { 0 };
     uint32_t chunk_buffer_size = 0, recv_len = 0;
-    uint8_t fl_do_transcript = false;
+    uint32_t overlap_carry = 0, overlap_head_ms = 0; // audio of the last chunk at the start of chunk_buffer
+    uint8_t fl_do_transcript = false, fl_utterance_end = false, fl_realtime_tried = false, fl_grammar_tried = false;
+    uint8_t fl_chunk_cut = false, fl_chunk_continued = false; // cut at chunk-size-sec / starts with the rest of a cut utterance
+    char *grammar_text = NULL;
     void *pop = NULL;
 
     switch_mutex_lock(asr_ctx->mutex);
@@ -59,62 +203,164 @@ static void *SWITCH_THREAD_FUNC transcript_thread(switch_thread_t *thread, void
             goto timer_next;
         }
 
-        fl_do_transcript = false;
-        while(switch_queue_trypop(asr_ctx->q_audio, &pop) == SWITCH_STATUS_SUCCESS) {
-            xdata_buffer_t *audio_buffer = (xdata_buffer_t *)pop;
-            if(globals.fl_shutdown || asr_ctx->fl_destroyed ) {
-                xdata_buffer_free(&audio_buffer);
+        // realtime: the session stays there, unless the connection fails and the chunks take over
+        if(asr_ctx->fl_realtime && !fl_realtime_tried) {
+            fl_realtime_tried = true;
+            if(realtime_run(asr_ctx) == SWITCH_STATUS_SUCCESS) {
                 break;
             }
-            if(audio_buffer && audio_buffer->len) {
-                if(switch_buffer_write(chunk_buffer, audio_buffer->data, audio_buffer->len) >= chunk_buffer_size) {
-                    fl_do_transcript = true;
+        }
+
+        // a chunk waiting for a free upload slot stays in chunk_buffer, new audio stays in q_audio meanwhile
+        if(!fl_do_transcript) {
+            while(switch_queue_trypop(asr_ctx->q_audio, &pop) == SWITCH_STATUS_SUCCESS) {
+                xdata_buffer_t *audio_buffer = (xdata_buffer_t *)pop;
+                __atomic_sub_fetch(&asr_ctx->q_audio_bytes, audio_buffer->len, __ATOMIC_RELEASE);
+                if(globals.fl_shutdown || asr_ctx->fl_destroyed ) {
+                    xdata_buffer_free(&audio_buffer);
                     break;
                 }
+                if(audio_buffer && audio_buffer->len) {
+                    if(!stream && asr_ctx->cfg->fl_progressive_upload && !asr_ctx->cfg->sidecar_socket && switch_buffer_inuse(chunk_buffer) == 0) {
+                        stream = upload_stream_start(asr_ctx, asr_ctx->chunk_seq);
+                    }
+                    uint32_t used = switch_buffer_write(chunk_buffer, audio_buffer->data, audio_buffer->len);
+                    if(stream) {
+                        upload_stream_push(stream, audio_buffer);
+                        audio_buffer = NULL;
+                    }
+                    if(used >= chunk_buffer_size) {
+                        fl_do_transcript = true;
+                        fl_utterance_end = false;
+                        fl_chunk_cut = true;
+                        xdata_buffer_free(&audio_buffer);
+                        break;
+                    }
+                }
+                xdata_buffer_free(&audio_buffer);
+            }
+            if(!fl_do_transcript && asr_ctx->fl_coalesce) {
+                // the chunk goes when it's big or old enough, the session isn't paused between utterances
+                if(switch_buffer_inuse(chunk_buffer) > coalesce.offs && asr_ctx->vad_state == SWITCH_VAD_STATE_STOP_TALKING) {
+                    fl_do_transcript = coalesce_utterance_end(asr_ctx, &coalesce, chunk_buffer, stream);
+                } else if(coalesce.count && asr_ctx->vad_state != SWITCH_VAD_STATE_TALKING && asr_ctx->vad_state != SWITCH_VAD_STATE_START_TALKING) {
+                    fl_do_transcript = (switch_micro_time_now() >= coalesce.expiry);
+                }
+                fl_utterance_end = false;
+            } else if(!fl_do_transcript) {
+                fl_do_transcript = (switch_buffer_inuse(chunk_buffer) > 0 && asr_ctx->vad_state == SWITCH_VAD_STATE_STOP_TALKING);
+                fl_utterance_end = fl_do_transcript;
+            }
+
+            // only a chunk of whole utterances: a piece of a long one isn't judged without the rest
+            if(fl_do_transcript && asr_ctx->fl_classifier_enabled && !fl_chunk_cut && !fl_chunk_continued) {
+                const void *chunk_buffer_ptr = NULL;
+                uint32_t buf_len = switch_buffer_peek_zerocopy(chunk_buffer, &chunk_buffer_ptr);
+                chunk_class_t cls = { 0 };
+                uint8_t reason = chunk_classify(asr_ctx, (const switch_byte_t *)chunk_buffer_ptr, buf_len, &cls);
+
+                if(reason != CHUNK_ACCEPT) {
+                    uint32_t chunk_id = asr_ctx->chunk_seq++;
+                    uint32_t audio_ms = buf_len / ((asr_ctx->samplerate / 1000) * asr_ctx->sample_bytes);
+
+                    switch(reason) {
+                        case CHUNK_REJECT_SHORT: __atomic_add_fetch(&globals.rejects_short, 1, __ATOMIC_RELAXED); break;
+                        case CHUNK_REJECT_NOISE: __atomic_add_fetch(&globals.rejects_noise, 1, __ATOMIC_RELAXED); break;
+                        case CHUNK_REJECT_TONE: __atomic_add_fetch(&globals.rejects_tone, 1, __ATOMIC_RELAXED); break;
+                    }
+                    __atomic_add_fetch(&globals.rejects_audio_ms, audio_ms, __ATOMIC_RELAXED);
+
+                    if(slog_sample(asr_ctx->cfg)) {
+                        slog_chunk(asr_ctx, chunk_id, SWITCH_LOG_INFO, "rejected", "reason=%s bytes=%u audio_ms=%u voiced_ms=%u flatness=%.2f tonal=%.2f",
+                                   chunk_reject2str(reason), buf_len, audio_ms, cls.voiced_ms, cls.flatness, cls.tonal);
+                    }
+
+                    // not a result: the session isn't paused and the open progressive request is aborted
+                    upload_stream_release(&stream);
+                    switch_buffer_zero(chunk_buffer);
+                    coalesce_reset(&coalesce);
+                    overlap_carry = overlap_head_ms = 0;
+                    fl_do_transcript = false;
+                }
             }
-            xdata_buffer_free(&audio_buffer);
-        }
-        if(!fl_do_transcript) {
-            fl_do_transcript = (switch_buffer_inuse(chunk_buffer) > 0 && asr_ctx->vad_state == SWITCH_VAD_STATE_STOP_TALKING);
         }
 
         if(fl_do_transcript) {
-            //if(asr_ctx->session) switch_ivr_play_file(asr_ctx->session, NULL, "tone_stream://%(200,0,500,600,700)", NULL);
-            asr_ctx->fl_pause = true; // 24/1/9
-            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "Whisper API: chunk\n");
             const void *chunk_buffer_ptr = NULL;
             uint32_t buf_len = switch_buffer_peek_zerocopy(chunk_buffer, &chunk_buffer_ptr);
-            char *fname=audio_file_write((switch_byte_t *)chunk_buffer_ptr, buf_len, asr_ctx->channels, asr_ctx->samplerate);
-            if(fname != NULL) {
-                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "Whisper API: invoke (%s)\n", asr_ctx->lang);
-                char *result = NULL;
-                status = whisper_transcribe(asr_ctx, fname, &result);
-                if(status == SWITCH_STATUS_SUCCESS && result) {
-                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "Whisper API: done\n");
-                    xdata_buffer_t *tbuff = NULL;
-                    if(xdata_buffer_alloc(&tbuff, result, strlen(result)) == SWITCH_STATUS_SUCCESS) {
-                        if(switch_queue_trypush(asr_ctx->q_text, tbuff) == SWITCH_STATUS_SUCCESS) {
-                            switch_mutex_lock(asr_ctx->mutex);
-                            asr_ctx->transcript_results++;
-                            switch_mutex_unlock(asr_ctx->mutex);
-                        }else{
-                            xdata_buffer_free(&tbuff);
-                        }
-                        switch_safe_free(result);
-                    }
+            uint32_t marks_ms[COALESCE_MAX_UTTERANCES] = { 0 }, marks_count = 0;
+            uint32_t overlap_tail_ms = (!fl_utterance_end && !asr_ctx->fl_coalesce ? asr_ctx->cfg->chunk_overlap_ms : 0);
+            grammar_t *grammar = (fl_utterance_end ? __atomic_load_n(&asr_ctx->grammar, __ATOMIC_ACQUIRE) : NULL);
+
+            if(asr_ctx->fl_coalesce) {
+                marks_count = coalesce_marks_ms(asr_ctx, &coalesce, buf_len, marks_ms);
+            }
+
+            // a whole short utterance against the grammar templates, once per chunk (it may wait for a slot)
+            if(grammar && !fl_grammar_tried) {
+                fl_grammar_tried = true;
+                grammar_text = grammar_recognize(asr_ctx, grammar, (const switch_byte_t *)chunk_buffer_ptr, buf_len);
+                if(grammar_text && asr_ctx->fl_nlsml) {
+                    char *doc = nlsml_build(grammar->name, grammar_text, grammar_text, NULL);
+                    switch_safe_free(grammar_text);
+                    grammar_text = doc;
+                }
+            }
+
+            //if(asr_ctx->session) switch_ivr_play_file(asr_ctx->session, NULL, "tone_stream://%(200,0,500,600,700)", NULL);
+            if(grammar_text) {
+                if(upload_local(asr_ctx, grammar_text) == SWITCH_STATUS_SUCCESS) {
+                    upload_stream_release(&stream);
+                    asr_ctx->fl_pause = true;
+                    switch_buffer_zero(chunk_buffer);
+                    coalesce_reset(&coalesce);
+                    switch_safe_free(grammar_text);
+                    overlap_carry = overlap_head_ms = 0;
+                    fl_chunk_cut = fl_chunk_continued = false;
+                    fl_grammar_tried = false;
+                    fl_do_transcript = false;
+                }
+            } else if(overlap_carry && buf_len <= overlap_carry) {
+                // the utterance ended right after a cut, nothing new: the words held from that chunk go out
+                if(upload_local(asr_ctx, NULL) == SWITCH_STATUS_SUCCESS) {
+                    upload_stream_release(&stream);
+                    asr_ctx->fl_pause = true;
+                    switch_buffer_zero(chunk_buffer);
+                    overlap_carry = overlap_head_ms = 0;
+                    fl_chunk_cut = fl_chunk_continued = false;
+                    fl_do_transcript = false;
+                }
+            } else if(upload_dispatch(asr_ctx, asr_ctx->pool, (const switch_byte_t *)chunk_buffer_ptr, buf_len, &stream, (marks_count ? marks_ms : NULL), marks_count, overlap_head_ms, overlap_tail_ms) == SWITCH_STATUS_SUCCESS) {
+                if(fl_utterance_end) {
+                    asr_ctx->fl_pause = true; // 24/1/9
+                }
+                if(overlap_tail_ms) {
+                    overlap_carry = chunk_overlap_carry(asr_ctx, chunk_buffer, overlap_tail_ms, &stream);
+                    overlap_head_ms = overlap_carry / ((asr_ctx->samplerate / 1000) * asr_ctx->sample_bytes);
                 } else {
-                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Whisper API: error\n");
+                    switch_buffer_zero(chunk_buffer);
+                    overlap_carry = overlap_head_ms = 0;
                 }
-                audio_file_delete(fname);
-                switch_safe_free(fname);
+                coalesce_reset(&coalesce);
+                fl_chunk_continued = fl_chunk_cut;
+                fl_chunk_cut = false;
+                fl_grammar_tried = false;
+                fl_do_transcript = false;
             }
-            switch_buffer_zero(chunk_buffer);
         }
         timer_next:
+        if(chunk_buffer) {
+            __atomic_store_n(&asr_ctx->chunk_bytes, switch_buffer_inuse(chunk_buffer), __ATOMIC_RELAXED);
+        }
+        if(asr_ctx->capture) {
+            capture_flush(asr_ctx);
+        }
         switch_yield(10000);
     }
 
 out:
+    upload_stream_release(&stream);
+    switch_safe_free(grammar_text);
     if(chunk_buffer) {
         switch_buffer_destroy(&chunk_buffer);
     }
@@ -126,6 +372,7 @@ out:
     if(asr_ctx->deps > 0) asr_ctx->deps--;
     switch_mutex_unlock(asr_ctx->mutex);
 
+    slog_thread_done();
     thread_finished();
 
     return NULL;
@@ -137,7 +384,7 @@ static switch_status_t asr_open(switch_asr_handle_t *ah, const char *codec, int
     switch_memory_pool_t *pool = NULL;
     gasr_ctx_t *asr_ctx = NULL;
 
-    if(strcmp(codec, "L16") !=0) {
+    if(strcmp(codec, "L16") != 0 && strcmp(codec, "PCMU") != 0 && strcmp(codec, "PCMA") != 0) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unsupported codec: %s\n", codec);
         switch_goto_status(SWITCH_STATUS_FALSE, out);
     }
@@ -147,41 +394,75 @@ static switch_status_t asr_open(switch_asr_handle_t *ah, const char *codec, int
         switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
 
+    // G.711 only when the caller opens the handle with it: detect_speech / play_and_detect_speech always ask for L16
+    if(strcmp(codec, "PCMU") == 0) {
+        asr_ctx->codec = CODEC_PCMU;
+        asr_ctx->sample_bytes = sizeof(uint8_t);
+    } else if(strcmp(codec, "PCMA") == 0) {
+        asr_ctx->codec = CODEC_PCMA;
+        asr_ctx->sample_bytes = sizeof(uint8_t);
+    } else {
+        asr_ctx->codec = CODEC_L16;
+        asr_ctx->sample_bytes = sizeof(int16_t);
+    }
+
+    if((asr_ctx->cfg = config_acquire()) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "No configuration\n");
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    }
+
     asr_ctx->session = switch_core_memory_pool_get_data(ah->memory_pool, "__session");
+    if(asr_ctx->session) {
+        switch_copy_string(asr_ctx->uuid, switch_core_session_get_uuid(asr_ctx->session), sizeof(asr_ctx->uuid));
+    } else {
+        switch_uuid_str(asr_ctx->uuid, sizeof(asr_ctx->uuid));
+    }
+    asr_ctx->pool = ah->memory_pool;
     asr_ctx->chunk_buffer_size = 0;
+    asr_ctx->max_parallel_uploads = asr_ctx->cfg->max_parallel_uploads;
     asr_ctx->samplerate = samplerate;
     asr_ctx->channels = 1;
-    asr_ctx->lang = (char *) globals.default_lang;
-    asr_ctx->opt_max_alternatives = globals.opt_max_alternatives;
-    asr_ctx->opt_enable_profanity_filter = globals.opt_enable_profanity_filter;
-    asr_ctx->opt_enable_word_time_offsets = globals.opt_enable_word_time_offsets;
-    asr_ctx->opt_enable_word_confidence = globals.opt_enable_word_confidence;
-    asr_ctx->opt_enable_automatic_punctuation = globals.opt_enable_automatic_punctuation;
-    asr_ctx->opt_enable_spoken_punctuation = globals.opt_enable_spoken_punctuation;
-    asr_ctx->opt_enable_spoken_emojis = globals.opt_enable_spoken_emojis;
-    asr_ctx->opt_meta_interaction_type = globals.opt_meta_interaction_type;
-    asr_ctx->opt_meta_microphone_distance = globals.opt_meta_microphone_distance;
-    asr_ctx->opt_meta_recording_device_type = globals.opt_meta_recording_device_type;
-    asr_ctx->opt_speech_model = globals.opt_speech_model;
-    asr_ctx->opt_use_enhanced_model = globals.opt_use_enhanced_model;
+    asr_ctx->lang = (char *) asr_ctx->cfg->default_lang;
+    asr_ctx->opt_max_alternatives = asr_ctx->cfg->opt_max_alternatives;
+    asr_ctx->opt_enable_profanity_filter = asr_ctx->cfg->opt_enable_profanity_filter;
+    asr_ctx->opt_enable_word_time_offsets = asr_ctx->cfg->opt_enable_word_time_offsets;
+    asr_ctx->opt_enable_word_confidence = asr_ctx->cfg->opt_enable_word_confidence;
+    asr_ctx->opt_enable_automatic_punctuation = asr_ctx->cfg->opt_enable_automatic_punctuation;
+    asr_ctx->opt_enable_spoken_punctuation = asr_ctx->cfg->opt_enable_spoken_punctuation;
+    asr_ctx->opt_enable_spoken_emojis = asr_ctx->cfg->opt_enable_spoken_emojis;
+    asr_ctx->opt_meta_interaction_type = asr_ctx->cfg->opt_meta_interaction_type;
+    asr_ctx->opt_meta_microphone_distance = asr_ctx->cfg->opt_meta_microphone_distance;
+    asr_ctx->opt_meta_recording_device_type = asr_ctx->cfg->opt_meta_recording_device_type;
+    asr_ctx->opt_speech_model = asr_ctx->cfg->opt_speech_model;
+    asr_ctx->opt_use_enhanced_model = asr_ctx->cfg->opt_use_enhanced_model;
     asr_ctx->opt_enable_speaker_diarization = false;
     asr_ctx->opt_diarization_min_speaker_count = 1;
     asr_ctx->opt_diarization_max_speaker_count = 1;
-    asr_ctx->start_input_timers = globals.start_input_timers;
-    asr_ctx->no_input_timeout = globals.no_input_timeout;
+    asr_ctx->start_input_timers = asr_ctx->cfg->start_input_timers;
+    asr_ctx->no_input_timeout = asr_ctx->cfg->no_input_timeout;
     asr_ctx->silence_time = 0;
+    asr_ctx->t_open = switch_micro_time_now();
 
    if((status = switch_mutex_init(&asr_ctx->mutex, SWITCH_MUTEX_NESTED, ah->memory_pool)) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail\n");
         switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
-    switch_queue_create(&asr_ctx->q_audio, QUEUE_SIZE, ah->memory_pool);
+    // items are bounded by bytes in audio_queue_push(), the capacity only has to fit 10ms frames
+    switch_queue_create(&asr_ctx->q_audio, (asr_ctx->cfg->audio_buffer_ms / 10) + QUEUE_SIZE, ah->memory_pool);
     switch_queue_create(&asr_ctx->q_text, QUEUE_SIZE, ah->memory_pool);
 
     // VAD
-    asr_ctx->fl_vad_enabled = globals.fl_vad_enabled;
+    asr_ctx->fl_vad_enabled = asr_ctx->cfg->fl_vad_enabled;
+    asr_ctx->fl_classifier_enabled = asr_ctx->cfg->fl_classifier_enabled;
+    asr_ctx->fl_coalesce = asr_ctx->cfg->fl_coalesce;
+    asr_ctx->fl_realtime = asr_ctx->cfg->fl_realtime;
+    asr_ctx->fl_spill = asr_ctx->cfg->fl_spill;
+    asr_ctx->fl_nlsml = asr_ctx->cfg->fl_nlsml;
     asr_ctx->vad_buffer = NULL;
+    asr_ctx->pcm_buffer = NULL;
     asr_ctx->frame_len = 0;
+    asr_ctx->feed_frame_len = (asr_ctx->samplerate / 1000) * FEED_PTIME * asr_ctx->sample_bytes;
+    asr_ctx->feed = feed_select(asr_ctx->codec, asr_ctx->samplerate, asr_ctx->feed_frame_len);
     asr_ctx->vad_buffer_offs = 0;
     asr_ctx->vad_buffer_size = 0; // will be calculated in the feed function
     asr_ctx->vad_stored_frames = 0;
@@ -191,15 +472,25 @@ static switch_status_t asr_open(switch_asr_handle_t *ah, const char *codec, int
         switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
     switch_vad_set_mode(asr_ctx->vad, -1);
-    switch_vad_set_param(asr_ctx->vad, "debug", globals.fl_vad_debug);
-    if(globals.vad_silence_ms > 0) { switch_vad_set_param(asr_ctx->vad, "silence_ms", globals.vad_silence_ms); }
-    if(globals.vad_voice_ms > 0) { switch_vad_set_param(asr_ctx->vad, "voice_ms", globals.vad_voice_ms); }
-    if(globals.vad_threshold > 0) { switch_vad_set_param(asr_ctx->vad, "thresh", globals.vad_threshold); }
+    switch_vad_set_param(asr_ctx->vad, "debug", asr_ctx->cfg->fl_vad_debug);
+    if(asr_ctx->cfg->vad_silence_ms > 0) { switch_vad_set_param(asr_ctx->vad, "silence_ms", asr_ctx->cfg->vad_silence_ms); }
+    if(asr_ctx->cfg->vad_voice_ms > 0) { switch_vad_set_param(asr_ctx->vad, "voice_ms", asr_ctx->cfg->vad_voice_ms); }
+    if(asr_ctx->cfg->vad_threshold > 0) { switch_vad_set_param(asr_ctx->vad, "thresh", asr_ctx->cfg->vad_threshold); }
 
     ah->private_info = asr_ctx;
 
+    switch_mutex_lock(globals.mutex);
+    switch_core_hash_insert(globals.sessions, asr_ctx->uuid, asr_ctx);
+    switch_mutex_unlock(globals.mutex);
+
     thread_launch(ah->memory_pool, transcript_thread, asr_ctx);
 out:
+    if(status != SWITCH_STATUS_SUCCESS && asr_ctx) {
+        if(asr_ctx->vad) {
+            switch_vad_destroy(&asr_ctx->vad);
+        }
+        config_release(&asr_ctx->cfg);
+    }
     return status;
 }
 
@@ -209,6 +500,12 @@ static switch_status_t asr_close(switch_asr_handle_t *ah, switch_asr_flag_t *fla
 
     assert(asr_ctx != NULL);
 
+    switch_mutex_lock(globals.mutex);
+    if(switch_core_hash_find(globals.sessions, asr_ctx->uuid) == asr_ctx) {
+        switch_core_hash_delete(globals.sessions, asr_ctx->uuid);
+    }
+    switch_mutex_unlock(globals.mutex);
+
     asr_ctx->fl_abort = true;
     asr_ctx->fl_destroyed = true;
 
@@ -237,17 +534,18 @@ static switch_status_t asr_close(switch_asr_handle_t *ah, switch_asr_flag_t *fla
     if(asr_ctx->vad) {
         switch_vad_destroy(&asr_ctx->vad);
     }
+    upload_slots_clean(asr_ctx);
+    capture_destroy(asr_ctx);
+
+    config_release(&asr_ctx->cfg);
 
     switch_set_flag(ah, SWITCH_ASR_FLAG_CLOSED);
 
     return SWITCH_STATUS_SUCCESS;
 }
 
-static switch_status_t asr_feed(switch_asr_handle_t *ah, void *data, unsigned int data_len, switch_asr_flag_t *flags) {
+static switch_status_t asr_feed_frame(switch_asr_handle_t *ah, void *data, unsigned int data_len, switch_asr_flag_t *flags) {
     gasr_ctx_t *asr_ctx = (gasr_ctx_t *) ah->private_info;
-    switch_vad_state_t vad_state = SWITCH_VAD_STATE_NONE;
-    uint8_t fl_has_audio = false;
-    uint32_t recover_len = 0;
 
     assert(asr_ctx != NULL);
 
@@ -267,96 +565,40 @@ static switch_status_t asr_feed(switch_asr_handle_t *ah, void *data, unsigned in
     if(data_len > 0 && asr_ctx->frame_len == 0) {
         switch_mutex_lock(asr_ctx->mutex);
         asr_ctx->frame_len = data_len;
-        asr_ctx->ptime = (data_len / sizeof(int16_t)) / (asr_ctx->samplerate / 1000);
-        asr_ctx->chunk_buffer_size = ((globals.chunk_size_sec * 1000) * data_len) / asr_ctx->ptime;
+        asr_ctx->ptime = (data_len / asr_ctx->sample_bytes) / (asr_ctx->samplerate / 1000);
+        asr_ctx->chunk_buffer_size = ((asr_ctx->cfg->chunk_size_sec * 1000) * data_len) / asr_ctx->ptime;
         asr_ctx->vad_buffer_size = (asr_ctx->frame_len * VAD_STORE_FRAMES);
+        asr_ctx->q_audio_budget = (asr_ctx->cfg->audio_buffer_ms * data_len) / asr_ctx->ptime;
         switch_mutex_unlock(asr_ctx->mutex);
 
         if((asr_ctx->vad_buffer = switch_core_alloc(ah->memory_pool, asr_ctx->vad_buffer_size)) == NULL) {
             asr_ctx->vad_buffer_size = 0; // force disable
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail (vad_buffer)\n");
         }
-    }
-
-    if(asr_ctx->fl_vad_enabled && asr_ctx->vad_buffer_size) {
-        if(asr_ctx->vad_state == SWITCH_VAD_STATE_NONE || asr_ctx->vad_state == SWITCH_VAD_STATE_STOP_TALKING) {
-            //if(asr_ctx->frame_len >= data_len) { }
-            if(asr_ctx->vad_buffer_offs >= asr_ctx->vad_buffer_size) {
-                recover_len = asr_ctx->vad_buffer_size / 2;
-                memcpy((void *)(asr_ctx->vad_buffer), (void *)(asr_ctx->vad_buffer + recover_len), recover_len);
-                memset((void *)(asr_ctx->vad_buffer + recover_len), 0, recover_len);
-                asr_ctx->vad_buffer_offs = recover_len;
-                asr_ctx->vad_stored_frames = VAD_STORE_FRAMES / 2;
-            }
-            memcpy((void *)(asr_ctx->vad_buffer + asr_ctx->vad_buffer_offs), data, MIN(asr_ctx->frame_len, data_len));
-            asr_ctx->vad_buffer_offs += asr_ctx->frame_len;
-            asr_ctx->vad_stored_frames++;
-        }
-
-        vad_state = switch_vad_process(asr_ctx->vad, (int16_t *)data, (data_len / sizeof(int16_t)));
-#if 1
-        if(asr_ctx->start_input_timers) {
-            if(vad_state == SWITCH_VAD_STATE_NONE && asr_ctx->silence_time > 0) {
-                switch_time_t elapsed_ms = (switch_micro_time_now() - asr_ctx->silence_time) / 1000;
-                if(asr_ctx->no_input_timeout > 0 && elapsed_ms >= asr_ctx->no_input_timeout) {
-                    return SWITCH_STATUS_BREAK;
-                }
+        if(asr_ctx->codec != CODEC_L16) {
+            if((asr_ctx->pcm_buffer = switch_core_alloc(ah->memory_pool, asr_ctx->frame_len * sizeof(int16_t))) == NULL) {
+                asr_ctx->vad_buffer_size = 0; // force disable
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mem fail (pcm_buffer)\n");
             }
         }
-#endif
-        if(vad_state == SWITCH_VAD_STATE_START_TALKING) {
-#if 1
-            if(asr_ctx->session) {
-                switch_channel_t *channel = switch_core_session_get_channel(asr_ctx->session);
-                switch_channel_set_flag(channel, CF_BREAK);
-            }
-#endif
-            asr_ctx->vad_state = vad_state;
-            fl_has_audio = true;
-        } else if(vad_state == SWITCH_VAD_STATE_STOP_TALKING) {
-            asr_ctx->vad_state = vad_state;
-            fl_has_audio = false;
-            switch_vad_reset(asr_ctx->vad);
-        } else if(vad_state == SWITCH_VAD_STATE_TALKING) {
-            asr_ctx->vad_state = vad_state;
-            fl_has_audio = true;
+        if(asr_ctx->feed_frame_len != data_len) {
+            asr_ctx->feed_frame_len = data_len;
+            asr_ctx->feed = feed_select(asr_ctx->codec, asr_ctx->samplerate, asr_ctx->feed_frame_len);
         }
-    } else {
-        fl_has_audio = true;
     }
 
-    if(fl_has_audio) {
-        if(vad_state == SWITCH_VAD_STATE_START_TALKING && asr_ctx->vad_buffer_offs > 0) {
-            xdata_buffer_t *tau_buf = NULL;
-            uint32_t tdata_len = 0;
-
-            if(asr_ctx->vad_stored_frames >= VAD_RECOVERY_FRAMES) { asr_ctx->vad_stored_frames = VAD_RECOVERY_FRAMES; }
-
-            recover_len = (asr_ctx->vad_stored_frames * asr_ctx->frame_len);
-            asr_ctx->vad_buffer_offs -= recover_len;
-            if(asr_ctx->vad_buffer_offs < 0 ) { asr_ctx->vad_buffer_offs = 0; }
-
-            tdata_len = recover_len + data_len;
-            switch_zmalloc(tau_buf, sizeof(xdata_buffer_t));
-            switch_malloc(tau_buf->data, tdata_len);
-            tau_buf->len = tdata_len;
-
-            tdata_len = recover_len;
-            memcpy(tau_buf->data, asr_ctx->vad_buffer + asr_ctx->vad_buffer_offs, tdata_len);
-            memcpy(tau_buf->data + tdata_len, data, data_len);
+    return asr_ctx->feed(asr_ctx, (switch_byte_t *)data, data_len);
+}
 
-            if(switch_queue_trypush(asr_ctx->q_audio, tau_buf) != SWITCH_STATUS_SUCCESS) {
-                xdata_buffer_free(&tau_buf);
-            }
+static switch_status_t asr_feed(switch_asr_handle_t *ah, void *data, unsigned int data_len, switch_asr_flag_t *flags) {
+    gasr_ctx_t *asr_ctx = (gasr_ctx_t *) ah->private_info;
+    switch_status_t status = asr_feed_frame(ah, data, data_len, flags);
 
-            asr_ctx->vad_stored_frames = 0;
-            asr_ctx->vad_buffer_offs = 0;
-        } else {
-            xdata_buffer_push(asr_ctx->q_audio, data, data_len);
-        }
+    if(asr_ctx && asr_ctx->capture) {
+        capture_put(asr_ctx, CAP_FEED, status, data, (data ? data_len : 0), NULL, 0);
     }
 
-    return SWITCH_STATUS_SUCCESS;
+    return status;
 }
 
 static switch_status_t asr_check_results(switch_asr_handle_t *ah, switch_asr_flag_t *flags) {
@@ -386,6 +628,10 @@ static switch_status_t asr_get_results(switch_asr_handle_t *ah, char **xmlstr, s
         switch_mutex_unlock(asr_ctx->mutex);
     }
 
+    if(result && asr_ctx->capture) {
+        capture_put(asr_ctx, CAP_TEXT, SWITCH_STATUS_SUCCESS, result, strlen(result), NULL, 0);
+    }
+
     *xmlstr = result;
     return (result ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_FALSE);
 }
@@ -396,6 +642,10 @@ static switch_status_t asr_start_input_timers(switch_asr_handle_t *ah) {
 
     asr_ctx->silence_time = switch_micro_time_now();
 
+    if(asr_ctx->capture) {
+        capture_put(asr_ctx, CAP_TIMERS, SWITCH_STATUS_SUCCESS, NULL, 0, NULL, 0);
+    }
+
     return SWITCH_STATUS_SUCCESS;
 }
 
@@ -406,6 +656,9 @@ static switch_status_t asr_pause(switch_asr_handle_t *ah) {
     if(!asr_ctx->fl_pause) {
         asr_ctx->fl_pause = true;
     }
+    if(asr_ctx->capture) {
+        capture_put(asr_ctx, CAP_PAUSE, SWITCH_STATUS_SUCCESS, NULL, 0, NULL, 0);
+    }
 
     return SWITCH_STATUS_SUCCESS;
 }
@@ -420,6 +673,9 @@ static switch_status_t asr_resume(switch_asr_handle_t *ah) {
             asr_ctx->silence_time = switch_micro_time_now();
         }
     }
+    if(asr_ctx->capture) {
+        capture_put(asr_ctx, CAP_RESUME, SWITCH_STATUS_SUCCESS, NULL, 0, NULL, 0);
+    }
 
     return SWITCH_STATUS_SUCCESS;
 }
@@ -430,6 +686,18 @@ static void asr_text_param(switch_asr_handle_t *ah, char *param, const char *val
 
     if(strcasecmp(param, "vad") == 0) {
         if(val) asr_ctx->fl_vad_enabled = switch_true(val);
+    } else if(strcasecmp(param, "classifier") == 0) {
+        if(val) asr_ctx->fl_classifier_enabled = switch_true(val);
+    } else if(strcasecmp(param, "coalesce") == 0) {
+        if(val) asr_ctx->fl_coalesce = switch_true(val);
+    } else if(strcasecmp(param, "spill") == 0) {
+        if(val) asr_ctx->fl_spill = switch_true(val);
+    } else if(strcasecmp(param, "realtime") == 0) {
+        if(val) asr_ctx->fl_realtime = switch_true(val);
+    } else if(strcasecmp(param, "nlsml") == 0) {
+        if(val) asr_ctx->fl_nlsml = switch_true(val);
+    } else if(strcasecmp(param, "capture") == 0) {
+        if(val && switch_true(val)) { capture_start(asr_ctx); } else { capture_stop(asr_ctx); }
     } else if(strcasecmp(param, "lang") == 0) {
         if(val) asr_ctx->lang = switch_core_strdup(ah->memory_pool, val);
     } else if(!strcasecmp(param, "speech-model")) {
@@ -470,6 +738,10 @@ static void asr_text_param(switch_asr_handle_t *ah, char *param, const char *val
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "no-input-timeout = %d\n", asr_ctx->no_input_timeout);
     }
 
+    if(asr_ctx->capture && param) {
+        capture_put(asr_ctx, CAP_PARAM, SWITCH_STATUS_SUCCESS, param, strlen(param) + 1, (val ? val : ""), (val ? strlen(val) : 0));
+    }
+
 }
 
 static void asr_numeric_param(switch_asr_handle_t *ah, char *param, int val) {
@@ -478,122 +750,300 @@ static void asr_numeric_param(switch_asr_handle_t *ah, char *param, int val) {
 static void asr_float_param(switch_asr_handle_t *ah, char *param, double val) {
 }
 
+/**
+ ** not understood grammars are ignored (the session goes on without one), see grammar.c
+ **/
 static switch_status_t asr_load_grammar(switch_asr_handle_t *ah, const char *grammar, const char *name) {
+    gasr_ctx_t *asr_ctx = (gasr_ctx_t *) ah->private_info;
+    grammar_t *gram = grammar_parse(asr_ctx->pool, asr_ctx->cfg, grammar, name);
+
+    if(!gram && !zstr(grammar)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Grammar not used (%s): %s\n", asr_ctx->uuid, grammar);
+    }
+    __atomic_store_n(&asr_ctx->grammar, gram, __ATOMIC_RELEASE);
+
     return SWITCH_STATUS_SUCCESS;
 }
 
 static switch_status_t asr_unload_grammar(switch_asr_handle_t *ah, const char *name) {
+    gasr_ctx_t *asr_ctx = (gasr_ctx_t *) ah->private_info;
+
+    __atomic_store_n(&asr_ctx->grammar, NULL, __ATOMIC_RELEASE);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+/**
+ ** the threads of the features the current config turns on, each one started once
+ **/
+static void features_start() {
+    config_t *cfg = config_acquire();
+
+    switch_mutex_lock(globals.mutex);
+    if(cfg) {
+        sidecar_start(cfg);
+        journal_start(cfg);
+        spill_start(cfg);
+    }
+    switch_mutex_unlock(globals.mutex);
+
+    config_release(&cfg);
+}
+
+static void event_handler_reloadxml(switch_event_t *event) {
+    if(config_reload() == SWITCH_STATUS_SUCCESS) {
+        features_start();
+    }
+}
+
+#define CMD_SYNTAX "reload\nstats\nsessions\nkill <uuid>\njournal <uuid> [export]\ncapture <uuid> on|off\n"
+
+/**
+ ** one line of 'sfwhisper sessions', only atomic reads: a stuck session doesn't block the command
+ **/
+static void session_print(gasr_ctx_t *asr_ctx, switch_time_t now, switch_stream_handle_t *stream) {
+    uint32_t bytes_ms = (asr_ctx->samplerate / 1000) * asr_ctx->sample_bytes;
+    uint32_t buffered = __atomic_load_n(&asr_ctx->q_audio_bytes, __ATOMIC_RELAXED) + __atomic_load_n(&asr_ctx->chunk_bytes, __ATOMIC_RELAXED);
+    uint32_t inflight = __atomic_load_n(&asr_ctx->uploads_active, __ATOMIC_RELAXED);
+    switch_time_t oldest = 0;
+
+    for(uint32_t i = 0; i < MAX_PARALLEL_UPLOADS; i++) {
+        switch_time_t t = __atomic_load_n(&asr_ctx->upload_since[i], __ATOMIC_RELAXED);
+        if(t && (!oldest || t < oldest)) { oldest = t; }
+    }
+
+    stream->write_function(stream, "%-36s %-6s %-14s %-6s %7u %6u %11u %8u %11u %14"PRIu64" %6u %6u\n",
+                           asr_ctx->uuid, (asr_ctx->lang ? asr_ctx->lang : "-"), switch_vad_state2str(asr_ctx->vad_state), BOOL2STR(asr_ctx->fl_pause),
+                           switch_queue_size(asr_ctx->q_audio), switch_queue_size(asr_ctx->q_text), (bytes_ms ? buffered / bytes_ms : 0),
+                           inflight, (uint32_t)(oldest && now > oldest ? (now - oldest) / 1000 : 0), __atomic_load_n(&asr_ctx->bytes_uploaded, __ATOMIC_RELAXED),
+                           __atomic_load_n(&asr_ctx->upload_seq, __ATOMIC_RELAXED), (uint32_t)((now - asr_ctx->t_open) / 1000000));
+}
+
+SWITCH_STANDARD_API(sfwhisper_cmd_handler) {
+    char *mycmd = NULL, *argv[10] = { 0 };
+    int argc = 0;
+
+    if(!zstr(cmd)) {
+        mycmd = strdup(cmd);
+        switch_assert(mycmd);
+        argc = switch_separate_string(mycmd, ' ', argv, (sizeof(argv) / sizeof(argv[0])));
+    }
+    if(argc == 0) {
+        goto usage;
+    }
+
+    if(strcasecmp(argv[0], "reload") == 0) {
+        if(config_reload() == SWITCH_STATUS_SUCCESS) {
+            features_start();
+            stream->write_function(stream, "+OK\n");
+        } else {
+            stream->write_function(stream, "-ERR: reload failed, see log\n");
+        }
+        goto out;
+    }
+
+    if(strcasecmp(argv[0], "stats") == 0) {
+        stream->write_function(stream, "drops_frames: %"PRIu64"\n", __atomic_load_n(&globals.drops_frames, __ATOMIC_RELAXED));
+        stream->write_function(stream, "drops_bytes: %"PRIu64"\n", __atomic_load_n(&globals.drops_bytes, __ATOMIC_RELAXED));
+        stream->write_function(stream, "drops_utterances: %"PRIu64"\n", __atomic_load_n(&globals.drops_utterances, __ATOMIC_RELAXED));
+        stream->write_function(stream, "chunks_uploaded: %"PRIu64"\n", __atomic_load_n(&globals.chunks_uploaded, __ATOMIC_RELAXED));
+        stream->write_function(stream, "rejects_short: %"PRIu64"\n", __atomic_load_n(&globals.rejects_short, __ATOMIC_RELAXED));
+        stream->write_function(stream, "rejects_noise: %"PRIu64"\n", __atomic_load_n(&globals.rejects_noise, __ATOMIC_RELAXED));
+        stream->write_function(stream, "rejects_tone: %"PRIu64"\n", __atomic_load_n(&globals.rejects_tone, __ATOMIC_RELAXED));
+        stream->write_function(stream, "rejects_audio_ms: %"PRIu64"\n", __atomic_load_n(&globals.rejects_audio_ms, __ATOMIC_RELAXED));
+        stream->write_function(stream, "sidecar_connected: %s\n", BOOL2STR(sidecar_connected()));
+        stream->write_function(stream, "sidecar_requests: %"PRIu64"\n", __atomic_load_n(&globals.sidecar_requests, __ATOMIC_RELAXED));
+        stream->write_function(stream, "sidecar_errors: %"PRIu64"\n", __atomic_load_n(&globals.sidecar_errors, __ATOMIC_RELAXED));
+        stream->write_function(stream, "sidecar_reconnects: %"PRIu64"\n", __atomic_load_n(&globals.sidecar_reconnects, __ATOMIC_RELAXED));
+        stream->write_function(stream, "journal_records: %"PRIu64"\n", __atomic_load_n(&globals.journal_records, __ATOMIC_RELAXED));
+        stream->write_function(stream, "journal_bytes: %"PRIu64"\n", __atomic_load_n(&globals.journal_bytes, __ATOMIC_RELAXED));
+        stream->write_function(stream, "journal_drops: %"PRIu64"\n", __atomic_load_n(&globals.journal_drops, __ATOMIC_RELAXED));
+        stream->write_function(stream, "uploads_killed: %"PRIu64"\n", __atomic_load_n(&globals.uploads_killed, __ATOMIC_RELAXED));
+        stream->write_function(stream, "realtime_sessions: %"PRIu64"\n", __atomic_load_n(&globals.realtime_sessions, __ATOMIC_RELAXED));
+        stream->write_function(stream, "realtime_results: %"PRIu64"\n", __atomic_load_n(&globals.realtime_results, __ATOMIC_RELAXED));
+        stream->write_function(stream, "realtime_errors: %"PRIu64"\n", __atomic_load_n(&globals.realtime_errors, __ATOMIC_RELAXED));
+        stream->write_function(stream, "realtime_fallbacks: %"PRIu64"\n", __atomic_load_n(&globals.realtime_fallbacks, __ATOMIC_RELAXED));
+        stream->write_function(stream, "apikey_exhausted: %"PRIu64"\n", __atomic_load_n(&globals.apikey_exhausted, __ATOMIC_RELAXED));
+        stream->write_function(stream, "spill_depth: %"PRIu64"\n", __atomic_load_n(&globals.spill_depth, __ATOMIC_RELAXED));
+        stream->write_function(stream, "spill_bytes: %"PRIu64"\n", __atomic_load_n(&globals.spill_bytes, __ATOMIC_RELAXED));
+        stream->write_function(stream, "spill_written: %"PRIu64"\n", __atomic_load_n(&globals.spill_written, __ATOMIC_RELAXED));
+        stream->write_function(stream, "spill_deferred: %"PRIu64"\n", __atomic_load_n(&globals.spill_deferred, __ATOMIC_RELAXED));
+        stream->write_function(stream, "spill_drained: %"PRIu64"\n", __atomic_load_n(&globals.spill_drained, __ATOMIC_RELAXED));
+        stream->write_function(stream, "spill_drained_last_min: %u\n", spill_drained_last_min());
+        stream->write_function(stream, "spill_failed: %"PRIu64"\n", __atomic_load_n(&globals.spill_failed, __ATOMIC_RELAXED));
+        stream->write_function(stream, "spill_dropped: %"PRIu64"\n", __atomic_load_n(&globals.spill_dropped, __ATOMIC_RELAXED));
+        stream->write_function(stream, "grammar_local: %"PRIu64"\n", __atomic_load_n(&globals.grammar_local, __ATOMIC_RELAXED));
+        stream->write_function(stream, "grammar_cloud: %"PRIu64"\n", __atomic_load_n(&globals.grammar_cloud, __ATOMIC_RELAXED));
+        stream->write_function(stream, "grammar_mapped: %"PRIu64"\n", __atomic_load_n(&globals.grammar_mapped, __ATOMIC_RELAXED));
+        stream->write_function(stream, "grammar_nomatch: %"PRIu64"\n", __atomic_load_n(&globals.grammar_nomatch, __ATOMIC_RELAXED));
+        stream->write_function(stream, "grammar_learned: %"PRIu64"\n", __atomic_load_n(&globals.grammar_learned, __ATOMIC_RELAXED));
+        stream->write_function(stream, "grammar_templates: %u\n", grammar_templates());
+        stream->write_function(stream, "overlap_aligned: %"PRIu64"\n", __atomic_load_n(&globals.overlap_aligned, __ATOMIC_RELAXED));
+        stream->write_function(stream, "overlap_cut: %"PRIu64"\n", __atomic_load_n(&globals.overlap_cut, __ATOMIC_RELAXED));
+        stream->write_function(stream, "nlsml_results: %"PRIu64"\n", __atomic_load_n(&globals.nlsml_results, __ATOMIC_RELAXED));
+        stream->write_function(stream, "vjson_errors: %"PRIu64"\n", __atomic_load_n(&globals.vjson_errors, __ATOMIC_RELAXED));
+        apikey_stats(stream);
+        goto out;
+    }
+
+    if(strcasecmp(argv[0], "sessions") == 0) {
+        switch_hash_index_t *hi = NULL;
+        switch_time_t now = switch_micro_time_now();
+        uint32_t total = 0;
+
+        stream->write_function(stream, "%-36s %-6s %-14s %-6s %7s %6s %11s %8s %11s %14s %6s %6s\n", "uuid", "lang", "vad", "paused",
+                               "q_audio", "q_text", "buffered_ms", "inflight", "inflight_ms", "bytes_uploaded", "chunks", "age_s");
+
+        // the registry lock only, asr_close() takes the session out under it before tearing it down
+        switch_mutex_lock(globals.mutex);
+        for(hi = switch_core_hash_first(globals.sessions); hi; hi = switch_core_hash_next(&hi)) {
+            void *val = NULL;
+            switch_core_hash_this(hi, NULL, NULL, &val);
+            session_print((gasr_ctx_t *)val, now, stream);
+            total++;
+        }
+        switch_mutex_unlock(globals.mutex);
+
+        stream->write_function(stream, "\n%u total.\n", total);
+        goto out;
+    }
+
+    if(strcasecmp(argv[0], "kill") == 0) {
+        gasr_ctx_t *asr_ctx = NULL;
+        uint32_t killed = 0;
+
+        if(argc < 2) {
+            goto usage;
+        }
+
+        switch_mutex_lock(globals.mutex);
+        if((asr_ctx = switch_core_hash_find(globals.sessions, argv[1])) != NULL) {
+            killed = upload_kill(asr_ctx);
+        }
+        switch_mutex_unlock(globals.mutex);
+
+        if(asr_ctx) {
+            stream->write_function(stream, "+OK %u request(s) aborted\n", killed);
+        } else {
+            stream->write_function(stream, "-ERR: no session: %s\n", argv[1]);
+        }
+        goto out;
+    }
+
+    if(strcasecmp(argv[0], "journal") == 0) {
+        if(argc < 2) {
+            goto usage;
+        }
+        journal_lookup(argv[1], (argc > 2 && strcasecmp(argv[2], "export") == 0), stream);
+        goto out;
+    }
+
+    if(strcasecmp(argv[0], "capture") == 0) {
+        gasr_ctx_t *asr_ctx = NULL;
+        uint8_t fl_on = false;
+
+        if(argc < 3) {
+            goto usage;
+        }
+        fl_on = (strcasecmp(argv[2], "on") == 0 || switch_true(argv[2]));
+
+        // the session can't be closed while it's looked up
+        switch_mutex_lock(globals.mutex);
+        if((asr_ctx = switch_core_hash_find(globals.sessions, argv[1])) != NULL) {
+            if(fl_on) {
+                if(capture_start(asr_ctx) == SWITCH_STATUS_SUCCESS) {
+                    stream->write_function(stream, "+OK\n");
+                } else {
+                    stream->write_function(stream, "-ERR: couldn't open the capture file, see log\n");
+                }
+            } else {
+                capture_stop(asr_ctx);
+                stream->write_function(stream, "+OK\n");
+            }
+        }
+        switch_mutex_unlock(globals.mutex);
+
+        if(!asr_ctx) {
+            stream->write_function(stream, "-ERR: no session: %s\n", argv[1]);
+        }
+        goto out;
+    }
+
+usage:
+    stream->write_function(stream, "-USAGE:\n%s\n", CMD_SYNTAX);
+out:
+    switch_safe_free(mycmd);
     return SWITCH_STATUS_SUCCESS;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------------------------------
 // main
 // ---------------------------------------------------------------------------------------------------------------------------------------------
-#define CONFIG_NAME "sfwhisper.conf"
+static void threads_stop() {
+    uint8_t fl_wloop = true;
+
+    globals.fl_shutdown = true;
+
+    switch_mutex_lock(globals.mutex);
+    fl_wloop = (globals.active_threads > 0);
+    switch_mutex_unlock(globals.mutex);
+
+    if(fl_wloop) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Waiting for termination '%d' threads...\n", globals.active_threads);
+        while(fl_wloop) {
+            switch_mutex_lock(globals.mutex);
+            fl_wloop = (globals.active_threads > 0);
+            switch_mutex_unlock(globals.mutex);
+            switch_yield(100000);
+        }
+    }
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_sfwhisper_load) {
     switch_status_t status = SWITCH_STATUS_SUCCESS;
-    switch_xml_t cfg, xml, settings, param;
     switch_asr_interface_t *asr_interface;
+    switch_api_interface_t *commands_interface;
 
     memset(&globals, 0, sizeof(globals));
-    globals.start_input_timers = SWITCH_FALSE;
-    globals.no_input_timeout = 5000;
+    globals.pool = pool;
 
     switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_core_hash_init(&globals.sessions);
+    g711_init();
+    apikey_init(pool);
 
-    if((xml = switch_xml_open_cfg(CONFIG_NAME, &cfg, NULL)) == NULL) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't open configuration file: %s\n", CONFIG_NAME);
-        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    if((status = config_load(&globals.config)) != SWITCH_STATUS_SUCCESS) {
+        goto out;
     }
 
-    if((settings = switch_xml_child(cfg, "settings"))) {
-        for (param = switch_xml_child(settings, "param"); param; param = param->next) {
-            char *var = (char *) switch_xml_attr_soft(param, "name");
-            char *val = (char *) switch_xml_attr_soft(param, "value");
-
-            if(!strcasecmp(var, "vad-silence-ms")) {
-                if(val) globals.vad_silence_ms = atoi (val);
-            } else if(!strcasecmp(var, "vad-voice-ms")) {
-                if(val) globals.vad_voice_ms = atoi (val);
-            } else if(!strcasecmp(var, "vad-threshold")) {
-                if(val) globals.vad_threshold = atoi (val);
-            } else if(!strcasecmp(var, "vad-enable")) {
-                if(val) globals.fl_vad_enabled = switch_true(val);
-            } else if(!strcasecmp(var, "vad-debug")) {
-                if(val) globals.fl_vad_debug = switch_true(val);
-            } else if(!strcasecmp(var, "api-key")) {
-                if(val) globals.api_key = switch_core_strdup(pool, val);
-            } else if(!strcasecmp(var, "api-url")) {
-                if(val) globals.api_url = switch_core_strdup(pool, val);
-            } else if(!strcasecmp(var, "user-agent")) {
-                if(val) globals.user_agent = switch_core_strdup(pool, val);
-            } else if(!strcasecmp(var, "proxy")) {
-                if(val) globals.proxy = switch_core_strdup(pool, val);
-            } else if(!strcasecmp(var, "proxy-credentials")) {
-                if(val) globals.proxy_credentials = switch_core_strdup(pool, val);
-            } else if(!strcasecmp(var, "default-language")) {
-                if(val) globals.default_lang = switch_core_strdup(pool, val);
-            } else if(!strcasecmp(var, "encoding")) {
-                if(val) globals.opt_encoding = switch_core_strdup(pool, gcp_get_encoding(val));
-            } else if(!strcasecmp(var, "chunk-size-sec")) {
-                if(val) globals.chunk_size_sec = atoi(val);
-            } else if(!strcasecmp(var, "request-timeout")) {
-                if(val) globals.request_timeout = atoi(val);
-            } else if(!strcasecmp(var, "connect-timeout")) {
-                if(val) globals.connect_timeout = atoi(val);
-            } else if(!strcasecmp(var, "speech-model")) {
-                if(val) globals.opt_speech_model = switch_core_strdup(pool, val);
-            } else if(!strcasecmp(var, "use-enhanced-model")) {
-                if(val) globals.opt_use_enhanced_model = switch_true(val);
-            } else if(!strcasecmp(var, "max-alternatives")) {
-                if(val) globals.opt_max_alternatives = atoi(val);
-            } else if(!strcasecmp(var, "enable-word-time-offsets")) {
-                if(val) globals.opt_enable_word_time_offsets = switch_true(val);
-            } else if(!strcasecmp(var, "enable-word-confidence")) {
-                if(val) globals.opt_enable_word_confidence = switch_true(val);
-            } else if(!strcasecmp(var, "enable-profanity-filter")) {
-                if(val) globals.opt_enable_profanity_filter = switch_true(val);
-            } else if(!strcasecmp(var, "enable-automatic-punctuation")) {
-                if(val) globals.opt_enable_automatic_punctuation = switch_true(val);
-            } else if(!strcasecmp(var, "enable-spoken-punctuation")) {
-                if(val) globals.opt_enable_spoken_punctuation = switch_true(val);
-            } else if(!strcasecmp(var, "enable-spoken-emojis")) {
-                if(val) globals.opt_enable_spoken_emojis = switch_true(val);
-            } else if(!strcasecmp(var, "microphone-distance")) {
-                if(val) globals.opt_meta_microphone_distance = switch_core_strdup(pool, gcp_get_microphone_distance(val));
-            } else if(!strcasecmp(var, "recording-device-type")) {
-                if(val) globals.opt_meta_recording_device_type = switch_core_strdup(pool, gcp_get_recording_device(val));
-            } else if(!strcasecmp(var, "interaction-type")) {
-                if(val) globals.opt_meta_interaction_type = switch_core_strdup(pool, gcp_get_interaction(val));
-            } else if(!strcasecmp(var, "start-input-timers")) {
-                if(val) globals.start_input_timers = switch_true(val);
-            } else if(!strcasecmp(var, "no-input-timeout")) {
-                if(val && switch_is_number(val)) globals.no_input_timeout = atoi(val);
-            }
-        }
+    if(switch_event_reserve_subclass(EVENT_OVERFLOW) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't register subclass: %s\n", EVENT_OVERFLOW);
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
-
-    if(!globals.api_url) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid parameter: api-url\n");
+    if(switch_event_reserve_subclass(EVENT_PARTIAL) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't register subclass: %s\n", EVENT_PARTIAL);
         switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
-    if(!globals.api_key) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid parameter: api-key\n");
+    if(switch_event_reserve_subclass(EVENT_RESULT) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't register subclass: %s\n", EVENT_RESULT);
         switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
-
-    globals.api_url_ep = switch_string_replace(globals.api_url, "${api-key}", globals.api_key);
-    if(!globals.api_url_ep) {
-        globals.api_url_ep = strdup(globals.api_key);
+    if(switch_event_reserve_subclass(EVENT_SPILL_RESULT) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't register subclass: %s\n", EVENT_SPILL_RESULT);
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
 
-    globals.chunk_size_sec = globals.chunk_size_sec > DEF_CHUNK_SZ_SEC ? globals.chunk_size_sec : DEF_CHUNK_SZ_SEC;
-    globals.opt_encoding = globals.opt_encoding ?  globals.opt_encoding : gcp_get_encoding("l16");
-    globals.opt_speech_model = globals.opt_speech_model ?  globals.opt_speech_model : "phone_call";
-    globals.opt_max_alternatives = globals.opt_max_alternatives > 0 ? globals.opt_max_alternatives : 1;
-    globals.opt_meta_microphone_distance = globals.opt_meta_microphone_distance ? globals.opt_meta_microphone_distance : gcp_get_microphone_distance("unspecified");
-    globals.opt_meta_recording_device_type = globals.opt_meta_recording_device_type ? globals.opt_meta_recording_device_type : gcp_get_recording_device("unspecified");
-    globals.opt_meta_interaction_type = globals.opt_meta_interaction_type ? globals.opt_meta_interaction_type : gcp_get_interaction("unspecified");
+    sidecar_init(pool);
+    journal_init(pool);
+    spill_init(pool);
+    grammar_init(pool);
+
+    // nothing fails from here on, the threads go last
+    slog_init(pool);
+    features_start();
+
+    switch_event_bind_removable(modname, SWITCH_EVENT_RELOADXML, NULL, event_handler_reloadxml, NULL, &globals.reloadxml_node);
 
     // -------------------------
     *module_interface = switch_loadable_module_create_module_interface(pool, modname);
@@ -614,34 +1064,48 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_sfwhisper_load) {
     asr_interface->asr_load_grammar = asr_load_grammar;
     asr_interface->asr_unload_grammar = asr_unload_grammar;
 
+    SWITCH_ADD_API(commands_interface, "sfwhisper", "sfwhisper management", sfwhisper_cmd_handler, CMD_SYNTAX);
+    switch_console_set_complete("add sfwhisper reload");
+    switch_console_set_complete("add sfwhisper stats");
+    switch_console_set_complete("add sfwhisper sessions");
+    switch_console_set_complete("add sfwhisper kill");
+    switch_console_set_complete("add sfwhisper journal");
+    switch_console_set_complete("add sfwhisper capture");
+
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "SfWhisper-%s\n", VERSION);
 out:
-    if(xml) {
-        switch_xml_free(xml);
+    if(status != SWITCH_STATUS_SUCCESS) {
+        // the shutdown function isn't called for a module that failed to load, nothing may run once it's unmapped
+        threads_stop();
+        switch_event_free_subclass(EVENT_OVERFLOW);
+        switch_event_free_subclass(EVENT_PARTIAL);
+        switch_event_free_subclass(EVENT_RESULT);
+        switch_event_free_subclass(EVENT_SPILL_RESULT);
+        config_release(&globals.config);
     }
     return status;
 }
 
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_sfwhisper_shutdown) {
-    uint8_t fl_wloop = true;
+    threads_stop();
 
-    globals.fl_shutdown = true;
-
-    switch_mutex_lock(globals.mutex);
-    fl_wloop = (globals.active_threads > 0);
-    switch_mutex_unlock(globals.mutex);
-
-    if(fl_wloop) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Waiting for termination '%d' threads...\n", globals.active_threads);
-        while(fl_wloop) {
-            switch_mutex_lock(globals.mutex);
-            fl_wloop = (globals.active_threads > 0);
-            switch_mutex_unlock(globals.mutex);
-            switch_yield(100000);
-        }
+    if(globals.reloadxml_node) {
+        switch_event_unbind(&globals.reloadxml_node);
     }
 
-    switch_safe_free(globals.api_url_ep);
+    switch_event_free_subclass(EVENT_OVERFLOW);
+    switch_event_free_subclass(EVENT_PARTIAL);
+    switch_event_free_subclass(EVENT_RESULT);
+    switch_event_free_subclass(EVENT_SPILL_RESULT);
+
+    journal_shutdown();
+    grammar_shutdown();
+    slog_shutdown();
+    config_release(&globals.config);
+    apikey_shutdown();
+    if(globals.sessions) {
+        switch_core_hash_destroy(&globals.sessions);
+    }
 
     return SWITCH_STATUS_SUCCESS;
 }
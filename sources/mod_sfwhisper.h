@@ -13,6 +13,10 @@
 #include <stdint.h>
 #include <string.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #ifndef true
 #define true SWITCH_TRUE
 #endif
@@ -24,17 +28,107 @@
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
 #define VERSION             "1.0 (openai-whisper-v1)"
+#define WHISPER_MODEL       "whisper-1"
 #define QUEUE_SIZE          64
 #define VAD_STORE_FRAMES    32
 #define VAD_RECOVERY_FRAMES 20
+#define FEED_PTIME          20  // asr_open picks the feed kernel for it, see feed.cpp
 #define DEF_CHUNK_SZ_SEC    15
+#define DEF_AUDIO_BUFFER_MS 2000
+#define PROGRESSIVE_RETRY_SEC 300
+#define DEF_PARALLEL_UPLOADS 3
+#define MAX_PARALLEL_UPLOADS 8
+#define SILENCE_ENERGY_THRESHOLD 100
 #define BASE64_ENC_SZ(n)    (4*(n/3))
+#define WAV_HDR_L16_SZ      44
+#define WAV_HDR_G711_SZ     58
+#define WAV_HDR_MAX_SZ      WAV_HDR_G711_SZ
+#define WAV_LEN_UNKNOWN     0xffffffff
+#define LOG_RING_SLOTS      64
+#define LOG_RECORD_SZ       384
+#define LOG_FLUSH_INTERVAL_MS 100
+#define CLS_MIN_VOICED_MS   300
+#define CLS_MAX_FLATNESS    0.45
+#define CLS_TONE_RATIO      0.80
+#define CLS_TONE_FRAMES     0.60
+#define CLS_FRAME_MS        32
+#define CLS_BAND_LO_HZ      100
+#define CLS_BAND_HI_HZ      4000
+#define COALESCE_MAX_UTTERANCES 32
+#define DEF_COALESCE_MAX_SEC 10
+#define DEF_COALESCE_MAX_AGE_MS 5000
+#define DEF_COALESCE_GAP_MS 500
+#define OVERLAP_MIN_CHUNK_SEC 3    // chunk-size-sec can go down to it with chunk-overlap-ms
+#define OVERLAP_ALIGN_MS    400     // the same word in two chunks, start time difference
+#define SPILL_MAGIC         0x4c495053  // "SPIL"
+#define SPILL_VERSION       1
+#define SPILL_MAX_ATTEMPTS  20
+#define SPILL_RETRY_MS      1000                // drain backoff after a failure, doubles up to the max
+#define SPILL_RETRY_MAX_MS  60000
+#define SPILL_SCAN_MS       5000                // nothing to drain, look again
+#define SPILL_TICK_MS       50
+#define DEF_SPILL_MAX_MB    512
+#define DEF_SPILL_DRAIN_PER_MIN 60
+#define MAX_API_KEYS        32
+#define GRAMMAR_MAX_ITEMS   64
+#define GRAMMAR_MAX_TEMPLATES 8                 // per phrase, a learned one replaces the oldest
+#define GRAMMAR_RATE        8000                // features are taken at 8kHz whatever the session rate
+#define GRAMMAR_FRAME       200                 // 25ms
+#define GRAMMAR_HOP         80                  // 10ms
+#define GRAMMAR_FFT         256
+#define GRAMMAR_BANDS       20                  // mel 100..3800 Hz
+#define GRAMMAR_CEPS        12                  // c1..c12, mean removed
+#define GRAMMAR_MIN_FRAMES  15                  // voiced part shorter than that isn't a word
+#define GRAMMAR_MAX_WAV     (1024 * 1024)
+#define DEF_GRAMMAR_MAX_MS  2500
+#define DEF_GRAMMAR_CONFIDENCE 0.25
+#define DEF_GRAMMAR_MAX_DISTANCE 9.0
+#define APIKEY_BACKOFF_MS   1000                // first 429 without retry-after, doubles up to the max
+#define APIKEY_BACKOFF_MAX_MS 60000
+#define APIKEY_ROOM_UNKNOWN 1000000             // no rate-limit headers seen (or past their reset)
+#define SIDECAR_RECONNECT_MS 1000
+#define SIDECAR_ABORT_CHECK_MS 100              // a waiter sees a hangup / kill this late at most, responses wake it at once
+#define JOURNAL_MAGIC       0x4c4e524a  // "JRNL"
+#define JOURNAL_QUEUE_SIZE  1024
+#define JOURNAL_BATCH       64
+#define JOURNAL_FLUSH_MS    200
+#define DEF_JOURNAL_SEGMENT_MB 64
+#define JOURNAL_FL_ERROR    0x01
+#define JOURNAL_FL_SEGMENTS 0x02
+#define CAPTURE_MAGIC       0x43574653  // "SFWC"
+#define CAPTURE_VERSION     1
+#define CAPTURE_QUEUE_SIZE  1024
+#define DEF_CAPTURE_MAX_MB  100
+#define DEF_REALTIME_URL    "wss://api.openai.com/v1/realtime?intent=transcription"
+#define DEF_REALTIME_MODEL  "gpt-4o-transcribe"
+#define REALTIME_SAMPLERATE 24000           // pcm16 of the realtime api
+
+#define CODEC_L16           0
+#define CODEC_PCMU          1
+#define CODEC_PCMA          2
+
+#define OVERFLOW_DROP_OLDEST    0
+#define OVERFLOW_DROP_NEWEST    1
+#define OVERFLOW_COMPACT_SILENCE 2
+
+#define CHUNK_ACCEPT            0
+#define CHUNK_REJECT_SHORT      1
+#define CHUNK_REJECT_NOISE      2
+#define CHUNK_REJECT_TONE       3
+
+#define EVENT_OVERFLOW      "sfwhisper::overflow"
+#define EVENT_PARTIAL       "sfwhisper::partial"
+#define EVENT_RESULT        "sfwhisper::result"
+#define EVENT_SPILL_RESULT  "sfwhisper::spill-result"
 #define BOOL2STR(v)         (v ? "true" : "false")
 
 typedef struct {
-    switch_mutex_t          *mutex;
-    uint32_t                active_threads;
+    switch_memory_pool_t    *pool;
+    volatile switch_atomic_t refs;
+    uint32_t                gen;
     uint32_t                chunk_size_sec;
+    uint32_t                audio_buffer_ms;    // q_audio budget
+    uint8_t                 overflow_policy;
     uint32_t                vad_silence_ms;
     uint32_t                vad_voice_ms;
     uint32_t                vad_threshold;
@@ -42,14 +136,51 @@ typedef struct {
     uint32_t                connect_timeout; // seconds
     uint8_t                 fl_vad_debug;
     uint8_t                 fl_vad_enabled;
-    uint8_t                 fl_shutdown;
+    uint8_t                 fl_log_transcripts;
+    uint8_t                 fl_progressive_upload;
+    uint32_t                max_parallel_uploads; // per session
+    uint8_t                 fl_classifier_enabled;
+    uint32_t                classifier_min_voiced_ms;
+    double                  classifier_max_flatness;
+    double                  classifier_tone_ratio;      // of a frame's energy in its 2 peaks
+    double                  classifier_tone_frames;     // of the voiced frames that are tonal
+    uint8_t                 fl_coalesce;        // default for the sessions
+    uint32_t                coalesce_max_sec;
+    uint32_t                coalesce_max_age_ms;
+    uint32_t                coalesce_gap_ms;
+    uint32_t                chunk_overlap_ms;   // audio shared by the chunks of a long utterance, 0 - off
+    uint8_t                 fl_nlsml;           // default for the sessions
+    uint8_t                 fl_sidecar_fallback;    // in-process upload when the sidecar fails
+    uint8_t                 fl_journal_audio;
+    uint32_t                journal_segment_mb;
+    uint32_t                journal_max_segments;   // 0 - keep all
+    uint32_t                capture_max_mb;     // per capture file
+    uint8_t                 fl_realtime;        // default for the sessions
+    uint8_t                 fl_spill;           // default for the sessions
+    uint32_t                spill_max_mb;
+    uint32_t                spill_drain_per_min;
+    uint8_t                 fl_grammar_learn;   // keep the cloud results that matched a grammar item as templates
+    uint32_t                grammar_max_ms;     // longer utterances go to the cloud
+    double                  grammar_confidence;
+    double                  grammar_max_distance;
+    switch_log_level_t      log_level;
+    uint32_t                log_sample_rate;    // 1 of N chunks
     char                    *api_url_ep;
-    const char              *api_key;
+    const char              *api_key;           // the first one of api_keys
+    const char              *api_keys[MAX_API_KEYS];
+    uint32_t                api_keys_count;
     const char              *api_url;
     const char              *user_agent;
     const char              *default_lang;
     const char              *proxy;
     const char              *proxy_credentials;
+    const char              *sidecar_socket;
+    const char              *journal_dir;
+    const char              *spill_dir;
+    const char              *capture_dir;
+    const char              *grammar_templates_dir;
+    const char              *realtime_url;
+    const char              *realtime_model;
     const char              *opt_encoding;
     const char              *opt_speech_model;
     const char              *opt_meta_microphone_distance;
@@ -66,17 +197,144 @@ typedef struct {
     //
     switch_bool_t           start_input_timers;
     int                     no_input_timeout;
+} config_t;
+
+typedef struct {
+    switch_mutex_t          *mutex;
+    switch_memory_pool_t    *pool;              // module's, for the threads started on reload
+    switch_event_node_t     *reloadxml_node;
+    config_t                *config;            // current snapshot, swapped on reload
+    switch_hash_t           *sessions;          // uuid => gasr_ctx_t, under mutex
+    uint32_t                config_gen;
+    uint32_t                active_threads;
+    uint8_t                 fl_shutdown;
+    uint64_t                drops_frames;
+    uint64_t                drops_bytes;
+    uint64_t                drops_utterances;
+    uint64_t                chunks_uploaded;
+    uint64_t                rejects_short;
+    uint64_t                rejects_noise;
+    uint64_t                rejects_tone;
+    uint64_t                rejects_audio_ms;   // audio that wasn't sent to the API
+    uint64_t                sidecar_requests;
+    uint64_t                sidecar_errors;
+    uint64_t                sidecar_reconnects;
+    uint64_t                journal_records;
+    uint64_t                journal_bytes;
+    uint64_t                journal_drops;
+    uint64_t                uploads_killed;     // sfwhisper kill
+    uint64_t                realtime_sessions;
+    uint64_t                realtime_results;
+    uint64_t                realtime_errors;
+    uint64_t                realtime_fallbacks; // connect failed or dropped, went on with the uploads
+    uint64_t                apikey_exhausted;   // every key was backed off
+    uint64_t                spill_depth;        // files waiting in spill-dir
+    uint64_t                spill_bytes;
+    uint64_t                spill_written;
+    uint64_t                spill_deferred;     // not even tried, the backend was down
+    uint64_t                spill_drained;
+    uint64_t                spill_failed;       // drain attempts
+    uint64_t                spill_dropped;      // spill-max-mb, write errors, SPILL_MAX_ATTEMPTS
+    uint64_t                grammar_local;      // recognized without a request
+    uint64_t                grammar_cloud;      // sent with the grammar as the prompt
+    uint64_t                grammar_mapped;     // cloud text matched an item
+    uint64_t                grammar_nomatch;
+    uint64_t                grammar_learned;
+    uint64_t                overlap_aligned;    // chunk texts joined on the same words
+    uint64_t                overlap_cut;        // no common words, cut in the middle of the overlap
+    uint64_t                nlsml_results;
+    uint64_t                vjson_errors;       // verbose_json responses that couldn't be parsed
+    switch_time_t           progressive_retry_time; // chunked uploads rejected, don't try before
 } globals_t;
 extern globals_t globals;
 
 typedef struct {
+    char                    *phrase;            // normalized words: the template name, compared with the cloud text
+    char                    *value;             // the result: SRGS tag or the phrase
+} grammar_item_t;
+
+typedef struct {
+    char                    *name;
+    char                    *prompt;            // the vocabulary, for the cloud request
+    uint32_t                count;
+    grammar_item_t          items[GRAMMAR_MAX_ITEMS];
+} grammar_t;
+
+/**
+ ** sfwhisper::result timestamps
+ **/
+typedef struct {
+    switch_time_t           t_speech_start;     // VAD start of the utterance
+    switch_time_t           t_speech_end;       // VAD end, 0 - the chunk was cut while talking (or no VAD)
+    switch_time_t           t_dispatch;         // chunk handed to the upload (realtime: commit)
+    switch_time_t           t_response;
+} result_timing_t;
+
+/**
+ ** a parsed verbose_json response (vjson.c), the strings point into mem
+ **/
+typedef struct {
+    const char              *text;
+    double                  start;
+    double                  end;
+    double                  avg_logprob;
+    double                  no_speech_prob;
+} vjson_segment_t;
+
+typedef struct {
+    const char              *word;
+    double                  start;
+    double                  end;
+} vjson_word_t;
+
+typedef struct {
+    void                    *mem;               // one block: segments, words, strings
+    const char              *text;
+    const char              *language;
+    double                  duration;
+    vjson_segment_t         *segments;
+    vjson_word_t            *words;
+    uint32_t                segments_count;
+    uint32_t                words_count;
+} vjson_t;
+
+typedef struct {
+    const char              *word;
+    uint32_t                start_ms;
+    uint32_t                end_ms;
+} overlap_word_t;
+
+typedef struct {
+    uint32_t                head_ms;            // audio shared with the previous chunk
+    uint32_t                tail_ms;            // with the next one
+    uint32_t                len_ms;
+    uint32_t                first;              // held: the words from it on
+    uint32_t                count;
+    overlap_word_t          *words;
+    void                    *mem;               // the parsed response the words point into
+} overlap_chunk_t;
+
+typedef struct {
+    uint8_t                 fl_done;
+    uint32_t                count;
+    char                    **texts;            // one per utterance in the chunk, NULL if the chunk failed or nothing was said
+    overlap_chunk_t         *overlap;           // words of an overlapping chunk, for overlap_stitch()
+    result_timing_t         timing;
+} upload_slot_t;
+
+typedef struct gasr_ctx_s {
     switch_memory_pool_t    *pool;
     switch_core_session_t   *session;
+    config_t                *cfg;               // snapshot taken in asr_open
+    char                    uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
     switch_vad_t            *vad;
     switch_byte_t           *vad_buffer;
+    int16_t                 *pcm_buffer;        // decoded frame for VAD (G.711 only)
     switch_mutex_t          *mutex;
     switch_queue_t          *q_audio;
     switch_queue_t          *q_text;
+    struct capture_s        *capture;           // set once by capture_start(), freed in asr_close
+    grammar_t               *grammar;           // asr_load_grammar, in the session pool: a request may still use the previous one
     switch_buffer_t         *curl_recv_buffer_ref;
     switch_byte_t           *curl_send_buffer_ref;
     char                    *lang;
@@ -88,14 +346,43 @@ typedef struct {
     uint32_t                vad_stored_frames;
     uint32_t                chunk_buffer_size;
     uint32_t                deps;
+    uint32_t                chunk_seq;
+    uint32_t                upload_seq;         // next dispatched chunk
+    uint32_t                deliver_seq;        // next result for q_text
+    uint32_t                uploads_active;
+    uint32_t                max_parallel_uploads;
+    upload_slot_t           upload_slots[MAX_PARALLEL_UPLOADS];
+    overlap_chunk_t         *overlap_pending;   // tail words of the last delivered chunk, under mutex
+    uint32_t                q_audio_bytes;
+    uint32_t                q_audio_budget;
+    uint32_t                drops_frames;
+    uint32_t                drops_bytes;
     uint32_t                samplerate;
     uint32_t                channels;
+    uint32_t                sample_bytes;
+    uint8_t                 codec;
     uint32_t                frame_len;
     uint32_t                ptime;
+    uint32_t                feed_frame_len;     // frame size the feed kernel was picked for
+    switch_status_t         (*feed)(struct gasr_ctx_s *asr_ctx, switch_byte_t *data, uint32_t data_len);
     uint8_t                 fl_pause;
     uint8_t                 fl_vad_enabled;
+    uint8_t                 fl_classifier_enabled;
+    uint8_t                 fl_coalesce;
+    uint8_t                 fl_realtime;
+    uint8_t                 fl_spill;
+    uint8_t                 fl_nlsml;
     uint8_t                 fl_destroyed;
     uint8_t                 fl_abort;
+    uint8_t                 fl_drop_reported;   // once per utterance
+    // read by 'sfwhisper sessions' without the mutex
+    uint32_t                kill_gen;           // 'sfwhisper kill': the requests started before the change give up
+    uint32_t                chunk_bytes;        // audio in the transcript thread's chunk buffer
+    uint64_t                bytes_uploaded;
+    switch_time_t           upload_since[MAX_PARALLEL_UPLOADS]; // request start by seq, 0 - none
+    switch_time_t           t_open;
+    switch_time_t           t_speech_start;     // set by asr_feed on the VAD changes
+    switch_time_t           t_speech_end;
     //
     const char              *opt_encoding;
     const char              *opt_speech_model;
@@ -124,6 +411,220 @@ typedef struct {
     switch_byte_t           *data;
 } xdata_buffer_t;
 
+typedef struct {
+    uint32_t                voiced_ms;
+    double                  flatness;           // mean over voiced frames, 0 (tonal) .. 1 (white noise)
+    double                  tonal;              // share of voiced frames with a steady 1-2 peak spectrum
+} chunk_class_t;
+
+typedef struct {
+    uint32_t                marks[COALESCE_MAX_UTTERANCES]; // chunk offsets where the utterances start
+    uint32_t                count;
+    uint32_t                offs;               // end of the last gap
+    switch_time_t           expiry;             // age limit of the first utterance
+} coalesce_t;
+
+typedef struct {
+    char                    *key;
+    char                    label[24];          // for logs/stats: sk-...abcd
+    uint8_t                 fl_active;          // in the current config
+    uint32_t                inflight;
+    int64_t                 remaining_requests; // -1 - unknown
+    int64_t                 remaining_tokens;
+    switch_time_t           reset_requests;
+    switch_time_t           reset_tokens;
+    switch_time_t           backoff_until;
+    uint32_t                backoff_ms;         // grows with consecutive 429s
+    uint64_t                requests;
+    uint64_t                errors;
+    uint64_t                rate_limited;
+} apikey_t;
+
+/**
+ ** what a response said about its key
+ **/
+typedef struct {
+    long                    http_code;
+    int64_t                 remaining_requests; // -1 - no header
+    int64_t                 remaining_tokens;
+    uint32_t                reset_requests_ms;
+    uint32_t                reset_tokens_ms;
+    uint32_t                retry_after_ms;
+} apikey_limits_t;
+
+/**
+ ** progressive upload of one chunk (chunked multipart body, fed while the caller speaks)
+ **/
+typedef struct {
+    gasr_ctx_t              *asr_ctx;
+    switch_memory_pool_t    *pool;
+    switch_mutex_t          *mutex;
+    switch_queue_t          *q_data;            // xdata_buffer_t, an empty one marks the end of audio
+    switch_buffer_t         *recv_buffer;
+    xdata_buffer_t          *cur;
+    switch_byte_t           *head;              // form fields + file part header + wav header
+    char                    *tail;              // closing boundary
+    char                    boundary[SWITCH_UUID_FORMATTED_LENGTH + 1];
+    uint32_t                head_len;
+    uint32_t                tail_len;
+    uint32_t                offs;
+    uint32_t                chunk_id;
+    uint32_t                bytes_sent;
+    long                    http_code;
+    char                    *text;
+    uint8_t                 fl_eof;
+    uint8_t                 fl_done;
+    uint8_t                 fl_cancel;
+    uint8_t                 fl_released;
+    uint8_t                 fl_unsupported;
+    uint8_t                 fl_segments;        // verbose_json requested, text is the whole response
+    uint8_t                 fl_words;           // the same with word timestamps (overlapping chunks)
+    uint8_t                 fl_nlsml;           // the same with word and segment timestamps
+    uint32_t                kill_gen;
+} upload_stream_t;
+
+typedef struct {
+    gasr_ctx_t              *asr_ctx;
+    upload_stream_t         *stream;            // progressive request of this chunk, if any
+    grammar_t               *grammar;           // of the session at dispatch
+    switch_byte_t           *data;
+    uint32_t                data_len;
+    uint32_t                chunk_id;
+    uint32_t                seq;
+    uint8_t                 fl_segments;        // coalesced chunk, split the result by marks_ms
+    uint8_t                 fl_words;           // overlapping chunks: word timestamps for overlap_stitch()
+    uint8_t                 fl_nlsml;           // word and segment timestamps, the result in NLSML
+    uint32_t                overlap_head_ms;
+    uint32_t                overlap_tail_ms;
+    uint32_t                kill_gen;
+    result_timing_t         timing;
+    uint32_t                marks_count;
+    uint32_t                marks_ms[COALESCE_MAX_UTTERANCES];
+} upload_job_t;
+
+/**
+ ** spill file: this header + audio
+ **/
+typedef struct {
+    uint32_t                magic;
+    uint16_t                version;
+    uint8_t                 codec;
+    uint8_t                 fl_segments;
+    uint32_t                channels;
+    uint32_t                samplerate;
+    uint32_t                chunk_id;
+    uint32_t                attempts;
+    uint32_t                audio_len;
+    uint32_t                marks_count;
+    uint32_t                marks_ms[COALESCE_MAX_UTTERANCES];
+    int64_t                 t_speech_start;
+    int64_t                 t_speech_end;
+    int64_t                 t_dispatch;
+    int64_t                 t_spill;
+    char                    uuid[40];
+    char                    lang[16];
+} spill_hdr_t;
+
+/**
+ ** journal record: this header + text + audio, 8 bytes aligned; the index (.idx) holds one journal_idx_t per record
+ **/
+typedef struct {
+    uint32_t                magic;
+    uint32_t                len;                // whole record
+    uint64_t                timestamp;          // upload start, usec
+    char                    uuid[40];
+    char                    lang[16];
+    char                    mode[12];
+    uint32_t                chunk_id;
+    uint32_t                seq;
+    uint32_t                samplerate;
+    uint8_t                 codec;
+    uint8_t                 channels;
+    uint16_t                flags;              // JOURNAL_FL_*
+    uint32_t                audio_ms;
+    uint32_t                upload_ms;
+    uint32_t                text_len;           // utterances separated by '\n'
+    uint32_t                audio_len;
+} journal_rec_t;
+
+typedef struct {
+    char                    uuid[40];
+    uint32_t                offs;
+    uint32_t                len;
+} journal_idx_t;
+
+/**
+ ** capture file (sfwcap): capture_hdr_t, then capture_rec_t + payload, ts_us from the capture start.
+ ** CAP_FEED: the frame, vad is the session state after it, status what asr_feed returned;
+ ** CAP_PARAM: "name\0value"; CAP_RESULT: capture_result_t + the API response; CAP_TEXT: what asr_get_results handed out
+ **/
+typedef enum {
+    CAP_FEED = 1,
+    CAP_PAUSE,
+    CAP_RESUME,
+    CAP_PARAM,
+    CAP_TIMERS,
+    CAP_RESULT,
+    CAP_TEXT,
+    CAP_END
+} capture_type_t;
+
+#define CAP_HDR_FL_VAD          0x01
+#define CAP_HDR_FL_CLASSIFIER   0x02
+#define CAP_HDR_FL_COALESCE     0x04
+
+typedef struct {
+    uint32_t                magic;
+    uint16_t                version;
+    uint8_t                 codec;
+    uint8_t                 channels;
+    uint32_t                samplerate;
+    uint32_t                flags;              // CAP_HDR_FL_*
+    uint32_t                chunk_size_sec;
+    uint32_t                vad_silence_ms;
+    uint32_t                vad_voice_ms;
+    uint32_t                vad_threshold;
+    uint32_t                classifier_min_voiced_ms;
+    uint32_t                coalesce_max_sec;
+    uint32_t                coalesce_max_age_ms;
+    uint32_t                coalesce_gap_ms;
+    uint32_t                max_parallel_uploads;
+    uint32_t                reserved;
+    int64_t                 timestamp;          // capture start, epoch us
+    char                    uuid[40];
+    char                    lang[16];
+} capture_hdr_t;
+
+typedef struct {
+    uint8_t                 type;               // capture_type_t
+    uint8_t                 vad;
+    uint8_t                 status;
+    uint8_t                 fl_pause;
+    uint32_t                len;                // payload
+    int64_t                 ts_us;
+} capture_rec_t;
+
+typedef struct {
+    uint64_t                hash;               // capture_hash() of the chunk, matches the response to the request on replay
+    uint32_t                chunk_id;
+    uint32_t                seq;
+    uint32_t                data_len;
+    uint32_t                upload_ms;
+    uint8_t                 fl_error;
+    uint8_t                 fl_segments;
+    uint16_t                reserved;
+    char                    mode[12];
+} capture_result_t;
+
+/* mod_sfwhisper.c */
+void result_event(gasr_ctx_t *asr_ctx, const char *text, uint32_t utterance, const result_timing_t *timing);
+void session_wake(gasr_ctx_t *asr_ctx);
+switch_status_t audio_queue_push(gasr_ctx_t *asr_ctx, xdata_buffer_t *buf);
+
+/* feed.cpp */
+typedef switch_status_t (*feed_kernel_t)(gasr_ctx_t *asr_ctx, switch_byte_t *data, uint32_t data_len);
+feed_kernel_t feed_select(uint8_t codec, uint32_t samplerate, uint32_t frame_len);
+
 /* utils.c */
 void thread_finished();
 void thread_launch(switch_memory_pool_t *pool, switch_thread_start_t fun, void *data);
@@ -132,17 +633,141 @@ switch_status_t xdata_buffer_alloc(xdata_buffer_t **out, switch_byte_t *data, ui
 void xdata_buffer_free(xdata_buffer_t **buf);
 void xdata_buffer_queue_clean(switch_queue_t *queue);
 
-char *audio_file_write(switch_byte_t *buf, uint32_t buf_len, uint32_t channels, uint32_t samplerate);
+uint32_t wav_header_build(switch_byte_t *hdr, uint8_t codec, uint32_t channels, uint32_t samplerate, uint32_t data_len);
+char *audio_file_write(switch_byte_t *buf, uint32_t buf_len, uint8_t codec, uint32_t channels, uint32_t samplerate);
 void data_file_write(switch_byte_t *buf, uint32_t buf_len);
 void audio_file_delete(const char *file_name);
 
+void g711_init();
+void g711_decode(uint8_t codec, const switch_byte_t *src, uint32_t len, int16_t *dst);
+const int16_t *g711_table(uint8_t codec);
+
+uint8_t pcm_is_silence(const int16_t *samples, uint32_t count, uint32_t threshold);
+const char *overflow_policy2str(uint8_t policy);
+
 char *gcp_get_language(const char *val);
 char *gcp_get_encoding(const char *val);
 char *gcp_get_microphone_distance(const char *val);
 char *gcp_get_recording_device(const char *val);
 char *gcp_get_interaction(const char *val);
 
+/* classify.c */
+uint8_t chunk_classify(gasr_ctx_t *asr_ctx, const switch_byte_t *data, uint32_t data_len, chunk_class_t *cls);
+const char *chunk_reject2str(uint8_t reason);
+void fft_radix2(float *re, float *im, uint32_t n);
+
+/* coalesce.c */
+void coalesce_reset(coalesce_t *co);
+uint8_t coalesce_utterance_end(gasr_ctx_t *asr_ctx, coalesce_t *co, switch_buffer_t *chunk_buffer, upload_stream_t *stream);
+uint32_t coalesce_marks_ms(gasr_ctx_t *asr_ctx, coalesce_t *co, uint32_t chunk_len, uint32_t *marks_ms);
+switch_status_t coalesce_split(const char *json_str, const uint32_t *marks_ms, uint32_t count, char **texts);
+
+/* chunk_upload.c */
+switch_status_t upload_dispatch(gasr_ctx_t *asr_ctx, switch_memory_pool_t *pool, const switch_byte_t *data, uint32_t data_len, upload_stream_t **stream, const uint32_t *marks_ms, uint32_t marks_count, uint32_t overlap_head_ms, uint32_t overlap_tail_ms);
+void upload_slots_clean(gasr_ctx_t *asr_ctx);
+void upload_timing_start(gasr_ctx_t *asr_ctx, result_timing_t *timing);
+uint32_t upload_kill(gasr_ctx_t *asr_ctx);
+switch_status_t upload_local(gasr_ctx_t *asr_ctx, char *text);
+
+/* overlap.c */
+switch_status_t overlap_parse(const char *json_str, uint32_t head_ms, uint32_t tail_ms, uint32_t len_ms, overlap_chunk_t **out, char **text);
+void overlap_stitch(gasr_ctx_t *asr_ctx, upload_slot_t *slot);
+void overlap_free(overlap_chunk_t **oc);
+
+/* vjson.c */
+switch_status_t vjson_parse(const char *buf, size_t len, vjson_t *vj);
+void vjson_free(vjson_t *vj);
+
+/* nlsml.c */
+char *nlsml_build(const char *grammar, const char *instance, const char *input, const vjson_t *vj);
+switch_status_t nlsml_result(gasr_ctx_t *asr_ctx, grammar_t *grammar, const switch_byte_t *data, uint32_t data_len, const char *json, char **text);
+
+/* sidecar.c */
+void sidecar_init(switch_memory_pool_t *pool);
+void sidecar_start(config_t *cfg);
+uint8_t sidecar_connected();
+switch_status_t sidecar_transcribe(gasr_ctx_t *asr_ctx, const switch_byte_t *data, uint32_t data_len, uint8_t fl_segments, uint8_t fl_words, uint8_t fl_timestamps, char **text);
+
+/* journal.c */
+void journal_init(switch_memory_pool_t *pool);
+void journal_start(config_t *cfg);
+void journal_shutdown();
+void journal_write(gasr_ctx_t *asr_ctx, upload_job_t *job, const char *mode, uint16_t flags, char **texts, uint32_t count, switch_time_t t_upload, switch_time_t t_done);
+void journal_lookup(const char *uuid, uint8_t fl_export, switch_stream_handle_t *stream);
+
+/* spill.c */
+void spill_init(switch_memory_pool_t *pool);
+void spill_start(config_t *cfg);
+uint8_t spill_deferring(gasr_ctx_t *asr_ctx);
+switch_status_t spill_put(gasr_ctx_t *asr_ctx, upload_job_t *job);
+uint32_t spill_drained_last_min();
+
+/* grammar.c */
+void grammar_init(switch_memory_pool_t *pool);
+void grammar_shutdown();
+grammar_t *grammar_parse(switch_memory_pool_t *pool, config_t *cfg, const char *grammar, const char *name);
+char *grammar_recognize(gasr_ctx_t *asr_ctx, grammar_t *grammar, const switch_byte_t *data, uint32_t data_len);
+void grammar_result(gasr_ctx_t *asr_ctx, grammar_t *grammar, const switch_byte_t *data, uint32_t data_len, char **text);
+const char *grammar_prompt(gasr_ctx_t *asr_ctx);
+uint32_t grammar_templates();
+
+/* capture.c */
+switch_status_t capture_start(gasr_ctx_t *asr_ctx);
+void capture_stop(gasr_ctx_t *asr_ctx);
+void capture_destroy(gasr_ctx_t *asr_ctx);
+void capture_put(gasr_ctx_t *asr_ctx, uint8_t type, uint8_t status, const void *data, uint32_t len, const void *data2, uint32_t len2);
+void capture_result(gasr_ctx_t *asr_ctx, upload_job_t *job, const char *mode, switch_status_t status, const char *response, switch_time_t t_upload, switch_time_t t_done);
+void capture_flush(gasr_ctx_t *asr_ctx);
+uint64_t capture_hash(const switch_byte_t *data, uint32_t len);
+
+/* ws.c */
+typedef struct ws_s ws_t;
+ws_t *ws_connect(const char *url, const char *headers, config_t *cfg);
+switch_status_t ws_send_text(ws_t *ws, const char *data, uint32_t len);
+switch_status_t ws_recv(ws_t *ws, char **msg, int timeout_ms);
+void ws_close(ws_t **ws);
+
+/* realtime.c */
+switch_status_t realtime_run(gasr_ctx_t *asr_ctx);
+
+/* apikeys.c */
+void apikey_init(switch_memory_pool_t *pool);
+void apikey_shutdown();
+void apikey_sync(config_t *cfg);
+apikey_t *apikey_acquire(config_t *cfg);
+void apikey_release(apikey_t *key, apikey_limits_t *lim, config_t *cfg);
+void apikey_limits_init(apikey_limits_t *lim);
+void apikey_header(apikey_limits_t *lim, const char *line, size_t len);
+void apikey_stats(switch_stream_handle_t *stream);
+
+/* config.c */
+switch_status_t config_load(config_t **out);
+switch_status_t config_reload();
+config_t *config_acquire();
+void config_release(config_t **cfg);
+
+/* log.c */
+void slog_init(switch_memory_pool_t *pool);
+void slog_shutdown();
+void slog_thread_attach();
+void slog_thread_done();
+uint8_t slog_sample(config_t *cfg);
+void slog_printf(config_t *cfg, switch_log_level_t level, const char *fmt, ...);
+void slog_chunk(gasr_ctx_t *asr_ctx, uint32_t chunk_id, switch_log_level_t level, const char *stage, const char *fmt, ...);
+
+/* upload_stream.c */
+upload_stream_t *upload_stream_start(gasr_ctx_t *asr_ctx, uint32_t chunk_id);
+void upload_stream_push(upload_stream_t *stream, xdata_buffer_t *buf);
+switch_status_t upload_stream_finish(upload_stream_t *stream, char **text);
+void upload_stream_release(upload_stream_t **stream);
+
 /* curl.c */
 switch_status_t curl_perform(gasr_ctx_t *asr_ctx);
+switch_status_t curl_upload_stream(upload_stream_t *stream);
+switch_status_t curl_transcribe(gasr_ctx_t *asr_ctx, const char *fname, uint8_t fl_verbose, uint8_t fl_words, uint8_t fl_segments, switch_buffer_t *recv_buffer);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
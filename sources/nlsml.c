@@ -0,0 +1,148 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+#include <math.h>
+
+extern globals_t globals;
+
+/**
+ ** NLSML results ({nlsml=true}): the chunk is requested as verbose_json with word and segment timestamps and the
+ ** result is an MRCP-style NLSML document instead of the text. The interpretation's confidence comes from the
+ ** segments (exp(avg_logprob) less no_speech_prob, weighted by their length), the instance is the grammar item's
+ ** value or the transcript; the timestamps follow the interpretation.
+ **/
+static double clampd(double v, double lo, double hi) {
+    return (v < lo ? lo : (v > hi ? hi : v));
+}
+
+static const char *skip_ws(const char *s) {
+    while(s && (*s == ' ' || *s == '\t' || *s == '\n')) { s++; }
+    return s;
+}
+
+/**
+ ** worst case 6 bytes per byte (&quot;)
+ **/
+static char *xml_put(char *dst, const char *src) {
+    for(; src && *src; src++) {
+        unsigned char c = *src;
+        switch(c) {
+            case '&':  memcpy(dst, "&amp;", 5); dst += 5; break;
+            case '<':  memcpy(dst, "&lt;", 4); dst += 4; break;
+            case '>':  memcpy(dst, "&gt;", 4); dst += 4; break;
+            case '"':  memcpy(dst, "&quot;", 6); dst += 6; break;
+            case '\'': memcpy(dst, "&apos;", 6); dst += 6; break;
+            default:   *dst++ = (c < 0x20 && c != '\t' && c != '\n' && c != '\r' ? ' ' : c); break;
+        }
+    }
+    return dst;
+}
+
+static double nlsml_confidence(const vjson_t *vj) {
+    double sum = 0, weight = 0;
+
+    for(uint32_t i = 0; i < vj->segments_count; i++) {
+        const vjson_segment_t *seg = &vj->segments[i];
+        double w = MAX(seg->end - seg->start, 0.01);
+
+        sum += w * exp(clampd(seg->avg_logprob, -100, 0)) * (1.0 - clampd(seg->no_speech_prob, 0, 1));
+        weight += w;
+    }
+    return (weight > 0 ? clampd(sum / weight, 0, 1) : 0);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+/**
+ ** vj NULL: no timestamps and no confidence (a grammar match without a request)
+ **/
+char *nlsml_build(const char *grammar, const char *instance, const char *input, const vjson_t *vj) {
+    size_t len = 256 + (strlen(grammar ? grammar : "") + strlen(instance ? instance : "") + strlen(input ? input : "")) * 6;
+    char *doc = NULL, *p = NULL;
+
+    if(vj) {
+        len += 96 + strlen(vj->language ? vj->language : "") * 6;
+        for(uint32_t i = 0; i < vj->segments_count; i++) {
+            len += 112 + strlen(vj->segments[i].text) * 6;
+        }
+        for(uint32_t i = 0; i < vj->words_count; i++) {
+            len += 64 + strlen(vj->words[i].word) * 6;
+        }
+    }
+
+    switch_malloc(doc, len);
+    p = doc;
+
+    p += sprintf(p, "<?xml version=\"1.0\"?>\n<result>\n  <interpretation");
+    if(grammar) {
+        p += sprintf(p, " grammar=\"");
+        p = xml_put(p, grammar);
+        *p++ = '"';
+    }
+    if(vj && vj->segments_count) {
+        p += sprintf(p, " confidence=\"%.2f\"", nlsml_confidence(vj));
+    }
+    p += sprintf(p, ">\n    <instance>");
+    p = xml_put(p, instance);
+    p += sprintf(p, "</instance>\n    <input mode=\"speech\">");
+    p = xml_put(p, input);
+    p += sprintf(p, "</input>\n  </interpretation>\n");
+
+    if(vj && (vj->segments_count || vj->words_count)) {
+        p += sprintf(p, "  <timestamps");
+        if(vj->language) {
+            p += sprintf(p, " language=\"");
+            p = xml_put(p, vj->language);
+            *p++ = '"';
+        }
+        p += sprintf(p, " duration=\"%.2f\">\n", clampd(vj->duration, 0, 86400));
+        for(uint32_t i = 0; i < vj->segments_count; i++) {
+            const vjson_segment_t *seg = &vj->segments[i];
+            p += sprintf(p, "    <segment start=\"%.2f\" end=\"%.2f\" avg-logprob=\"%.3f\" no-speech-prob=\"%.3f\">",
+                         clampd(seg->start, 0, 86400), clampd(seg->end, 0, 86400), clampd(seg->avg_logprob, -100, 0), clampd(seg->no_speech_prob, 0, 1));
+            p = xml_put(p, skip_ws(seg->text));
+            p += sprintf(p, "</segment>\n");
+        }
+        for(uint32_t i = 0; i < vj->words_count; i++) {
+            const vjson_word_t *word = &vj->words[i];
+            p += sprintf(p, "    <word start=\"%.2f\" end=\"%.2f\">", clampd(word->start, 0, 86400), clampd(word->end, 0, 86400));
+            p = xml_put(p, skip_ws(word->word));
+            p += sprintf(p, "</word>\n");
+        }
+        p += sprintf(p, "  </timestamps>\n");
+    }
+    sprintf(p, "</result>");
+
+    return doc;
+}
+
+/**
+ ** verbose_json response -> NLSML; a grammar turn gets the value of the item the text names as the instance
+ **/
+switch_status_t nlsml_result(gasr_ctx_t *asr_ctx, grammar_t *grammar, const switch_byte_t *data, uint32_t data_len, const char *json, char **text) {
+    vjson_t vj = { 0 };
+    const char *input = NULL;
+    char *instance = NULL;
+
+    // no text: not a transcription (an error body)
+    if(!json || vjson_parse(json, strlen(json), &vj) != SWITCH_STATUS_SUCCESS || !vj.text) {
+        __atomic_add_fetch(&globals.vjson_errors, 1, __ATOMIC_RELAXED);
+        vjson_free(&vj);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    input = skip_ws(vj.text);
+    instance = strdup(input);
+    if(grammar) {
+        grammar_result(asr_ctx, grammar, data, data_len, &instance);
+    }
+
+    *text = nlsml_build((grammar ? grammar->name : NULL), instance, input, &vj);
+    __atomic_add_fetch(&globals.nlsml_results, 1, __ATOMIC_RELAXED);
+
+    switch_safe_free(instance);
+    vjson_free(&vj);
+    return SWITCH_STATUS_SUCCESS;
+}
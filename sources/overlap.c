@@ -0,0 +1,211 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+#include <ctype.h>
+
+extern globals_t globals;
+
+/**
+ ** Overlapping chunks (chunk-overlap-ms): a chunk cut while talking leaves its last chunk-overlap-ms at the start of
+ ** the next one, the chunks are requested with word timestamps. At the delivery (in seq order, under the session mutex)
+ ** the words in the tail of a chunk are held back, the next chunk's result is aligned with them by the longest run of
+ ** the same words at about the same time; without such a run the overlap is cut in the middle.
+ ** Stitched texts are built from the words (no punctuation), a chunk that doesn't touch an overlap keeps its text.
+ **/
+static void word_norm(const char *src, char *dst, uint32_t len) {
+    uint32_t i = 0;
+
+    for(; *src && i < len - 1; src++) {
+        unsigned char c = *src;
+        if(c >= 0x80 || isalnum(c)) {
+            dst[i++] = tolower(c);
+        }
+    }
+    dst[i] = '\0';
+}
+
+static uint8_t word_eq(const overlap_word_t *a, const overlap_word_t *b) {
+    char na[64], nb[64];
+
+    word_norm(a->word, na, sizeof(na));
+    word_norm(b->word, nb, sizeof(nb));
+    return (na[0] && !strcmp(na, nb));
+}
+
+static void words_append(char **dst, size_t *dlen, overlap_word_t *words, uint32_t from, uint32_t to) {
+    for(uint32_t i = from; i < to; i++) {
+        const char *w = words[i].word;
+        size_t wlen = 0;
+
+        while(*w == ' ') { w++; }
+        if(!(wlen = strlen(w))) {
+            continue;
+        }
+        *dst = realloc(*dst, *dlen + wlen + 2);
+        if(*dlen) {
+            (*dst)[(*dlen)++] = ' ';
+        }
+        memcpy(*dst + *dlen, w, wlen + 1);
+        *dlen += wlen;
+    }
+}
+
+void overlap_free(overlap_chunk_t **oc) {
+    if(!oc || !*oc) {
+        return;
+    }
+    switch_safe_free((*oc)->words);
+    switch_safe_free((*oc)->mem);
+    switch_safe_free(*oc);
+}
+
+/**
+ ** verbose_json response -> words (or segments if there are no words) and the text;
+ ** head_ms/tail_ms: the audio shared with the previous/next chunk, len_ms: the chunk
+ **/
+switch_status_t overlap_parse(const char *json_str, uint32_t head_ms, uint32_t tail_ms, uint32_t len_ms, overlap_chunk_t **out, char **text) {
+    overlap_chunk_t *oc = NULL;
+    const char *ttext = NULL;
+    vjson_t vj = { 0 };
+    uint32_t items = 0;
+
+    if(!json_str || vjson_parse(json_str, strlen(json_str), &vj) != SWITCH_STATUS_SUCCESS) {
+        __atomic_add_fetch(&globals.vjson_errors, 1, __ATOMIC_RELAXED);
+        vjson_free(&vj);
+        return SWITCH_STATUS_FALSE;
+    }
+    if((ttext = vj.text)) {
+        while(*ttext == ' ') { ttext++; }
+        *text = strdup(ttext);
+    }
+    items = (vj.words_count ? vj.words_count : vj.segments_count);
+
+    switch_zmalloc(oc, sizeof(overlap_chunk_t));
+    oc->head_ms = head_ms;
+    oc->tail_ms = tail_ms;
+    oc->len_ms = len_ms;
+
+    // the words stay in the parsed block, the chunk keeps it
+    if(items > 0) {
+        switch_zmalloc(oc->words, sizeof(overlap_word_t) * items);
+        for(uint32_t i = 0; i < items; i++) {
+            overlap_word_t *w = &oc->words[i];
+            if(vj.words_count) {
+                w->word = vj.words[i].word;
+                w->start_ms = vj.words[i].start * 1000;
+                w->end_ms = vj.words[i].end * 1000;
+            } else {
+                w->word = vj.segments[i].text;
+                w->start_ms = vj.segments[i].start * 1000;
+                w->end_ms = (vj.segments[i].end > 0 ? vj.segments[i].end * 1000 : len_ms);
+            }
+        }
+        oc->count = items;
+    } else if(ttext) {
+        // no timestamps at all: one word over the whole chunk
+        switch_zmalloc(oc->words, sizeof(overlap_word_t));
+        oc->words[0].word = ttext;
+        oc->words[0].end_ms = len_ms;
+        oc->count = 1;
+    }
+    oc->mem = vj.mem;
+
+    *out = oc;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ ** the slot's text merged with the words held from the previous chunk, the slot's own tail is held for the next one;
+ ** a slot without words (failed, local result) gets the held words before its text
+ **/
+void overlap_stitch(gasr_ctx_t *asr_ctx, upload_slot_t *slot) {
+    overlap_chunk_t *prev = asr_ctx->overlap_pending, *oc = slot->overlap;
+    uint32_t prev_to = 0, from = 0, to = 0, best = 0;
+    char *text = NULL;
+    size_t len = 0;
+
+    slot->overlap = NULL;
+
+    if(!oc) {
+        if(prev) {
+            overlap_word_t own = { .word = (slot->count ? slot->texts[0] : NULL) };
+
+            words_append(&text, &len, prev->words, prev->first, prev->count);
+            if(own.word) {
+                words_append(&text, &len, &own, 0, 1);
+                switch_safe_free(slot->texts[0]);
+            }
+            if(!slot->count) {
+                switch_zmalloc(slot->texts, sizeof(char *));
+                slot->count = 1;
+            }
+            slot->texts[0] = text;
+            overlap_free(&asr_ctx->overlap_pending);
+        }
+        return;
+    }
+
+    // nothing shared with a delivered chunk: the text as it came
+    if(!prev && !oc->tail_ms) {
+        overlap_free(&oc);
+        return;
+    }
+
+    to = oc->count;
+    if(prev) {
+        int64_t shift = (int64_t)prev->len_ms - oc->head_ms;   // prev time - shift = this chunk's time
+
+        prev_to = prev->count;
+        for(uint32_t i = prev->first; oc->head_ms && i < prev->count; i++) {
+            for(uint32_t j = 0; j < oc->count && oc->words[j].start_ms < oc->head_ms; j++) {
+                uint32_t k = 0;
+                if(llabs(((int64_t)prev->words[i].start_ms - shift) - oc->words[j].start_ms) > OVERLAP_ALIGN_MS) {
+                    continue;
+                }
+                while(i + k < prev->count && j + k < oc->count && word_eq(&prev->words[i + k], &oc->words[j + k])) { k++; }
+                if(k > best) {
+                    best = k;
+                    prev_to = i;
+                    from = j;
+                }
+            }
+        }
+        if(!best && oc->head_ms) {
+            int64_t cut = oc->head_ms / 2;
+            for(prev_to = prev->first; prev_to < prev->count; prev_to++) {
+                if((((int64_t)prev->words[prev_to].start_ms + prev->words[prev_to].end_ms) / 2) - shift >= cut) { break; }
+            }
+            for(from = 0; from < oc->count; from++) {
+                if(((int64_t)oc->words[from].start_ms + oc->words[from].end_ms) / 2 >= cut) { break; }
+            }
+        }
+        words_append(&text, &len, prev->words, prev->first, prev_to);
+        overlap_free(&asr_ctx->overlap_pending);
+    }
+    if(oc->tail_ms) {
+        for(to = from; to < oc->count; to++) {
+            if(oc->words[to].end_ms > oc->len_ms - oc->tail_ms) { break; }
+        }
+    }
+    words_append(&text, &len, oc->words, from, to);
+
+    if(prev) {
+        __atomic_add_fetch((best ? &globals.overlap_aligned : &globals.overlap_cut), 1, __ATOMIC_RELAXED);
+    }
+    if(oc->tail_ms) {
+        oc->first = to;
+        asr_ctx->overlap_pending = oc;
+    } else {
+        overlap_free(&oc);
+    }
+
+    if(slot->count) {
+        switch_safe_free(slot->texts[0]);
+        slot->texts[0] = text;
+    } else {
+        switch_safe_free(text);
+    }
+}
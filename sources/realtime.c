@@ -0,0 +1,312 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+#include "whisper_api.h"
+#include <math.h>
+
+extern globals_t globals;
+
+/**
+ ** Realtime backend ({realtime=true}): one WebSocket per session to a streaming transcription endpoint
+ ** (OpenAI realtime transcription protocol). The audio goes out as it comes from asr_feed (input_audio_buffer.append,
+ ** base64, L16 resampled to 24kHz, G.711 as is), the module's VAD ends the turn (commit; with vad=false the
+ ** server's VAD does). Deltas are fired as sfwhisper::partial events, the completed transcript is the ASR result.
+ ** If the connection can't be made or drops, the session goes on with the chunked uploads.
+ **/
+typedef struct {
+    gasr_ctx_t              *asr_ctx;
+    ws_t                    *ws;
+    char                    *item_id;
+    char                    *partial;           // deltas of the current item
+    uint32_t                partial_len;
+    int16_t                 *pcm;               // resampled frame
+    uint32_t                pcm_size;
+    char                    *msg;
+    uint32_t                msg_size;
+    double                  phase;
+    int16_t                 prev;
+    uint32_t                sent_bytes;         // since the last commit
+    switch_time_t           t_commit;
+} realtime_t;
+
+static const char *realtime_format(uint8_t codec) {
+    return (codec == CODEC_PCMU ? "g711_ulaw" : codec == CODEC_PCMA ? "g711_alaw" : "pcm16");
+}
+
+/**
+ ** linear interpolation to REALTIME_SAMPLERATE; the position carries over between frames,
+ ** -1 is the last sample of the previous one
+ **/
+static uint32_t resample(realtime_t *rt, const int16_t *in, uint32_t samples, uint32_t rate, int16_t *out) {
+    double step = (double)rate / REALTIME_SAMPLERATE;
+    uint32_t n = 0;
+
+    while(rt->phase < (double)samples - 1.0) {
+        int32_t i = (int32_t)floor(rt->phase);
+        double frac = rt->phase - i;
+        int16_t s0 = (i < 0 ? rt->prev : in[i]);
+        int16_t s1 = in[i + 1];
+
+        out[n++] = (int16_t)(s0 + (s1 - s0) * frac);
+        rt->phase += step;
+    }
+    rt->phase -= samples;
+    rt->prev = in[samples - 1];
+
+    return n;
+}
+
+static switch_status_t realtime_send_audio(realtime_t *rt, const switch_byte_t *data, uint32_t len) {
+    gasr_ctx_t *asr_ctx = rt->asr_ctx;
+    const switch_byte_t *audio = data;
+    uint32_t audio_len = len, need = 0;
+    int hlen = 0;
+
+    if(asr_ctx->codec == CODEC_L16 && asr_ctx->samplerate != REALTIME_SAMPLERATE) {
+        uint32_t samples = len / sizeof(int16_t);
+        uint32_t out_max = (samples * REALTIME_SAMPLERATE / asr_ctx->samplerate) + 4;
+
+        if(!samples) {
+            return SWITCH_STATUS_SUCCESS;
+        }
+        if(rt->pcm_size < out_max) {
+            rt->pcm_size = out_max;
+            rt->pcm = realloc(rt->pcm, rt->pcm_size * sizeof(int16_t));
+        }
+        audio = (switch_byte_t *)rt->pcm;
+        audio_len = resample(rt, (const int16_t *)data, samples, asr_ctx->samplerate, rt->pcm) * sizeof(int16_t);
+    }
+
+    need = 64 + ((audio_len + 2) / 3) * 4 + 1;
+    if(rt->msg_size < need) {
+        rt->msg_size = need;
+        rt->msg = realloc(rt->msg, rt->msg_size);
+    }
+    hlen = snprintf(rt->msg, rt->msg_size, "{\"type\":\"input_audio_buffer.append\",\"audio\":\"");
+    switch_b64_encode((unsigned char *)audio, audio_len, (unsigned char *)rt->msg + hlen, rt->msg_size - hlen);
+    hlen += strlen(rt->msg + hlen);
+    hlen += snprintf(rt->msg + hlen, rt->msg_size - hlen, "\"}");
+
+    rt->sent_bytes += len;
+    return ws_send_text(rt->ws, rt->msg, hlen);
+}
+
+static void realtime_partial(realtime_t *rt, const char *item_id, const char *delta) {
+    gasr_ctx_t *asr_ctx = rt->asr_ctx;
+    switch_event_t *event = NULL;
+    uint32_t dlen = strlen(delta);
+
+    if(!rt->item_id || strcmp(rt->item_id, item_id)) {
+        switch_safe_free(rt->item_id);
+        rt->item_id = strdup(item_id);
+        rt->partial_len = 0;
+    }
+    rt->partial = realloc(rt->partial, rt->partial_len + dlen + 1);
+    memcpy(rt->partial + rt->partial_len, delta, dlen + 1);
+    rt->partial_len += dlen;
+
+    if(switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, EVENT_PARTIAL) == SWITCH_STATUS_SUCCESS) {
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", asr_ctx->uuid);
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Item-ID", item_id);
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Delta", delta);
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Partial-Text", rt->partial);
+        switch_event_fire(&event);
+    }
+}
+
+static void realtime_result(realtime_t *rt, const char *text) {
+    gasr_ctx_t *asr_ctx = rt->asr_ctx;
+    xdata_buffer_t *tbuff = NULL;
+    result_timing_t timing = { 0 };
+    switch_time_t t_commit = rt->t_commit;
+    uint32_t commit_ms = (t_commit ? (uint32_t)((switch_micro_time_now() - t_commit) / 1000) : 0);
+    uint8_t fl_delivered = false;
+
+    rt->partial_len = 0;
+    rt->t_commit = 0;
+    __atomic_add_fetch(&globals.realtime_results, 1, __ATOMIC_RELAXED);
+
+    if(slog_sample(asr_ctx->cfg)) {
+        slog_printf(asr_ctx->cfg, SWITCH_LOG_NOTICE, "uuid=%s stage=realtime done lang=%s commit_ms=%u text_len=%u", asr_ctx->uuid, asr_ctx->lang, commit_ms, (uint32_t)strlen(text));
+    }
+    if(!text[0] || asr_ctx->fl_destroyed) {
+        return;
+    }
+
+    upload_timing_start(asr_ctx, &timing);
+    timing.t_dispatch = (t_commit ? t_commit : timing.t_dispatch);
+    timing.t_response = switch_micro_time_now();
+
+    switch_mutex_lock(asr_ctx->mutex);
+    if(xdata_buffer_alloc(&tbuff, (switch_byte_t *)text, strlen(text)) == SWITCH_STATUS_SUCCESS) {
+        if(switch_queue_trypush(asr_ctx->q_text, tbuff) == SWITCH_STATUS_SUCCESS) {
+            asr_ctx->transcript_results++;
+            result_event(asr_ctx, text, 0, &timing);
+            fl_delivered = true;
+        } else {
+            xdata_buffer_free(&tbuff);
+        }
+    }
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    if(fl_delivered) {
+        session_wake(asr_ctx);
+    }
+}
+
+static void realtime_event(realtime_t *rt, const char *msg) {
+    cJSON *json = cJSON_Parse(msg);
+    cJSON *type = (json ? cJSON_GetObjectItem(json, "type") : NULL);
+
+    if(!type || !type->valuestring) {
+        goto out;
+    }
+
+    if(!strcmp(type->valuestring, "conversation.item.input_audio_transcription.delta")) {
+        cJSON *item_id = cJSON_GetObjectItem(json, "item_id");
+        cJSON *delta = cJSON_GetObjectItem(json, "delta");
+        if(delta && delta->valuestring) {
+            realtime_partial(rt, (item_id && item_id->valuestring ? item_id->valuestring : ""), delta->valuestring);
+        }
+    } else if(!strcmp(type->valuestring, "conversation.item.input_audio_transcription.completed")) {
+        cJSON *transcript = cJSON_GetObjectItem(json, "transcript");
+        realtime_result(rt, (transcript && transcript->valuestring ? transcript->valuestring : ""));
+    } else if(!strcmp(type->valuestring, "error") || !strcmp(type->valuestring, "conversation.item.input_audio_transcription.failed")) {
+        cJSON *error = cJSON_GetObjectItem(json, "error");
+        cJSON *message = (error ? cJSON_GetObjectItem(error, "message") : NULL);
+
+        __atomic_add_fetch(&globals.realtime_errors, 1, __ATOMIC_RELAXED);
+        slog_printf(rt->asr_ctx->cfg, SWITCH_LOG_ERROR, "uuid=%s stage=realtime error=\"%s\"", rt->asr_ctx->uuid, (message && message->valuestring ? message->valuestring : type->valuestring));
+    }
+out:
+    if(json) {
+        cJSON_Delete(json);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+/**
+ ** transcript thread, until the session ends (SWITCH_STATUS_SUCCESS) or the connection is lost
+ **/
+switch_status_t realtime_run(gasr_ctx_t *asr_ctx) {
+    config_t *cfg = asr_ctx->cfg;
+    const char *prompt = grammar_prompt(asr_ctx);
+    realtime_t rt = { 0 };
+    cJSON *json = NULL, *session = NULL, *transcription = NULL, *turn = NULL;
+    char *headers = NULL, *update = NULL;
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    apikey_t *key = apikey_acquire(cfg);
+    apikey_limits_t lim;
+    void *pop = NULL;
+
+    rt.asr_ctx = asr_ctx;
+    headers = switch_mprintf("Authorization: Bearer %s\r\nOpenAI-Beta: realtime=v1\r\n", (key ? key->key : cfg->api_key));
+
+    // the key is held for the handshake only, the session's requests aren't counted against it
+    rt.ws = ws_connect(cfg->realtime_url, headers, cfg);
+    apikey_limits_init(&lim);
+    lim.http_code = (rt.ws ? 101 : 0);
+    apikey_release(key, &lim, cfg);
+
+    if(!rt.ws) {
+        __atomic_add_fetch(&globals.realtime_fallbacks, 1, __ATOMIC_RELAXED);
+        slog_printf(cfg, SWITCH_LOG_WARNING, "uuid=%s stage=realtime fallback reason=connect url=%s", asr_ctx->uuid, cfg->realtime_url);
+        goto out;
+    }
+    __atomic_add_fetch(&globals.realtime_sessions, 1, __ATOMIC_RELAXED);
+
+    // the language and the prompt are the caller's, cJSON escapes them; with the module's VAD the turns are ours, otherwise the server cuts them
+    json = cJSON_CreateObject();
+    cJSON_AddItemToObject(json, "type", cJSON_CreateString("transcription_session.update"));
+    cJSON_AddItemToObject(json, "session", (session = cJSON_CreateObject()));
+    cJSON_AddItemToObject(session, "input_audio_format", cJSON_CreateString(realtime_format(asr_ctx->codec)));
+    cJSON_AddItemToObject(session, "input_audio_transcription", (transcription = cJSON_CreateObject()));
+    cJSON_AddItemToObject(transcription, "model", cJSON_CreateString(cfg->realtime_model));
+    if(asr_ctx->lang) {
+        cJSON_AddItemToObject(transcription, "language", cJSON_CreateString(asr_ctx->lang));
+    }
+    if(prompt) {
+        cJSON_AddItemToObject(transcription, "prompt", cJSON_CreateString(prompt));
+    }
+    if(asr_ctx->fl_vad_enabled) {
+        cJSON_AddItemToObject(session, "turn_detection", cJSON_CreateNull());
+    } else {
+        cJSON_AddItemToObject(session, "turn_detection", (turn = cJSON_CreateObject()));
+        cJSON_AddItemToObject(turn, "type", cJSON_CreateString("server_vad"));
+        cJSON_AddItemToObject(turn, "silence_duration_ms", cJSON_CreateNumber(cfg->vad_silence_ms ? cfg->vad_silence_ms : 500));
+    }
+    update = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    if(ws_send_text(rt.ws, update, strlen(update)) != SWITCH_STATUS_SUCCESS) {
+        goto lost;
+    }
+
+    while(true) {
+        uint8_t fl_stop = false;
+        char *msg = NULL;
+        switch_status_t rs;
+
+        if(globals.fl_shutdown || asr_ctx->fl_destroyed) {
+            status = SWITCH_STATUS_SUCCESS;
+            break;
+        }
+
+        // seen before the drain: the frames of the turn are all in q_audio by then
+        fl_stop = (asr_ctx->fl_vad_enabled && asr_ctx->vad_state == SWITCH_VAD_STATE_STOP_TALKING);
+
+        while(switch_queue_trypop(asr_ctx->q_audio, &pop) == SWITCH_STATUS_SUCCESS) {
+            xdata_buffer_t *audio_buffer = (xdata_buffer_t *)pop;
+            switch_status_t ss = SWITCH_STATUS_SUCCESS;
+
+            __atomic_sub_fetch(&asr_ctx->q_audio_bytes, audio_buffer->len, __ATOMIC_RELEASE);
+            if(audio_buffer->len) {
+                ss = realtime_send_audio(&rt, audio_buffer->data, audio_buffer->len);
+                __atomic_add_fetch(&asr_ctx->bytes_uploaded, audio_buffer->len, __ATOMIC_RELAXED);
+            }
+            xdata_buffer_free(&audio_buffer);
+            if(ss != SWITCH_STATUS_SUCCESS) {
+                goto lost;
+            }
+        }
+
+        if(fl_stop && rt.sent_bytes > 0) {
+            const char *commit = "{\"type\":\"input_audio_buffer.commit\"}";
+            if(ws_send_text(rt.ws, commit, strlen(commit)) != SWITCH_STATUS_SUCCESS) {
+                goto lost;
+            }
+            rt.sent_bytes = 0;
+            rt.t_commit = switch_micro_time_now();
+            asr_ctx->fl_pause = true; // as with the uploads: one result per turn
+        }
+
+        for(int timeout = 10; (rs = ws_recv(rt.ws, &msg, timeout)) == SWITCH_STATUS_SUCCESS; timeout = 0) {
+            realtime_event(&rt, msg);
+            switch_safe_free(msg);
+        }
+        if(rs == SWITCH_STATUS_FALSE) {
+            goto lost;
+        }
+    }
+    goto out;
+
+lost:
+    if(!asr_ctx->fl_destroyed && !globals.fl_shutdown) {
+        __atomic_add_fetch(&globals.realtime_fallbacks, 1, __ATOMIC_RELAXED);
+        slog_printf(cfg, SWITCH_LOG_WARNING, "uuid=%s stage=realtime fallback reason=disconnected", asr_ctx->uuid);
+    } else {
+        status = SWITCH_STATUS_SUCCESS;
+    }
+out:
+    ws_close(&rt.ws);
+    switch_safe_free(rt.item_id);
+    switch_safe_free(rt.partial);
+    switch_safe_free(rt.pcm);
+    switch_safe_free(rt.msg);
+    switch_safe_free(headers);
+    switch_safe_free(update);
+
+    return status;
+}
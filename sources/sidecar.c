@@ -0,0 +1,343 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+#include "whisper_api.h"
+#include "sidecar_proto.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+
+extern globals_t globals;
+
+/**
+ ** Sidecar mode (sidecar-socket): the chunk goes to a separate process (sidecar/) that does the WAV encoding and
+ ** the HTTP/TLS work, so none of it runs inside the switch. One connection for all sessions: an upload thread sends
+ ** its chunk (header, request and audio in one sendmsg, no copy) and waits for the response with its id,
+ ** one reader thread keeps the connection up and hands the responses over.
+ **/
+typedef struct sidecar_pending_s {
+    struct sidecar_pending_s *next;
+    uint32_t                id;
+    uint8_t                 fl_done;
+    uint8_t                 fl_error;
+    char                    *text;
+} sidecar_pending_t;
+
+static struct {
+    switch_mutex_t          *mutex;             // fd, pending
+    switch_thread_cond_t    *cond;              // a pending entry is done (with mutex)
+    switch_mutex_t          *wr_mutex;          // one message at a time, the socket isn't closed while it's held
+    sidecar_pending_t       *pending;
+    uint32_t                next_id;
+    int                     fd;
+    uint8_t                 fl_started;
+} sidecar = { .fd = -1 };
+
+static int sidecar_connect(const char *path) {
+    struct sockaddr_un addr = { 0 };
+    struct timeval tv = { .tv_sec = 5, .tv_usec = 0 };
+    int fd = -1;
+
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    // a stuck sidecar fails the send instead of blocking the upload thread
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    return fd;
+}
+
+static void sidecar_disconnect(const char *reason) {
+    sidecar_pending_t *p = NULL;
+    int fd = -1;
+
+    switch_mutex_lock(sidecar.mutex);
+    fd = sidecar.fd;
+    sidecar.fd = -1;
+    for(p = sidecar.pending; p; p = p->next) {
+        p->fl_error = true;
+        p->fl_done = true;
+    }
+    switch_thread_cond_broadcast(sidecar.cond);
+    switch_mutex_unlock(sidecar.mutex);
+
+    if(fd >= 0) {
+        shutdown(fd, SHUT_RDWR);
+        switch_mutex_lock(sidecar.wr_mutex);
+        close(fd);
+        switch_mutex_unlock(sidecar.wr_mutex);
+
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "sfwhisper: stage=sidecar disconnected (%s)\n", reason);
+    }
+}
+
+static int read_full(int fd, void *buf, uint32_t len) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    uint32_t offs = 0;
+
+    while(offs < len) {
+        ssize_t n = 0;
+        int rc = poll(&pfd, 1, 100);
+
+        if(globals.fl_shutdown) {
+            return -1;
+        }
+        if(rc == 0 || (rc < 0 && errno == EINTR)) {
+            continue;
+        }
+        if(rc < 0) {
+            return -1;
+        }
+        if((n = read(fd, (uint8_t *)buf + offs, len - offs)) <= 0) {
+            if(n < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            return -1;
+        }
+        offs += n;
+    }
+
+    return 0;
+}
+
+static int send_iov(int fd, struct iovec *iov, int cnt) {
+    struct msghdr msg = { 0 };
+
+    while(cnt > 0) {
+        ssize_t n = 0;
+
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        if((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while(cnt > 0 && n >= (ssize_t)iov->iov_len) {
+            n -= iov->iov_len;
+            iov++; cnt--;
+        }
+        if(cnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+static void *SWITCH_THREAD_FUNC sidecar_thread(switch_thread_t *thread, void *obj) {
+    uint8_t fl_connected_once = false;
+
+    while(!globals.fl_shutdown) {
+        sidecar_hdr_t hdr = { 0 };
+        sidecar_pending_t *p = NULL;
+        char *payload = NULL;
+        int fd = sidecar.fd;
+
+        if(fd < 0) {
+            config_t *cfg = config_acquire();
+
+            if(cfg && cfg->sidecar_socket) {
+                fd = sidecar_connect(cfg->sidecar_socket);
+            }
+            if(fd >= 0) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "sfwhisper: stage=sidecar connected (%s)\n", cfg->sidecar_socket);
+            }
+            config_release(&cfg);
+
+            if(fd < 0) {
+                switch_yield(SIDECAR_RECONNECT_MS * 1000);
+                continue;
+            }
+            if(fl_connected_once) {
+                __atomic_add_fetch(&globals.sidecar_reconnects, 1, __ATOMIC_RELAXED);
+            }
+            fl_connected_once = true;
+
+            switch_mutex_lock(sidecar.mutex);
+            sidecar.fd = fd;
+            switch_mutex_unlock(sidecar.mutex);
+        }
+
+        if(read_full(fd, &hdr, sizeof(hdr)) != 0) {
+            if(!globals.fl_shutdown) sidecar_disconnect("read");
+            continue;
+        }
+        if(hdr.magic != SC_MAGIC || hdr.type != SC_MSG_RESULT || hdr.len > SC_MAX_PAYLOAD) {
+            sidecar_disconnect("protocol");
+            continue;
+        }
+
+        switch_malloc(payload, hdr.len + 1);
+        if(read_full(fd, payload, hdr.len) != 0) {
+            switch_safe_free(payload);
+            sidecar_disconnect("read");
+            continue;
+        }
+        payload[hdr.len] = '\0';
+
+        // the caller may have given up already
+        switch_mutex_lock(sidecar.mutex);
+        for(p = sidecar.pending; p && p->id != hdr.id; p = p->next);
+        if(p) {
+            p->text = payload;
+            p->fl_error = (hdr.flags & SC_FL_ERROR) ? true : false;
+            p->fl_done = true;
+            payload = NULL;
+            switch_thread_cond_broadcast(sidecar.cond);
+        }
+        switch_mutex_unlock(sidecar.mutex);
+
+        switch_safe_free(payload);
+    }
+
+    sidecar_disconnect("shutdown");
+    thread_finished();
+
+    return NULL;
+}
+
+static void pending_remove(sidecar_pending_t *pend) {
+    sidecar_pending_t *p = NULL, *prev = NULL;
+
+    switch_mutex_lock(sidecar.mutex);
+    for(p = sidecar.pending; p; prev = p, p = p->next) {
+        if(p == pend) {
+            if(prev) { prev->next = p->next; } else { sidecar.pending = p->next; }
+            break;
+        }
+    }
+    switch_mutex_unlock(sidecar.mutex);
+
+    switch_safe_free(pend->text);
+    free(pend);
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+void sidecar_init(switch_memory_pool_t *pool) {
+    sidecar.fd = -1;
+    sidecar.pending = NULL;
+    switch_mutex_init(&sidecar.mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_mutex_init(&sidecar.wr_mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_thread_cond_create(&sidecar.cond, pool);
+}
+
+/**
+ ** the thread runs from the first config with sidecar-socket on (load or reload), under globals.mutex
+ **/
+void sidecar_start(config_t *cfg) {
+    if(cfg->sidecar_socket && !sidecar.fl_started) {
+        sidecar.fl_started = true;
+        thread_launch(globals.pool, sidecar_thread, NULL);
+    }
+}
+
+uint8_t sidecar_connected() {
+    return (sidecar.fd >= 0);
+}
+
+/**
+ ** text: the transcript, or the verbose_json response with fl_segments (coalesced chunk) / fl_words (overlapping chunk) /
+ ** fl_timestamps (NLSML result)
+ **/
+switch_status_t sidecar_transcribe(gasr_ctx_t *asr_ctx, const switch_byte_t *data, uint32_t data_len, uint8_t fl_segments, uint8_t fl_words, uint8_t fl_timestamps, char **text) {
+    config_t *cfg = asr_ctx->cfg;
+    switch_time_t expiry = switch_micro_time_now() + (MAX(cfg->request_timeout, 1) * 1000000LL);
+    const char *prompt = grammar_prompt(asr_ctx);
+    sidecar_pending_t *pend = NULL;
+    sidecar_hdr_t hdr = { 0 };
+    sidecar_req_t req = { 0 };
+    struct iovec iov[4];
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    uint8_t fl_done = false;
+    uint32_t kill_gen = asr_ctx->kill_gen;
+    int fd = -1;
+
+    if(!sidecar.mutex || sidecar.fd < 0) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    req.codec = asr_ctx->codec;
+    req.channels = asr_ctx->channels;
+    req.samplerate = asr_ctx->samplerate;
+    req.prompt_len = (prompt ? strlen(prompt) : 0);
+    snprintf(req.lang, sizeof(req.lang), "%s", asr_ctx->lang);
+    snprintf(req.model, sizeof(req.model), "%s", WHISPER_MODEL);
+
+    switch_zmalloc(pend, sizeof(sidecar_pending_t));
+
+    switch_mutex_lock(sidecar.mutex);
+    pend->id = ++sidecar.next_id;
+    pend->next = sidecar.pending;
+    sidecar.pending = pend;
+    switch_mutex_unlock(sidecar.mutex);
+
+    hdr.magic = SC_MAGIC;
+    hdr.type = SC_MSG_TRANSCRIBE;
+    hdr.flags = (fl_segments ? SC_FL_SEGMENTS : 0) | (fl_words ? SC_FL_WORDS : 0) | (fl_timestamps ? SC_FL_TIMESTAMPS : 0);
+    hdr.id = pend->id;
+    hdr.len = sizeof(req) + req.prompt_len + data_len;
+
+    iov[0].iov_base = &hdr; iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = &req; iov[1].iov_len = sizeof(req);
+    iov[2].iov_base = (void *)(prompt ? prompt : ""); iov[2].iov_len = req.prompt_len;
+    iov[3].iov_base = (void *)data; iov[3].iov_len = data_len;
+
+    switch_mutex_lock(sidecar.wr_mutex);
+    if((fd = sidecar.fd) >= 0 && send_iov(fd, iov, 4) != 0) {
+        // a half written message breaks the stream, the reader reconnects
+        shutdown(fd, SHUT_RDWR);
+        fd = -1;
+    }
+    switch_mutex_unlock(sidecar.wr_mutex);
+
+    if(fd < 0) {
+        __atomic_add_fetch(&globals.sidecar_errors, 1, __ATOMIC_RELAXED);
+        pending_remove(pend);
+        return SWITCH_STATUS_FALSE;
+    }
+    __atomic_add_fetch(&globals.sidecar_requests, 1, __ATOMIC_RELAXED);
+
+    // the reader wakes the waiters on every response and on a disconnect, the bounded wait is for the hangup / kill checks
+    switch_mutex_lock(sidecar.mutex);
+    while(!(fl_done = pend->fl_done)) {
+        switch_time_t now = switch_micro_time_now();
+
+        if(globals.fl_shutdown || asr_ctx->fl_destroyed || asr_ctx->kill_gen != kill_gen || now > expiry) {
+            break;
+        }
+        switch_thread_cond_timedwait(sidecar.cond, sidecar.mutex, MIN(expiry - now + 1, SIDECAR_ABORT_CHECK_MS * 1000));
+    }
+    switch_mutex_unlock(sidecar.mutex);
+
+    if(fl_done && !pend->fl_error && pend->text) {
+        *text = pend->text;
+        pend->text = NULL;
+        status = SWITCH_STATUS_SUCCESS;
+    } else {
+        __atomic_add_fetch(&globals.sidecar_errors, 1, __ATOMIC_RELAXED);
+        slog_printf(cfg, SWITCH_LOG_ERROR, "uuid=%s stage=sidecar id=%u error=\"%s\"", asr_ctx->uuid, pend->id,
+                    (fl_done ? (pend->text ? pend->text : "disconnected") : "timeout"));
+    }
+
+    pending_remove(pend);
+    return status;
+}
@@ -0,0 +1,511 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+/**
+ ** Transcription sidecar for mod_sfwhisper (sidecar-socket): takes the chunks over a Unix socket,
+ ** wraps them in WAV, does the API calls on its own worker threads and sends the results back.
+ ** The module keeps one connection for all sessions, requests are answered as they complete.
+ **
+ **   sfwhisper_sidecar --socket /run/sfwhisper.sock --api-key sk-... [--workers 8] [--cpus 2,3]
+ **/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <curl/curl.h>
+#include "sidecar_proto.h"
+
+#define DEF_API_URL     "https://api.openai.com/v1/audio/transcriptions"
+#define DEF_WORKERS     8
+#define DEF_QUEUE       256
+#define DEF_TIMEOUT     30
+#define WAV_HDR_MAX     58
+
+typedef struct {
+    int                 fd;
+    int                 refs;
+    int                 fl_closed;
+    pthread_mutex_t     mutex;      // refs, writes
+} conn_t;
+
+typedef struct job_s {
+    struct job_s        *next;
+    conn_t              *conn;
+    sidecar_hdr_t       hdr;
+    uint8_t             *payload;
+} job_t;
+
+typedef struct {
+    uint8_t             *data;
+    size_t              len;
+} body_t;
+
+static struct {
+    const char          *socket_path;
+    const char          *api_url;
+    const char          *api_key;
+    const char          *proxy;
+    uint32_t            workers;
+    uint32_t            queue_max;
+    uint32_t            timeout;
+    int                 verbose;
+} opts = { .api_url = DEF_API_URL, .workers = DEF_WORKERS, .queue_max = DEF_QUEUE, .timeout = DEF_TIMEOUT };
+
+static struct {
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+    job_t               *head;
+    job_t               *tail;
+    uint32_t            len;
+} queue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0 };
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+static void conn_unref(conn_t *conn) {
+    int refs = 0;
+
+    pthread_mutex_lock(&conn->mutex);
+    refs = --conn->refs;
+    pthread_mutex_unlock(&conn->mutex);
+
+    if(refs == 0) {
+        close(conn->fd);
+        pthread_mutex_destroy(&conn->mutex);
+        free(conn);
+    }
+}
+
+static int send_iov(int fd, struct iovec *iov, int cnt) {
+    struct msghdr msg = { 0 };
+
+    while(cnt > 0) {
+        ssize_t n = 0;
+
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        if((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while(cnt > 0 && n >= (ssize_t)iov->iov_len) {
+            n -= iov->iov_len;
+            iov++; cnt--;
+        }
+        if(cnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+static void conn_reply(conn_t *conn, uint32_t id, uint16_t flags, const void *data, uint32_t len) {
+    sidecar_hdr_t hdr = { .magic = SC_MAGIC, .type = SC_MSG_RESULT, .flags = flags, .id = id, .len = len };
+    struct iovec iov[2] = { { &hdr, sizeof(hdr) }, { (void *)data, len } };
+
+    pthread_mutex_lock(&conn->mutex);
+    if(!conn->fl_closed && send_iov(conn->fd, iov, 2) != 0) {
+        conn->fl_closed = 1;
+        shutdown(conn->fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&conn->mutex);
+}
+
+static int read_full(int fd, void *buf, uint32_t len) {
+    uint32_t offs = 0;
+
+    while(offs < len) {
+        ssize_t n = read(fd, (uint8_t *)buf + offs, len - offs);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        offs += n;
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+static void wav_put_le(uint8_t *p, uint32_t v, uint32_t n) {
+    for(uint32_t i = 0; i < n; i++) { p[i] = (v >> (8 * i)) & 0xff; }
+}
+
+/**
+ ** same layout as wav_header_build() in the module: L16 as PCM, G.711 as is (WAVE_FORMAT_ALAW / MULAW)
+ **/
+static uint32_t wav_header(uint8_t *hdr, uint8_t codec, uint32_t channels, uint32_t samplerate, uint32_t data_len) {
+    uint32_t l16 = (codec == 0), hdr_len = (l16 ? 44 : 58), bits = (l16 ? 16 : 8);
+
+    memcpy(hdr + 0, "RIFF", 4);
+    wav_put_le(hdr + 4, (hdr_len - 8) + data_len, 4);
+    memcpy(hdr + 8, "WAVEfmt ", 8);
+    wav_put_le(hdr + 16, (l16 ? 16 : 18), 4);
+    wav_put_le(hdr + 20, (l16 ? 1 : (codec == 2 ? 6 : 7)), 2);
+    wav_put_le(hdr + 22, channels, 2);
+    wav_put_le(hdr + 24, samplerate, 4);
+    wav_put_le(hdr + 28, samplerate * channels * (bits / 8), 4);
+    wav_put_le(hdr + 32, channels * (bits / 8), 2);
+    wav_put_le(hdr + 34, bits, 2);
+    if(l16) {
+        memcpy(hdr + 36, "data", 4);
+        wav_put_le(hdr + 40, data_len, 4);
+    } else {
+        wav_put_le(hdr + 36, 0, 2);
+        memcpy(hdr + 38, "fact", 4);
+        wav_put_le(hdr + 42, 4, 4);
+        wav_put_le(hdr + 46, data_len / channels, 4);
+        memcpy(hdr + 50, "data", 4);
+        wav_put_le(hdr + 54, data_len, 4);
+    }
+
+    return hdr_len;
+}
+
+static size_t body_write(char *buffer, size_t size, size_t nitems, void *user_data) {
+    body_t *body = (body_t *)user_data;
+    size_t len = size * nitems;
+    uint8_t *p = realloc(body->data, body->len + len + 1);
+
+    if(!p) {
+        return 0;
+    }
+    memcpy(p + body->len, buffer, len);
+    body->data = p;
+    body->len += len;
+    body->data[body->len] = '\0';
+
+    return len;
+}
+
+/**
+ ** plain text (response_format=text) or the verbose_json response with SC_FL_SEGMENTS/SC_FL_WORDS/SC_FL_TIMESTAMPS
+ **/
+static void job_process(CURL *curl, job_t *job) {
+    sidecar_req_t *req = (sidecar_req_t *)job->payload;
+    uint16_t fl_verbose = job->hdr.flags & (SC_FL_SEGMENTS | SC_FL_WORDS | SC_FL_TIMESTAMPS);
+    uint8_t *prompt = job->payload + sizeof(sidecar_req_t);
+    uint8_t *audio = prompt + req->prompt_len;
+    uint32_t audio_len = job->hdr.len - sizeof(sidecar_req_t) - req->prompt_len;
+    uint8_t *wav = NULL;
+    uint32_t wav_len = 0;
+    struct curl_slist *headers = NULL;
+    curl_mime *mime = NULL;
+    curl_mimepart *part = NULL;
+    body_t body = { 0 };
+    char auth[512] = { 0 }, err[256] = { 0 };
+    char lang[sizeof(req->lang) + 1] = { 0 }, model[sizeof(req->model) + 1] = { 0 };
+    long http_code = 0;
+    CURLcode rc = 0;
+
+    memcpy(lang, req->lang, sizeof(req->lang));
+    memcpy(model, req->model, sizeof(req->model));
+
+    if((wav = malloc(WAV_HDR_MAX + audio_len)) == NULL) {
+        conn_reply(job->conn, job->hdr.id, SC_FL_ERROR, "mem fail", 8);
+        return;
+    }
+    wav_len = wav_header(wav, req->codec, req->channels, req->samplerate, audio_len);
+    memcpy(wav + wav_len, audio, audio_len);
+    wav_len += audio_len;
+
+    curl_easy_reset(curl);
+    mime = curl_mime_init(curl);
+
+    part = curl_mime_addpart(mime);
+    curl_mime_name(part, "model");
+    curl_mime_data(part, model, CURL_ZERO_TERMINATED);
+    part = curl_mime_addpart(mime);
+    curl_mime_name(part, "language");
+    curl_mime_data(part, lang, CURL_ZERO_TERMINATED);
+    if(req->prompt_len) {
+        part = curl_mime_addpart(mime);
+        curl_mime_name(part, "prompt");
+        curl_mime_data(part, (char *)prompt, req->prompt_len);
+    }
+    part = curl_mime_addpart(mime);
+    curl_mime_name(part, "response_format");
+    curl_mime_data(part, (fl_verbose ? "verbose_json" : "text"), CURL_ZERO_TERMINATED);
+    if(job->hdr.flags & (SC_FL_WORDS | SC_FL_TIMESTAMPS)) {
+        part = curl_mime_addpart(mime);
+        curl_mime_name(part, "timestamp_granularities[]");
+        curl_mime_data(part, "word", CURL_ZERO_TERMINATED);
+    }
+    if(job->hdr.flags & SC_FL_TIMESTAMPS) {
+        part = curl_mime_addpart(mime);
+        curl_mime_name(part, "timestamp_granularities[]");
+        curl_mime_data(part, "segment", CURL_ZERO_TERMINATED);
+    }
+    part = curl_mime_addpart(mime);
+    curl_mime_name(part, "file");
+    curl_mime_filename(part, "audio.wav");
+    curl_mime_type(part, "audio/wav");
+    curl_mime_data(part, (char *)wav, wav_len);
+
+    snprintf(auth, sizeof(auth), "Authorization: Bearer %s", (opts.api_key ? opts.api_key : ""));
+    headers = curl_slist_append(headers, auth);
+
+    curl_easy_setopt(curl, CURLOPT_URL, opts.api_url);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_MIMEPOST, mime);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)opts.timeout);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, body_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+    if(opts.proxy) {
+        curl_easy_setopt(curl, CURLOPT_PROXY, opts.proxy);
+    }
+
+    rc = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+    if(rc == CURLE_OK && http_code == 200 && body.data) {
+        uint32_t len = body.len;
+        if(!fl_verbose) {
+            while(len > 0 && (body.data[len - 1] == '\n' || body.data[len - 1] == '\r' || body.data[len - 1] == ' ')) { len--; }
+        }
+        conn_reply(job->conn, job->hdr.id, fl_verbose, body.data, len);
+    } else {
+        snprintf(err, sizeof(err), "http=%ld curl=%d %.160s", http_code, rc, (body.data ? (char *)body.data : curl_easy_strerror(rc)));
+        conn_reply(job->conn, job->hdr.id, SC_FL_ERROR, err, strlen(err));
+    }
+
+    if(opts.verbose) {
+        fprintf(stderr, "id=%u lang=%s bytes=%u http=%ld curl=%d\n", job->hdr.id, lang, audio_len, http_code, rc);
+    }
+
+    curl_slist_free_all(headers);
+    curl_mime_free(mime);
+    free(body.data);
+    free(wav);
+}
+
+static void *worker_thread(void *arg) {
+    CURL *curl = curl_easy_init();
+
+    while(1) {
+        job_t *job = NULL;
+
+        pthread_mutex_lock(&queue.mutex);
+        while(!queue.head) {
+            pthread_cond_wait(&queue.cond, &queue.mutex);
+        }
+        job = queue.head;
+        if(!(queue.head = job->next)) {
+            queue.tail = NULL;
+        }
+        queue.len--;
+        pthread_mutex_unlock(&queue.mutex);
+
+        if(!job->conn->fl_closed) {
+            job_process(curl, job);
+        }
+
+        conn_unref(job->conn);
+        free(job->payload);
+        free(job);
+    }
+
+    return NULL;
+}
+
+/**
+ ** one per module connection; a full queue is answered right away so the module can fall back
+ **/
+static void *conn_thread(void *arg) {
+    conn_t *conn = (conn_t *)arg;
+
+    while(1) {
+        job_t *job = NULL;
+        sidecar_hdr_t hdr = { 0 };
+        uint8_t fl_busy = 0;
+
+        if(read_full(conn->fd, &hdr, sizeof(hdr)) != 0) {
+            break;
+        }
+        if(hdr.magic != SC_MAGIC || hdr.type != SC_MSG_TRANSCRIBE || hdr.len < sizeof(sidecar_req_t) || hdr.len > SC_MAX_PAYLOAD) {
+            fprintf(stderr, "protocol error, closing the connection\n");
+            break;
+        }
+        if((job = calloc(1, sizeof(job_t))) == NULL || (job->payload = malloc(hdr.len)) == NULL) {
+            free(job);
+            break;
+        }
+        job->hdr = hdr;
+        if(read_full(conn->fd, job->payload, hdr.len) != 0 || ((sidecar_req_t *)job->payload)->prompt_len > hdr.len - sizeof(sidecar_req_t)) {
+            free(job->payload);
+            free(job);
+            break;
+        }
+
+        pthread_mutex_lock(&conn->mutex);
+        conn->refs++;
+        pthread_mutex_unlock(&conn->mutex);
+        job->conn = conn;
+
+        pthread_mutex_lock(&queue.mutex);
+        if(queue.len >= opts.queue_max) {
+            fl_busy = 1;
+        } else {
+            if(queue.tail) { queue.tail->next = job; } else { queue.head = job; }
+            queue.tail = job;
+            queue.len++;
+            pthread_cond_signal(&queue.cond);
+        }
+        pthread_mutex_unlock(&queue.mutex);
+
+        if(fl_busy) {
+            conn_reply(conn, hdr.id, SC_FL_ERROR, "busy", 4);
+            conn_unref(conn);
+            free(job->payload);
+            free(job);
+        }
+    }
+
+    pthread_mutex_lock(&conn->mutex);
+    conn->fl_closed = 1;
+    shutdown(conn->fd, SHUT_RDWR);
+    pthread_mutex_unlock(&conn->mutex);
+    conn_unref(conn);
+
+    if(opts.verbose) {
+        fprintf(stderr, "connection closed\n");
+    }
+    return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+static int cpus_pin(const char *list) {
+    cpu_set_t set;
+    char *dup = strdup(list), *tok = NULL, *save = NULL;
+
+    CPU_ZERO(&set);
+    for(tok = strtok_r(dup, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        CPU_SET(atoi(tok), &set);
+    }
+    free(dup);
+
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s --socket PATH [options]\n"
+        "  --api-url URL       transcription endpoint (%s)\n"
+        "  --api-key KEY       default: $OPENAI_API_KEY\n"
+        "  --proxy URL\n"
+        "  --workers N         parallel API calls (%d)\n"
+        "  --queue N           requests waiting for a worker before 'busy' (%d)\n"
+        "  --timeout SEC       per request (%d)\n"
+        "  --cpus LIST         pin to these cores, e.g. 2,3\n"
+        "  --verbose\n", name, DEF_API_URL, DEF_WORKERS, DEF_QUEUE, DEF_TIMEOUT);
+}
+
+int main(int argc, char **argv) {
+    static struct option lopts[] = {
+        { "socket", required_argument, 0, 's' }, { "api-url", required_argument, 0, 'u' }, { "api-key", required_argument, 0, 'k' },
+        { "proxy", required_argument, 0, 'p' }, { "workers", required_argument, 0, 'w' }, { "queue", required_argument, 0, 'q' },
+        { "timeout", required_argument, 0, 't' }, { "cpus", required_argument, 0, 'c' }, { "verbose", no_argument, 0, 'v' },
+        { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 }
+    };
+    struct sockaddr_un addr = { 0 };
+    const char *cpus = NULL;
+    int opt = 0, lfd = -1;
+
+    opts.api_key = getenv("OPENAI_API_KEY");
+
+    while((opt = getopt_long(argc, argv, "s:u:k:p:w:q:t:c:vh", lopts, NULL)) != -1) {
+        switch(opt) {
+            case 's': opts.socket_path = optarg; break;
+            case 'u': opts.api_url = optarg; break;
+            case 'k': opts.api_key = optarg; break;
+            case 'p': opts.proxy = optarg; break;
+            case 'w': opts.workers = atoi(optarg); break;
+            case 'q': opts.queue_max = atoi(optarg); break;
+            case 't': opts.timeout = atoi(optarg); break;
+            case 'c': cpus = optarg; break;
+            case 'v': opts.verbose = 1; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(!opts.socket_path || strlen(opts.socket_path) >= sizeof(addr.sun_path) || opts.workers == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if(cpus && cpus_pin(cpus) != 0) {
+        fprintf(stderr, "sched_setaffinity(%s): %s\n", cpus, strerror(errno));
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    if((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return 1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, opts.socket_path);
+    unlink(opts.socket_path);
+    if(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 16) < 0) {
+        perror(opts.socket_path);
+        return 1;
+    }
+
+    for(uint32_t i = 0; i < opts.workers; i++) {
+        pthread_t tid;
+        pthread_create(&tid, NULL, worker_thread, NULL);
+        pthread_detach(tid);
+    }
+
+    fprintf(stderr, "listening on %s, %u workers\n", opts.socket_path, opts.workers);
+
+    while(1) {
+        conn_t *conn = NULL;
+        pthread_t tid;
+        int fd = accept(lfd, NULL, NULL);
+
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        if((conn = calloc(1, sizeof(conn_t))) == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->refs = 1;
+        pthread_mutex_init(&conn->mutex, NULL);
+
+        if(opts.verbose) {
+            fprintf(stderr, "connection accepted\n");
+        }
+        pthread_create(&tid, NULL, conn_thread, conn);
+        pthread_detach(tid);
+    }
+
+    close(lfd);
+    unlink(opts.socket_path);
+    curl_global_cleanup();
+
+    return 0;
+}
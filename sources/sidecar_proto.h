@@ -0,0 +1,44 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#ifndef SIDECAR_PROTO_H
+#define SIDECAR_PROTO_H
+
+#include <stdint.h>
+
+/**
+ ** Module <-> sidecar framing over a Unix stream socket, host byte order (same machine).
+ ** Every message is sidecar_hdr_t + len bytes of payload, requests of many sessions share one connection
+ ** and the responses come back in any order, matched by id.
+ **   SC_MSG_TRANSCRIBE: sidecar_req_t + prompt (prompt_len) + raw audio (the rest)
+ **   SC_MSG_RESULT:     text (SC_FL_SEGMENTS/SC_FL_WORDS/SC_FL_TIMESTAMPS: the verbose_json response), flags & SC_FL_ERROR: error message
+ **/
+#define SC_MAGIC            0x53465753  // "SWFS"
+#define SC_MSG_TRANSCRIBE   1
+#define SC_MSG_RESULT       2
+#define SC_FL_SEGMENTS      0x01
+#define SC_FL_WORDS         0x02    // verbose_json with word timestamps
+#define SC_FL_TIMESTAMPS    0x04    // verbose_json with word and segment timestamps
+#define SC_FL_ERROR         0x80
+#define SC_MAX_PAYLOAD      (64 * 1024 * 1024)
+
+typedef struct {
+    uint32_t    magic;
+    uint16_t    type;
+    uint16_t    flags;
+    uint32_t    id;
+    uint32_t    len;
+} sidecar_hdr_t;
+
+typedef struct {
+    uint8_t     codec;          // CODEC_L16, CODEC_PCMU, CODEC_PCMA
+    uint8_t     channels;
+    uint16_t    prompt_len;
+    uint32_t    samplerate;
+    char        lang[16];
+    char        model[32];
+} sidecar_req_t;
+
+#endif
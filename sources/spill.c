@@ -0,0 +1,361 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+#include "whisper_api.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+
+extern globals_t globals;
+
+/**
+ ** Spill ({spill=true} with spill-dir set): a chunk whose upload failed is written to <spill-dir> as one file
+ ** (spill_hdr_t + audio, named by the enqueue time so the names sort oldest first) instead of being lost, up to
+ ** spill-max-mb in total. One drain thread sends them at spill-drain-per-min, one at a time, and fires the results
+ ** as sfwhisper::spill-result (the call may be long gone). While the drain is failing the backend is taken as down:
+ ** it backs off (SPILL_RETRY_MS doubling) and the new chunks of spill sessions go straight to the disk.
+ ** A failed file goes to the back of the queue, after SPILL_MAX_ATTEMPTS it's dropped. Files left by a previous
+ ** run are picked up.
+ **/
+static struct {
+    switch_mutex_t          *mutex;             // counters vs. the dir scan
+    uint8_t                 fl_outage;          // the last attempt (live or drain) failed
+    uint32_t                retry_ms;
+    switch_time_t           retry_time;
+    uint32_t                drained_sec[60];    // ring of per-second counts, the last minute's drain rate
+    switch_time_t           drained_at[60];
+    uint8_t                 fl_started;
+} spill;
+
+static char *spill_name(config_t *cfg, switch_time_t t, const char *uuid, uint32_t chunk_id) {
+    return switch_mprintf("%s%s%016"PRIx64"-%s-%u.spl", cfg->spill_dir, SWITCH_PATH_SEPARATOR, (uint64_t)t, uuid, chunk_id);
+}
+
+static uint8_t spill_name_valid(const char *name) {
+    uint32_t len = strlen(name);
+    return (len > 20 && name[16] == '-' && !strcmp(name + len - 4, ".spl"));
+}
+
+static void spill_drained_count() {
+    switch_time_t sec = switch_micro_time_now() / 1000000;
+    uint32_t i = sec % 60;
+
+    if(spill.drained_at[i] != sec) {
+        spill.drained_at[i] = sec;
+        spill.drained_sec[i] = 0;
+    }
+    spill.drained_sec[i]++;
+}
+
+/**
+ ** oldest file name (caller frees), refreshes spill_depth/spill_bytes on the way
+ **/
+static char *spill_oldest(config_t *cfg) {
+    struct dirent *de = NULL;
+    char *oldest = NULL, *path = NULL;
+    uint64_t depth = 0, bytes = 0;
+    struct stat st;
+    DIR *d = NULL;
+
+    if((d = opendir(cfg->spill_dir)) == NULL) {
+        return NULL;
+    }
+    while((de = readdir(d)) != NULL) {
+        if(!spill_name_valid(de->d_name)) {
+            continue;
+        }
+        path = switch_mprintf("%s%s%s", cfg->spill_dir, SWITCH_PATH_SEPARATOR, de->d_name);
+        if(stat(path, &st) == 0) {
+            depth++;
+            bytes += st.st_size;
+        }
+        switch_safe_free(path);
+        if(!oldest || strcmp(de->d_name, oldest) < 0) {
+            switch_safe_free(oldest);
+            oldest = strdup(de->d_name);
+        }
+    }
+    closedir(d);
+
+    switch_mutex_lock(spill.mutex);
+    __atomic_store_n(&globals.spill_depth, depth, __ATOMIC_RELAXED);
+    __atomic_store_n(&globals.spill_bytes, bytes, __ATOMIC_RELAXED);
+    switch_mutex_unlock(spill.mutex);
+
+    return oldest;
+}
+
+static void spill_remove(const char *path, uint64_t len) {
+    unlink(path);
+
+    switch_mutex_lock(spill.mutex);
+    if(globals.spill_depth > 0) globals.spill_depth--;
+    globals.spill_bytes = (globals.spill_bytes > len ? globals.spill_bytes - len : 0);
+    switch_mutex_unlock(spill.mutex);
+}
+
+static void spill_result_event(spill_hdr_t *hdr, const char *text, uint32_t utterance, switch_time_t t_response) {
+    switch_event_t *event = NULL;
+
+    if(switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, EVENT_SPILL_RESULT) == SWITCH_STATUS_SUCCESS) {
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", hdr->uuid);
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Transcript", text);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Chunk-ID", "%u", hdr->chunk_id);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Utterance", "%u", utterance);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Attempts", "%u", hdr->attempts + 1);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Speech-Start", "%"PRId64, hdr->t_speech_start);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Speech-End", "%"PRId64, hdr->t_speech_end);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Spill-Time", "%"PRId64, hdr->t_spill);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Response-Time", "%"PRId64, (int64_t)t_response);
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Delay-MS", "%"PRId64, (int64_t)((t_response - hdr->t_spill) / 1000));
+        switch_event_fire(&event);
+    }
+}
+
+/**
+ ** one file: SWITCH_STATUS_SUCCESS - done (sent or dropped), SWITCH_STATUS_FALSE - the API failed
+ **/
+static switch_status_t spill_send(config_t *cfg, const char *name) {
+    char *path = switch_mprintf("%s%s%s", cfg->spill_dir, SWITCH_PATH_SEPARATOR, name);
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    switch_byte_t *audio = NULL;
+    char *fname = NULL, *result = NULL, **texts = NULL;
+    uint32_t count = 1;
+    spill_hdr_t hdr = { 0 };
+    gasr_ctx_t ctx;
+    FILE *fp = NULL;
+
+    if((fp = fopen(path, "rb")) == NULL) {
+        goto out;
+    }
+    if(fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != SPILL_MAGIC || hdr.version != SPILL_VERSION || !hdr.audio_len || !hdr.samplerate) {
+        fclose(fp);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "sfwhisper: stage=spill bad file dropped: %s\n", path);
+        __atomic_add_fetch(&globals.spill_dropped, 1, __ATOMIC_RELAXED);
+        spill_remove(path, 0);
+        goto out;
+    }
+    switch_malloc(audio, hdr.audio_len);
+    if(fread(audio, hdr.audio_len, 1, fp) != 1) {
+        fclose(fp);
+        __atomic_add_fetch(&globals.spill_dropped, 1, __ATOMIC_RELAXED);
+        spill_remove(path, sizeof(hdr));
+        goto out;
+    }
+    fclose(fp);
+
+    // whisper_transcribe() only looks at the config, lang and uuid
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.cfg = cfg;
+    ctx.lang = hdr.lang;
+    snprintf(ctx.uuid, sizeof(ctx.uuid), "%.36s", hdr.uuid);
+
+    if((fname = audio_file_write(audio, hdr.audio_len, hdr.codec, MAX(hdr.channels, 1), hdr.samplerate)) == NULL) {
+        switch_goto_status(SWITCH_STATUS_FALSE, out);
+    }
+    status = (hdr.fl_segments ? whisper_transcribe_segments(&ctx, fname, &result) : whisper_transcribe(&ctx, fname, &result));
+    audio_file_delete(fname);
+
+    if(status != SWITCH_STATUS_SUCCESS) {
+        char *requeue = NULL;
+
+        __atomic_add_fetch(&globals.spill_failed, 1, __ATOMIC_RELAXED);
+        if(++hdr.attempts >= SPILL_MAX_ATTEMPTS) {
+            slog_printf(cfg, SWITCH_LOG_ERROR, "uuid=%s stage=spill chunk=%u dropped attempts=%u", hdr.uuid, hdr.chunk_id, hdr.attempts);
+            __atomic_add_fetch(&globals.spill_dropped, 1, __ATOMIC_RELAXED);
+            spill_remove(path, sizeof(hdr) + hdr.audio_len);
+            goto out;
+        }
+        // to the back of the queue, one bad chunk doesn't hold up the rest
+        if((fp = fopen(path, "r+b")) != NULL) {
+            if(fwrite(&hdr, sizeof(hdr), 1, fp) != 1) { }
+            fclose(fp);
+        }
+        requeue = spill_name(cfg, switch_micro_time_now(), hdr.uuid, hdr.chunk_id);
+        if(rename(path, requeue) != 0) { }
+        switch_safe_free(requeue);
+        goto out;
+    }
+
+    if(hdr.fl_segments) {
+        count = MIN(hdr.marks_count, COALESCE_MAX_UTTERANCES);
+        switch_zmalloc(texts, sizeof(char *) * MAX(count, 1));
+        if(coalesce_split(result, hdr.marks_ms, count, texts) != SWITCH_STATUS_SUCCESS) {
+            count = 0;
+        }
+    } else {
+        switch_zmalloc(texts, sizeof(char *));
+        texts[0] = result;
+        result = NULL;
+    }
+    for(uint32_t i = 0; i < count; i++) {
+        if(texts[i] && texts[i][0]) {
+            spill_result_event(&hdr, texts[i], i, switch_micro_time_now());
+        }
+        switch_safe_free(texts[i]);
+    }
+
+    slog_printf(cfg, SWITCH_LOG_NOTICE, "uuid=%s stage=spill chunk=%u drained attempts=%u delay_ms=%"PRId64, hdr.uuid, hdr.chunk_id, hdr.attempts + 1,
+                (int64_t)((switch_micro_time_now() - hdr.t_spill) / 1000));
+    __atomic_add_fetch(&globals.spill_drained, 1, __ATOMIC_RELAXED);
+    spill_drained_count();
+    spill_remove(path, sizeof(hdr) + hdr.audio_len);
+out:
+    switch_safe_free(texts);
+    switch_safe_free(result);
+    switch_safe_free(fname);
+    switch_safe_free(audio);
+    switch_safe_free(path);
+    return status;
+}
+
+static void *SWITCH_THREAD_FUNC spill_thread(switch_thread_t *thread, void *obj) {
+    switch_time_t t_next = 0;
+
+    while(!globals.fl_shutdown) {
+        config_t *cfg = config_acquire();
+        switch_time_t now = switch_micro_time_now();
+        char *name = NULL;
+
+        if(!cfg || !cfg->spill_dir || now < t_next || (spill.fl_outage && now < spill.retry_time)) {
+            goto next;
+        }
+        if((name = spill_oldest(cfg)) == NULL) {
+            spill.fl_outage = false;
+            t_next = now + SPILL_SCAN_MS * 1000;
+            goto next;
+        }
+
+        t_next = now + (60000000 / MAX(cfg->spill_drain_per_min, 1));
+        if(spill_send(cfg, name) == SWITCH_STATUS_SUCCESS) {
+            spill.fl_outage = false;
+            spill.retry_ms = 0;
+        } else {
+            spill.fl_outage = true;
+            spill.retry_ms = (spill.retry_ms ? MIN(spill.retry_ms * 2, SPILL_RETRY_MAX_MS) : SPILL_RETRY_MS);
+            spill.retry_time = switch_micro_time_now() + (switch_time_t)spill.retry_ms * 1000;
+            slog_printf(cfg, SWITCH_LOG_WARNING, "stage=spill drain failed, retry_ms=%u depth=%"PRIu64, spill.retry_ms, __atomic_load_n(&globals.spill_depth, __ATOMIC_RELAXED));
+        }
+next:
+        switch_safe_free(name);
+        config_release(&cfg);
+        switch_yield(SPILL_TICK_MS * 1000);
+    }
+
+    thread_finished();
+    return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+void spill_init(switch_memory_pool_t *pool) {
+    switch_mutex_init(&spill.mutex, SWITCH_MUTEX_NESTED, pool);
+}
+
+/**
+ ** the thread runs from the first config with spill-dir on (load or reload), under globals.mutex
+ **/
+void spill_start(config_t *cfg) {
+    if(cfg->spill_dir && !spill.fl_started) {
+        spill.fl_started = true;
+        thread_launch(globals.pool, spill_thread, NULL);
+    }
+}
+
+/**
+ ** the backend is down: the upload threads of spill sessions don't even try
+ **/
+uint8_t spill_deferring(gasr_ctx_t *asr_ctx) {
+    return (asr_ctx->fl_spill && asr_ctx->cfg->spill_dir && spill.fl_outage);
+}
+
+/**
+ ** upload thread, the chunk failed (or was deferred); SWITCH_STATUS_FALSE - not spilled
+ ** an upload aborted on purpose (hangup, kill, shutdown) is neither spilled nor taken for an outage
+ **/
+switch_status_t spill_put(gasr_ctx_t *asr_ctx, upload_job_t *job) {
+    config_t *cfg = asr_ctx->cfg;
+    spill_hdr_t hdr = { 0 };
+    uint64_t len = sizeof(hdr) + job->data_len;
+    char *path = NULL, *tmp = NULL;
+    uint8_t fl_full = false, fl_ok = false;
+    FILE *fp = NULL;
+
+    if(!asr_ctx->fl_spill || !cfg->spill_dir || !spill.mutex || !job->data_len) {
+        return SWITCH_STATUS_FALSE;
+    }
+    if(asr_ctx->fl_destroyed || globals.fl_shutdown || job->kill_gen != asr_ctx->kill_gen) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_mutex_lock(spill.mutex);
+    if((fl_full = (globals.spill_bytes + len > (uint64_t)cfg->spill_max_mb * 1024 * 1024)) == false) {
+        globals.spill_bytes += len;
+        globals.spill_depth++;
+    }
+    spill.fl_outage = true;
+    switch_mutex_unlock(spill.mutex);
+
+    if(fl_full) {
+        __atomic_add_fetch(&globals.spill_dropped, 1, __ATOMIC_RELAXED);
+        slog_chunk(asr_ctx, job->chunk_id, SWITCH_LOG_ERROR, "spill", "dropped reason=spill-max-mb bytes=%u", job->data_len);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    hdr.magic = SPILL_MAGIC;
+    hdr.version = SPILL_VERSION;
+    hdr.codec = asr_ctx->codec;
+    hdr.fl_segments = job->fl_segments;
+    hdr.channels = asr_ctx->channels;
+    hdr.samplerate = asr_ctx->samplerate;
+    hdr.chunk_id = job->chunk_id;
+    hdr.audio_len = job->data_len;
+    hdr.marks_count = job->marks_count;
+    memcpy(hdr.marks_ms, job->marks_ms, sizeof(hdr.marks_ms));
+    hdr.t_speech_start = job->timing.t_speech_start;
+    hdr.t_speech_end = job->timing.t_speech_end;
+    hdr.t_dispatch = job->timing.t_dispatch;
+    hdr.t_spill = switch_micro_time_now();
+    snprintf(hdr.uuid, sizeof(hdr.uuid), "%s", asr_ctx->uuid);
+    snprintf(hdr.lang, sizeof(hdr.lang), "%s", (asr_ctx->lang ? asr_ctx->lang : ""));
+
+    // written under a temporary name, the drain never sees half a file
+    path = spill_name(cfg, hdr.t_spill, asr_ctx->uuid, job->chunk_id);
+    tmp = switch_mprintf("%s.tmp", path);
+    if((fp = fopen(tmp, "wb")) != NULL) {
+        fl_ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && fwrite(job->data, job->data_len, 1, fp) == 1);
+        fl_ok = (fclose(fp) == 0 && fl_ok && rename(tmp, path) == 0);
+    }
+    if(!fl_ok) {
+        spill_remove(tmp, len);
+        __atomic_add_fetch(&globals.spill_dropped, 1, __ATOMIC_RELAXED);
+        slog_chunk(asr_ctx, job->chunk_id, SWITCH_LOG_ERROR, "spill", "dropped reason=write file=%s", path);
+        switch_safe_free(path);
+        switch_safe_free(tmp);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    __atomic_add_fetch(&globals.spill_written, 1, __ATOMIC_RELAXED);
+    slog_chunk(asr_ctx, job->chunk_id, SWITCH_LOG_WARNING, "spill", "bytes=%u depth=%"PRIu64, job->data_len, __atomic_load_n(&globals.spill_depth, __ATOMIC_RELAXED));
+
+    switch_safe_free(path);
+    switch_safe_free(tmp);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ ** chunks drained in the last 60 seconds
+ **/
+uint32_t spill_drained_last_min() {
+    switch_time_t sec = switch_micro_time_now() / 1000000;
+    uint32_t total = 0;
+
+    for(uint32_t i = 0; i < 60; i++) {
+        if(spill.drained_at[i] > sec - 60) {
+            total += spill.drained_sec[i];
+        }
+    }
+    return total;
+}
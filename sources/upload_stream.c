@@ -0,0 +1,210 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+#include "whisper_api.h"
+
+extern globals_t globals;
+
+static void upload_stream_destroy(upload_stream_t *stream) {
+    switch_memory_pool_t *pool = stream->pool;
+
+    xdata_buffer_free(&stream->cur);
+    if(stream->q_data) {
+        xdata_buffer_queue_clean(stream->q_data);
+        switch_queue_term(stream->q_data);
+    }
+    if(stream->recv_buffer) {
+        switch_buffer_destroy(&stream->recv_buffer);
+    }
+    switch_safe_free(stream->text);
+    switch_core_destroy_memory_pool(&pool);
+}
+
+static void *SWITCH_THREAD_FUNC upload_stream_thread(switch_thread_t *thread, void *obj) {
+    upload_stream_t *stream = (upload_stream_t *) obj;
+    gasr_ctx_t *asr_ctx = stream->asr_ctx;
+    uint8_t fl_destroy = false;
+
+    if(curl_upload_stream(stream) == SWITCH_STATUS_SUCCESS) {
+        const void *ptr = NULL;
+        switch_size_t len = switch_buffer_peek_zerocopy(stream->recv_buffer, &ptr);
+
+        if(len > 0 && ptr) {
+            if(stream->fl_segments || stream->fl_words || stream->fl_nlsml) {
+                stream->text = strdup((char *)ptr);
+            } else {
+                vjson_t vj = { 0 };
+
+                if(vjson_parse((const char *)ptr, len, &vj) == SWITCH_STATUS_SUCCESS && vj.text) {
+                    stream->text = strdup(vj.text);
+                }
+                vjson_free(&vj);
+            }
+        }
+    }
+
+    if(stream->fl_unsupported) {
+        switch_mutex_lock(globals.mutex);
+        globals.progressive_retry_time = switch_micro_time_now() + (PROGRESSIVE_RETRY_SEC * 1000000LL);
+        switch_mutex_unlock(globals.mutex);
+
+        slog_printf(asr_ctx->cfg, SWITCH_LOG_WARNING, "uuid=%s stage=stream http=%ld chunked uploads rejected, buffered mode for %us",
+                    asr_ctx->uuid, stream->http_code, PROGRESSIVE_RETRY_SEC);
+    }
+
+    switch_mutex_lock(stream->mutex);
+    stream->fl_done = true;
+    fl_destroy = stream->fl_released;
+    switch_mutex_unlock(stream->mutex);
+
+    if(fl_destroy) {
+        upload_stream_destroy(stream);
+    }
+
+    switch_mutex_lock(asr_ctx->mutex);
+    if(asr_ctx->deps > 0) asr_ctx->deps--;
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    slog_thread_done();
+    thread_finished();
+
+    return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+upload_stream_t *upload_stream_start(gasr_ctx_t *asr_ctx, uint32_t chunk_id) {
+    switch_memory_pool_t *pool = NULL;
+    upload_stream_t *stream = NULL;
+    switch_byte_t wav_hdr[WAV_HDR_MAX_SZ] = { 0 };
+    const char *prompt = grammar_prompt(asr_ctx);
+    char *fields = NULL, *format = "";
+    uint32_t fields_len = 0, wav_hdr_len = 0;
+
+    switch_mutex_lock(globals.mutex);
+    if(globals.progressive_retry_time > switch_micro_time_now()) {
+        switch_mutex_unlock(globals.mutex);
+        return NULL;
+    }
+    switch_mutex_unlock(globals.mutex);
+
+    if(switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_core_new_memory_pool() fail\n");
+        return NULL;
+    }
+
+    stream = switch_core_alloc(pool, sizeof(upload_stream_t));
+    stream->pool = pool;
+    stream->asr_ctx = asr_ctx;
+    stream->chunk_id = chunk_id;
+    stream->fl_segments = asr_ctx->fl_coalesce;
+    stream->fl_words = (asr_ctx->cfg->chunk_overlap_ms && !asr_ctx->fl_coalesce);
+    stream->fl_nlsml = (asr_ctx->fl_nlsml && !stream->fl_segments && !stream->fl_words);
+    stream->kill_gen = asr_ctx->kill_gen;
+
+    switch_mutex_init(&stream->mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_queue_create(&stream->q_data, (asr_ctx->cfg->chunk_size_sec * 100) + QUEUE_SIZE, pool);
+    switch_buffer_create_dynamic(&stream->recv_buffer, 1024, 2048, 0);
+
+    switch_uuid_str(stream->boundary, sizeof(stream->boundary));
+    if(stream->fl_segments || stream->fl_words || stream->fl_nlsml) {
+        format = switch_core_sprintf(pool, "--%s\r\nContent-Disposition: form-data; name=\"response_format\"\r\n\r\nverbose_json\r\n", stream->boundary);
+    }
+    if(stream->fl_words || stream->fl_nlsml) {
+        format = switch_core_sprintf(pool, "%s--%s\r\nContent-Disposition: form-data; name=\"timestamp_granularities[]\"\r\n\r\nword\r\n", format, stream->boundary);
+    }
+    if(stream->fl_nlsml) {
+        format = switch_core_sprintf(pool, "%s--%s\r\nContent-Disposition: form-data; name=\"timestamp_granularities[]\"\r\n\r\nsegment\r\n", format, stream->boundary);
+    }
+    fields = switch_core_sprintf(pool,
+                "--%s\r\nContent-Disposition: form-data; name=\"model\"\r\n\r\n%s\r\n"
+                "--%s\r\nContent-Disposition: form-data; name=\"language\"\r\n\r\n%s\r\n"
+                "%s%s%s%s%s"
+                "%s"
+                "--%s\r\nContent-Disposition: form-data; name=\"file\"; filename=\"audio.wav\"\r\nContent-Type: audio/wav\r\n\r\n",
+                stream->boundary, WHISPER_MODEL,
+                stream->boundary, asr_ctx->lang,
+                (prompt ? "--" : ""), (prompt ? stream->boundary : ""), (prompt ? "\r\nContent-Disposition: form-data; name=\"prompt\"\r\n\r\n" : ""), (prompt ? prompt : ""), (prompt ? "\r\n" : ""),
+                format,
+                stream->boundary);
+
+    fields_len = strlen(fields);
+    wav_hdr_len = wav_header_build(wav_hdr, asr_ctx->codec, asr_ctx->channels, asr_ctx->samplerate, WAV_LEN_UNKNOWN);
+
+    stream->head_len = fields_len + wav_hdr_len;
+    stream->head = switch_core_alloc(pool, stream->head_len);
+    memcpy(stream->head, fields, fields_len);
+    memcpy(stream->head + fields_len, wav_hdr, wav_hdr_len);
+
+    stream->tail = switch_core_sprintf(pool, "\r\n--%s--\r\n", stream->boundary);
+    stream->tail_len = strlen(stream->tail);
+
+    switch_mutex_lock(asr_ctx->mutex);
+    asr_ctx->deps++;
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    thread_launch(pool, upload_stream_thread, stream);
+
+    return stream;
+}
+
+/**
+ ** takes the ownership of the buffer
+ **/
+void upload_stream_push(upload_stream_t *stream, xdata_buffer_t *buf) {
+    if(stream->fl_done || switch_queue_trypush(stream->q_data, buf) != SWITCH_STATUS_SUCCESS) {
+        xdata_buffer_free(&buf);
+    }
+}
+
+/**
+ ** marks the end of audio and waits for the response
+ **/
+switch_status_t upload_stream_finish(upload_stream_t *stream, char **text) {
+    config_t *cfg = stream->asr_ctx->cfg;
+    switch_time_t expiry = switch_micro_time_now() + (MAX(cfg->request_timeout, 1) * 1000000LL);
+    xdata_buffer_t *eof = NULL;
+
+    if(xdata_buffer_alloc(&eof, NULL, 0) == SWITCH_STATUS_SUCCESS) {
+        upload_stream_push(stream, eof);
+    }
+
+    while(!stream->fl_done) {
+        if(globals.fl_shutdown || stream->asr_ctx->fl_destroyed || stream->kill_gen != stream->asr_ctx->kill_gen || switch_micro_time_now() > expiry) {
+            stream->fl_cancel = true;
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_yield(5000);
+    }
+
+    if(!stream->text) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    *text = strdup(stream->text);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void upload_stream_release(upload_stream_t **stream) {
+    upload_stream_t *st = NULL;
+    uint8_t fl_destroy = false;
+
+    if(!stream || !*stream) {
+        return;
+    }
+
+    st = *stream;
+    *stream = NULL;
+
+    switch_mutex_lock(st->mutex);
+    st->fl_cancel = true;
+    st->fl_released = true;
+    fl_destroy = st->fl_done;
+    switch_mutex_unlock(st->mutex);
+
+    if(fl_destroy) {
+        upload_stream_destroy(st);
+    }
+}
@@ -7,6 +7,9 @@
 
 extern globals_t globals;
 
+static int16_t g711_ulaw_tbl[256];
+static int16_t g711_alaw_tbl[256];
+
 
 /**
  ** https://cloud.google.com/speech-to-text/docs/reference/rest/v1/RecognitionConfig
@@ -66,6 +69,74 @@ char *gcp_get_interaction(const char *val) {
     return (char *)val;
 }
 
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+// G.711 (ITU-T), expanded once into lookup tables
+static int16_t ulaw_to_linear(uint8_t v) {
+    int t;
+
+    v = ~v;
+    t = ((v & 0x0f) << 3) + 0x84;
+    t <<= (v & 0x70) >> 4;
+
+    return (int16_t)((v & 0x80) ? (0x84 - t) : (t - 0x84));
+}
+
+static int16_t alaw_to_linear(uint8_t v) {
+    int t, seg;
+
+    v ^= 0x55;
+    t = (v & 0x0f) << 4;
+    seg = (v & 0x70) >> 4;
+
+    switch(seg) {
+        case 0: t += 8; break;
+        case 1: t += 0x108; break;
+        default: t += 0x108; t <<= seg - 1;
+    }
+
+    return (int16_t)((v & 0x80) ? t : -t);
+}
+
+void g711_init() {
+    for(int i = 0; i < 256; i++) {
+        g711_ulaw_tbl[i] = ulaw_to_linear((uint8_t) i);
+        g711_alaw_tbl[i] = alaw_to_linear((uint8_t) i);
+    }
+}
+
+const int16_t *g711_table(uint8_t codec) {
+    return (codec == CODEC_PCMA ? g711_alaw_tbl : g711_ulaw_tbl);
+}
+
+void g711_decode(uint8_t codec, const switch_byte_t *src, uint32_t len, int16_t *dst) {
+    const int16_t *tbl = g711_table(codec);
+
+    for(uint32_t i = 0; i < len; i++) {
+        dst[i] = tbl[src[i]];
+    }
+}
+
+uint8_t pcm_is_silence(const int16_t *samples, uint32_t count, uint32_t threshold) {
+    uint64_t energy = 0;
+
+    if(!count) {
+        return true;
+    }
+    for(uint32_t i = 0; i < count; i++) {
+        energy += abs(samples[i]);
+    }
+
+    return ((energy / count) < threshold);
+}
+
+const char *overflow_policy2str(uint8_t policy) {
+    switch(policy) {
+        case OVERFLOW_DROP_NEWEST: return "drop-newest";
+        case OVERFLOW_COMPACT_SILENCE: return "compact-silence";
+    }
+    return "drop-oldest";
+}
+
 // ------------------------------------------------------------------------------------------------------------------------------------------------
 void thread_finished() {
     switch_mutex_lock(globals.mutex);
@@ -73,9 +144,26 @@ void thread_finished() {
     switch_mutex_unlock(globals.mutex);
 }
 
+typedef struct {
+    switch_thread_start_t   fun;
+    void                    *data;
+} thread_start_t;
+
+static void *SWITCH_THREAD_FUNC thread_start(switch_thread_t *thread, void *obj) {
+    thread_start_t *start = (thread_start_t *)obj;
+    switch_thread_start_t fun = start->fun;
+    void *data = start->data;
+
+    free(start);
+    slog_thread_attach();
+
+    return fun(thread, data);
+}
+
 void thread_launch(switch_memory_pool_t *pool, switch_thread_start_t fun, void *data) {
     switch_threadattr_t *attr = NULL;
     switch_thread_t *thread = NULL;
+    thread_start_t *start = NULL;
 
     switch_mutex_lock(globals.mutex);
     globals.active_threads++;
@@ -84,7 +172,12 @@ void thread_launch(switch_memory_pool_t *pool, switch_thread_start_t fun, void *
     switch_threadattr_create(&attr, pool);
     switch_threadattr_detach_set(attr, 1);
     switch_threadattr_stacksize_set(attr, SWITCH_THREAD_STACKSIZE);
-    switch_thread_create(&thread, attr, fun, data, pool);
+    switch_zmalloc(start, sizeof(thread_start_t));
+    start->fun = fun;
+    start->data = data;
+    if(switch_thread_create(&thread, attr, thread_start, start, pool) != SWITCH_STATUS_SUCCESS) {
+        free(start);
+    }
 
     return;
 }
@@ -135,14 +228,110 @@ switch_status_t xdata_buffer_push(switch_queue_t *queue, switch_byte_t *data, ui
     return SWITCH_STATUS_FALSE;
 }
 
-char *audio_file_write(switch_byte_t *buf, uint32_t buf_len, uint32_t channels, uint32_t samplerate) {
+static void wav_put_le(switch_byte_t *p, uint32_t v, uint32_t n) {
+    for(uint32_t i = 0; i < n; i++) {
+        p[i] = (v >> (i * 8)) & 0xff;
+    }
+}
+
+/**
+ ** data_len = WAV_LEN_UNKNOWN for streamed uploads
+ **/
+uint32_t wav_header_build(switch_byte_t *hdr, uint8_t codec, uint32_t channels, uint32_t samplerate, uint32_t data_len) {
+    uint32_t hdr_len = (codec == CODEC_L16 ? WAV_HDR_L16_SZ : WAV_HDR_G711_SZ);
+    uint32_t bits = (codec == CODEC_L16 ? 16 : 8);
+    uint32_t riff_len = (data_len == WAV_LEN_UNKNOWN ? WAV_LEN_UNKNOWN : (hdr_len - 8) + data_len);
+
+    memcpy(hdr + 0, "RIFF", 4);
+    wav_put_le(hdr + 4, riff_len, 4);
+    memcpy(hdr + 8, "WAVEfmt ", 8);
+    wav_put_le(hdr + 16, (codec == CODEC_L16 ? 16 : 18), 4);
+    wav_put_le(hdr + 20, (codec == CODEC_L16 ? 1 : (codec == CODEC_PCMA ? 6 : 7)), 2);
+    wav_put_le(hdr + 22, channels, 2);
+    wav_put_le(hdr + 24, samplerate, 4);
+    wav_put_le(hdr + 28, samplerate * channels * (bits / 8), 4);
+    wav_put_le(hdr + 32, channels * (bits / 8), 2);
+    wav_put_le(hdr + 34, bits, 2);
+
+    if(codec == CODEC_L16) {
+        memcpy(hdr + 36, "data", 4);
+        wav_put_le(hdr + 40, data_len, 4);
+    } else {
+        wav_put_le(hdr + 36, 0, 2);
+        memcpy(hdr + 38, "fact", 4);
+        wav_put_le(hdr + 42, 4, 4);
+        wav_put_le(hdr + 46, (data_len == WAV_LEN_UNKNOWN ? data_len : data_len / channels), 4);
+        memcpy(hdr + 50, "data", 4);
+        wav_put_le(hdr + 54, data_len, 4);
+    }
+
+    return hdr_len;
+}
+
+/**
+ ** G.711 goes out as is (WAVE_FORMAT_MULAW / WAVE_FORMAT_ALAW), without expanding to L16
+ **/
+static char *audio_file_write_g711(switch_byte_t *buf, uint32_t buf_len, uint8_t codec, uint32_t channels, uint32_t samplerate) {
     switch_status_t status = SWITCH_STATUS_FALSE;
-    switch_size_t len = buf_len;
+    switch_memory_pool_t *pool = NULL;
+    switch_file_t *fd = NULL;
+    switch_size_t len = 0;
+    switch_byte_t hdr[WAV_HDR_MAX_SZ] = { 0 };
+    uint32_t hdr_len = 0;
+    char *file_name = NULL;
+    char name_uuid[SWITCH_UUID_FORMATTED_LENGTH + 1] = { 0 };
+
+    switch_uuid_str((char *)name_uuid, sizeof(name_uuid));
+    file_name = switch_mprintf("%s%s%s.wav", SWITCH_GLOBAL_dirs.temp_dir, SWITCH_PATH_SEPARATOR, name_uuid);
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "audio-file: %s (%s)\n", file_name, (codec == CODEC_PCMA ? "alaw" : "ulaw"));
+
+    hdr_len = wav_header_build(hdr, codec, channels, samplerate, buf_len);
+
+    if(switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_core_new_memory_pool() fail\n");
+        goto out;
+    }
+    if(switch_file_open(&fd, file_name, (SWITCH_FOPEN_WRITE | SWITCH_FOPEN_TRUNCATE | SWITCH_FOPEN_CREATE), SWITCH_FPROT_OS_DEFAULT, pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Open fail: %s\n", file_name);
+        goto out;
+    }
+
+    len = hdr_len;
+    if((status = switch_file_write(fd, hdr, &len)) == SWITCH_STATUS_SUCCESS) {
+        len = buf_len;
+        status = switch_file_write(fd, buf, &len);
+    }
+    if(status != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Write fail (%s)\n", file_name);
+    }
+    switch_file_close(fd);
+
+out:
+    if(pool) {
+        switch_core_destroy_memory_pool(&pool);
+    }
+    if(status != SWITCH_STATUS_SUCCESS) {
+        if(file_name) {
+            unlink(file_name);
+            switch_safe_free(file_name);
+        }
+        return NULL;
+    }
+    return file_name;
+}
+
+char *audio_file_write(switch_byte_t *buf, uint32_t buf_len, uint8_t codec, uint32_t channels, uint32_t samplerate) {
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    switch_size_t len = buf_len / sizeof(int16_t); // samples
     switch_file_handle_t fh = { 0 };
     char *file_name = NULL;
     char name_uuid[SWITCH_UUID_FORMATTED_LENGTH + 1] = { 0 };
     int flags = (SWITCH_FILE_FLAG_WRITE | SWITCH_FILE_DATA_SHORT);
 
+    if(codec == CODEC_PCMU || codec == CODEC_PCMA) {
+        return audio_file_write_g711(buf, buf_len, codec, channels, samplerate);
+    }
+
     switch_uuid_str((char *)name_uuid, sizeof(name_uuid));
     file_name = switch_mprintf("%s%s%s.wav", SWITCH_GLOBAL_dirs.temp_dir, SWITCH_PATH_SEPARATOR, name_uuid);
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "audio-file: %s\n", file_name);
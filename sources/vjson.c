@@ -0,0 +1,424 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+#include <math.h>
+
+/**
+ ** verbose_json responses without a DOM: one pass over the received buffer, the fields the module uses are picked up
+ ** as they go by and everything else is skipped. One allocation per response: the segments, the words and the
+ ** unescaped strings share a block sized from the input (an object is at least a '{', a string doesn't grow
+ ** when it's unescaped), the result points into it.
+ **/
+typedef struct {
+    const char              *p;
+    const char              *end;
+    char                    *out;               // next free byte for the strings
+    uint32_t                max_items;
+} vjson_scan_t;
+
+#define SCAN_WS(s)          while((s)->p < (s)->end && (*(s)->p == ' ' || *(s)->p == '\n' || *(s)->p == '\r' || *(s)->p == '\t')) { (s)->p++; }
+#define SCAN_PEEK(s)        ((s)->p < (s)->end ? *(s)->p : '\0')
+#define KEY_IS(k, klen, lit) ((klen) == sizeof(lit) - 1 && !memcmp((k), (lit), sizeof(lit) - 1))
+
+static const double pow10_tbl[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+
+static uint32_t hex4(const char *p) {
+    uint32_t v = 0;
+
+    for(int i = 0; i < 4; i++) {
+        char c = p[i];
+        v <<= 4;
+        if(c >= '0' && c <= '9') { v |= c - '0'; }
+        else if(c >= 'a' && c <= 'f') { v |= c - 'a' + 10; }
+        else if(c >= 'A' && c <= 'F') { v |= c - 'A' + 10; }
+        else { return UINT32_MAX; }
+    }
+    return v;
+}
+
+static char *utf8_put(char *dst, uint32_t cp) {
+    if(cp < 0x80) {
+        *dst++ = cp;
+    } else if(cp < 0x800) {
+        *dst++ = 0xc0 | (cp >> 6);
+        *dst++ = 0x80 | (cp & 0x3f);
+    } else if(cp < 0x10000) {
+        *dst++ = 0xe0 | (cp >> 12);
+        *dst++ = 0x80 | ((cp >> 6) & 0x3f);
+        *dst++ = 0x80 | (cp & 0x3f);
+    } else {
+        *dst++ = 0xf0 | (cp >> 18);
+        *dst++ = 0x80 | ((cp >> 12) & 0x3f);
+        *dst++ = 0x80 | ((cp >> 6) & 0x3f);
+        *dst++ = 0x80 | (cp & 0x3f);
+    }
+    return dst;
+}
+
+/**
+ ** at the opening quote; dst NULL: skipped, else unescaped into the block
+ **/
+static int scan_string(vjson_scan_t *s, const char **dst) {
+    char *out = s->out;
+
+    if(SCAN_PEEK(s) != '"') {
+        return -1;
+    }
+    s->p++;
+
+    while(s->p < s->end) {
+        const char *q = s->p;
+
+        // plain runs go in one copy
+        while(q < s->end && *q != '"' && *q != '\\') { q++; }
+        if(dst) {
+            memcpy(out, s->p, q - s->p);
+            out += (q - s->p);
+        }
+        s->p = q;
+        if(q >= s->end) {
+            break;
+        }
+        if(*q == '"') {
+            s->p++;
+            if(dst) {
+                *out++ = '\0';
+                *dst = s->out;
+                s->out = out;
+            }
+            return 0;
+        }
+
+        // escape
+        if(s->end - q < 2) {
+            break;
+        }
+        if(q[1] == 'u') {
+            uint32_t cp = 0;
+
+            if(s->end - q < 6 || (cp = hex4(q + 2)) == UINT32_MAX) {
+                return -1;
+            }
+            s->p = q + 6;
+            if(cp >= 0xd800 && cp < 0xdc00 && s->end - s->p >= 6 && s->p[0] == '\\' && s->p[1] == 'u') {
+                uint32_t lo = hex4(s->p + 2);
+                if(lo >= 0xdc00 && lo < 0xe000) {
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                    s->p += 6;
+                }
+            }
+            if(dst) {
+                out = utf8_put(out, cp);
+            }
+            continue;
+        }
+        if(dst) {
+            switch(q[1]) {
+                case 'n': *out++ = '\n'; break;
+                case 'r': *out++ = '\r'; break;
+                case 't': *out++ = '\t'; break;
+                case 'b': *out++ = '\b'; break;
+                case 'f': *out++ = '\f'; break;
+                default:  *out++ = q[1]; break;
+            }
+        }
+        s->p = q + 2;
+    }
+
+    return -1;
+}
+
+/**
+ ** -1: not a number (null, a string, ...), the caller skips the value
+ **/
+static int scan_number(vjson_scan_t *s, double *val) {
+    const char *p = s->p;
+    uint64_t mant = 0;
+    int32_t exp10 = 0, digits = 0, eval = 0;
+    uint8_t fl_neg = false, fl_eneg = false;
+    double v = 0;
+
+    if(p < s->end && *p == '-') { fl_neg = true; p++; }
+    if(p >= s->end || *p < '0' || *p > '9') {
+        return -1;
+    }
+    for(; p < s->end && *p >= '0' && *p <= '9'; p++) {
+        if(digits < 18) { mant = (mant * 10) + (*p - '0'); digits++; } else { exp10++; }
+    }
+    if(p < s->end && *p == '.') {
+        for(p++; p < s->end && *p >= '0' && *p <= '9'; p++) {
+            if(digits < 18) { mant = (mant * 10) + (*p - '0'); digits++; exp10--; }
+        }
+    }
+    if(p < s->end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if(p < s->end && (*p == '-' || *p == '+')) { fl_eneg = (*p == '-'); p++; }
+        for(; p < s->end && *p >= '0' && *p <= '9'; p++) {
+            if(eval < 10000) { eval = (eval * 10) + (*p - '0'); }
+        }
+        exp10 += (fl_eneg ? -eval : eval);
+    }
+
+    v = (double)mant;
+    if(exp10 < 0) {
+        v = (-exp10 <= 18 ? v / pow10_tbl[-exp10] : v * pow(10, exp10));
+    } else if(exp10 > 0) {
+        v = (exp10 <= 18 ? v * pow10_tbl[exp10] : v * pow(10, exp10));
+    }
+
+    *val = (fl_neg ? -v : v);
+    s->p = p;
+    return 0;
+}
+
+static int skip_value(vjson_scan_t *s) {
+    uint32_t depth = 0;
+
+    do {
+        char c = SCAN_PEEK(s);
+
+        if(c == '"') {
+            if(scan_string(s, NULL) != 0) {
+                return -1;
+            }
+        } else if(c == '{' || c == '[') {
+            depth++;
+            s->p++;
+        } else if(c == '}' || c == ']') {
+            if(!depth) {
+                return -1;
+            }
+            depth--;
+            s->p++;
+        } else if(c == '\0') {
+            return -1;
+        } else {
+            // a number, true/false/null, or the ',' and ':' inside a nested value
+            s->p++;
+            while(s->p < s->end && !strchr(",:]}\"{[ \t\r\n", *s->p)) { s->p++; }
+        }
+        SCAN_WS(s);
+    } while(depth);
+
+    return 0;
+}
+
+/**
+ ** inside an object: 1 - the next key (the value is next), 0 - the closing '}', -1 - broken
+ **/
+static int object_next(vjson_scan_t *s, const char **key, size_t *klen) {
+    const char *k = NULL;
+
+    SCAN_WS(s);
+    if(SCAN_PEEK(s) == '}') {
+        s->p++;
+        return 0;
+    }
+    if(SCAN_PEEK(s) == ',') {
+        s->p++;
+        SCAN_WS(s);
+    }
+    if(SCAN_PEEK(s) != '"') {
+        return -1;
+    }
+    // keys are compared as they are, the ones looked for have no escapes
+    k = ++s->p;
+    while(s->p < s->end && *s->p != '"') {
+        s->p += (*s->p == '\\' ? 2 : 1);
+    }
+    if(s->p >= s->end) {
+        return -1;
+    }
+    *key = k;
+    *klen = (s->p - k);
+    s->p++;
+
+    SCAN_WS(s);
+    if(SCAN_PEEK(s) != ':') {
+        return -1;
+    }
+    s->p++;
+    SCAN_WS(s);
+    return 1;
+}
+
+/**
+ ** inside an array: 1 - the next value, 0 - the closing ']', -1 - broken
+ **/
+static int array_next(vjson_scan_t *s) {
+    SCAN_WS(s);
+    if(SCAN_PEEK(s) == ']') {
+        s->p++;
+        return 0;
+    }
+    if(SCAN_PEEK(s) == ',') {
+        s->p++;
+        SCAN_WS(s);
+    }
+    return (s->p < s->end ? 1 : -1);
+}
+
+static int value_number(vjson_scan_t *s, double *val) {
+    return (scan_number(s, val) == 0 ? 0 : skip_value(s));
+}
+
+static int value_string(vjson_scan_t *s, const char **val) {
+    return (SCAN_PEEK(s) == '"' ? scan_string(s, val) : skip_value(s));
+}
+
+static int scan_segment(vjson_scan_t *s, vjson_segment_t *seg) {
+    const char *key = NULL;
+    size_t klen = 0;
+    int rc = 0;
+
+    while((rc = object_next(s, &key, &klen)) > 0) {
+        if(KEY_IS(key, klen, "start")) {
+            rc = value_number(s, &seg->start);
+        } else if(KEY_IS(key, klen, "end")) {
+            rc = value_number(s, &seg->end);
+        } else if(KEY_IS(key, klen, "text")) {
+            rc = value_string(s, &seg->text);
+        } else if(KEY_IS(key, klen, "avg_logprob")) {
+            rc = value_number(s, &seg->avg_logprob);
+        } else if(KEY_IS(key, klen, "no_speech_prob")) {
+            rc = value_number(s, &seg->no_speech_prob);
+        } else {
+            rc = skip_value(s);
+        }
+        if(rc != 0) {
+            return -1;
+        }
+    }
+    return rc;
+}
+
+static int scan_word(vjson_scan_t *s, vjson_word_t *word) {
+    const char *key = NULL;
+    size_t klen = 0;
+    int rc = 0;
+
+    while((rc = object_next(s, &key, &klen)) > 0) {
+        if(KEY_IS(key, klen, "word")) {
+            rc = value_string(s, &word->word);
+        } else if(KEY_IS(key, klen, "start")) {
+            rc = value_number(s, &word->start);
+        } else if(KEY_IS(key, klen, "end")) {
+            rc = value_number(s, &word->end);
+        } else {
+            rc = skip_value(s);
+        }
+        if(rc != 0) {
+            return -1;
+        }
+    }
+    return rc;
+}
+
+/**
+ ** segments / words: arrays of objects, anything else in them is skipped
+ **/
+static int scan_items(vjson_scan_t *s, vjson_t *vj, uint8_t fl_words) {
+    int rc = 0;
+
+    if(SCAN_PEEK(s) != '[') {
+        return skip_value(s);
+    }
+    s->p++;
+
+    while((rc = array_next(s)) > 0) {
+        uint32_t *count = (fl_words ? &vj->words_count : &vj->segments_count);
+
+        if(SCAN_PEEK(s) != '{' || *count >= s->max_items) {
+            rc = skip_value(s);
+        } else {
+            s->p++;
+            if(fl_words) {
+                vjson_word_t *word = &vj->words[*count];
+                memset(word, 0, sizeof(*word));
+                rc = scan_word(s, word);
+                if(rc == 0 && word->word) { (*count)++; }
+            } else {
+                vjson_segment_t *seg = &vj->segments[*count];
+                memset(seg, 0, sizeof(*seg));
+                rc = scan_segment(s, seg);
+                if(rc == 0 && seg->text) { (*count)++; }
+            }
+        }
+        if(rc != 0) {
+            return -1;
+        }
+    }
+    return rc;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+/**
+ ** buf doesn't have to be terminated; vjson_free() the result (on a failure too)
+ **/
+switch_status_t vjson_parse(const char *buf, size_t len, vjson_t *vj) {
+    vjson_scan_t s = { 0 };
+    const char *key = NULL, *p = buf;
+    size_t klen = 0, block_len = 0;
+    uint32_t objects = 0;
+    int rc = 0;
+
+    memset(vj, 0, sizeof(*vj));
+    if(!buf || !len) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    while((p = memchr(p, '{', len - (p - buf))) != NULL) {
+        objects++;
+        p++;
+    }
+    block_len = (objects * sizeof(vjson_segment_t)) + (objects * sizeof(vjson_word_t)) + len + 1;
+    switch_malloc(vj->mem, block_len);
+    if(!vj->mem) {
+        return SWITCH_STATUS_FALSE;
+    }
+    vj->segments = (vjson_segment_t *)vj->mem;
+    vj->words = (vjson_word_t *)(vj->segments + objects);
+
+    s.p = buf;
+    s.end = buf + len;
+    s.out = (char *)(vj->words + objects);
+    s.max_items = objects;
+
+    SCAN_WS(&s);
+    if(SCAN_PEEK(&s) != '{') {
+        return SWITCH_STATUS_FALSE;
+    }
+    s.p++;
+
+    while((rc = object_next(&s, &key, &klen)) > 0) {
+        if(KEY_IS(key, klen, "text")) {
+            rc = value_string(&s, &vj->text);
+        } else if(KEY_IS(key, klen, "language")) {
+            rc = value_string(&s, &vj->language);
+        } else if(KEY_IS(key, klen, "duration")) {
+            rc = value_number(&s, &vj->duration);
+        } else if(KEY_IS(key, klen, "segments")) {
+            rc = scan_items(&s, vj, false);
+        } else if(KEY_IS(key, klen, "words")) {
+            rc = scan_items(&s, vj, true);
+        } else {
+            rc = skip_value(&s);
+        }
+        if(rc != 0) {
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    return (rc == 0 ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_FALSE);
+}
+
+void vjson_free(vjson_t *vj) {
+    if(!vj) {
+        return;
+    }
+    switch_safe_free(vj->mem);
+    memset(vj, 0, sizeof(*vj));
+}
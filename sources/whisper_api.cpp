@@ -1,32 +1,64 @@
 #include "whisper_api.h"
-#include "openai.hpp"
-#include <string>
-#include <exception>
 
 extern "C" {
-switch_status_t whisper_transcribe(gasr_ctx_t *asr_ctx, const char *fname, char **script){
+const char *whisper_prompt(const char *lang){
+    if(lang && strcmp(lang, "zh")==0){
+        return "以下是普通话的句子，这是一段电话客服交谈记录，主要涉及产品售前咨询、售后服务等。";
+    }
+    return NULL;
+}
+
+/**
+ ** the request goes through curl_transcribe(): the key pool sees the status and the rate limit headers,
+ ** and nothing here touches curl's global state from the upload threads
+ **/
+static switch_status_t transcribe(gasr_ctx_t *asr_ctx, const char *fname, bool verbose, bool words, bool segments, char **script){
+    switch_buffer_t *recv_buffer = NULL;
+    const void *ptr = NULL;
+    switch_size_t len = 0;
     char *result = NULL;
-    std::string token=globals.api_key;
-    openai::start(token);
-    //switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "token: %s\n", token.c_str());
-    try{
-        std::string audiofile=fname;
-        std::string langcode=asr_ctx->lang;
-        std::string jreq=R"({"file": ")"+audiofile+R"(", "model": "whisper-1", "language": ")"+langcode+R"("})";
-        if(langcode=="zh"){
-            jreq=R"({"file": ")"+audiofile+R"(", "model": "whisper-1", "language": ")"+langcode+R"(", "prompt":"以下是普通话的句子，这是一段电话客服交谈记录，主要涉及产品售前咨询、售后服务等。"})";
+
+    switch_buffer_create_dynamic(&recv_buffer, 1024, 2048, 0);
+    // verbose: the body as it came, nlsml_result()/overlap_parse()/coalesce_split() scan it once with vjson
+    if(curl_transcribe(asr_ctx, fname, verbose, words, segments, recv_buffer) == SWITCH_STATUS_SUCCESS && (len = switch_buffer_peek_zerocopy(recv_buffer, &ptr)) > 0 && ptr){
+        if(verbose){
+            result=strdup((const char *)ptr);
+        }else{
+            vjson_t vj = { 0 };
+            if(vjson_parse((const char *)ptr, len, &vj) == SWITCH_STATUS_SUCCESS && vj.text){
+                result=strdup(vj.text);
+            }
+            vjson_free(&vj);
         }
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "audio: %s\n", jreq.c_str());
-        auto jdoc=nlohmann::json::parse(jreq);
-        auto transcription=openai::audio().transcribe(jdoc);
-        std::string text=transcription["text"];
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "script: %s\n", text.c_str());
-        result=strdup(text.c_str());
-    }catch(std::exception& e){
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "error: %s\n", e.what());
-        result=NULL;
     }
+    switch_buffer_destroy(&recv_buffer);
+
     *script = result;
     return (result ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_FALSE);
 }
+
+switch_status_t whisper_transcribe(gasr_ctx_t *asr_ctx, const char *fname, char **script){
+    return transcribe(asr_ctx, fname, false, false, false, script);
+}
+
+/**
+ ** verbose_json, the whole response (with segments) for coalesce_split()
+ **/
+switch_status_t whisper_transcribe_segments(gasr_ctx_t *asr_ctx, const char *fname, char **json){
+    return transcribe(asr_ctx, fname, true, false, false, json);
+}
+
+/**
+ ** verbose_json with word timestamps, for overlap_parse()
+ **/
+switch_status_t whisper_transcribe_words(gasr_ctx_t *asr_ctx, const char *fname, char **json){
+    return transcribe(asr_ctx, fname, true, true, false, json);
+}
+
+/**
+ ** verbose_json with word and segment timestamps, for nlsml_result()
+ **/
+switch_status_t whisper_transcribe_timestamps(gasr_ctx_t *asr_ctx, const char *fname, char **json){
+    return transcribe(asr_ctx, fname, true, true, true, json);
+}
 }
@@ -10,6 +10,10 @@ extern "C"
 #endif
 
 switch_status_t whisper_transcribe(gasr_ctx_t *asr_ctx, const char *fname, char **script);
+switch_status_t whisper_transcribe_segments(gasr_ctx_t *asr_ctx, const char *fname, char **json);
+switch_status_t whisper_transcribe_words(gasr_ctx_t *asr_ctx, const char *fname, char **json);
+switch_status_t whisper_transcribe_timestamps(gasr_ctx_t *asr_ctx, const char *fname, char **json);
+const char *whisper_prompt(const char *lang);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,368 @@
+/**
+ * (C)2023 aks
+ * https://akscf.me/
+ * https://github.com/akscf/
+ **/
+#include "mod_sfwhisper.h"
+#include <poll.h>
+
+extern globals_t globals;
+
+/**
+ ** Minimal WebSocket client (RFC 6455) for the realtime backend: curl does the connect (proxy, TLS) with
+ ** CONNECT_ONLY, the upgrade request and the framing are done here over curl_easy_send/recv.
+ ** Text messages only; pings are answered, fragments are reassembled.
+ **/
+struct ws_s {
+    CURL                    *curl;
+    curl_socket_t           sock;
+    switch_byte_t           *rx;
+    uint32_t                rx_len;
+    uint32_t                rx_size;
+    switch_byte_t           *msg;               // fragments of the current message
+    uint32_t                msg_len;
+    uint8_t                 fl_closed;
+};
+
+#define WS_OP_CONT          0x0
+#define WS_OP_TEXT          0x1
+#define WS_OP_BINARY        0x2
+#define WS_OP_CLOSE         0x8
+#define WS_OP_PING          0x9
+#define WS_OP_PONG          0xA
+#define WS_RX_MAX           (4 * 1024 * 1024)
+
+static int ws_wait(ws_t *ws, short events, int timeout_ms) {
+    struct pollfd pfd = { .fd = ws->sock, .events = events };
+    return poll(&pfd, 1, timeout_ms);
+}
+
+static switch_status_t ws_write(ws_t *ws, const void *data, uint32_t len) {
+    uint32_t offs = 0;
+
+    while(offs < len) {
+        size_t n = 0;
+        CURLcode rc = curl_easy_send(ws->curl, (const uint8_t *)data + offs, len - offs, &n);
+
+        if(rc == CURLE_AGAIN) {
+            if(ws_wait(ws, POLLOUT, 1000) < 0 || globals.fl_shutdown) {
+                return SWITCH_STATUS_FALSE;
+            }
+            continue;
+        }
+        if(rc != CURLE_OK) {
+            ws->fl_closed = true;
+            return SWITCH_STATUS_FALSE;
+        }
+        offs += n;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ ** whatever the socket has, without waiting; -1 on close/error
+ **/
+static int ws_read_avail(ws_t *ws) {
+    int total = 0;
+
+    while(true) {
+        size_t n = 0;
+        CURLcode rc;
+
+        if(ws->rx_size - ws->rx_len < 4096) {
+            if(ws->rx_size >= WS_RX_MAX) {
+                return -1;
+            }
+            ws->rx_size = (ws->rx_size ? ws->rx_size * 2 : 16384);
+            ws->rx = realloc(ws->rx, ws->rx_size);
+        }
+
+        // one byte is kept for the terminator of the handshake response
+        rc = curl_easy_recv(ws->curl, ws->rx + ws->rx_len, ws->rx_size - ws->rx_len - 1, &n);
+        if(rc == CURLE_AGAIN) {
+            return total;
+        }
+        if(rc != CURLE_OK || n == 0) {
+            ws->fl_closed = true;
+            return -1;
+        }
+        ws->rx_len += n;
+        total += n;
+    }
+}
+
+static switch_status_t ws_send_frame(ws_t *ws, uint8_t opcode, const void *data, uint32_t len) {
+    switch_byte_t hdr[14] = { 0 }, mask[4] = { 0 };
+    switch_byte_t *frame = NULL;
+    uint32_t hlen = 2;
+    switch_status_t status;
+
+    hdr[0] = 0x80 | opcode;
+    if(len < 126) {
+        hdr[1] = 0x80 | len;
+    } else if(len <= 0xffff) {
+        hdr[1] = 0x80 | 126;
+        hdr[2] = (len >> 8) & 0xff;
+        hdr[3] = len & 0xff;
+        hlen = 4;
+    } else {
+        hdr[1] = 0x80 | 127;
+        for(int i = 0; i < 4; i++) { hdr[6 + i] = (len >> (24 - i * 8)) & 0xff; }
+        hlen = 10;
+    }
+    // client frames are masked, the key doesn't have to be strong
+    for(int i = 0; i < 4; i++) { mask[i] = (switch_byte_t)rand(); }
+    memcpy(hdr + hlen, mask, 4);
+    hlen += 4;
+
+    switch_malloc(frame, hlen + len);
+    memcpy(frame, hdr, hlen);
+    for(uint32_t i = 0; i < len; i++) {
+        frame[hlen + i] = ((const switch_byte_t *)data)[i] ^ mask[i & 3];
+    }
+    status = ws_write(ws, frame, hlen + len);
+    free(frame);
+
+    return status;
+}
+
+/**
+ ** one complete frame off rx, 0 - need more data
+ **/
+static int ws_parse_frame(ws_t *ws, uint8_t *fin, uint8_t *opcode, switch_byte_t **payload, uint64_t *plen) {
+    switch_byte_t *p = ws->rx;
+    uint64_t len = 0;
+    uint32_t hlen = 2;
+
+    if(ws->rx_len < 2) {
+        return 0;
+    }
+    *fin = (p[0] & 0x80) ? true : false;
+    *opcode = p[0] & 0x0f;
+    len = p[1] & 0x7f;
+    if(len == 126) {
+        if(ws->rx_len < 4) return 0;
+        len = (p[2] << 8) | p[3];
+        hlen = 4;
+    } else if(len == 127) {
+        if(ws->rx_len < 10) return 0;
+        len = 0;
+        for(int i = 0; i < 8; i++) { len = (len << 8) | p[2 + i]; }
+        hlen = 10;
+    }
+    if(p[1] & 0x80) {
+        hlen += 4; // servers don't mask, skipped if one does
+    }
+    if(len > WS_RX_MAX) {
+        return -1;
+    }
+    if(ws->rx_len < hlen + len) {
+        return 0;
+    }
+    *payload = p + hlen;
+    *plen = len;
+    return hlen + len;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------
+/**
+ ** url: ws:// or wss://, headers: "Name: value\r\n" lines
+ **/
+ws_t *ws_connect(const char *url, const char *headers, config_t *cfg) {
+    ws_t *ws = NULL;
+    char *http_url = NULL, *req = NULL, *host = NULL, *path = NULL;
+    switch_byte_t key_raw[16] = { 0 };
+    char key[32] = { 0 };
+    uint8_t fl_tls = (strncasecmp(url, "wss://", 6) == 0);
+    const char *rest = url + (fl_tls ? 6 : 5);
+    switch_time_t expiry = switch_micro_time_now() + (MAX(cfg->connect_timeout, 5) * 1000000LL);
+    char *eoh = NULL;
+
+    if(strncasecmp(url, "ws://", 5) && !fl_tls) {
+        return NULL;
+    }
+
+    switch_zmalloc(ws, sizeof(ws_t));
+    ws->sock = CURL_SOCKET_BAD;
+
+    host = strdup(rest);
+    if((path = strchr(host, '/')) != NULL) {
+        *path = '\0';
+        path = switch_mprintf("/%s", path + 1);
+    } else {
+        path = strdup("/");
+    }
+    http_url = switch_mprintf("%s://%s%s", (fl_tls ? "https" : "http"), host, path);
+
+    ws->curl = switch_curl_easy_init();
+    switch_curl_easy_setopt(ws->curl, CURLOPT_URL, http_url);
+    switch_curl_easy_setopt(ws->curl, CURLOPT_CONNECT_ONLY, 1L);
+    switch_curl_easy_setopt(ws->curl, CURLOPT_NOSIGNAL, 1L);
+    if(cfg->connect_timeout > 0) {
+        switch_curl_easy_setopt(ws->curl, CURLOPT_CONNECTTIMEOUT, cfg->connect_timeout);
+    }
+    if(fl_tls) {
+        switch_curl_easy_setopt(ws->curl, CURLOPT_SSL_VERIFYPEER, 0);
+        switch_curl_easy_setopt(ws->curl, CURLOPT_SSL_VERIFYHOST, 0);
+    }
+    if(cfg->proxy) {
+        if(cfg->proxy_credentials != NULL) {
+            switch_curl_easy_setopt(ws->curl, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
+            switch_curl_easy_setopt(ws->curl, CURLOPT_PROXYUSERPWD, cfg->proxy_credentials);
+        }
+        switch_curl_easy_setopt(ws->curl, CURLOPT_PROXY, cfg->proxy);
+        switch_curl_easy_setopt(ws->curl, CURLOPT_HTTPPROXYTUNNEL, 1L);
+    }
+    if(switch_curl_easy_perform(ws->curl) != CURLE_OK || curl_easy_getinfo(ws->curl, CURLINFO_ACTIVESOCKET, &ws->sock) != CURLE_OK) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "sfwhisper: stage=ws connect fail (%s)\n", url);
+        goto fail;
+    }
+
+    for(int i = 0; i < 16; i++) { key_raw[i] = (switch_byte_t)rand(); }
+    switch_b64_encode(key_raw, sizeof(key_raw), (unsigned char *)key, sizeof(key));
+
+    // the 101 is taken as the handshake result, Sec-WebSocket-Accept isn't checked
+    req = switch_mprintf("GET %s HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n%s%s%s\r\n",
+                         path, host, key, (cfg->user_agent ? "User-Agent: " : ""), (cfg->user_agent ? cfg->user_agent : ""), (cfg->user_agent ? "\r\n" : ""));
+    if(headers) {
+        char *tmp = switch_mprintf("%.*s%s\r\n", (int)(strlen(req) - 2), req, headers);
+        switch_safe_free(req);
+        req = tmp;
+    }
+    if(ws_write(ws, req, strlen(req)) != SWITCH_STATUS_SUCCESS) {
+        goto fail;
+    }
+
+    while(true) {
+        int n = 0;
+
+        if(ws->rx_len) {
+            ws->rx[ws->rx_len] = '\0';
+            if((eoh = strstr((char *)ws->rx, "\r\n\r\n")) != NULL) {
+                break;
+            }
+        }
+        if(switch_micro_time_now() > expiry || globals.fl_shutdown) {
+            goto fail;
+        }
+        if((n = ws_read_avail(ws)) < 0) {
+            goto fail;
+        }
+        if(n == 0) {
+            ws_wait(ws, POLLIN, 100);
+        }
+    }
+    if(strncmp((char *)ws->rx, "HTTP/1.1 101", 12) != 0) {
+        *eoh = '\0';
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "sfwhisper: stage=ws upgrade refused (%s): %.120s\n", url, (char *)ws->rx);
+        goto fail;
+    }
+
+    // frames that came with the response stay in rx
+    ws->rx_len -= (eoh + 4 - (char *)ws->rx);
+    memmove(ws->rx, eoh + 4, ws->rx_len);
+
+    switch_safe_free(req);
+    switch_safe_free(http_url);
+    switch_safe_free(path);
+    switch_safe_free(host);
+    return ws;
+
+fail:
+    switch_safe_free(req);
+    switch_safe_free(http_url);
+    switch_safe_free(path);
+    switch_safe_free(host);
+    ws_close(&ws);
+    return NULL;
+}
+
+switch_status_t ws_send_text(ws_t *ws, const char *text, uint32_t len) {
+    if(!ws || ws->fl_closed) {
+        return SWITCH_STATUS_FALSE;
+    }
+    return ws_send_frame(ws, WS_OP_TEXT, text, len);
+}
+
+/**
+ ** next text message (caller frees), waits up to timeout_ms;
+ ** SWITCH_STATUS_SUCCESS - *msg is set, SWITCH_STATUS_TIMEOUT - nothing yet, SWITCH_STATUS_FALSE - closed
+ **/
+switch_status_t ws_recv(ws_t *ws, char **msg, int timeout_ms) {
+    uint8_t fl_waited = false;
+
+    if(!ws || ws->fl_closed) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    while(true) {
+        switch_byte_t *payload = NULL;
+        uint64_t plen = 0;
+        uint8_t fin = 0, opcode = 0;
+        int flen = ws_parse_frame(ws, &fin, &opcode, &payload, &plen);
+
+        if(flen < 0) {
+            ws->fl_closed = true;
+            return SWITCH_STATUS_FALSE;
+        }
+        if(flen == 0) {
+            int n = ws_read_avail(ws);
+            if(n < 0) {
+                return SWITCH_STATUS_FALSE;
+            }
+            if(n == 0) {
+                if(fl_waited || timeout_ms <= 0) {
+                    return SWITCH_STATUS_TIMEOUT;
+                }
+                ws_wait(ws, POLLIN, timeout_ms);
+                fl_waited = true;
+            }
+            continue;
+        }
+
+        if(opcode == WS_OP_PING) {
+            ws_send_frame(ws, WS_OP_PONG, payload, plen);
+        } else if(opcode == WS_OP_CLOSE) {
+            ws_send_frame(ws, WS_OP_CLOSE, payload, (plen >= 2 ? 2 : 0));
+            ws->fl_closed = true;
+            return SWITCH_STATUS_FALSE;
+        } else if(opcode == WS_OP_TEXT || opcode == WS_OP_BINARY || opcode == WS_OP_CONT) {
+            ws->msg = realloc(ws->msg, ws->msg_len + plen + 1);
+            memcpy(ws->msg + ws->msg_len, payload, plen);
+            ws->msg_len += plen;
+        }
+
+        ws->rx_len -= flen;
+        memmove(ws->rx, ws->rx + flen, ws->rx_len);
+
+        if(fin && ws->msg && (opcode == WS_OP_TEXT || opcode == WS_OP_BINARY || opcode == WS_OP_CONT)) {
+            ws->msg[ws->msg_len] = '\0';
+            *msg = (char *)ws->msg;
+            ws->msg = NULL;
+            ws->msg_len = 0;
+            return SWITCH_STATUS_SUCCESS;
+        }
+    }
+}
+
+void ws_close(ws_t **ws) {
+    ws_t *w = NULL;
+
+    if(!ws || !*ws) {
+        return;
+    }
+    w = *ws;
+    *ws = NULL;
+
+    if(w->curl) {
+        if(!w->fl_closed && w->sock != CURL_SOCKET_BAD) {
+            uint8_t code[2] = { 0x03, 0xe8 }; // 1000
+            ws_send_frame(w, WS_OP_CLOSE, code, sizeof(code));
+        }
+        switch_curl_easy_cleanup(w->curl);
+    }
+    switch_safe_free(w->rx);
+    switch_safe_free(w->msg);
+    free(w);
+}
@@ -0,0 +1,267 @@
+#!/usr/bin/env python3
+#
+# Local stand-in for the transcription endpoint (api-url=http://127.0.0.1:8080/v1/audio/transcriptions).
+# Accepts both the buffered (Content-Length) and the progressive (chunked) multipart uploads
+# and answers with {"text": ...} describing what it received (plus "segments" with avg_logprob/no_speech_prob for
+# response_format=verbose_json, "words" with timestamp_granularities[]=word, plain text for response_format=text).
+# GET /v1/realtime is a WebSocket stand-in for the realtime transcription api (realtime-url=ws://127.0.0.1:8080/v1/realtime):
+# the appended audio is counted and every input_audio_buffer.commit is answered word by word with delta events
+# (--delay-ms apart) and a completed event.
+# With --require-granularity word a verbose_json request without timestamp_granularities[]=word is answered 400
+# (and reported on stderr), to check that every transport sends it in the overlap mode.
+# With --rate-limit N each api key gets N requests per --rate-window-ms, reported in x-ratelimit-* headers,
+# the ones over it are answered 429 with retry-after.
+#
+import argparse
+import base64
+import hashlib
+import json
+import struct
+import sys
+import threading
+import time
+import zlib
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+OPTS = None
+RATE = {}  # key => (window start, requests)
+RATE_LOCK = threading.Lock()
+
+
+def rate_check(key):
+    # (remaining, reset_ms), remaining < 0: over the limit
+    now = time.time()
+    with RATE_LOCK:
+        start, count = RATE.get(key, (now, 0))
+        if now - start >= OPTS.rate_window_ms / 1000.0:
+            start, count = now, 0
+        count += 1
+        RATE[key] = (start, count)
+    return OPTS.rate_limit - count, max(int((start + OPTS.rate_window_ms / 1000.0 - now) * 1000), 1)
+
+
+def segments(wav):
+    # one segment per run of non-zero L16 samples (silence gaps of 100ms+ split them)
+    if len(wav) < 44 or struct.unpack("<H", wav[20:22])[0] != 1:
+        return []
+    rate = struct.unpack("<I", wav[24:28])[0] or 8000
+    pcm = wav[44:]
+    samples = struct.unpack("<%dh" % (len(pcm) // 2), pcm[:len(pcm) // 2 * 2])
+    segs, start, quiet = [], None, 0
+    for i, v in enumerate(samples + (0,) * (rate // 10)):
+        if v:
+            start, quiet = (i if start is None else start), 0
+        elif start is not None:
+            quiet += 1
+            if quiet >= rate // 10:
+                end = i - quiet + 1
+                segs.append({"id": len(segs), "start": start / rate, "end": end / rate, "text": "segment %d (%d ms)" % (len(segs), (end - start) * 1000 // rate)})
+                start, quiet = None, 0
+    return segs
+
+
+def words(wav):
+    # a "word" per segment named by its audio, so the same audio in two overlapping chunks gives the same word
+    segs = segments(wav)
+    if not segs:
+        return []
+    rate = struct.unpack("<I", wav[24:28])[0] or 8000
+    pcm = wav[44:]
+    return [{"word": "w%08x" % zlib.crc32(pcm[int(s["start"] * rate) * 2:int(s["end"] * rate) * 2]), "start": s["start"], "end": s["end"]} for s in segs]
+
+
+WS_GUID = b"258EAFA5-E914-47DA-95CA-C5AB0DC11B85"
+
+
+def ws_read(rfile):
+    # (opcode, payload), None when the peer is gone
+    buf, opcode = b"", None
+    while True:
+        head = rfile.read(2)
+        if len(head) < 2:
+            return None
+        fin, op, size = head[0] & 0x80, head[0] & 0x0f, head[1] & 0x7f
+        if size == 126:
+            size = struct.unpack(">H", rfile.read(2))[0]
+        elif size == 127:
+            size = struct.unpack(">Q", rfile.read(8))[0]
+        mask = rfile.read(4) if head[1] & 0x80 else b"\0\0\0\0"
+        data = bytes(b ^ mask[i % 4] for i, b in enumerate(rfile.read(size)))
+        if op >= 8:
+            return op, data
+        opcode = op if op else opcode
+        buf += data
+        if fin:
+            return opcode, buf
+
+
+def ws_write(wfile, opcode, data):
+    size = len(data)
+    head = bytes([0x80 | opcode])
+    if size < 126:
+        head += bytes([size])
+    elif size < 65536:
+        head += bytes([126]) + struct.pack(">H", size)
+    else:
+        head += bytes([127]) + struct.pack(">Q", size)
+    wfile.write(head + data)
+    wfile.flush()
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def do_GET(self):
+        if not self.path.startswith("/v1/realtime") or self.headers.get("Upgrade", "").lower() != "websocket":
+            return self.reply(404, {"error": {"message": "not found"}})
+        accept = base64.b64encode(hashlib.sha1(self.headers["Sec-WebSocket-Key"].encode() + WS_GUID).digest()).decode()
+        self.send_response(101)
+        self.send_header("Upgrade", "websocket")
+        self.send_header("Connection", "Upgrade")
+        self.send_header("Sec-WebSocket-Accept", accept)
+        self.end_headers()
+        self.wfile.flush()
+        self.close_connection = True
+
+        send = lambda obj: ws_write(self.wfile, 1, json.dumps(obj).encode())
+        audio_bytes, items, session = 0, 0, {}
+        while True:
+            frame = ws_read(self.rfile)
+            if frame is None or frame[0] == 8:
+                if frame:
+                    ws_write(self.wfile, 8, frame[1][:2])
+                return
+            if frame[0] == 9:
+                ws_write(self.wfile, 10, frame[1])
+                continue
+            if frame[0] != 1:
+                continue
+            msg = json.loads(frame[1])
+            if msg.get("type") == "transcription_session.update":
+                session = msg.get("session", {})
+                send({"type": "transcription_session.updated", "session": session})
+            elif msg.get("type") == "input_audio_buffer.append":
+                audio_bytes += len(base64.b64decode(msg.get("audio", "")))
+            elif msg.get("type") == "input_audio_buffer.commit":
+                items += 1
+                item_id = "item_%03d" % items
+                fmt = session.get("input_audio_format", "pcm16")
+                ms = audio_bytes * 1000 // (48000 if fmt == "pcm16" else 8000)
+                lang = session.get("input_audio_transcription", {}).get("language", "?")
+                text = "mock realtime: %d ms, %s, %s" % (ms, fmt, lang)
+                send({"type": "input_audio_buffer.committed", "item_id": item_id})
+                words = text.split(" ")
+                for i, w in enumerate(words):
+                    time.sleep(OPTS.delay_ms / 1000.0 / len(words))
+                    send({"type": "conversation.item.input_audio_transcription.delta", "item_id": item_id, "delta": w + (" " if i + 1 < len(words) else "")})
+                send({"type": "conversation.item.input_audio_transcription.completed", "item_id": item_id, "transcript": text})
+                audio_bytes = 0
+
+    def read_chunked(self):
+        body = bytearray()
+        t_first = None
+        while True:
+            size = int(self.rfile.readline().strip().split(b";")[0], 16)
+            if t_first is None:
+                t_first = time.time()
+            if size == 0:
+                self.rfile.readline()
+                break
+            body += self.rfile.read(size)
+            self.rfile.readline()
+        return bytes(body), t_first
+
+    def reply(self, code, obj, headers=None):
+        self.reply_text(code, json.dumps(obj), "application/json", headers)
+
+    def reply_text(self, code, text, ctype="text/plain", headers=None):
+        data = text.encode()
+        self.send_response(code)
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        self.send_header("Content-Type", ctype)
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def do_POST(self):
+        t_start = time.time()
+        chunked = self.headers.get("Transfer-Encoding", "").lower() == "chunked"
+        if chunked and OPTS.reject_chunked:
+            self.rfile.read(0)
+            self.close_connection = True
+            return self.reply(411, {"error": {"message": "Length Required"}})
+        if chunked:
+            body, _ = self.read_chunked()
+        else:
+            body = self.rfile.read(int(self.headers.get("Content-Length", "0")))
+        t_end = time.time()
+
+        fields, grans = {}, set()
+        audio = b""
+        boundary = self.headers.get("Content-Type", "").split("boundary=")[-1].encode()
+        for part in body.split(b"--" + boundary):
+            head, _, value = part.partition(b"\r\n\r\n")
+            if b'name="file"' in head:
+                audio = value[:-2] if value.endswith(b"\r\n") else value
+            elif b"name=" in head:
+                name = head.split(b'name="')[1].split(b'"')[0].decode()
+                fields[name] = value.rstrip(b"\r\n").decode(errors="replace")
+                if name == "timestamp_granularities[]":
+                    grans.add(fields[name])
+
+        key = self.headers.get("Authorization", "").split(" ")[-1]
+        headers = {}
+        if OPTS.rate_limit:
+            remaining, reset_ms = rate_check(key)
+            headers = {"x-ratelimit-limit-requests": str(OPTS.rate_limit), "x-ratelimit-remaining-requests": str(max(remaining, 0)),
+                       "x-ratelimit-reset-requests": "%dms" % reset_ms}
+            if remaining < 0:
+                headers["retry-after-ms"] = str(reset_ms)
+                return self.reply(429, {"error": {"message": "Rate limit reached for requests", "code": "rate_limit_exceeded"}}, headers)
+
+        missing = [g for g in (OPTS.require_granularity or []) if g not in grans]
+        if fields.get("response_format") == "verbose_json" and missing:
+            print("mock: %s upload without timestamp_granularities[]=%s" % ("chunked" if chunked else "buffered", ",".join(missing)), file=sys.stderr)
+            return self.reply(400, {"error": {"message": "timestamp_granularities[] %s expected" % ",".join(missing)}}, headers)
+
+        time.sleep(OPTS.delay_ms / 1000.0)
+        resp = {
+            "text": "mock: %d bytes, %s, %s, key ...%s" % (max(len(audio) - 44, 0), fields.get("language", "?"), "chunked" if chunked else "buffered", key[-4:]),
+            "receive_ms": int((t_end - t_start) * 1000),
+        }
+        if fields.get("response_format") == "verbose_json":
+            resp["segments"] = segments(audio)
+            resp["text"] = " ".join(s["text"] for s in resp["segments"])
+            for s in resp["segments"]:
+                s.update(avg_logprob=-0.25, no_speech_prob=0.02)
+            resp.update(task="transcribe", language="english", duration=max(len(audio) - 44, 0) / 16000.0)
+            if "word" in grans:
+                resp["words"] = words(audio)
+                resp["text"] = " ".join(w["word"] for w in resp["words"])
+        elif fields.get("response_format") == "text":
+            return self.reply_text(200, resp["text"] + "\n", headers=headers)
+        self.reply(200, resp, headers)
+
+    def log_message(self, fmt, *args):
+        if not OPTS.quiet:
+            super().log_message(fmt, *args)
+
+
+def main():
+    global OPTS
+    ap = argparse.ArgumentParser()
+    ap.add_argument("--port", type=int, default=8080)
+    ap.add_argument("--delay-ms", type=int, default=0, help="processing time added to every response")
+    ap.add_argument("--reject-chunked", action="store_true", help="answer 411 to chunked uploads (fallback test)")
+    ap.add_argument("--rate-limit", type=int, default=0, help="requests per key per --rate-window-ms, 429 above")
+    ap.add_argument("--rate-window-ms", type=int, default=1000)
+    ap.add_argument("--require-granularity", action="append", choices=("word", "segment"),
+                    help="answer 400 to verbose_json requests without this timestamp_granularities[] (repeatable)")
+    ap.add_argument("--quiet", action="store_true")
+    OPTS = ap.parse_args()
+    ThreadingHTTPServer(("127.0.0.1", OPTS.port), Handler).serve_forever()
+
+
+if __name__ == "__main__":
+    main()